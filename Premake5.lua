@@ -1,3 +1,15 @@
+newoption {
+   trigger = "runtime-shaders",
+   description = "Compile shaders at runtime from the copy next to the binary (development mode)"
+}
+
+newoption {
+   trigger = "dxc",
+   value = "path",
+   default = "dxc",
+   description = "DXC used to compile the embedded shaders at build time"
+}
+
 workspace "Basics of DirectX 12"
    configurations { "Debug", "Release" }
    language "C++"
@@ -5,7 +17,8 @@ workspace "Basics of DirectX 12"
    systemversion "latest"
    toolset "v142"
    optimize "Speed"
-   links { "d3d12", "dxgi", "d3dcompiler" }
+   cppdialect "C++20"
+   links { "d3d12", "dxgi" }
    filter("configurations:Debug")
       defines({ "DEBUG" })
       symbols("On")
@@ -32,11 +45,118 @@ workspace "Basics of DirectX 12"
       includedirs { "libs/tinyobjloader" }
       files { "src/dx12_labs.h" }
       files { "src/renderer.h", "src/renderer.cpp"}
+      files { "src/pipeline_cache.h", "src/pipeline_cache.cpp"}
+      files { "src/pipeline_cache_format.h", "src/pipeline_cache_format.cpp"}
+      files { "src/presenter.h", "src/presenter.cpp"}
+      files { "src/asset_streamer.h", "src/asset_streamer.cpp"}
+      files { "src/async_task.h", "src/async_task.cpp"}
+      files { "src/descriptor_allocator.h", "src/descriptor_allocator.cpp"}
+      files { "src/gpu_culling.h", "src/gpu_culling.cpp"}
+      files { "src/gpu_memory_allocator.h", "src/gpu_memory_allocator.cpp"}
+      files { "src/gpu_timer.h", "src/gpu_timer.cpp"}
+      files { "src/heap_suballocator.h", "src/heap_suballocator.cpp"}
+      files { "src/instance_culling.h", "src/instance_culling.cpp"}
+      files { "src/instance_set.h", "src/instance_set.cpp"}
+      files { "src/mesh_loader.h", "src/mesh_loader.cpp"}
+      files { "src/mesh_cache.h", "src/mesh_cache.cpp"}
+      files { "src/mapped_file.h", "src/mapped_file.cpp"}
+      files { "src/obj_parser.h", "src/obj_parser.cpp"}
+      files { "src/mesh_optimizer.h", "src/mesh_optimizer.cpp"}
+      files { "src/mesh_simplifier.h", "src/mesh_simplifier.cpp"}
+      files { "src/meshlet_builder.h", "src/meshlet_builder.cpp"}
+      files { "src/render_graph.h", "src/render_graph.cpp"}
+      files { "src/resource_state_tracker.h", "src/resource_state_tracker.cpp"}
+      files { "src/shader_pack.h", "src/shader_pack.cpp"}
+      files { "src/submesh_builder.h", "src/submesh_builder.cpp"}
+      files { "src/cluster_culling.h", "src/cluster_culling.cpp"}
+      files { "src/thread_pool.h", "src/thread_pool.cpp"}
+      files { "src/upload_ring.h", "src/upload_ring.cpp"}
+      files { "src/upload_scheduler.h", "src/upload_scheduler.cpp"}
+      files { "src/vertex_quantizer.h", "src/vertex_quantizer.cpp"}
       files { "src/win32_window.h", "src/win32_window.cpp"}
       files { "src/win32_window_main.cpp" }
       files { "libs/tinyobjloader/tiny_obj_loader.h"}
       postbuildcommands {
-         "{COPY} shaders/shaders.hlsl \"%{cfg.buildtarget.directory}\"",
          "{COPY} models/CornellBox-Original.obj \"%{cfg.buildtarget.directory}\"",
          "{COPY} models/CornellBox-Original.mtl \"%{cfg.buildtarget.directory}\""
-       }
\ No newline at end of file
+       }
+      filter("options:runtime-shaders")
+         defines({ "DX12_RUNTIME_SHADERS" })
+         links({ "d3dcompiler" })
+         removefiles({ "src/shader_pack.h", "src/shader_pack.cpp" })
+         postbuildcommands({
+            "{COPY} shaders/shaders.hlsl \"%{cfg.buildtarget.directory}\"",
+            "{COPY} shaders/culling.hlsl \"%{cfg.buildtarget.directory}\""
+         })
+      filter("not options:runtime-shaders")
+         includedirs({ "generated" })
+      filter({ "not options:runtime-shaders", "configurations:Debug" })
+         prebuildcommands({ "python tools/compile_shaders.py shaders/shaders.manifest generated/shader_pack_generated.h --debug --dxc \"" .. _OPTIONS["dxc"] .. "\"" })
+      filter({ "not options:runtime-shaders", "configurations:Release" })
+         prebuildcommands({ "python tools/compile_shaders.py shaders/shaders.manifest generated/shader_pack_generated.h --dxc \"" .. _OPTIONS["dxc"] .. "\"" })
+      filter({})
+
+   project "OBJ parser benchmark"
+      kind "ConsoleApp"
+      entrypoint "mainCRTStartup"
+      includedirs { "src" }
+      includedirs { "libs/tinyobjloader" }
+      files { "src/mapped_file.h", "src/mapped_file.cpp"}
+      files { "src/obj_parser.h", "src/obj_parser.cpp"}
+      files { "src/thread_pool.h", "src/thread_pool.cpp"}
+      files { "src/obj_parser_bench_main.cpp" }
+      files { "libs/tinyobjloader/tiny_obj_loader.h"}
+      postbuildcommands {
+         "{COPY} models/CornellBox-Original.obj \"%{cfg.buildtarget.directory}\"",
+         "{COPY} models/CornellBox-Original.mtl \"%{cfg.buildtarget.directory}\""
+       }
+
+   project "Mesh optimizer report"
+      kind "ConsoleApp"
+      entrypoint "mainCRTStartup"
+      includedirs { "src" }
+      includedirs { "libs/tinyobjloader" }
+      files { "src/mapped_file.h", "src/mapped_file.cpp"}
+      files { "src/mesh_optimizer.h", "src/mesh_optimizer.cpp"}
+      files { "src/mesh_simplifier.h", "src/mesh_simplifier.cpp"}
+      files { "src/obj_parser.h", "src/obj_parser.cpp"}
+      files { "src/thread_pool.h", "src/thread_pool.cpp"}
+      files { "src/mesh_optimizer_main.cpp" }
+      files { "libs/tinyobjloader/tiny_obj_loader.h"}
+      postbuildcommands {
+         "{COPY} models/CornellBox-Original.obj \"%{cfg.buildtarget.directory}\"",
+         "{COPY} models/CornellBox-Original.mtl \"%{cfg.buildtarget.directory}\""
+       }
+
+   project "Suballocator test"
+      kind "ConsoleApp"
+      entrypoint "mainCRTStartup"
+      includedirs { "src" }
+      files { "src/heap_suballocator.h", "src/heap_suballocator.cpp"}
+      files { "src/heap_suballocator_test_main.cpp" }
+
+   project "Resource state tracker test"
+      kind "ConsoleApp"
+      entrypoint "mainCRTStartup"
+      includedirs { "src" }
+      includedirs { "libs/D3DX12" }
+      files { "src/dx12_labs.h" }
+      files { "src/resource_state_tracker.h", "src/resource_state_tracker.cpp"}
+      files { "src/resource_state_tracker_test_main.cpp" }
+
+   project "Render graph test"
+      kind "ConsoleApp"
+      entrypoint "mainCRTStartup"
+      includedirs { "src" }
+      includedirs { "libs/D3DX12" }
+      files { "src/dx12_labs.h" }
+      files { "src/render_graph.h", "src/render_graph.cpp"}
+      files { "src/resource_state_tracker.h", "src/resource_state_tracker.cpp"}
+      files { "src/render_graph_test_main.cpp" }
+
+   project "Pipeline cache format test"
+      kind "ConsoleApp"
+      entrypoint "mainCRTStartup"
+      includedirs { "src" }
+      files { "src/pipeline_cache_format.h", "src/pipeline_cache_format.cpp"}
+      files { "src/pipeline_cache_format_test_main.cpp" }
@@ -0,0 +1,186 @@
+// GPU version of InstanceCuller in src/instance_culling.cpp, keep both in step
+
+cbuffer CullingConstants : register(b0)
+{
+	row_major float4x4 transform;
+	float4 planes[6];
+	uint plane_count;
+	uint object_count;
+	uint material_table;
+	uint hiz_mip_count;
+	uint hiz_width;
+	uint hiz_height;
+	uint hiz_descriptor;
+	uint max_draw_count;
+	uint instance_count;
+};
+
+struct CullingObject
+{
+	float3 aabb_min;
+	uint index_offset;
+	float3 aabb_max;
+	uint index_count;
+	uint object_index;
+};
+
+struct IndirectDraw
+{
+	uint first_triangle;
+	uint object_index;
+	uint material_table;
+	uint index_count;
+	uint instance_count;
+	uint start_index;
+	int base_vertex;
+	uint start_instance;
+};
+
+StructuredBuffer<CullingObject> objects : register(t0);
+RWByteAddressBuffer draw_count : register(u0);	// the draws follow the count
+RWStructuredBuffer<IndirectDraw> draws : register(u1);
+Texture2D<float> textures[] : register(t0, space1);
+RWTexture2D<float> hiz_levels[] : register(u0, space2);	// one view per pyramid level
+
+// Root constants of CSBuildHiZ
+cbuffer HiZConstants : register(b1)
+{
+	uint source_descriptor;	// of the depth buffer for level 0, otherwise of the level above
+	uint target_descriptor;
+	uint source_width;
+	uint source_height;
+	uint target_width;
+	uint target_height;
+	uint from_depth;		// source_descriptor is a shader view of the depth buffer
+};
+
+#define CULLING_GROUP_SIZE 64
+
+bool IsInsideFrustum(CullingObject object)
+{
+	// Test the box corner farthest along each plane normal
+	for (uint p = 0; p < plane_count; p++)
+	{
+		float3 corner = float3(planes[p].x >= 0.f ? object.aabb_max.x : object.aabb_min.x,
+			planes[p].y >= 0.f ? object.aabb_max.y : object.aabb_min.y,
+			planes[p].z >= 0.f ? object.aabb_max.z : object.aabb_min.z);
+		if (dot(planes[p].xyz, corner) + planes[p].w < 0.f)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+uint2 ToTexel(float2 uv)
+{
+	return uint2(clamp(uv * float2(hiz_width, hiz_height), 0.f, float2(hiz_width - 1, hiz_height - 1)));
+}
+
+bool IsOccluded(CullingObject object)
+{
+	if (hiz_mip_count == 0)
+	{
+		return false;
+	}
+
+	// Screen rectangle and nearest depth of the eight corners
+	float2 minUV = 1.f;
+	float2 maxUV = 0.f;
+	float minDepth = 1.f;
+	for (uint corner = 0; corner < 8; corner++)
+	{
+		float3 position = float3((corner & 1) != 0 ? object.aabb_max.x : object.aabb_min.x,
+			(corner & 2) != 0 ? object.aabb_max.y : object.aabb_min.y,
+			(corner & 4) != 0 ? object.aabb_max.z : object.aabb_min.z);
+		float4 clip = mul(float4(position, 1.f), transform);
+		if (clip.w <= 0.f)
+		{
+			return false;
+		}
+		float2 uv = float2(clip.x / clip.w * 0.5f + 0.5f, 0.5f - clip.y / clip.w * 0.5f);
+		minUV = min(minUV, uv);
+		maxUV = max(maxUV, uv);
+		minDepth = min(minDepth, clip.z / clip.w);
+	}
+
+	// The level where the rectangle spans at most two texels per axis, so its four corners cover it
+	uint2 first = ToTexel(minUV);
+	uint2 last = ToTexel(maxUV);
+	uint span = max(last.x - first.x, last.y - first.y);
+	uint level = span ? firstbithigh(span) + 1 : 0;
+	if (level >= hiz_mip_count)
+	{
+		return false;
+	}
+
+	Texture2D<float> pyramid = textures[hiz_descriptor];
+	uint2 levelSize = max(uint2(hiz_width, hiz_height) >> level, 1);
+	uint2 texel0 = min(first >> level, levelSize - 1);
+	uint2 texel1 = min(last >> level, levelSize - 1);
+	float maxDepth = max(max(pyramid.Load(int3(texel0, level)), pyramid.Load(int3(texel1.x, texel0.y, level))),
+		max(pyramid.Load(int3(texel0.x, texel1.y, level)), pyramid.Load(int3(texel1, level))));
+	return minDepth > maxDepth;
+}
+
+// One thread per object, survivors are appended in whatever order the threads get there
+[numthreads(CULLING_GROUP_SIZE, 1, 1)]
+void CSCull(uint3 id : SV_DispatchThreadID)
+{
+	if (id.x >= object_count)
+	{
+		return;
+	}
+	CullingObject object = objects[id.x];
+	if (!IsInsideFrustum(object) || IsOccluded(object))
+	{
+		return;
+	}
+
+	uint slot;
+	draw_count.InterlockedAdd(0, 1, slot);
+	if (slot >= max_draw_count)
+	{
+		return;
+	}
+
+	IndirectDraw draw;
+	draw.first_triangle = object.index_offset / 3;
+	draw.object_index = object.object_index;
+	draw.material_table = material_table;
+	draw.index_count = object.index_count;
+	draw.instance_count = instance_count;
+	draw.start_index = object.index_offset;
+	draw.base_vertex = 0;
+	draw.start_instance = 0;
+	draws[slot] = draw;
+}
+
+#define HIZ_GROUP_SIZE 8
+
+// One thread per texel of the target level, the farthest depth of the 2x2 texels of the level above it.
+// Level 0 copies the depth buffer. Odd sizes fold the last row and column into the last texel, like
+// InstanceCuller::BuildHiZ.
+[numthreads(HIZ_GROUP_SIZE, HIZ_GROUP_SIZE, 1)]
+void CSBuildHiZ(uint3 id : SV_DispatchThreadID)
+{
+	if (id.x >= target_width || id.y >= target_height)
+	{
+		return;
+	}
+
+	uint2 scale = uint2(source_width == target_width ? 1 : 2, source_height == target_height ? 1 : 2);
+	uint2 first = id.xy * scale;
+	uint2 end = uint2(id.x + 1 == target_width ? source_width : min(first.x + scale.x, source_width),
+		id.y + 1 == target_height ? source_height : min(first.y + scale.y, source_height));
+	float farthest = 0.f;
+	for (uint y = first.y; y < end.y; y++)
+	{
+		for (uint x = first.x; x < end.x; x++)
+		{
+			float depth = from_depth ? textures[source_descriptor].Load(int3(x, y, 0)) : hiz_levels[source_descriptor][uint2(x, y)];
+			farthest = max(farthest, depth);
+		}
+	}
+	hiz_levels[target_descriptor][id.xy] = farthest;
+}
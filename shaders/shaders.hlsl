@@ -1,20 +1,94 @@
+cbuffer SceneConstants : register(b0)
+{
+	float4x4 mwp;
+	float4 position_offset;
+	float4 position_scale;
+	float4 fade;
+};
+
+cbuffer DrawConstants : register(b1)
+{
+	uint first_triangle;
+	uint object_index;
+	uint material_table;
+};
+
+struct Material
+{
+	float3 diffuse;
+	float shininess;
+	float3 specular;
+	float optical_density;
+	float3 emission;
+	uint illumination_model;
+};
+
+#define NO_MATERIAL_OVERRIDE 0xffffffff
+
+// InstanceData in src/instance_set.h
+struct Instance
+{
+	row_major float4x3 world;
+	uint material_override;
+	uint3 padding;
+};
+
+StructuredBuffer<Instance> instances : register(t0);
+
+// Bindless views over the whole descriptor heap, the triangle materials sit right after the material table
+StructuredBuffer<Material> material_tables[] : register(t0, space1);
+Buffer<uint> triangle_material_tables[] : register(t0, space2);
+
 struct PSInput
 {
 	float4 position : SV_POSITION;
-	float4 color : COLOR;
+	float3 normal : NORMAL;
+	nointerpolation uint material_override : MATERIAL;
 };
 
-PSInput VSMain(float4 position : POSITION, float4 color : COLOR)
+float3 DecodeOctahedral(float2 encoded)
+{
+	float3 normal = float3(encoded, 1.f - abs(encoded.x) - abs(encoded.y));
+	float t = saturate(-normal.z);
+	normal.xy += float2(normal.x >= 0.f ? -t : t, normal.y >= 0.f ? -t : t);
+	return normalize(normal);
+}
+
+// Shared by both vertex shaders, precise keeps their depth bit identical for the EQUAL test after the prepass
+float4 TransformPosition(uint4 packed, Instance instance)
+{
+	precise float3 position = packed.xyz / 65535.f * position_scale.xyz + position_offset.xyz;
+	precise float4 transformed = float4(mul(float4(position, 1.f), instance.world), 1.f);
+	return transformed;
+}
+
+// Position only, for the depth prepass
+float4 VSDepth(uint4 packed : PACKED, uint instance_id : SV_InstanceID) : SV_POSITION
+{
+	return TransformPosition(packed, instances[instance_id]);
+}
+
+// xyz is the unorm position, w holds the two snorm8 lanes of the octahedral normal
+PSInput VSMain(uint4 packed : PACKED, uint instance_id : SV_InstanceID)
 {
 	PSInput result;
+	Instance instance = instances[instance_id];
 
-	result.position = position;
-	result.color = color;
+	result.position = TransformPosition(packed, instance);
+	int2 normal = int2(packed.w << 24, packed.w << 16) >> 24;
+	result.normal = normalize(mul(DecodeOctahedral(max(normal / 127.f, -1.f)), (float3x3)instance.world));
+	result.material_override = instance.material_override;
 
 	return result;
 }
 
-float4 PSMain(PSInput input) : SV_TARGET
+float4 PSMain(PSInput input, uint primitive_id : SV_PrimitiveID) : SV_TARGET
 {
-	return input.color;
+	uint triangle_material = input.material_override;
+	if (triangle_material == NO_MATERIAL_OVERRIDE)
+	{
+		triangle_material = triangle_material_tables[material_table + 1][first_triangle + primitive_id];
+	}
+	Material material = material_tables[material_table][triangle_material];
+	return float4(material.diffuse, 1.f) * fade;
 }
@@ -0,0 +1,185 @@
+#include "asset_streamer.h"
+
+#include <algorithm>
+
+StreamingMesh::~StreamingMesh()
+{
+	if (memory_allocator)
+	{
+		memory_allocator->Free(vertex_buffer);
+		memory_allocator->Free(index_buffer);
+		memory_allocator->Free(triangle_material_buffer);
+		memory_allocator->Free(material_buffer);
+	}
+}
+
+AssetStreamer::AssetStreamer(GpuMemoryAllocator& memory_allocator, ThreadPool& thread_pool, UploadScheduler& upload_scheduler, UINT64 memory_budget) :
+	memory_allocator(memory_allocator), thread_pool(thread_pool), upload_scheduler(upload_scheduler), mesh_loader(thread_pool), memory_budget(thread_pool, memory_budget),
+	loads_in_flight(0)
+{
+}
+
+AssetStreamer::~AssetStreamer()
+{
+	CancelAll();
+}
+
+std::shared_ptr<StreamingMesh> AssetStreamer::LoadMesh(const std::wstring& obj_path)
+{
+	std::shared_ptr<StreamingMesh> mesh = std::make_shared<StreamingMesh>();
+	mesh->obj_path = obj_path;
+	mesh->state = STREAMING_QUEUED;
+	mesh->memory_allocator = &memory_allocator;
+	mesh->data.index_stride = 0;
+	mesh->data.quantization = {};
+	mesh->vertex_buffer_view = {};
+	mesh->index_buffer_view = {};
+	mesh->material_data = nullptr;
+	mesh->upload_fence_value = 0;
+
+	{
+		std::lock_guard<std::mutex> lock(meshes_mutex);
+		meshes.erase(std::remove_if(meshes.begin(), meshes.end(), [](const std::weak_ptr<StreamingMesh>& entry) { return entry.expired(); }), meshes.end());
+		meshes.push_back(mesh);
+		loads_in_flight++;
+	}
+	StartDetached(StreamMesh(mesh));
+	return mesh;
+}
+
+void AssetStreamer::CancelAll()
+{
+	{
+		std::lock_guard<std::mutex> lock(meshes_mutex);
+		for (const std::weak_ptr<StreamingMesh>& entry : meshes)
+		{
+			if (std::shared_ptr<StreamingMesh> mesh = entry.lock())
+			{
+				mesh->cancellation.Cancel();
+			}
+		}
+	}
+	WaitIdle();
+}
+
+void AssetStreamer::WaitIdle()
+{
+	std::unique_lock<std::mutex> lock(meshes_mutex);
+	idle_condition.wait(lock, [this]() { return loads_in_flight.load() == 0; });
+}
+
+Task<void> AssetStreamer::StreamMesh(std::shared_ptr<StreamingMesh> mesh)
+{
+	co_await ResumeOn(thread_pool);
+	const UINT64 budget = EstimateMemory(mesh->obj_path);
+	co_await memory_budget.Acquire(budget);
+
+	StreamingState finalState = STREAMING_READY;
+	try
+	{
+		mesh->cancellation.ThrowIfCancelled();
+		mesh->state = STREAMING_LOADING;
+
+		// Read, and only parse and process when the cache is stale
+		if (mesh_loader.ReadCache(mesh->obj_path, mesh->data))
+		{
+			OutputDebugString((L"Mesh loaded from cache: " + mesh->obj_path + L"\n").c_str());
+		}
+		else
+		{
+			ObjData obj;
+			mesh_loader.Parse(mesh->obj_path, obj);
+			mesh->cancellation.ThrowIfCancelled();
+
+			mesh_loader.Process(obj, mesh->data);
+			if (!mesh_loader.WriteCache(mesh->obj_path, mesh->data))
+			{
+				OutputDebugString(L"Failed to write mesh cache\n");
+			}
+		}
+		mesh->cancellation.ThrowIfCancelled();
+
+		// Upload
+		mesh->state = STREAMING_UPLOADING;
+		ScheduleUpload(*mesh);
+	}
+	catch (const OperationCancelled&)
+	{
+		finalState = STREAMING_CANCELLED;
+	}
+	catch (const com_exception& e)
+	{
+		OutputDebugString((L"Failed to stream " + mesh->obj_path + L": ").c_str());
+		OutputDebugString(e.get_wstring());
+		finalState = STREAMING_FAILED;
+	}
+	catch (const std::exception&)
+	{
+		OutputDebugString((L"Failed to stream " + mesh->obj_path + L"\n").c_str());
+		finalState = STREAMING_FAILED;
+	}
+
+	// The scheduler keeps its own staging copy, so the renderer only needs what it draws with
+	std::vector<PackedVertex>().swap(mesh->data.vertices);
+	std::vector<UINT8>().swap(mesh->data.index_data);
+	std::vector<UINT16>().swap(mesh->data.triangle_materials);
+	memory_budget.Release(budget);
+	mesh->state = finalState;
+
+	std::lock_guard<std::mutex> lock(meshes_mutex);
+	loads_in_flight--;
+	idle_condition.notify_all();
+}
+
+void AssetStreamer::ScheduleUpload(StreamingMesh& mesh)
+{
+	const UINT vertexDataSize = static_cast<UINT>(sizeof(PackedVertex) * mesh.data.vertices.size());
+	const UINT indexDataSize = static_cast<UINT>(mesh.data.index_data.size());
+	const UINT triangleMaterialDataSize = static_cast<UINT>(sizeof(UINT16) * mesh.data.triangle_materials.size());
+	const UINT materialDataSize = static_cast<UINT>(sizeof(GpuMaterial) * mesh.data.materials.size());
+	if (vertexDataSize == 0 || indexDataSize == 0 || triangleMaterialDataSize == 0 || materialDataSize == 0)
+	{
+		ThrowIfFailed(E_INVALIDARG);
+	}
+
+	// Default heap buffers start in COMMON and are promoted by the copy and by the first draw. The small ones share pages,
+	// so every view and copy adds the offset; the tables are viewed per element, so they are aligned to their element size.
+	mesh.vertex_buffer = memory_allocator.CreateBuffer(D3D12_HEAP_TYPE_DEFAULT, vertexDataSize);
+	mesh.index_buffer = memory_allocator.CreateBuffer(D3D12_HEAP_TYPE_DEFAULT, indexDataSize);
+	mesh.triangle_material_buffer = memory_allocator.CreateBuffer(D3D12_HEAP_TYPE_DEFAULT, triangleMaterialDataSize, sizeof(UINT16));
+
+	// The material table is tiny and meant to be edited, so it lives in the upload heap
+	mesh.material_buffer = memory_allocator.CreateBuffer(D3D12_HEAP_TYPE_UPLOAD, materialDataSize, sizeof(GpuMaterial));
+	mesh.material_data = reinterpret_cast<GpuMaterial*>(mesh.material_buffer.cpu_address);
+	memcpy(mesh.material_data, mesh.data.materials.data(), materialDataSize);
+
+	// Batch the rest with whatever else is pending on the copy queue
+	upload_scheduler.Enqueue(mesh.vertex_buffer.resource.Get(), mesh.vertex_buffer.offset, mesh.data.vertices.data(), vertexDataSize);
+	upload_scheduler.Enqueue(mesh.index_buffer.resource.Get(), mesh.index_buffer.offset, mesh.data.index_data.data(), indexDataSize);
+	upload_scheduler.Enqueue(mesh.triangle_material_buffer.resource.Get(), mesh.triangle_material_buffer.offset, mesh.data.triangle_materials.data(),
+		triangleMaterialDataSize);
+	mesh.upload_fence_value = upload_scheduler.Flush();
+
+	mesh.vertex_buffer_view.BufferLocation = mesh.vertex_buffer.GetGpuAddress();
+	mesh.vertex_buffer_view.StrideInBytes = sizeof(PackedVertex);
+	mesh.vertex_buffer_view.SizeInBytes = vertexDataSize;
+
+	mesh.index_buffer_view.BufferLocation = mesh.index_buffer.GetGpuAddress();
+	mesh.index_buffer_view.Format = mesh.data.index_stride == sizeof(UINT16) ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
+	mesh.index_buffer_view.SizeInBytes = indexDataSize;
+}
+
+UINT64 AssetStreamer::EstimateMemory(const std::wstring& obj_path) const
+{
+	// Parsing and processing hold a few copies of the geometry at once, the sources are a fair scale for that
+	UINT64 sourceSize = 0;
+	for (const std::wstring& source : MeshLoader::GetSourceFiles(obj_path))
+	{
+		WIN32_FILE_ATTRIBUTE_DATA attributes;
+		if (GetFileAttributesEx(source.c_str(), GetFileExInfoStandard, &attributes))
+		{
+			sourceSize += (static_cast<UINT64>(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow;
+		}
+	}
+	return sourceSize * 8;
+}
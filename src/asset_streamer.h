@@ -0,0 +1,82 @@
+#pragma once
+
+#include "dx12_labs.h"
+#include "async_task.h"
+#include "gpu_memory_allocator.h"
+#include "mesh_loader.h"
+#include "thread_pool.h"
+#include "upload_scheduler.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+enum StreamingState
+{
+	STREAMING_QUEUED,
+	STREAMING_LOADING,
+	STREAMING_UPLOADING,
+	STREAMING_READY,
+	STREAMING_CANCELLED,
+	STREAMING_FAILED
+};
+
+// Mesh loaded in the background. Everything except state belongs to the loading coroutine
+// until state turns STREAMING_READY, from then on it belongs to the render thread.
+struct StreamingMesh
+{
+	std::wstring obj_path;
+	std::atomic<StreamingState> state;
+	CancellationToken cancellation;
+
+	MeshData data;
+	GpuMemoryAllocator* memory_allocator;	// the buffers go back to it when the mesh is released
+	GpuAllocation vertex_buffer;
+	GpuAllocation index_buffer;
+	GpuAllocation triangle_material_buffer;
+	GpuAllocation material_buffer;	// upload heap, stays mapped so a material edit is a single small write
+	GpuMaterial* material_data;
+	D3D12_VERTEX_BUFFER_VIEW vertex_buffer_view;
+	D3D12_INDEX_BUFFER_VIEW index_buffer_view;
+	UINT64 upload_fence_value;	// copy fence value the direct queue waits on before the first draw
+
+	~StreamingMesh();
+};
+
+// Streams meshes through read -> parse -> process -> upload coroutines on the thread pool.
+// Uploads are handed to the upload scheduler and a mesh is ready as soon as they are submitted,
+// the renderer makes its queue wait on upload_fence_value before the first draw.
+// Loads in flight are limited by a memory budget estimated from the source file sizes.
+class AssetStreamer
+{
+public:
+	AssetStreamer(GpuMemoryAllocator& memory_allocator, ThreadPool& thread_pool, UploadScheduler& upload_scheduler, UINT64 memory_budget);
+	virtual ~AssetStreamer();
+
+	std::shared_ptr<StreamingMesh> LoadMesh(const std::wstring& obj_path);
+
+	// Cancels every load in flight and blocks until all of them stopped
+	void CancelAll();
+	void WaitIdle();
+
+	UINT GetLoadsInFlight() const { return loads_in_flight.load(); }
+
+protected:
+	GpuMemoryAllocator& memory_allocator;
+	ThreadPool& thread_pool;
+	UploadScheduler& upload_scheduler;
+	MeshLoader mesh_loader;
+	MemoryBudget memory_budget;
+
+	std::vector<std::weak_ptr<StreamingMesh>> meshes;
+	std::atomic<UINT> loads_in_flight;
+	std::mutex meshes_mutex;
+	std::condition_variable idle_condition;
+
+	Task<void> StreamMesh(std::shared_ptr<StreamingMesh> mesh);
+	void ScheduleUpload(StreamingMesh& mesh);
+	UINT64 EstimateMemory(const std::wstring& obj_path) const;
+};
@@ -0,0 +1,53 @@
+#include "async_task.h"
+
+#include <vector>
+
+bool MemoryBudget::TryAcquire(uint64_t size)
+{
+	std::lock_guard<std::mutex> lock(budget_mutex);
+	if (!waiters.empty() || !Fits(size))
+	{
+		return false;
+	}
+	used += size;
+	return true;
+}
+
+bool MemoryBudget::Enqueue(uint64_t size, std::coroutine_handle<> handle)
+{
+	// Memory may have been released since TryAcquire, only suspend when it still does not fit
+	std::lock_guard<std::mutex> lock(budget_mutex);
+	if (waiters.empty() && Fits(size))
+	{
+		used += size;
+		return false;
+	}
+	waiters.push_back({ size, handle });
+	return true;
+}
+
+void MemoryBudget::Release(uint64_t size)
+{
+	// Waiters are admitted in arrival order so a large load is not starved by small ones
+	std::vector<std::coroutine_handle<>> admitted;
+	{
+		std::lock_guard<std::mutex> lock(budget_mutex);
+		used -= size;
+		while (!waiters.empty() && Fits(waiters.front().size))
+		{
+			used += waiters.front().size;
+			admitted.push_back(waiters.front().handle);
+			waiters.pop_front();
+		}
+	}
+	for (std::coroutine_handle<> handle : admitted)
+	{
+		thread_pool.Submit([handle]() { handle.resume(); });
+	}
+}
+
+uint64_t MemoryBudget::GetUsed()
+{
+	std::lock_guard<std::mutex> lock(budget_mutex);
+	return used;
+}
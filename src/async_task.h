@@ -0,0 +1,229 @@
+#pragma once
+
+#include "thread_pool.h"
+
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+// Lazily started coroutine. Awaiting it runs the body on the awaiting thread until the body
+// switches threads itself, then the awaiting coroutine continues wherever the body finished.
+template <typename T = void>
+class Task;
+
+namespace detail
+{
+	struct TaskFinalAwaiter
+	{
+		bool await_ready() noexcept { return false; }
+		template <typename Promise>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+		{
+			std::coroutine_handle<> continuation = handle.promise().continuation;
+			return continuation ? continuation : std::noop_coroutine();
+		}
+		void await_resume() noexcept {}
+	};
+
+	struct TaskPromiseBase
+	{
+		std::coroutine_handle<> continuation;
+		std::exception_ptr exception;
+
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		TaskFinalAwaiter final_suspend() noexcept { return {}; }
+		void unhandled_exception() { exception = std::current_exception(); }
+	};
+}
+
+template <typename T>
+class Task
+{
+public:
+	struct promise_type : detail::TaskPromiseBase
+	{
+		std::optional<T> value;
+
+		Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		void return_value(T result) { value = std::move(result); }
+	};
+
+	Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {};
+	Task(const Task&) = delete;
+	Task& operator=(const Task&) = delete;
+	~Task()
+	{
+		if (handle)
+		{
+			handle.destroy();
+		}
+	};
+
+	bool await_ready() const noexcept { return false; }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+	{
+		handle.promise().continuation = awaiting;
+		return handle;
+	}
+	T await_resume()
+	{
+		if (handle.promise().exception)
+		{
+			std::rethrow_exception(handle.promise().exception);
+		}
+		return std::move(*handle.promise().value);
+	}
+
+protected:
+	explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {};
+	std::coroutine_handle<promise_type> handle;
+};
+
+template <>
+class Task<void>
+{
+public:
+	struct promise_type : detail::TaskPromiseBase
+	{
+		Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		void return_void() {}
+	};
+
+	Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {};
+	Task(const Task&) = delete;
+	Task& operator=(const Task&) = delete;
+	~Task()
+	{
+		if (handle)
+		{
+			handle.destroy();
+		}
+	};
+
+	bool await_ready() const noexcept { return false; }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+	{
+		handle.promise().continuation = awaiting;
+		return handle;
+	}
+	void await_resume()
+	{
+		if (handle.promise().exception)
+		{
+			std::rethrow_exception(handle.promise().exception);
+		}
+	}
+
+protected:
+	explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {};
+	std::coroutine_handle<promise_type> handle;
+};
+
+// Starts a task without waiting for it, the frame destroys itself when the task returns.
+// Exceptions must be handled inside the task, an escaping one terminates the process.
+struct DetachedTask
+{
+	struct promise_type
+	{
+		DetachedTask get_return_object() { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+
+inline DetachedTask StartDetached(Task<void> task)
+{
+	co_await task;
+}
+
+// co_await ResumeOn(pool) continues the coroutine on a pool worker
+inline auto ResumeOn(ThreadPool& thread_pool)
+{
+	struct ThreadPoolAwaiter
+	{
+		ThreadPool& thread_pool;
+
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> handle) { thread_pool.Submit([handle]() { handle.resume(); }); }
+		void await_resume() const noexcept {}
+	};
+	return ThreadPoolAwaiter{ thread_pool };
+}
+
+struct OperationCancelled : public std::exception
+{
+	const char* what() const noexcept override { return "Operation cancelled"; }
+};
+
+// Shared flag checked by the stages of a load, cancelling stops it at the next stage boundary
+class CancellationToken
+{
+public:
+	CancellationToken() : cancelled(std::make_shared<std::atomic<bool>>(false)) {};
+
+	void Cancel() { cancelled->store(true); }
+	bool IsCancelled() const { return cancelled->load(); }
+	void ThrowIfCancelled() const
+	{
+		if (IsCancelled())
+		{
+			throw OperationCancelled();
+		}
+	}
+
+protected:
+	std::shared_ptr<std::atomic<bool>> cancelled;
+};
+
+// Caps the bytes held by loads in flight. Acquire suspends until enough has been released,
+// a request larger than the whole budget is admitted alone so it cannot wait forever.
+class MemoryBudget
+{
+public:
+	MemoryBudget(ThreadPool& thread_pool, uint64_t capacity) : thread_pool(thread_pool), capacity(capacity), used(0) {};
+	virtual ~MemoryBudget() {};
+
+	MemoryBudget(const MemoryBudget&) = delete;
+	MemoryBudget& operator=(const MemoryBudget&) = delete;
+
+	struct AcquireAwaiter
+	{
+		MemoryBudget& budget;
+		uint64_t size;
+
+		bool await_ready() { return budget.TryAcquire(size); }
+		bool await_suspend(std::coroutine_handle<> handle) { return budget.Enqueue(size, handle); }
+		void await_resume() const noexcept {}
+	};
+
+	AcquireAwaiter Acquire(uint64_t size) { return AcquireAwaiter{ *this, size }; }
+	void Release(uint64_t size);
+
+	uint64_t GetCapacity() const { return capacity; }
+	uint64_t GetUsed();
+
+protected:
+	struct Waiter
+	{
+		uint64_t size;
+		std::coroutine_handle<> handle;
+	};
+
+	ThreadPool& thread_pool;
+	uint64_t capacity;
+	uint64_t used;
+	std::deque<Waiter> waiters;
+	std::mutex budget_mutex;
+
+	bool Fits(uint64_t size) const { return used == 0 || used + size <= capacity; }
+	bool TryAcquire(uint64_t size);
+	bool Enqueue(uint64_t size, std::coroutine_handle<> handle);
+};
@@ -0,0 +1,190 @@
+#include "cluster_culling.h"
+
+#include <chrono>
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define CLUSTER_CULLING_SSE 1
+#include <xmmintrin.h>
+#endif
+
+void ClusterCuller::SetMeshlets(const std::vector<Meshlet>& meshlets)
+{
+	count = meshlets.size();
+	std::vector<float>* arrays[] = { &center_x, &center_y, &center_z, &radius, &apex_x, &apex_y, &apex_z, &axis_x, &axis_y, &axis_z, &cutoff };
+	for (std::vector<float>* array : arrays)
+	{
+		array->assign(count, 0.f);
+	}
+
+	for (size_t i = 0; i < count; i++)
+	{
+		const Meshlet& meshlet = meshlets[i];
+		center_x[i] = meshlet.center[0];
+		center_y[i] = meshlet.center[1];
+		center_z[i] = meshlet.center[2];
+		radius[i] = meshlet.radius;
+		apex_x[i] = meshlet.cone_apex[0];
+		apex_y[i] = meshlet.cone_apex[1];
+		apex_z[i] = meshlet.cone_apex[2];
+		axis_x[i] = meshlet.cone_axis[0];
+		axis_y[i] = meshlet.cone_axis[1];
+		axis_z[i] = meshlet.cone_axis[2];
+		cutoff[i] = meshlet.cone_cutoff;
+	}
+}
+
+void ClusterCuller::Cull(const ClusterCullingView& view, std::vector<uint32_t>& visible)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	visible.clear();
+	statistics = {};
+	statistics.total = count;
+
+	size_t first = 0;
+#ifdef CLUSTER_CULLING_SSE
+	const __m128 zero = _mm_setzero_ps();
+	for (; first + 4 <= count; first += 4)
+	{
+		const __m128 cx = _mm_loadu_ps(&center_x[first]);
+		const __m128 cy = _mm_loadu_ps(&center_y[first]);
+		const __m128 cz = _mm_loadu_ps(&center_z[first]);
+		const __m128 negativeRadius = _mm_sub_ps(zero, _mm_loadu_ps(&radius[first]));
+
+		// Outside as soon as the sphere is entirely behind one plane
+		__m128 outside = _mm_setzero_ps();
+		for (uint32_t p = 0; p < view.plane_count; p++)
+		{
+			const float* plane = view.planes[p];
+			__m128 distance = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(plane[0])), _mm_mul_ps(cy, _mm_set1_ps(plane[1]))),
+				_mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(plane[2])), _mm_set1_ps(plane[3])));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, negativeRadius));
+		}
+
+		__m128 backfacing = _mm_setzero_ps();
+		if (view.cull_backfaces)
+		{
+			const __m128 ax = _mm_loadu_ps(&axis_x[first]);
+			const __m128 ay = _mm_loadu_ps(&axis_y[first]);
+			const __m128 az = _mm_loadu_ps(&axis_z[first]);
+			const __m128 cosine = _mm_loadu_ps(&cutoff[first]);
+			if (view.orthographic)
+			{
+				__m128 facing = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, _mm_set1_ps(view.view_direction[0])), _mm_mul_ps(ay, _mm_set1_ps(view.view_direction[1]))),
+					_mm_mul_ps(az, _mm_set1_ps(view.view_direction[2])));
+				backfacing = _mm_cmpge_ps(facing, cosine);
+			}
+			else
+			{
+				// dot(apex - eye, axis) >= cutoff * |apex - eye|
+				__m128 dx = _mm_sub_ps(_mm_loadu_ps(&apex_x[first]), _mm_set1_ps(view.camera_position[0]));
+				__m128 dy = _mm_sub_ps(_mm_loadu_ps(&apex_y[first]), _mm_set1_ps(view.camera_position[1]));
+				__m128 dz = _mm_sub_ps(_mm_loadu_ps(&apex_z[first]), _mm_set1_ps(view.camera_position[2]));
+				__m128 facing = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, ax), _mm_mul_ps(dy, ay)), _mm_mul_ps(dz, az));
+				__m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+				backfacing = _mm_cmpge_ps(facing, _mm_mul_ps(cosine, distance));
+			}
+		}
+
+		const int outsideMask = _mm_movemask_ps(outside);
+		const int backfacingMask = _mm_movemask_ps(backfacing) & ~outsideMask;
+		const int visibleMask = ~(outsideMask | backfacingMask) & 0xF;
+		for (uint32_t lane = 0; lane < 4; lane++)
+		{
+			statistics.frustum_culled += (outsideMask >> lane) & 1;
+			statistics.cone_culled += (backfacingMask >> lane) & 1;
+			if ((visibleMask >> lane) & 1)
+			{
+				visible.push_back(static_cast<uint32_t>(first + lane));
+			}
+		}
+	}
+#endif
+	CullScalar(view, first, visible);
+
+	statistics.visible = visible.size();
+	statistics.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void ClusterCuller::CullScalar(const ClusterCullingView& view, size_t first, std::vector<uint32_t>& visible)
+{
+	for (size_t i = first; i < count; i++)
+	{
+		bool outside = false;
+		for (uint32_t p = 0; p < view.plane_count && !outside; p++)
+		{
+			const float* plane = view.planes[p];
+			outside = center_x[i] * plane[0] + center_y[i] * plane[1] + center_z[i] * plane[2] + plane[3] < -radius[i];
+		}
+		if (outside)
+		{
+			statistics.frustum_culled++;
+			continue;
+		}
+
+		if (view.cull_backfaces)
+		{
+			bool backfacing;
+			if (view.orthographic)
+			{
+				backfacing = axis_x[i] * view.view_direction[0] + axis_y[i] * view.view_direction[1] + axis_z[i] * view.view_direction[2] >= cutoff[i];
+			}
+			else
+			{
+				float dx = apex_x[i] - view.camera_position[0];
+				float dy = apex_y[i] - view.camera_position[1];
+				float dz = apex_z[i] - view.camera_position[2];
+				backfacing = dx * axis_x[i] + dy * axis_y[i] + dz * axis_z[i] >= cutoff[i] * std::sqrt(dx * dx + dy * dy + dz * dz);
+			}
+			if (backfacing)
+			{
+				statistics.cone_culled++;
+				continue;
+			}
+		}
+
+		visible.push_back(static_cast<uint32_t>(i));
+	}
+}
+
+void ClusterCuller::ExtractFrustumPlanes(const float matrix[16], bool clip_depth, ClusterCullingView& view)
+{
+	// clip = v * M, so clip component j is column j of the matrix
+	auto column = [&](size_t j, float out[4])
+	{
+		for (size_t i = 0; i < 4; i++)
+		{
+			out[i] = matrix[i * 4 + j];
+		}
+	};
+	float x[4], y[4], z[4], w[4];
+	column(0, x);
+	column(1, y);
+	column(2, z);
+	column(3, w);
+
+	view.plane_count = 0;
+	auto add = [&](const float a[4], const float b[4], float sign)
+	{
+		float* plane = view.planes[view.plane_count++];
+		for (size_t i = 0; i < 4; i++)
+		{
+			plane[i] = a[i] + sign * (b ? b[i] : 0.f);
+		}
+		float length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+		for (size_t i = 0; i < 4 && length > 0.f; i++)
+		{
+			plane[i] /= length;
+		}
+	};
+	add(w, x, 1.f);		// -w <= x
+	add(w, x, -1.f);	// x <= w
+	add(w, y, 1.f);		// -w <= y
+	add(w, y, -1.f);	// y <= w
+	if (clip_depth)
+	{
+		add(z, nullptr, 0.f);	// 0 <= z
+		add(w, z, -1.f);		// z <= w
+	}
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "meshlet_builder.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Culling volume in the same space as the meshlet bounds
+struct ClusterCullingView
+{
+	float planes[6][4];	// normalized, a point is inside when a * x + b * y + c * z + d >= 0
+	uint32_t plane_count;
+	bool cull_backfaces;
+	bool orthographic;
+	float camera_position[3];	// perspective eye
+	float view_direction[3];	// orthographic direction of sight
+};
+
+struct ClusterCullingStatistics
+{
+	size_t total;
+	size_t visible;
+	size_t frustum_culled;
+	size_t cone_culled;
+	double milliseconds;
+};
+
+// Rejects meshlets against the frustum planes and their normal cones, four at a time with SSE.
+// Bounds are kept as structure of arrays, the tail that does not fill a register is culled one by one.
+class ClusterCuller
+{
+public:
+	ClusterCuller() : count(0), statistics() {};
+	virtual ~ClusterCuller() {};
+
+	void SetMeshlets(const std::vector<Meshlet>& meshlets);
+
+	// Fills visible with meshlet indices in ascending order
+	void Cull(const ClusterCullingView& view, std::vector<uint32_t>& visible);
+
+	const ClusterCullingStatistics& GetStatistics() const { return statistics; }
+
+	// Planes of a row vector matrix (v * M) with the D3D clip volume, near and far only when depth clip is on
+	static void ExtractFrustumPlanes(const float matrix[16], bool clip_depth, ClusterCullingView& view);
+
+protected:
+	size_t count;
+	std::vector<float> center_x, center_y, center_z, radius;
+	std::vector<float> apex_x, apex_y, apex_z;
+	std::vector<float> axis_x, axis_y, axis_z, cutoff;
+
+	ClusterCullingStatistics statistics;
+
+	void CullScalar(const ClusterCullingView& view, size_t first, std::vector<uint32_t>& visible);
+};
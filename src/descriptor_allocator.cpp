@@ -0,0 +1,149 @@
+#include "descriptor_allocator.h"
+
+#include <algorithm>
+
+DescriptorHeap::DescriptorHeap(ID3D12Device* device, UINT persistent_capacity, UINT dynamic_capacity) :
+	device(device), persistent_capacity(persistent_capacity), persistent_used(0),
+	dynamic_capacity(dynamic_capacity), dynamic_head(0), dynamic_used(0), frame_count(0)
+{
+	D3D12_DESCRIPTOR_HEAP_DESC heapDescriptor = {};
+	heapDescriptor.NumDescriptors = persistent_capacity + dynamic_capacity;
+	heapDescriptor.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
+	heapDescriptor.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
+	ThrowIfFailed(device->CreateDescriptorHeap(&heapDescriptor, IID_PPV_ARGS(&heap)));
+
+	descriptor_size = device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+	cpu_start = heap->GetCPUDescriptorHandleForHeapStart();
+	gpu_start = heap->GetGPUDescriptorHandleForHeapStart();
+	free_ranges.push_back({ 0, persistent_capacity });
+}
+
+DescriptorRange DescriptorHeap::Allocate(UINT count)
+{
+	for (auto range = free_ranges.begin(); range != free_ranges.end(); ++range)
+	{
+		if (range->count >= count)
+		{
+			const UINT offset = range->offset;
+			range->offset += count;
+			range->count -= count;
+			if (range->count == 0)
+			{
+				free_ranges.erase(range);
+			}
+			persistent_used += count;
+			return MakeRange(offset, count);
+		}
+	}
+
+	OutputDebugString(L"Persistent descriptors exhausted\n");
+	ThrowIfFailed(E_OUTOFMEMORY);
+	return {};
+}
+
+void DescriptorHeap::Free(const DescriptorRange& range)
+{
+	if (!range.IsValid())
+	{
+		return;
+	}
+
+	auto next = std::lower_bound(free_ranges.begin(), free_ranges.end(), range.offset, [](const FreeRange& free, UINT offset) { return free.offset < offset; });
+	next = free_ranges.insert(next, { range.offset, range.count });
+	persistent_used -= range.count;
+
+	// Merge with the following and the preceding free range
+	if (next + 1 != free_ranges.end() && next->offset + next->count == (next + 1)->offset)
+	{
+		next->count += (next + 1)->count;
+		free_ranges.erase(next + 1);
+	}
+	if (next != free_ranges.begin() && (next - 1)->offset + (next - 1)->count == next->offset)
+	{
+		(next - 1)->count += next->count;
+		free_ranges.erase(next);
+	}
+}
+
+DescriptorRange DescriptorHeap::AllocateDynamic(UINT count)
+{
+	// Ranges have to be contiguous, so a tail that is too short is skipped
+	UINT offset = dynamic_head;
+	UINT consumed = count;
+	if (offset + count > dynamic_capacity)
+	{
+		consumed += dynamic_capacity - offset;
+		offset = 0;
+	}
+	if (dynamic_used + consumed > dynamic_capacity)
+	{
+		// The heap cannot grow without a heap switch, so running out is a sizing bug
+		OutputDebugString(L"Dynamic descriptors exhausted\n");
+		ThrowIfFailed(E_OUTOFMEMORY);
+	}
+
+	dynamic_head = offset + count;
+	dynamic_used += consumed;
+	frame_count += consumed;
+	return MakeRange(persistent_capacity + offset, count);
+}
+
+void DescriptorHeap::FinishFrame(UINT64 fence_value)
+{
+	frames.push_back({ fence_value, frame_count });
+	frame_count = 0;
+}
+
+void DescriptorHeap::Reclaim(UINT64 completed_fence_value)
+{
+	while (!frames.empty() && frames.front().fence_value <= completed_fence_value)
+	{
+		dynamic_used -= frames.front().count;
+		frames.pop_front();
+	}
+}
+
+void DescriptorHeap::Copy(const DescriptorRange& destination, UINT destination_index, D3D12_CPU_DESCRIPTOR_HANDLE source, UINT count)
+{
+	CD3DX12_CPU_DESCRIPTOR_HANDLE destinationHandle(destination.cpu_handle, destination_index, descriptor_size);
+	device->CopyDescriptorsSimple(count, destinationHandle, source, D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+}
+
+DescriptorRange DescriptorHeap::MakeRange(UINT offset, UINT count) const
+{
+	return { CD3DX12_CPU_DESCRIPTOR_HANDLE(cpu_start, offset, descriptor_size), CD3DX12_GPU_DESCRIPTOR_HANDLE(gpu_start, offset, descriptor_size), offset, count };
+}
+
+StagingDescriptorHeap::StagingDescriptorHeap(ID3D12Device* device, D3D12_DESCRIPTOR_HEAP_TYPE type, UINT heap_size) :
+	device(device), type(type), heap_size(heap_size), next_in_heap(heap_size)
+{
+	descriptor_size = device->GetDescriptorHandleIncrementSize(type);
+}
+
+D3D12_CPU_DESCRIPTOR_HANDLE StagingDescriptorHeap::Allocate()
+{
+	if (!free_handles.empty())
+	{
+		D3D12_CPU_DESCRIPTOR_HANDLE handle = free_handles.back();
+		free_handles.pop_back();
+		return handle;
+	}
+
+	if (next_in_heap == heap_size)
+	{
+		D3D12_DESCRIPTOR_HEAP_DESC heapDescriptor = {};
+		heapDescriptor.NumDescriptors = heap_size;
+		heapDescriptor.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
+		heapDescriptor.Type = type;
+		ComPtr<ID3D12DescriptorHeap> heap;
+		ThrowIfFailed(device->CreateDescriptorHeap(&heapDescriptor, IID_PPV_ARGS(&heap)));
+		heaps.push_back(heap);
+		next_in_heap = 0;
+	}
+	return CD3DX12_CPU_DESCRIPTOR_HANDLE(heaps.back()->GetCPUDescriptorHandleForHeapStart(), next_in_heap++, descriptor_size);
+}
+
+void StagingDescriptorHeap::Free(D3D12_CPU_DESCRIPTOR_HANDLE handle)
+{
+	free_handles.push_back(handle);
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "dx12_labs.h"
+
+#include <deque>
+#include <vector>
+
+// Contiguous descriptors in one heap
+struct DescriptorRange
+{
+	D3D12_CPU_DESCRIPTOR_HANDLE cpu_handle;
+	D3D12_GPU_DESCRIPTOR_HANDLE gpu_handle;	// null for CPU only heaps
+	UINT offset;
+	UINT count;
+
+	bool IsValid() const { return count != 0; }
+};
+
+// The one shader-visible CBV/SRV/UAV heap of the renderer, so it is bound once per list and never switched.
+// The front of the heap holds long-lived descriptors handed out from a free list, the back is a ring
+// of transient descriptors that are released per frame once the GPU passed the frame's fence value.
+class DescriptorHeap
+{
+public:
+	DescriptorHeap(ID3D12Device* device, UINT persistent_capacity, UINT dynamic_capacity);
+	virtual ~DescriptorHeap() {}
+
+	DescriptorHeap(const DescriptorHeap&) = delete;
+	DescriptorHeap& operator=(const DescriptorHeap&) = delete;
+
+	// Long-lived descriptors, first fit, freed ranges merge with their neighbours
+	DescriptorRange Allocate(UINT count);
+	void Free(const DescriptorRange& range);
+
+	// Transient descriptors, valid until the fence value passed to the next FinishFrame is reached
+	DescriptorRange AllocateDynamic(UINT count);
+	void FinishFrame(UINT64 fence_value);
+	void Reclaim(UINT64 completed_fence_value);
+
+	// Copies CPU only descriptors, usually from a staging heap, into the range
+	void Copy(const DescriptorRange& destination, UINT destination_index, D3D12_CPU_DESCRIPTOR_HANDLE source, UINT count = 1);
+
+	ID3D12DescriptorHeap* GetHeap() const { return heap.Get(); }
+	D3D12_GPU_DESCRIPTOR_HANDLE GetGpuStart() const { return gpu_start; }	// bindless tables index from here
+	UINT GetDescriptorSize() const { return descriptor_size; }
+	UINT GetPersistentUsed() const { return persistent_used; }
+	UINT GetDynamicUsed() const { return dynamic_used; }
+
+protected:
+	struct FreeRange
+	{
+		UINT offset;
+		UINT count;
+	};
+
+	struct FrameUsage
+	{
+		UINT64 fence_value;
+		UINT count;
+	};
+
+	ComPtr<ID3D12Device> device;
+	ComPtr<ID3D12DescriptorHeap> heap;
+	UINT descriptor_size;
+	D3D12_CPU_DESCRIPTOR_HANDLE cpu_start;
+	D3D12_GPU_DESCRIPTOR_HANDLE gpu_start;
+
+	UINT persistent_capacity;
+	UINT persistent_used;
+	std::vector<FreeRange> free_ranges;	// sorted by offset
+
+	UINT dynamic_capacity;
+	UINT dynamic_head;
+	UINT dynamic_used;
+	UINT frame_count;
+	std::deque<FrameUsage> frames;
+
+	DescriptorRange MakeRange(UINT offset, UINT count) const;
+};
+
+// CPU only heaps where descriptors are created before they are copied into the shader-visible heap.
+// Grows by whole heaps and recycles single descriptors through a free list.
+class StagingDescriptorHeap
+{
+public:
+	StagingDescriptorHeap(ID3D12Device* device, D3D12_DESCRIPTOR_HEAP_TYPE type, UINT heap_size = 1024);
+	virtual ~StagingDescriptorHeap() {}
+
+	StagingDescriptorHeap(const StagingDescriptorHeap&) = delete;
+	StagingDescriptorHeap& operator=(const StagingDescriptorHeap&) = delete;
+
+	D3D12_CPU_DESCRIPTOR_HANDLE Allocate();
+	void Free(D3D12_CPU_DESCRIPTOR_HANDLE handle);
+
+protected:
+	ComPtr<ID3D12Device> device;
+	D3D12_DESCRIPTOR_HEAP_TYPE type;
+	UINT heap_size;
+	UINT descriptor_size;
+
+	std::vector<ComPtr<ID3D12DescriptorHeap>> heaps;
+	UINT next_in_heap;
+	std::vector<D3D12_CPU_DESCRIPTOR_HANDLE> free_handles;
+};
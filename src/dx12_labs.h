@@ -57,8 +57,42 @@ namespace DX
 using namespace DX;
 using namespace DirectX;
 
-struct ColorVertex
+// Full precision vertex used while loading, uploaded as PackedVertex
+struct MeshVertex
 {
 	XMFLOAT3 position;
-	XMFLOAT4 color;
+	XMFLOAT3 normal;
+	UINT material_id;
+};
+
+// Triangle material indices are 16 bit
+static const UINT max_material_count = 0x10000;
+
+// Element of the t0 material table in shaders.hlsl, filled from the MTL file
+struct GpuMaterial
+{
+	XMFLOAT3 diffuse;		// Kd
+	float shininess;		// Ns
+	XMFLOAT3 specular;		// Ks
+	float optical_density;	// Ni
+	XMFLOAT3 emission;		// Ke
+	UINT illumination_model;	// illum
+};
+static_assert(sizeof(GpuMaterial) == 48, "GpuMaterial is stored in the mesh cache, keep it packed");
+
+// Layout of the b0 constant buffer in shaders.hlsl
+struct SceneConstants
+{
+	XMMATRIX mwp;
+	XMFLOAT4 position_offset;
+	XMFLOAT4 position_scale;
+	XMFLOAT4 fade;
+};
+
+// Layout of the b1 root constants in shaders.hlsl, written per draw
+struct DrawConstants
+{
+	UINT first_triangle;	// offsets SV_PrimitiveID into the per-triangle material table
+	UINT object_index;		// submesh the draw belongs to
+	UINT material_table;	// bindless index of the material table, the triangle materials follow it
 };
@@ -0,0 +1,300 @@
+#include "gpu_culling.h"
+
+GpuCuller::GpuCuller(ID3D12Device* device, GpuMemoryAllocator& memory_allocator, ResourceStateTracker& resource_states, PipelineLibrary& pipeline_library,
+	DescriptorHeap& descriptor_heap, StagingDescriptorHeap& staging_descriptors, D3D12_SHADER_BYTECODE culling_shader,
+	D3D12_SHADER_BYTECODE hiz_shader, ID3D12RootSignature* draw_root_signature, UINT draw_constants_parameter, UINT frame_count) :
+	device(device), memory_allocator(memory_allocator), resource_states(resource_states), descriptor_heap(descriptor_heap),
+	staging_descriptors(staging_descriptors), object_buffer(), draw_buffer(), zero_buffer(), object_count(0), readbacks(frame_count), pyramid(),
+	pyramid_descriptors(), pyramid_width(0), pyramid_height(0), pyramid_mip_count(0), pyramid_readback_size(0)
+{
+	D3D12_FEATURE_DATA_ROOT_SIGNATURE rsFeatureData = {};
+	rsFeatureData.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_1;
+	if (FAILED(device->CheckFeatureSupport(D3D12_FEATURE_ROOT_SIGNATURE, &rsFeatureData, sizeof(rsFeatureData))))
+	{
+		rsFeatureData.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_0;
+	}
+
+	// Buffers go in as root descriptors, only the pyramid texture needs the bindless table
+	CD3DX12_DESCRIPTOR_RANGE1 range;
+	CD3DX12_ROOT_PARAMETER1 rootParameters[ROOT_PARAMETER_COUNT];
+	range.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, UINT_MAX, 0, 1, D3D12_DESCRIPTOR_RANGE_FLAG_DESCRIPTORS_VOLATILE, 0);
+	rootParameters[ROOT_CULLING_CONSTANTS].InitAsConstantBufferView(0, 0, D3D12_ROOT_DESCRIPTOR_FLAG_DATA_STATIC);
+	rootParameters[ROOT_OBJECTS].InitAsShaderResourceView(0, 0, D3D12_ROOT_DESCRIPTOR_FLAG_DATA_STATIC_WHILE_SET_AT_EXECUTE);
+	rootParameters[ROOT_DRAW_COUNT].InitAsUnorderedAccessView(0, 0, D3D12_ROOT_DESCRIPTOR_FLAG_DATA_VOLATILE);
+	rootParameters[ROOT_DRAWS].InitAsUnorderedAccessView(1, 0, D3D12_ROOT_DESCRIPTOR_FLAG_DATA_VOLATILE);
+	rootParameters[ROOT_BINDLESS_TABLE].InitAsDescriptorTable(1, &range);
+
+	CD3DX12_VERSIONED_ROOT_SIGNATURE_DESC rootSignatureDescriptor;
+	rootSignatureDescriptor.Init_1_1(_countof(rootParameters), rootParameters, 0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_NONE);
+
+	ComPtr<ID3D10Blob> signature;
+	ComPtr<ID3D10Blob> error;
+	ThrowIfFailed(D3DX12SerializeVersionedRootSignature(&rootSignatureDescriptor, rsFeatureData.HighestVersion, &signature, &error));
+	ThrowIfFailed(device->CreateRootSignature(0, signature->GetBufferPointer(), signature->GetBufferSize(), IID_PPV_ARGS(&root_signature)));
+
+	D3D12_COMPUTE_PIPELINE_STATE_DESC psoDescriptor = {};
+	psoDescriptor.pRootSignature = root_signature.Get();
+	psoDescriptor.CS = culling_shader;
+	pipeline_state = pipeline_library.CreateComputePipeline(L"culling", psoDescriptor);
+
+	// The pyramid build reads the depth buffer as an SRV and the level above as a UAV, both by bindless index
+	CD3DX12_DESCRIPTOR_RANGE1 sourceRange;
+	CD3DX12_DESCRIPTOR_RANGE1 levelRange;
+	CD3DX12_ROOT_PARAMETER1 hizRootParameters[ROOT_HIZ_PARAMETER_COUNT];
+	sourceRange.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, UINT_MAX, 0, 1, D3D12_DESCRIPTOR_RANGE_FLAG_DESCRIPTORS_VOLATILE, 0);
+	levelRange.Init(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, UINT_MAX, 0, 2, D3D12_DESCRIPTOR_RANGE_FLAG_DESCRIPTORS_VOLATILE, 0);
+	hizRootParameters[ROOT_HIZ_CONSTANTS].InitAsConstants(sizeof(HiZConstants) / sizeof(UINT), 1, 0);
+	hizRootParameters[ROOT_HIZ_SOURCES].InitAsDescriptorTable(1, &sourceRange);
+	hizRootParameters[ROOT_HIZ_LEVELS].InitAsDescriptorTable(1, &levelRange);
+
+	rootSignatureDescriptor.Init_1_1(_countof(hizRootParameters), hizRootParameters, 0, nullptr, D3D12_ROOT_SIGNATURE_FLAG_NONE);
+	ThrowIfFailed(D3DX12SerializeVersionedRootSignature(&rootSignatureDescriptor, rsFeatureData.HighestVersion, &signature, &error));
+	ThrowIfFailed(device->CreateRootSignature(0, signature->GetBufferPointer(), signature->GetBufferSize(), IID_PPV_ARGS(&hiz_root_signature)));
+
+	psoDescriptor.pRootSignature = hiz_root_signature.Get();
+	psoDescriptor.CS = hiz_shader;
+	hiz_pipeline_state = pipeline_library.CreateComputePipeline(L"hi-z build", psoDescriptor);
+
+	// Every command sets the draw root constants, then draws
+	D3D12_INDIRECT_ARGUMENT_DESC arguments[2] = {};
+	arguments[0].Type = D3D12_INDIRECT_ARGUMENT_TYPE_CONSTANT;
+	arguments[0].Constant.RootParameterIndex = draw_constants_parameter;
+	arguments[0].Constant.DestOffsetIn32BitValues = 0;
+	arguments[0].Constant.Num32BitValuesToSet = sizeof(DrawConstants) / sizeof(UINT);
+	arguments[1].Type = D3D12_INDIRECT_ARGUMENT_TYPE_DRAW_INDEXED;
+	static_assert(sizeof(DrawConstants) + sizeof(D3D12_DRAW_INDEXED_ARGUMENTS) == sizeof(IndirectDraw), "IndirectDraw must match the command signature");
+
+	D3D12_COMMAND_SIGNATURE_DESC commandSignatureDescriptor = {};
+	commandSignatureDescriptor.ByteStride = sizeof(IndirectDraw);
+	commandSignatureDescriptor.NumArgumentDescs = _countof(arguments);
+	commandSignatureDescriptor.pArgumentDescs = arguments;
+	ThrowIfFailed(device->CreateCommandSignature(&commandSignatureDescriptor, draw_root_signature, IID_PPV_ARGS(&command_signature)));
+
+	zero_buffer = memory_allocator.CreateBuffer(D3D12_HEAP_TYPE_UPLOAD, sizeof(UINT));
+	memset(zero_buffer.cpu_address, 0, sizeof(UINT));
+}
+
+GpuCuller::~GpuCuller()
+{
+	if (draw_buffer.IsValid())
+	{
+		resource_states.Unregister(draw_buffer.resource.Get());
+	}
+	if (pyramid.IsValid())
+	{
+		resource_states.Unregister(pyramid.resource.Get());
+	}
+	memory_allocator.Free(object_buffer);
+	memory_allocator.Free(draw_buffer);
+	memory_allocator.Free(zero_buffer);
+	for (Readback& readback : readbacks)
+	{
+		memory_allocator.Free(readback.buffer);
+	}
+	memory_allocator.Free(pyramid);
+	descriptor_heap.Free(pyramid_descriptors);
+}
+
+UINT64 GpuCuller::SetObjects(const std::vector<CullingObject>& objects, UploadScheduler& upload_scheduler)
+{
+	if (objects.empty())
+	{
+		ThrowIfFailed(E_INVALIDARG);
+	}
+
+	// The old buffers stay alive until the frames that cull with them are done
+	if (draw_buffer.IsValid())
+	{
+		resource_states.Unregister(draw_buffer.resource.Get());
+	}
+	memory_allocator.Free(object_buffer);
+	memory_allocator.Free(draw_buffer);
+
+	object_count = static_cast<UINT>(objects.size());
+	const UINT64 objectDataSize = sizeof(CullingObject) * objects.size();
+	object_buffer = memory_allocator.CreateBuffer(D3D12_HEAP_TYPE_DEFAULT, objectDataSize, sizeof(CullingObject));
+	draw_buffer = memory_allocator.CreateBuffer(D3D12_HEAP_TYPE_DEFAULT, draws_offset + sizeof(IndirectDraw) * objects.size(),
+		D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+	resource_states.Register(draw_buffer.resource.Get(), D3D12_RESOURCE_STATE_COMMON);
+
+	upload_scheduler.Enqueue(object_buffer.resource.Get(), object_buffer.offset, objects.data(), objectDataSize);
+	return upload_scheduler.Flush();
+}
+
+void GpuCuller::SetPyramidSize(UINT width, UINT height)
+{
+	if (width == 0 || height == 0)
+	{
+		ThrowIfFailed(E_INVALIDARG);
+	}
+
+	// The memory waits for the frames in flight, the views are reused right away
+	if (pyramid.IsValid())
+	{
+		resource_states.Unregister(pyramid.resource.Get());
+	}
+	memory_allocator.Free(pyramid);
+	descriptor_heap.Free(pyramid_descriptors);
+
+	// Down to 1x1 like InstanceCuller::BuildHiZ
+	pyramid_width = width;
+	pyramid_height = height;
+	pyramid_mip_count = 1;
+	while ((width >> pyramid_mip_count) > 0 || (height >> pyramid_mip_count) > 0)
+	{
+		pyramid_mip_count++;
+	}
+
+	const D3D12_RESOURCE_DESC pyramidDescriptor = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R32_FLOAT, width, height, 1,
+		static_cast<UINT16>(pyramid_mip_count), 1, 0, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+	pyramid = memory_allocator.CreateTexture(pyramidDescriptor, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+	resource_states.Register(pyramid.resource.Get(), D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, pyramid_mip_count);
+	pyramid_footprints.resize(pyramid_mip_count);
+	device->GetCopyableFootprints(&pyramidDescriptor, 0, pyramid_mip_count, 0, pyramid_footprints.data(), nullptr, nullptr, &pyramid_readback_size);
+
+	pyramid_descriptors = descriptor_heap.Allocate(1 + pyramid_mip_count);
+	const D3D12_CPU_DESCRIPTOR_HANDLE stagingHandle = staging_descriptors.Allocate();
+	D3D12_SHADER_RESOURCE_VIEW_DESC srvDescriptor = {};
+	srvDescriptor.Format = DXGI_FORMAT_R32_FLOAT;
+	srvDescriptor.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+	srvDescriptor.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	srvDescriptor.Texture2D.MipLevels = pyramid_mip_count;
+	device->CreateShaderResourceView(pyramid.resource.Get(), &srvDescriptor, stagingHandle);
+	descriptor_heap.Copy(pyramid_descriptors, 0, stagingHandle);
+
+	D3D12_UNORDERED_ACCESS_VIEW_DESC uavDescriptor = {};
+	uavDescriptor.Format = DXGI_FORMAT_R32_FLOAT;
+	uavDescriptor.ViewDimension = D3D12_UAV_DIMENSION_TEXTURE2D;
+	for (UINT level = 0; level < pyramid_mip_count; level++)
+	{
+		uavDescriptor.Texture2D.MipSlice = level;
+		device->CreateUnorderedAccessView(pyramid.resource.Get(), nullptr, &uavDescriptor, stagingHandle);
+		descriptor_heap.Copy(pyramid_descriptors, 1 + level, stagingHandle);
+	}
+	staging_descriptors.Free(stagingHandle);
+}
+
+void GpuCuller::RecordBuildHiZ(ID3D12GraphicsCommandList* command_list, UINT depth_descriptor)
+{
+	ID3D12DescriptorHeap* heaps[] = { descriptor_heap.GetHeap() };
+	command_list->SetDescriptorHeaps(_countof(heaps), heaps);
+	command_list->SetComputeRootSignature(hiz_root_signature.Get());
+	command_list->SetPipelineState(hiz_pipeline_state.Get());
+	command_list->SetComputeRootDescriptorTable(ROOT_HIZ_SOURCES, descriptor_heap.GetGpuStart());
+	command_list->SetComputeRootDescriptorTable(ROOT_HIZ_LEVELS, descriptor_heap.GetGpuStart());
+
+	// Level 0 copies the depth buffer, every further level reads the one written by the dispatch before
+	for (UINT level = 0; level < pyramid_mip_count; level++)
+	{
+		HiZConstants constants = {};
+		constants.source_descriptor = level == 0 ? depth_descriptor : pyramid_descriptors.offset + level;
+		constants.target_descriptor = pyramid_descriptors.offset + 1 + level;
+		constants.source_width = level == 0 ? pyramid_width : max(pyramid_width >> (level - 1), 1u);
+		constants.source_height = level == 0 ? pyramid_height : max(pyramid_height >> (level - 1), 1u);
+		constants.target_width = max(pyramid_width >> level, 1u);
+		constants.target_height = max(pyramid_height >> level, 1u);
+		constants.from_depth = level == 0;
+		if (level > 0)
+		{
+			const D3D12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::UAV(pyramid.resource.Get());
+			command_list->ResourceBarrier(1, &barrier);
+		}
+		command_list->SetComputeRoot32BitConstants(ROOT_HIZ_CONSTANTS, sizeof(constants) / sizeof(UINT), &constants, 0);
+		command_list->Dispatch((constants.target_width + hiz_group_size - 1) / hiz_group_size, (constants.target_height + hiz_group_size - 1) / hiz_group_size, 1);
+	}
+}
+
+void GpuCuller::RecordReset(ID3D12GraphicsCommandList* command_list)
+{
+	command_list->CopyBufferRegion(draw_buffer.resource.Get(), draw_buffer.offset, zero_buffer.resource.Get(), zero_buffer.offset, sizeof(UINT));
+}
+
+void GpuCuller::RecordCull(ID3D12GraphicsCommandList* command_list, D3D12_GPU_VIRTUAL_ADDRESS constants_address, DescriptorHeap& descriptor_heap)
+{
+	ID3D12DescriptorHeap* heaps[] = { descriptor_heap.GetHeap() };
+	command_list->SetDescriptorHeaps(_countof(heaps), heaps);
+	command_list->SetComputeRootSignature(root_signature.Get());
+	command_list->SetPipelineState(pipeline_state.Get());
+	command_list->SetComputeRootConstantBufferView(ROOT_CULLING_CONSTANTS, constants_address);
+	command_list->SetComputeRootShaderResourceView(ROOT_OBJECTS, object_buffer.GetGpuAddress());
+	command_list->SetComputeRootUnorderedAccessView(ROOT_DRAW_COUNT, draw_buffer.GetGpuAddress());
+	command_list->SetComputeRootUnorderedAccessView(ROOT_DRAWS, draw_buffer.GetGpuAddress() + draws_offset);
+	command_list->SetComputeRootDescriptorTable(ROOT_BINDLESS_TABLE, descriptor_heap.GetGpuStart());
+	command_list->Dispatch((object_count + group_size - 1) / group_size, 1, 1);
+}
+
+void GpuCuller::RecordDraws(ID3D12GraphicsCommandList* command_list)
+{
+	command_list->ExecuteIndirect(command_signature.Get(), object_count, draw_buffer.resource.Get(), draw_buffer.offset + draws_offset,
+		draw_buffer.resource.Get(), draw_buffer.offset);
+}
+
+void GpuCuller::RecordReadback(ID3D12GraphicsCommandList* command_list, UINT frame, bool with_draws, bool with_pyramid)
+{
+	// The draws are copied whole, the GPU wrote however many survived
+	Readback& readback = readbacks[frame];
+	readback.draw_count = with_draws ? object_count : 0;
+	readback.pyramid = with_pyramid;
+	const UINT64 drawsEnd = draws_offset + sizeof(IndirectDraw) * readback.draw_count;
+	readback.pyramid_offset = (drawsEnd + D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT - 1) & ~static_cast<UINT64>(D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT - 1);
+	const UINT64 size = with_pyramid ? readback.pyramid_offset + pyramid_readback_size : with_draws ? drawsEnd : sizeof(UINT);
+	if (!readback.buffer.IsValid() || readback.buffer.size < size)
+	{
+		memory_allocator.Free(readback.buffer);
+		readback.buffer = memory_allocator.CreateBuffer(D3D12_HEAP_TYPE_READBACK, size, D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT);
+	}
+
+	command_list->CopyBufferRegion(readback.buffer.resource.Get(), readback.buffer.offset, draw_buffer.resource.Get(), draw_buffer.offset, sizeof(UINT));
+	if (readback.draw_count > 0)
+	{
+		command_list->CopyBufferRegion(readback.buffer.resource.Get(), readback.buffer.offset + draws_offset, draw_buffer.resource.Get(),
+			draw_buffer.offset + draws_offset, sizeof(IndirectDraw) * readback.draw_count);
+	}
+	for (UINT level = 0; with_pyramid && level < pyramid_mip_count; level++)
+	{
+		D3D12_PLACED_SUBRESOURCE_FOOTPRINT footprint = pyramid_footprints[level];
+		footprint.Offset += readback.buffer.offset + readback.pyramid_offset;
+		const CD3DX12_TEXTURE_COPY_LOCATION destination(readback.buffer.resource.Get(), footprint);
+		const CD3DX12_TEXTURE_COPY_LOCATION source(pyramid.resource.Get(), level);
+		command_list->CopyTextureRegion(&destination, 0, 0, 0, &source, nullptr);
+	}
+	readback.pending = true;
+}
+
+bool GpuCuller::GetReadback(UINT frame, UINT* draw_count, std::vector<IndirectDraw>& draws, HiZPyramid& pyramid)
+{
+	Readback& readback = readbacks[frame];
+	draws.clear();
+	pyramid.levels.clear();
+	if (!readback.pending)
+	{
+		return false;
+	}
+	readback.pending = false;
+
+	const UINT8* data = readback.buffer.cpu_address;
+	memcpy(draw_count, data, sizeof(UINT));
+	const IndirectDraw* readbackDraws = reinterpret_cast<const IndirectDraw*>(data + draws_offset);
+	draws.assign(readbackDraws, readbackDraws + min(*draw_count, readback.draw_count));
+
+	// Rows are padded to the copy pitch, the levels come out packed like InstanceCuller::BuildHiZ makes them
+	if (readback.pyramid)
+	{
+		pyramid.width = pyramid_width;
+		pyramid.height = pyramid_height;
+		pyramid.levels.resize(pyramid_mip_count);
+		for (UINT level = 0; level < pyramid_mip_count; level++)
+		{
+			const D3D12_PLACED_SUBRESOURCE_FOOTPRINT& footprint = pyramid_footprints[level];
+			const UINT8* levelData = data + readback.pyramid_offset + footprint.Offset;
+			const UINT levelWidth = pyramid.GetLevelWidth(level);
+			const UINT levelHeight = pyramid.GetLevelHeight(level);
+			pyramid.levels[level].resize(static_cast<size_t>(levelWidth) * levelHeight);
+			for (UINT y = 0; y < levelHeight; y++)
+			{
+				memcpy(&pyramid.levels[level][static_cast<size_t>(y) * levelWidth], levelData + static_cast<UINT64>(y) * footprint.Footprint.RowPitch, sizeof(float) * levelWidth);
+			}
+		}
+	}
+	return true;
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include "dx12_labs.h"
+#include "descriptor_allocator.h"
+#include "gpu_memory_allocator.h"
+#include "instance_culling.h"
+#include "pipeline_cache.h"
+#include "resource_state_tracker.h"
+#include "upload_scheduler.h"
+
+#include <vector>
+
+// Culls objects in a compute pass and draws the survivors with one ExecuteIndirect, so the CPU
+// records the same three commands however many objects there are. The draw buffer holds the
+// draw count followed by the IndirectDraw commands, one resource for the reset copy (COPY_DEST),
+// the culling writes (UNORDERED_ACCESS) and the draw (INDIRECT_ARGUMENT). It is registered with
+// the state tracker, so render graph passes can declare those states. The hierarchical-Z pyramid
+// for the occlusion test is built from a depth buffer and is registered the same way, it stays in
+// UNORDERED_ACCESS while it is built and is read in NON_PIXEL_SHADER_RESOURCE.
+class GpuCuller
+{
+public:
+	// The command signature writes the three DrawConstants at draw_constants_parameter of the draw root signature
+	// Every frame in flight has its own readback slot
+	GpuCuller(ID3D12Device* device, GpuMemoryAllocator& memory_allocator, ResourceStateTracker& resource_states, PipelineLibrary& pipeline_library,
+		DescriptorHeap& descriptor_heap, StagingDescriptorHeap& staging_descriptors, D3D12_SHADER_BYTECODE culling_shader,
+		D3D12_SHADER_BYTECODE hiz_shader, ID3D12RootSignature* draw_root_signature, UINT draw_constants_parameter, UINT frame_count);
+	virtual ~GpuCuller();
+
+	GpuCuller(const GpuCuller&) = delete;
+	GpuCuller& operator=(const GpuCuller&) = delete;
+
+	// Replaces the objects and sizes the draw buffer for all of them. Returns the copy fence value
+	// the culling queue has to wait on.
+	UINT64 SetObjects(const std::vector<CullingObject>& objects, UploadScheduler& upload_scheduler);
+
+	// Replaces the pyramid with a full mip chain for a depth buffer of width by height texels. The old views
+	// are reused right away, so the GPU has to be idle unless this is the first pyramid.
+	void SetPyramidSize(UINT width, UINT height);
+
+	UINT GetObjectCount() const { return object_count; }
+	ID3D12Resource* GetDrawBuffer() const { return draw_buffer.resource.Get(); }
+	ID3D12Resource* GetPyramid() const { return pyramid.resource.Get(); }
+	UINT GetPyramidWidth() const { return pyramid_width; }
+	UINT GetPyramidHeight() const { return pyramid_height; }
+	UINT GetPyramidMipCount() const { return pyramid_mip_count; }
+	UINT GetPyramidDescriptor() const { return pyramid_descriptors.offset; }	// bindless index of the view of every level
+
+	// Reduces the depth buffer, a shader view at depth_descriptor, level by level into the pyramid
+	void RecordBuildHiZ(ID3D12GraphicsCommandList* command_list, UINT depth_descriptor);
+
+	void RecordReset(ID3D12GraphicsCommandList* command_list);
+	void RecordCull(ID3D12GraphicsCommandList* command_list, D3D12_GPU_VIRTUAL_ADDRESS constants_address, DescriptorHeap& descriptor_heap);
+
+	// The draw state is the caller's, only the indirect arguments come from here
+	void RecordDraws(ID3D12GraphicsCommandList* command_list);
+
+	// Copies the draw count into the frame's readback slot, the draw buffer has to be in COPY_SOURCE. For validation
+	// the draws follow, and with the pyramid, also in COPY_SOURCE, every pyramid level.
+	void RecordReadback(ID3D12GraphicsCommandList* command_list, UINT frame, bool with_draws, bool with_pyramid);
+
+	// What the last readback of the slot found, once the GPU finished that frame. The count includes survivors
+	// that did not fit the draw buffer, draws holds the ones that did. Whatever was not read back comes out empty.
+	// False when nothing was read back since the last call.
+	bool GetReadback(UINT frame, UINT* draw_count, std::vector<IndirectDraw>& draws, HiZPyramid& pyramid);
+
+protected:
+	static constexpr UINT group_size = 64;	// CULLING_GROUP_SIZE in culling.hlsl
+	static constexpr UINT hiz_group_size = 8;	// HIZ_GROUP_SIZE in culling.hlsl
+	static constexpr UINT64 draws_offset = 256;
+
+	enum RootParameter
+	{
+		ROOT_CULLING_CONSTANTS,	// b0 root CBV
+		ROOT_OBJECTS,			// t0 root SRV
+		ROOT_DRAW_COUNT,		// u0 root UAV at the start of the draw buffer
+		ROOT_DRAWS,				// u1 root UAV at draws_offset
+		ROOT_BINDLESS_TABLE,	// the hierarchical-Z pyramid
+		ROOT_PARAMETER_COUNT
+	};
+
+	enum HiZRootParameter
+	{
+		ROOT_HIZ_CONSTANTS,	// b1 root constants
+		ROOT_HIZ_SOURCES,	// the whole heap as SRVs in space1, for the depth buffer
+		ROOT_HIZ_LEVELS,	// the whole heap as UAVs in space2, for the pyramid levels
+		ROOT_HIZ_PARAMETER_COUNT
+	};
+
+	// HiZConstants in culling.hlsl
+	struct HiZConstants
+	{
+		UINT source_descriptor;
+		UINT target_descriptor;
+		UINT source_width;
+		UINT source_height;
+		UINT target_width;
+		UINT target_height;
+		UINT from_depth;
+	};
+
+	ComPtr<ID3D12Device> device;
+	GpuMemoryAllocator& memory_allocator;
+	ResourceStateTracker& resource_states;
+	DescriptorHeap& descriptor_heap;
+	StagingDescriptorHeap& staging_descriptors;
+
+	ComPtr<ID3D12RootSignature> root_signature;
+	ComPtr<ID3D12PipelineState> pipeline_state;
+	ComPtr<ID3D12CommandSignature> command_signature;
+	ComPtr<ID3D12RootSignature> hiz_root_signature;
+	ComPtr<ID3D12PipelineState> hiz_pipeline_state;
+
+	GpuAllocation object_buffer;
+	GpuAllocation draw_buffer;
+	GpuAllocation zero_buffer;	// source of the count reset
+	UINT object_count;
+
+	struct Readback
+	{
+		GpuAllocation buffer;	// the count, the draws at draws_offset, then the pyramid levels
+		bool pending;	// recorded and not collected yet
+		UINT draw_count;	// of draws copied
+		bool pyramid;
+		UINT64 pyramid_offset;
+	};
+	std::vector<Readback> readbacks;	// per frame in flight
+
+	GpuAllocation pyramid;
+	DescriptorRange pyramid_descriptors;	// the view of every level, then one UAV per level
+	UINT pyramid_width;
+	UINT pyramid_height;
+	UINT pyramid_mip_count;
+	std::vector<D3D12_PLACED_SUBRESOURCE_FOOTPRINT> pyramid_footprints;	// of the levels in a readback buffer, from offset 0
+	UINT64 pyramid_readback_size;
+};
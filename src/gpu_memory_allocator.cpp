@@ -0,0 +1,316 @@
+#include "gpu_memory_allocator.h"
+
+#include <algorithm>
+#include <cstdio>
+
+GpuMemoryAllocator::GpuMemoryAllocator(ID3D12Device* device, UINT64 heap_size, UINT64 page_size, UINT64 small_buffer_size) :
+	device(device), heap_size(heap_size), page_size(page_size), small_buffer_size(min(small_buffer_size, page_size))
+{
+	const D3D12_HEAP_TYPE heapTypes[] = { D3D12_HEAP_TYPE_DEFAULT, D3D12_HEAP_TYPE_UPLOAD, D3D12_HEAP_TYPE_READBACK };
+	for (D3D12_HEAP_TYPE heapType : heapTypes)
+	{
+		for (UINT category = 0; category < GPU_MEMORY_CATEGORY_COUNT; category++)
+		{
+			Pool& pool = GetPool(heapType, static_cast<GpuMemoryCategory>(category));
+			pool.heap_type = heapType;
+			pool.category = static_cast<GpuMemoryCategory>(category);
+		}
+	}
+}
+
+GpuAllocation GpuMemoryAllocator::CreateBuffer(D3D12_HEAP_TYPE heap_type, UINT64 size, UINT64 alignment, D3D12_RESOURCE_FLAGS flags)
+{
+	if (size == 0)
+	{
+		ThrowIfFailed(E_INVALIDARG);
+	}
+	Pool& pool = GetPool(heap_type, GPU_MEMORY_BUFFERS);
+	std::lock_guard<std::mutex> lock(mutex);
+
+	// A buffer written as UAV is transitioned explicitly, which must not drag the rest of a page along
+	if (size <= small_buffer_size && flags == D3D12_RESOURCE_FLAG_NONE)
+	{
+		return CreatePacked(pool, size, alignment);
+	}
+
+	GpuAllocation buffer = CreatePlaced(pool, CD3DX12_RESOURCE_DESC::Buffer(size, flags), GetBufferState(heap_type), nullptr);
+	buffer.size = size;
+	Map(buffer, heap_type);
+	return buffer;
+}
+
+GpuAllocation GpuMemoryAllocator::CreateTexture(const D3D12_RESOURCE_DESC& desc, D3D12_RESOURCE_STATES initial_state, const D3D12_CLEAR_VALUE* clear_value)
+{
+	if (desc.Dimension == D3D12_RESOURCE_DIMENSION_BUFFER)
+	{
+		ThrowIfFailed(E_INVALIDARG);
+	}
+	const bool renderTarget = (desc.Flags & (D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET | D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL)) != 0;
+	Pool& pool = GetPool(D3D12_HEAP_TYPE_DEFAULT, renderTarget ? GPU_MEMORY_RENDER_TARGETS : GPU_MEMORY_TEXTURES);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	return CreatePlaced(pool, desc, initial_state, clear_value);
+}
+
+void GpuMemoryAllocator::Free(GpuAllocation& allocation)
+{
+	if (!allocation.IsValid())
+	{
+		return;
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	pending_frees.push_back({ allocation, 0 });
+	allocation = GpuAllocation();
+}
+
+void GpuMemoryAllocator::FinishFrame(UINT64 fence_value)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	for (PendingFree& pending : pending_frees)
+	{
+		if (pending.fence_value == 0)
+		{
+			pending.fence_value = fence_value;
+		}
+	}
+}
+
+void GpuMemoryAllocator::Reclaim(UINT64 completed_fence_value)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	while (!pending_frees.empty() && pending_frees.front().fence_value != 0 && pending_frees.front().fence_value <= completed_fence_value)
+	{
+		Release(pending_frees.front().allocation);
+		pending_frees.pop_front();
+	}
+}
+
+GpuMemoryStatistics GpuMemoryAllocator::GetStatistics() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	GpuMemoryStatistics statistics = {};
+	UINT64 freeMemory = 0;
+	UINT64 largestFree = 0;
+	for (const Pool& pool : pools)
+	{
+		for (const HeapBlock& block : pool.blocks)
+		{
+			if (block.suballocator)
+			{
+				const SuballocatorStatistics heap = block.suballocator->GetStatistics();
+				statistics.heap_count++;
+				statistics.reserved += heap.capacity;
+				statistics.used += heap.used;
+				statistics.placed_count += heap.allocation_count;
+				freeMemory += heap.capacity - heap.used;
+				largestFree += heap.largest_free_block;
+			}
+		}
+
+		// Pages are placed buffers themselves, only what was packed into them counts as used
+		for (const Page& page : pool.pages)
+		{
+			if (page.suballocator)
+			{
+				const SuballocatorStatistics packed = page.suballocator->GetStatistics();
+				statistics.page_count++;
+				statistics.used -= packed.capacity - packed.used;
+				statistics.placed_count--;
+				statistics.packed_count += packed.allocation_count;
+			}
+		}
+	}
+	statistics.fragmentation = freeMemory ? 1.0 - static_cast<double>(largestFree) / freeMemory : 0.0;
+	return statistics;
+}
+
+std::string GpuMemoryAllocator::FormatReport() const
+{
+	const GpuMemoryStatistics statistics = GetStatistics();
+	char report[256];
+	snprintf(report, sizeof(report), "GPU memory: %u heaps, %.2f MB reserved, %.2f MB used, %zu placed and %zu packed resources in %u pages, %.1f%% fragmented\n",
+		statistics.heap_count, statistics.reserved / (1024.0 * 1024.0), statistics.used / (1024.0 * 1024.0), statistics.placed_count,
+		statistics.packed_count, statistics.page_count, statistics.fragmentation * 100.0);
+	return report;
+}
+
+GpuMemoryAllocator::Pool& GpuMemoryAllocator::GetPool(D3D12_HEAP_TYPE heap_type, GpuMemoryCategory category)
+{
+	switch (heap_type)
+	{
+	case D3D12_HEAP_TYPE_DEFAULT:
+	case D3D12_HEAP_TYPE_UPLOAD:
+	case D3D12_HEAP_TYPE_READBACK:
+		return pools[(heap_type - D3D12_HEAP_TYPE_DEFAULT) * GPU_MEMORY_CATEGORY_COUNT + category];
+	default:
+		ThrowIfFailed(E_INVALIDARG);
+		return pools[0];
+	}
+}
+
+GpuAllocation GpuMemoryAllocator::CreatePlaced(Pool& pool, const D3D12_RESOURCE_DESC& desc, D3D12_RESOURCE_STATES initial_state, const D3D12_CLEAR_VALUE* clear_value)
+{
+	const D3D12_RESOURCE_ALLOCATION_INFO info = device->GetResourceAllocationInfo(0, 1, &desc);
+	GpuAllocation result = {};
+	result.pool = static_cast<UINT>(&pool - pools);
+	result.page = no_page;
+	result.block = UINT_MAX;
+	result.size = info.SizeInBytes;
+
+	for (UINT b = 0; b < pool.blocks.size() && result.block == UINT_MAX; b++)
+	{
+		if (pool.blocks[b].suballocator)
+		{
+			result.allocation = pool.blocks[b].suballocator->Allocate(info.SizeInBytes, info.Alignment);
+			result.block = result.allocation.IsValid() ? b : UINT_MAX;
+		}
+	}
+
+	// No room left, a resource larger than a heap gets a dedicated one
+	if (result.block == UINT_MAX)
+	{
+		const UINT64 heapAlignment = pool.category == GPU_MEMORY_RENDER_TARGETS ? D3D12_DEFAULT_MSAA_RESOURCE_PLACEMENT_ALIGNMENT : D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT;
+		const UINT64 size = (max(heap_size, info.SizeInBytes) + heapAlignment - 1) / heapAlignment * heapAlignment;
+		const D3D12_HEAP_FLAGS categoryFlags[] = { D3D12_HEAP_FLAG_ALLOW_ONLY_BUFFERS, D3D12_HEAP_FLAG_ALLOW_ONLY_NON_RT_DS_TEXTURES,
+			D3D12_HEAP_FLAG_ALLOW_ONLY_RT_DS_TEXTURES };
+
+		HeapBlock block;
+		CD3DX12_HEAP_DESC heapDescriptor(size, pool.heap_type, heapAlignment, categoryFlags[pool.category]);
+		ThrowIfFailed(device->CreateHeap(&heapDescriptor, IID_PPV_ARGS(&block.heap)));
+		block.suballocator = std::make_unique<TlsfSuballocator>(size, D3D12_SMALL_RESOURCE_PLACEMENT_ALIGNMENT);
+
+		result.block = 0;
+		while (result.block < pool.blocks.size() && pool.blocks[result.block].suballocator)
+		{
+			result.block++;
+		}
+		if (result.block == pool.blocks.size())
+		{
+			pool.blocks.emplace_back();
+		}
+		pool.blocks[result.block] = std::move(block);
+		result.allocation = pool.blocks[result.block].suballocator->Allocate(info.SizeInBytes, info.Alignment);
+	}
+
+	HeapBlock& block = pool.blocks[result.block];
+	const HRESULT hr = device->CreatePlacedResource(block.heap.Get(), result.allocation.offset, &desc, initial_state, clear_value,
+		IID_PPV_ARGS(&result.resource));
+	if (FAILED(hr))
+	{
+		block.suballocator->Free(result.allocation);
+		ThrowIfFailed(hr);
+	}
+	return result;
+}
+
+GpuAllocation GpuMemoryAllocator::CreatePacked(Pool& pool, UINT64 size, UINT64 alignment)
+{
+	GpuAllocation result = {};
+	result.pool = static_cast<UINT>(&pool - pools);
+	result.page = no_page;
+	result.block = UINT_MAX;
+	result.size = size;
+
+	for (UINT p = 0; p < pool.pages.size() && result.page == no_page; p++)
+	{
+		if (pool.pages[p].suballocator)
+		{
+			result.allocation = pool.pages[p].suballocator->Allocate(size, alignment);
+			result.page = result.allocation.IsValid() ? p : no_page;
+		}
+	}
+
+	if (result.page == no_page)
+	{
+		Page page;
+		page.buffer = CreatePlaced(pool, CD3DX12_RESOURCE_DESC::Buffer(page_size), GetBufferState(pool.heap_type), nullptr);
+		Map(page.buffer, pool.heap_type);
+		page.suballocator = std::make_unique<TlsfSuballocator>(page_size, D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT);
+
+		result.page = 0;
+		while (result.page < pool.pages.size() && pool.pages[result.page].suballocator)
+		{
+			result.page++;
+		}
+		if (result.page == pool.pages.size())
+		{
+			pool.pages.emplace_back();
+		}
+		pool.pages[result.page] = std::move(page);
+		result.allocation = pool.pages[result.page].suballocator->Allocate(size, alignment);
+		if (!result.allocation.IsValid())
+		{
+			ThrowIfFailed(E_INVALIDARG);
+		}
+	}
+
+	const Page& page = pool.pages[result.page];
+	result.resource = page.buffer.resource;
+	result.offset = result.allocation.offset;
+	result.cpu_address = page.buffer.cpu_address ? page.buffer.cpu_address + result.offset : nullptr;
+	return result;
+}
+
+void GpuMemoryAllocator::Release(GpuAllocation& allocation)
+{
+	// One empty heap or page per pool is kept, so a resource that comes and goes doesn't create one every time
+	Pool& pool = pools[allocation.pool];
+	allocation.resource.Reset();
+	if (allocation.page != no_page)
+	{
+		Page& page = pool.pages[allocation.page];
+		if (!page.suballocator->Free(allocation.allocation))
+		{
+			ThrowIfFailed(E_INVALIDARG);
+		}
+		const bool keep = std::none_of(pool.pages.begin(), pool.pages.end(), [&page](const Page& other)
+		{
+			return &other != &page && other.suballocator && other.suballocator->IsEmpty();
+		});
+		if (page.suballocator->IsEmpty() && !keep)
+		{
+			page.suballocator.reset();
+			Release(page.buffer);
+		}
+		return;
+	}
+
+	HeapBlock& block = pool.blocks[allocation.block];
+	if (!block.suballocator->Free(allocation.allocation))
+	{
+		ThrowIfFailed(E_INVALIDARG);
+	}
+	const bool keep = block.suballocator->GetCapacity() <= heap_size && std::none_of(pool.blocks.begin(), pool.blocks.end(), [&block](const HeapBlock& other)
+	{
+		return &other != &block && other.suballocator && other.suballocator->IsEmpty();
+	});
+	if (block.suballocator->IsEmpty() && !keep)
+	{
+		block.suballocator.reset();
+		block.heap.Reset();
+	}
+}
+
+D3D12_RESOURCE_STATES GpuMemoryAllocator::GetBufferState(D3D12_HEAP_TYPE heap_type)
+{
+	switch (heap_type)
+	{
+	case D3D12_HEAP_TYPE_UPLOAD:
+		return D3D12_RESOURCE_STATE_GENERIC_READ;
+	case D3D12_HEAP_TYPE_READBACK:
+		return D3D12_RESOURCE_STATE_COPY_DEST;
+	default:
+		return D3D12_RESOURCE_STATE_COMMON;
+	}
+}
+
+void GpuMemoryAllocator::Map(GpuAllocation& allocation, D3D12_HEAP_TYPE heap_type)
+{
+	// The CPU never reads upload memory, readback memory is read anywhere
+	CD3DX12_RANGE readRange(0, 0);
+	allocation.cpu_address = nullptr;
+	if (heap_type != D3D12_HEAP_TYPE_DEFAULT)
+	{
+		ThrowIfFailed(allocation.resource->Map(0, heap_type == D3D12_HEAP_TYPE_UPLOAD ? &readRange : nullptr, reinterpret_cast<void**>(&allocation.cpu_address)));
+	}
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "dx12_labs.h"
+#include "heap_suballocator.h"
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Heap tier 1 hardware keeps buffers, textures and render targets in separate heaps
+enum GpuMemoryCategory
+{
+	GPU_MEMORY_BUFFERS,
+	GPU_MEMORY_TEXTURES,
+	GPU_MEMORY_RENDER_TARGETS,
+	GPU_MEMORY_CATEGORY_COUNT
+};
+
+// A placed resource of its own, or for small buffers a range of a page buffer shared with others.
+// Views and copies have to add offset, packed buffers share the page's resource state.
+struct GpuAllocation
+{
+	ComPtr<ID3D12Resource> resource;
+	UINT64 offset;
+	UINT64 size;
+	UINT8* cpu_address;	// upload and readback buffers stay mapped
+
+	// Where the allocation came from, only meaningful to the allocator
+	UINT pool;
+	UINT block;
+	UINT page;
+	SuballocatorAllocation allocation;
+
+	bool IsValid() const { return resource != nullptr; }
+	D3D12_GPU_VIRTUAL_ADDRESS GetGpuAddress() const { return resource->GetGPUVirtualAddress() + offset; }
+};
+
+struct GpuMemoryStatistics
+{
+	UINT heap_count;
+	UINT page_count;
+	UINT64 reserved;
+	UINT64 used;
+	size_t placed_count;
+	size_t packed_count;
+	double fragmentation;	// share of the free memory that is not the largest free range of its heap
+};
+
+// Places resources in large heaps, one set per heap type and category, instead of giving every
+// resource an implicit heap of its own. Heaps are split with the TLSF suballocator, resources
+// larger than a heap get a dedicated one. Buffers up to small_buffer_size without resource flags
+// are packed into page buffers, which saves the 64 KB alignment of a placed buffer. Thread-safe.
+class GpuMemoryAllocator
+{
+public:
+	GpuMemoryAllocator(ID3D12Device* device, UINT64 heap_size = 64ull * 1024 * 1024, UINT64 page_size = 2ull * 1024 * 1024,
+		UINT64 small_buffer_size = 256 * 1024);
+	virtual ~GpuMemoryAllocator() {}
+
+	GpuMemoryAllocator(const GpuMemoryAllocator&) = delete;
+	GpuMemoryAllocator& operator=(const GpuMemoryAllocator&) = delete;
+
+	// Default heap buffers start in COMMON, upload buffers in GENERIC_READ and readback buffers in COPY_DEST.
+	// The offset of a packed buffer is a multiple of alignment, which does not need to be a power of two.
+	GpuAllocation CreateBuffer(D3D12_HEAP_TYPE heap_type, UINT64 size, UINT64 alignment = D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT,
+		D3D12_RESOURCE_FLAGS flags = D3D12_RESOURCE_FLAG_NONE);
+	GpuAllocation CreateTexture(const D3D12_RESOURCE_DESC& desc, D3D12_RESOURCE_STATES initial_state, const D3D12_CLEAR_VALUE* clear_value = nullptr);
+
+	// The memory is reused once the frame that is recorded now finished on the GPU
+	void Free(GpuAllocation& allocation);
+
+	// Same protocol as the upload ring
+	void FinishFrame(UINT64 fence_value);
+	void Reclaim(UINT64 completed_fence_value);
+
+	GpuMemoryStatistics GetStatistics() const;
+	std::string FormatReport() const;
+
+protected:
+	static constexpr UINT no_page = UINT_MAX;
+
+	struct HeapBlock
+	{
+		ComPtr<ID3D12Heap> heap;
+		std::unique_ptr<TlsfSuballocator> suballocator;	// null once the heap was released
+	};
+
+	struct Page
+	{
+		GpuAllocation buffer;	// placed in the buffer heaps of the pool's heap type
+		std::unique_ptr<TlsfSuballocator> suballocator;
+	};
+
+	struct Pool
+	{
+		D3D12_HEAP_TYPE heap_type;
+		GpuMemoryCategory category;
+		std::vector<HeapBlock> blocks;
+		std::vector<Page> pages;	// only in buffer pools
+	};
+
+	struct PendingFree
+	{
+		GpuAllocation allocation;
+		UINT64 fence_value;	// 0 until the frame it was freed in is finished
+	};
+
+	ComPtr<ID3D12Device> device;
+	const UINT64 heap_size;
+	const UINT64 page_size;
+	const UINT64 small_buffer_size;
+
+	mutable std::mutex mutex;
+	Pool pools[3 * GPU_MEMORY_CATEGORY_COUNT];
+	std::deque<PendingFree> pending_frees;
+
+	Pool& GetPool(D3D12_HEAP_TYPE heap_type, GpuMemoryCategory category);
+	GpuAllocation CreatePlaced(Pool& pool, const D3D12_RESOURCE_DESC& desc, D3D12_RESOURCE_STATES initial_state, const D3D12_CLEAR_VALUE* clear_value);
+	GpuAllocation CreatePacked(Pool& pool, UINT64 size, UINT64 alignment);
+	void Release(GpuAllocation& allocation);
+
+	static D3D12_RESOURCE_STATES GetBufferState(D3D12_HEAP_TYPE heap_type);
+	static void Map(GpuAllocation& allocation, D3D12_HEAP_TYPE heap_type);
+};
@@ -0,0 +1,71 @@
+#include "gpu_timer.h"
+
+GpuTimer::GpuTimer(ID3D12Device* device, ID3D12CommandQueue* queue, GpuMemoryAllocator& memory_allocator, UINT frame_count, UINT timer_count) :
+	memory_allocator(memory_allocator), readback_buffer(), frame_count(frame_count), timer_count(timer_count), frequency(0), frame_index(0),
+	ended(frame_count * timer_count, false), resolved(frame_count * timer_count, false), milliseconds(timer_count, 0.0), measured(timer_count, false)
+{
+	if (frame_count == 0 || timer_count == 0)
+	{
+		ThrowIfFailed(E_INVALIDARG);
+	}
+	ThrowIfFailed(queue->GetTimestampFrequency(&frequency));
+
+	D3D12_QUERY_HEAP_DESC queryHeapDescriptor = {};
+	queryHeapDescriptor.Type = D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
+	queryHeapDescriptor.Count = frame_count * timer_count * 2;
+	ThrowIfFailed(device->CreateQueryHeap(&queryHeapDescriptor, IID_PPV_ARGS(&query_heap)));
+
+	readback_buffer = memory_allocator.CreateBuffer(D3D12_HEAP_TYPE_READBACK, sizeof(UINT64) * queryHeapDescriptor.Count);
+}
+
+GpuTimer::~GpuTimer()
+{
+	memory_allocator.Free(readback_buffer);
+}
+
+void GpuTimer::BeginFrame(UINT frame_index)
+{
+	this->frame_index = frame_index;
+	const UINT64* timestamps = reinterpret_cast<const UINT64*>(readback_buffer.cpu_address);
+	for (UINT timer = 0; timer < timer_count; timer++)
+	{
+		const UINT query = GetQuery(frame_index, timer);
+		measured[timer] = resolved[frame_index * timer_count + timer] && timestamps[query + 1] >= timestamps[query];
+		milliseconds[timer] = measured[timer] ? 1000.0 * (timestamps[query + 1] - timestamps[query]) / frequency : 0.0;
+		ended[frame_index * timer_count + timer] = false;
+		resolved[frame_index * timer_count + timer] = false;
+	}
+}
+
+void GpuTimer::Begin(ID3D12GraphicsCommandList* command_list, UINT timer)
+{
+	command_list->EndQuery(query_heap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, GetQuery(frame_index, timer));
+}
+
+void GpuTimer::End(ID3D12GraphicsCommandList* command_list, UINT timer)
+{
+	command_list->EndQuery(query_heap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, GetQuery(frame_index, timer) + 1);
+	ended[frame_index * timer_count + timer] = true;
+}
+
+void GpuTimer::Resolve(ID3D12GraphicsCommandList* command_list)
+{
+	// Queries that were never written must not be resolved, so every timer is copied on its own
+	for (UINT timer = 0; timer < timer_count; timer++)
+	{
+		if (!ended[frame_index * timer_count + timer])
+		{
+			continue;
+		}
+		const UINT query = GetQuery(frame_index, timer);
+		command_list->ResolveQueryData(query_heap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, query, 2, readback_buffer.resource.Get(),
+			readback_buffer.offset + sizeof(UINT64) * query);
+		resolved[frame_index * timer_count + timer] = true;
+	}
+}
+
+bool GpuTimer::GetMilliseconds(UINT timer, double& milliseconds) const
+{
+	milliseconds = this->milliseconds[timer];
+	return measured[timer];
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "dx12_labs.h"
+#include "gpu_memory_allocator.h"
+
+#include <vector>
+
+// Times ranges of GPU work with timestamp queries. Every frame in flight has its own queries and
+// readback range, which are only read once the GPU finished the frame, so reading never stalls.
+class GpuTimer
+{
+public:
+	GpuTimer(ID3D12Device* device, ID3D12CommandQueue* queue, GpuMemoryAllocator& memory_allocator, UINT frame_count, UINT timer_count);
+	virtual ~GpuTimer();
+
+	GpuTimer(const GpuTimer&) = delete;
+	GpuTimer& operator=(const GpuTimer&) = delete;
+
+	// Collects what was measured the last time the frame slot was used, the GPU has to be done with it
+	void BeginFrame(UINT frame_index);
+
+	void Begin(ID3D12GraphicsCommandList* command_list, UINT timer);
+	void End(ID3D12GraphicsCommandList* command_list, UINT timer);
+
+	// Copies the timers that ended this frame to the readback buffer, recorded after the last End
+	void Resolve(ID3D12GraphicsCommandList* command_list);
+
+	// Of the last collected frame, false when the timer did not run in it
+	bool GetMilliseconds(UINT timer, double& milliseconds) const;
+
+protected:
+	GpuMemoryAllocator& memory_allocator;
+	ComPtr<ID3D12QueryHeap> query_heap;
+	GpuAllocation readback_buffer;	// two timestamps per timer and frame
+	const UINT frame_count;
+	const UINT timer_count;
+	UINT64 frequency;
+	UINT frame_index;
+
+	std::vector<bool> ended;		// per frame and timer
+	std::vector<bool> resolved;		// per frame and timer
+	std::vector<double> milliseconds;
+	std::vector<bool> measured;
+
+	UINT GetQuery(UINT frame, UINT timer) const { return (frame * timer_count + timer) * 2; }
+};
@@ -0,0 +1,239 @@
+#include "heap_suballocator.h"
+
+#include <algorithm>
+#include <bit>
+#include <numeric>
+
+TlsfSuballocator::TlsfSuballocator(uint64_t capacity, uint64_t granularity) :
+	capacity(capacity / granularity * granularity), granularity(granularity), used(0), allocation_count(0), first_level_bitmap(0)
+{
+	std::fill(std::begin(second_level_bitmaps), std::end(second_level_bitmaps), 0u);
+	for (auto& list : free_lists)
+	{
+		std::fill(std::begin(list), std::end(list), no_block);
+	}
+
+	// Block 0 always starts at offset 0, merges keep the lower block
+	if (this->capacity > 0)
+	{
+		InsertFree(NewBlock(0, this->capacity));
+	}
+}
+
+SuballocatorAllocation TlsfSuballocator::Allocate(uint64_t size, uint64_t alignment)
+{
+	const SuballocatorAllocation failed = { 0, no_block };
+	size = (std::max(size, uint64_t(1)) + granularity - 1) / granularity * granularity;
+	alignment = std::lcm(std::max(alignment, uint64_t(1)), granularity);
+
+	// Any free block this large fits the allocation after its worst case front padding
+	const uint64_t searchSize = size + alignment - granularity;
+	if (searchSize > capacity)
+	{
+		return failed;
+	}
+	uint32_t block = FindFreeBlock(searchSize);
+	if (block == no_block)
+	{
+		return failed;
+	}
+	RemoveFree(block);
+
+	// Padding in front goes back to the free lists as a block of its own
+	const uint64_t alignedOffset = (blocks[block].offset + alignment - 1) / alignment * alignment;
+	if (alignedOffset != blocks[block].offset)
+	{
+		const uint32_t padding = block;
+		Split(padding, alignedOffset - blocks[padding].offset);
+		block = blocks[padding].next_physical;
+		InsertFree(padding);
+	}
+	if (blocks[block].size - size >= granularity)
+	{
+		Split(block, size);
+		InsertFree(blocks[block].next_physical);
+	}
+
+	blocks[block].free = false;
+	used += blocks[block].size;
+	allocation_count++;
+	return { blocks[block].offset, block };
+}
+
+bool TlsfSuballocator::Free(const SuballocatorAllocation& allocation)
+{
+	uint32_t block = allocation.block;
+	if (block >= blocks.size() || blocks[block].free || blocks[block].offset != allocation.offset)
+	{
+		return false;
+	}
+	used -= blocks[block].size;
+	allocation_count--;
+
+	const uint32_t next = blocks[block].next_physical;
+	if (next != no_block && blocks[next].free)
+	{
+		RemoveFree(next);
+		block = Merge(block, next);
+	}
+	const uint32_t previous = blocks[block].previous_physical;
+	if (previous != no_block && blocks[previous].free)
+	{
+		RemoveFree(previous);
+		block = Merge(previous, block);
+	}
+	InsertFree(block);
+	return true;
+}
+
+SuballocatorStatistics TlsfSuballocator::GetStatistics() const
+{
+	SuballocatorStatistics statistics = { capacity, used, allocation_count, 0, 0 };
+	for (uint32_t block = blocks.empty() ? no_block : 0; block != no_block; block = blocks[block].next_physical)
+	{
+		if (blocks[block].free)
+		{
+			statistics.free_block_count++;
+			statistics.largest_free_block = std::max(statistics.largest_free_block, blocks[block].size);
+		}
+	}
+	return statistics;
+}
+
+void TlsfSuballocator::Map(uint64_t units, uint32_t& first_level, uint32_t& second_level)
+{
+	// Sizes below second_level_count units have an exact list each, above that every power of two is split in second_level_count lists
+	if (units < second_level_count)
+	{
+		first_level = 0;
+		second_level = static_cast<uint32_t>(units);
+		return;
+	}
+	const uint32_t highestBit = static_cast<uint32_t>(std::bit_width(units)) - 1;
+	first_level = highestBit - second_level_log2 + 1;
+	second_level = static_cast<uint32_t>(units >> (highestBit - second_level_log2)) - second_level_count;
+}
+
+uint32_t TlsfSuballocator::FindFreeBlock(uint64_t size) const
+{
+	// Round up to the next list so that every block in the list found is large enough
+	uint64_t units = size / granularity;
+	if (units >= second_level_count)
+	{
+		units += (1ull << (std::bit_width(units) - 1 - second_level_log2)) - 1;
+	}
+	uint32_t firstLevel, secondLevel;
+	Map(units, firstLevel, secondLevel);
+	if (firstLevel >= first_level_count)
+	{
+		return no_block;
+	}
+
+	uint32_t secondLevelMap = second_level_bitmaps[firstLevel] & (~0u << secondLevel);
+	if (secondLevelMap == 0)
+	{
+		const uint64_t firstLevelMap = firstLevel + 1 < 64 ? first_level_bitmap & (~0ull << (firstLevel + 1)) : 0;
+		if (firstLevelMap == 0)
+		{
+			return no_block;
+		}
+		firstLevel = static_cast<uint32_t>(std::countr_zero(firstLevelMap));
+		secondLevelMap = second_level_bitmaps[firstLevel];
+	}
+	return free_lists[firstLevel][std::countr_zero(secondLevelMap)];
+}
+
+uint32_t TlsfSuballocator::NewBlock(uint64_t offset, uint64_t size)
+{
+	uint32_t block;
+	if (unused_blocks.empty())
+	{
+		block = static_cast<uint32_t>(blocks.size());
+		blocks.emplace_back();
+	}
+	else
+	{
+		block = unused_blocks.back();
+		unused_blocks.pop_back();
+	}
+	blocks[block] = { offset, size, no_block, no_block, no_block, no_block, false };
+	return block;
+}
+
+void TlsfSuballocator::InsertFree(uint32_t block)
+{
+	uint32_t firstLevel, secondLevel;
+	Map(blocks[block].size / granularity, firstLevel, secondLevel);
+
+	uint32_t& head = free_lists[firstLevel][secondLevel];
+	blocks[block].free = true;
+	blocks[block].previous_free = no_block;
+	blocks[block].next_free = head;
+	if (head != no_block)
+	{
+		blocks[head].previous_free = block;
+	}
+	head = block;
+	second_level_bitmaps[firstLevel] |= 1u << secondLevel;
+	first_level_bitmap |= 1ull << firstLevel;
+}
+
+void TlsfSuballocator::RemoveFree(uint32_t block)
+{
+	uint32_t firstLevel, secondLevel;
+	Map(blocks[block].size / granularity, firstLevel, secondLevel);
+
+	const Block& removed = blocks[block];
+	if (removed.previous_free != no_block)
+	{
+		blocks[removed.previous_free].next_free = removed.next_free;
+	}
+	if (removed.next_free != no_block)
+	{
+		blocks[removed.next_free].previous_free = removed.previous_free;
+	}
+
+	uint32_t& head = free_lists[firstLevel][secondLevel];
+	if (head == block)
+	{
+		head = removed.next_free;
+		if (head == no_block)
+		{
+			second_level_bitmaps[firstLevel] &= ~(1u << secondLevel);
+			if (second_level_bitmaps[firstLevel] == 0)
+			{
+				first_level_bitmap &= ~(1ull << firstLevel);
+			}
+		}
+	}
+	blocks[block].free = false;
+}
+
+void TlsfSuballocator::Split(uint32_t block, uint64_t size)
+{
+	const uint32_t rest = NewBlock(blocks[block].offset + size, blocks[block].size - size);
+	const uint32_t next = blocks[block].next_physical;
+	blocks[rest].previous_physical = block;
+	blocks[rest].next_physical = next;
+	if (next != no_block)
+	{
+		blocks[next].previous_physical = rest;
+	}
+	blocks[block].next_physical = rest;
+	blocks[block].size = size;
+}
+
+uint32_t TlsfSuballocator::Merge(uint32_t block, uint32_t next)
+{
+	// next is retired and marked free with no size, so freeing it again fails
+	const uint32_t after = blocks[next].next_physical;
+	blocks[block].size += blocks[next].size;
+	blocks[block].next_physical = after;
+	if (after != no_block)
+	{
+		blocks[after].previous_physical = block;
+	}
+	blocks[next] = { 0, 0, no_block, no_block, no_block, no_block, true };
+	unused_blocks.push_back(next);
+	return block;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct SuballocatorStatistics
+{
+	uint64_t capacity;
+	uint64_t used;	// including alignment padding that could not be split off
+	size_t allocation_count;
+	size_t free_block_count;
+	uint64_t largest_free_block;
+
+	// 0 when all free memory is one block, close to 1 when it is scattered into small pieces
+	double GetFragmentation() const
+	{
+		const uint64_t unused = capacity - used;
+		return unused ? 1.0 - static_cast<double>(largest_free_block) / static_cast<double>(unused) : 0.0;
+	}
+};
+
+struct SuballocatorAllocation
+{
+	uint64_t offset;
+	uint32_t block;
+
+	bool IsValid() const { return block != UINT32_MAX; }
+};
+
+// Two level segregated fit allocator over an abstract range of bytes, the caller decides what the
+// offsets point into. Allocation and free are constant time: free blocks are kept in lists by size
+// class with a bitmap per level, so finding one that fits is two bit scans, and a freed block merges
+// with its free neighbours right away. Kept free of D3D so it builds and runs anywhere.
+class TlsfSuballocator
+{
+public:
+	// Sizes and offsets are multiples of granularity, which has to be a power of two
+	TlsfSuballocator(uint64_t capacity, uint64_t granularity = 256);
+	virtual ~TlsfSuballocator() {}
+
+	// Any alignment works, not only powers of two. Returns an invalid allocation when nothing fits.
+	// The search rounds size plus worst case padding up to the next size class, so a request can fail
+	// although one free block would hold it: on an empty heap whose capacity is not a class boundary,
+	// an allocation of the whole capacity fails. Above 16 granules the classes are 16 steps per power of two.
+	SuballocatorAllocation Allocate(uint64_t size, uint64_t alignment);
+
+	// Fails on an allocation that was not made here or was already freed
+	bool Free(const SuballocatorAllocation& allocation);
+
+	bool IsEmpty() const { return allocation_count == 0; }
+	uint64_t GetCapacity() const { return capacity; }
+	SuballocatorStatistics GetStatistics() const;
+
+protected:
+	static constexpr uint32_t second_level_log2 = 4;
+	static constexpr uint32_t second_level_count = 1u << second_level_log2;
+	static constexpr uint32_t first_level_count = 64 - second_level_log2 + 1;
+	static constexpr uint32_t no_block = UINT32_MAX;
+
+	struct Block
+	{
+		uint64_t offset;
+		uint64_t size;
+		uint32_t previous_physical;
+		uint32_t next_physical;
+		uint32_t previous_free;
+		uint32_t next_free;
+		bool free;
+	};
+
+	uint64_t capacity;
+	uint64_t granularity;
+	uint64_t used;
+	size_t allocation_count;
+
+	std::vector<Block> blocks;
+	std::vector<uint32_t> unused_blocks;
+
+	uint64_t first_level_bitmap;
+	uint32_t second_level_bitmaps[first_level_count];
+	uint32_t free_lists[first_level_count][second_level_count];
+
+	static void Map(uint64_t units, uint32_t& first_level, uint32_t& second_level);
+
+	uint32_t FindFreeBlock(uint64_t size) const;
+	uint32_t NewBlock(uint64_t offset, uint64_t size);
+	void InsertFree(uint32_t block);
+	void RemoveFree(uint32_t block);
+
+	// Cuts size bytes off the front of block, the rest becomes a new free block after it
+	void Split(uint32_t block, uint64_t size);
+	uint32_t Merge(uint32_t block, uint32_t next);
+};
@@ -0,0 +1,187 @@
+#include "heap_suballocator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <random>
+#include <vector>
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what)
+{
+	if (!condition)
+	{
+		std::cout << "FAILED: " << what << std::endl;
+		failures++;
+	}
+}
+
+struct LiveAllocation
+{
+	SuballocatorAllocation allocation;
+	uint64_t size;
+};
+
+// Random allocations and frees with sizes from one granule to a sixteenth of the heap and any alignment, checked
+// against a map of the live ranges. Freeing everything has to leave one block that covers the whole heap.
+static void TestRandom(uint32_t seed)
+{
+	const uint64_t granularity = 256;
+	const uint64_t capacity = 64ull << 20;
+	TlsfSuballocator allocator(capacity, granularity);
+	std::mt19937_64 random(seed);
+	std::vector<LiveAllocation> live;
+	std::map<uint64_t, uint64_t> ranges;	// offset to end of every live allocation
+	uint64_t requested = 0;
+
+	for (int step = 0; step < 200000; step++)
+	{
+		if (live.empty() || random() % 100 < 55)
+		{
+			const uint64_t size = 1 + random() % (capacity / 16);
+			const uint64_t alignments[] = { 1, 256, 4096, 65536, 768, 3000 };
+			const uint64_t alignment = alignments[random() % std::size(alignments)];
+			const SuballocatorAllocation allocation = allocator.Allocate(size, alignment);
+			if (!allocation.IsValid())
+			{
+				continue;
+			}
+			Check(allocation.offset % alignment == 0 && allocation.offset % granularity == 0, "aligned offsets");
+			Check(allocation.offset + size <= capacity, "inside the heap");
+
+			// The neighbours in offset order must end before and start after the new range
+			auto next = ranges.lower_bound(allocation.offset);
+			Check(next == ranges.end() || next->first >= allocation.offset + size, "no overlap with the next allocation");
+			Check(next == ranges.begin() || std::prev(next)->second <= allocation.offset, "no overlap with the previous allocation");
+			ranges[allocation.offset] = allocation.offset + size;
+			live.push_back({ allocation, size });
+			requested += size;
+		}
+		else
+		{
+			const size_t index = random() % live.size();
+			const LiveAllocation freed = live[index];
+			live[index] = live.back();
+			live.pop_back();
+			Check(allocator.Free(freed.allocation), "free of a live allocation");
+			Check(!allocator.Free(freed.allocation), "second free fails");
+			ranges.erase(freed.allocation.offset);
+			requested -= freed.size;
+		}
+
+		if (step % 1000 == 0)
+		{
+			const SuballocatorStatistics statistics = allocator.GetStatistics();
+			Check(statistics.allocation_count == live.size() && statistics.used >= requested && statistics.used <= capacity, "statistics follow the live set");
+		}
+	}
+
+	for (const LiveAllocation& allocation : live)
+	{
+		Check(allocator.Free(allocation.allocation), "free of a live allocation");
+	}
+	const SuballocatorStatistics statistics = allocator.GetStatistics();
+	Check(allocator.IsEmpty() && statistics.used == 0, "empty after freeing everything");
+	Check(statistics.free_block_count == 1 && statistics.largest_free_block == capacity, "free blocks coalesce back into one");
+}
+
+// A full heap allocation only succeeds when the capacity is a size class boundary, see TlsfSuballocator::Allocate
+static void TestFullCapacity()
+{
+	const uint64_t granularity = 256;
+	{
+		TlsfSuballocator allocator(272 * granularity, granularity);
+		const SuballocatorAllocation allocation = allocator.Allocate(allocator.GetCapacity(), 1);
+		Check(allocation.IsValid() && allocation.offset == 0, "the whole heap when the capacity is on a class boundary");
+	}
+	{
+		TlsfSuballocator allocator(273 * granularity, granularity);
+		Check(!allocator.Allocate(allocator.GetCapacity(), 1).IsValid(), "no whole heap when the capacity is off a class boundary");
+		Check(allocator.Allocate(272 * granularity, 1).IsValid(), "the class boundary below the capacity still fits");
+	}
+	{
+		TlsfSuballocator allocator(15 * granularity, granularity);
+		Check(allocator.Allocate(allocator.GetCapacity(), 1).IsValid(), "small sizes have an exact class each");
+	}
+}
+
+// Allocation and free time with a working set of 1000 to 2000 live allocations in a 1 GB heap
+static void Benchmark()
+{
+	const uint64_t capacity = 1ull << 30;
+	const size_t operations = 2000000;
+	TlsfSuballocator allocator(capacity, 256);
+	std::mt19937_64 random(1);
+	std::vector<uint64_t> sizes(operations);
+	for (uint64_t& size : sizes)
+	{
+		// Mostly small buffers with the odd large one, like the mesh buffers
+		size = random() % 8 ? 256 + random() % (64 << 10) : 1 + random() % (4 << 20);
+	}
+
+	std::vector<SuballocatorAllocation> live;
+	live.reserve(operations);
+	double allocateSeconds = 0.0;
+	double freeSeconds = 0.0;
+	size_t allocations = 0;
+	size_t frees = 0;
+	size_t failed = 0;
+	for (size_t i = 0; i < operations; i++)
+	{
+		const size_t workingSet = 1000;
+		if (live.size() < workingSet || (live.size() < 2 * workingSet && random() % 2 == 0))
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			const SuballocatorAllocation allocation = allocator.Allocate(sizes[i], 65536);
+			allocateSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+			allocations++;
+			if (allocation.IsValid())
+			{
+				live.push_back(allocation);
+			}
+			else
+			{
+				failed++;
+			}
+		}
+		else
+		{
+			const size_t index = random() % live.size();
+			const SuballocatorAllocation allocation = live[index];
+			live[index] = live.back();
+			live.pop_back();
+			auto start = std::chrono::high_resolution_clock::now();
+			allocator.Free(allocation);
+			freeSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+			frees++;
+		}
+	}
+
+	const SuballocatorStatistics statistics = allocator.GetStatistics();
+	std::cout << "Allocate " << allocateSeconds * 1e9 / allocations << " ns, free " << freeSeconds * 1e9 / frees << " ns over "
+		<< allocations << " allocations (" << failed << " did not fit) and " << frees << " frees" << std::endl;
+	std::cout << statistics.allocation_count << " live allocations use " << statistics.used / (1024.0 * 1024.0) << " MB in "
+		<< statistics.free_block_count << " free blocks, fragmentation " << statistics.GetFragmentation() << std::endl;
+}
+
+// Checks the TLSF suballocator for overlaps, alignment and coalescing, then times it. Has no Windows dependencies.
+int main()
+{
+	for (uint32_t seed = 1; seed <= 4; seed++)
+	{
+		TestRandom(seed);
+	}
+	TestFullCapacity();
+	Benchmark();
+
+	if (failures)
+	{
+		std::cout << failures << " checks failed" << std::endl;
+		return 1;
+	}
+	std::cout << "Suballocator: all checks passed" << std::endl;
+	return 0;
+}
@@ -0,0 +1,137 @@
+#include "instance_culling.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+bool InstanceCuller::IsInsideFrustum(const CullingObject& object, const CullingConstants& constants)
+{
+	// Test the box corner farthest along each plane normal
+	for (uint32_t p = 0; p < constants.plane_count; p++)
+	{
+		const float* plane = constants.planes[p];
+		float distance = plane[3];
+		for (size_t k = 0; k < 3; k++)
+		{
+			distance += plane[k] * (plane[k] >= 0.f ? object.aabb_max[k] : object.aabb_min[k]);
+		}
+		if (distance < 0.f)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool InstanceCuller::IsOccluded(const CullingObject& object, const CullingConstants& constants, const HiZPyramid& pyramid)
+{
+	if (constants.hiz_mip_count == 0)
+	{
+		return false;
+	}
+
+	// Screen rectangle and nearest depth of the eight corners
+	float minU = 1.f, minV = 1.f, maxU = 0.f, maxV = 0.f, minDepth = 1.f;
+	for (uint32_t corner = 0; corner < 8; corner++)
+	{
+		const float position[3] = {
+			corner & 1 ? object.aabb_max[0] : object.aabb_min[0],
+			corner & 2 ? object.aabb_max[1] : object.aabb_min[1],
+			corner & 4 ? object.aabb_max[2] : object.aabb_min[2] };
+		float clip[4];
+		for (size_t j = 0; j < 4; j++)
+		{
+			clip[j] = position[0] * constants.transform[j] + position[1] * constants.transform[4 + j] + position[2] * constants.transform[8 + j] +
+				constants.transform[12 + j];
+		}
+		if (clip[3] <= 0.f)
+		{
+			return false;
+		}
+		const float u = clip[0] / clip[3] * 0.5f + 0.5f;
+		const float v = 0.5f - clip[1] / clip[3] * 0.5f;
+		minU = std::min(minU, u);
+		minV = std::min(minV, v);
+		maxU = std::max(maxU, u);
+		maxV = std::max(maxV, v);
+		minDepth = std::min(minDepth, clip[2] / clip[3]);
+	}
+
+	// The level where the rectangle spans at most two texels per axis, so its four corners cover it
+	auto texel = [](float coordinate, uint32_t size)
+	{
+		return static_cast<uint32_t>(std::clamp(coordinate * size, 0.f, static_cast<float>(size - 1)));
+	};
+	const uint32_t x0 = texel(minU, constants.hiz_width), x1 = texel(maxU, constants.hiz_width);
+	const uint32_t y0 = texel(minV, constants.hiz_height), y1 = texel(maxV, constants.hiz_height);
+	const uint32_t level = static_cast<uint32_t>(std::bit_width(std::max(x1 - x0, y1 - y0)));
+	if (level >= constants.hiz_mip_count)
+	{
+		return false;
+	}
+
+	const uint32_t levelWidth = pyramid.GetLevelWidth(level);
+	const uint32_t levelHeight = pyramid.GetLevelHeight(level);
+	const std::vector<float>& depth = pyramid.levels[level];
+	float maxDepth = 0.f;
+	for (uint32_t y : { y0, y1 })
+	{
+		for (uint32_t x : { x0, x1 })
+		{
+			maxDepth = std::max(maxDepth, depth[std::min(y >> level, levelHeight - 1) * levelWidth + std::min(x >> level, levelWidth - 1)]);
+		}
+	}
+	return minDepth > maxDepth;
+}
+
+void InstanceCuller::Cull(const CullingConstants& constants, const std::vector<CullingObject>& objects, const HiZPyramid* pyramid,
+	std::vector<IndirectDraw>& draws)
+{
+	draws.clear();
+	const size_t objectCount = std::min(objects.size(), static_cast<size_t>(constants.object_count));
+	for (size_t i = 0; i < objectCount && draws.size() < constants.max_draw_count; i++)
+	{
+		const CullingObject& object = objects[i];
+		if (!IsInsideFrustum(object, constants) || (pyramid && IsOccluded(object, constants, *pyramid)))
+		{
+			continue;
+		}
+		draws.push_back({ object.index_offset / 3, object.object_index, constants.material_table, object.index_count, constants.instance_count,
+			object.index_offset, 0, 0 });
+	}
+}
+
+void InstanceCuller::BuildHiZ(const float* depth, uint32_t width, uint32_t height, HiZPyramid& pyramid)
+{
+	pyramid.width = width;
+	pyramid.height = height;
+	pyramid.levels.clear();
+	pyramid.levels.emplace_back(depth, depth + static_cast<size_t>(width) * height);
+
+	for (uint32_t level = 1; pyramid.GetLevelWidth(level - 1) > 1 || pyramid.GetLevelHeight(level - 1) > 1; level++)
+	{
+		const uint32_t sourceWidth = pyramid.GetLevelWidth(level - 1), sourceHeight = pyramid.GetLevelHeight(level - 1);
+		const uint32_t levelWidth = pyramid.GetLevelWidth(level), levelHeight = pyramid.GetLevelHeight(level);
+		const std::vector<float>& source = pyramid.levels[level - 1];
+		std::vector<float> reduced(static_cast<size_t>(levelWidth) * levelHeight);
+		for (uint32_t y = 0; y < levelHeight; y++)
+		{
+			// The last row and column also take the leftovers of an odd size
+			const uint32_t yEnd = y + 1 == levelHeight ? sourceHeight : std::min(2 * y + 2, sourceHeight);
+			for (uint32_t x = 0; x < levelWidth; x++)
+			{
+				const uint32_t xEnd = x + 1 == levelWidth ? sourceWidth : std::min(2 * x + 2, sourceWidth);
+				float farthest = 0.f;
+				for (uint32_t sy = 2 * y; sy < yEnd; sy++)
+				{
+					for (uint32_t sx = 2 * x; sx < xEnd; sx++)
+					{
+						farthest = std::max(farthest, source[static_cast<size_t>(sy) * sourceWidth + sx]);
+					}
+				}
+				reduced[static_cast<size_t>(y) * levelWidth + x] = farthest;
+			}
+		}
+		pyramid.levels.push_back(std::move(reduced));
+	}
+}
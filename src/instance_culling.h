@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Element of the object buffer in culling.hlsl, one per drawable object
+struct CullingObject
+{
+	float aabb_min[3];
+	uint32_t index_offset;
+	float aabb_max[3];
+	uint32_t index_count;
+	uint32_t object_index;
+};
+static_assert(sizeof(CullingObject) == 36, "CullingObject must match culling.hlsl");
+
+// Layout of the b0 constant buffer in culling.hlsl
+struct CullingConstants
+{
+	float transform[16];	// object to clip space, row vector (v * M)
+	float planes[6][4];		// of the same transform, in object space
+	uint32_t plane_count;
+	uint32_t object_count;
+	uint32_t material_table;	// written into every draw
+	uint32_t hiz_mip_count;		// 0 turns the occlusion test off
+	uint32_t hiz_width;
+	uint32_t hiz_height;
+	uint32_t hiz_descriptor;	// bindless index of the pyramid
+	uint32_t max_draw_count;
+	uint32_t instance_count;	// of every draw, the instances share the object's bounds
+	uint32_t padding[3];
+};
+static_assert(sizeof(CullingConstants) == 208, "CullingConstants must match culling.hlsl");
+
+// Indirect command written per surviving object: the draw root constants followed by
+// D3D12_DRAW_INDEXED_ARGUMENTS, the layout of the renderer's command signature
+struct IndirectDraw
+{
+	uint32_t first_triangle;
+	uint32_t object_index;
+	uint32_t material_table;
+	uint32_t index_count;
+	uint32_t instance_count;
+	uint32_t start_index;
+	int32_t base_vertex;
+	uint32_t start_instance;
+};
+static_assert(sizeof(IndirectDraw) == 32, "IndirectDraw must match the command signature");
+
+// Farthest depth of every 2x2 texels of the level below. Odd sizes fold the last row and column
+// into the last texel, so a texel always covers its share of level 0 without gaps.
+struct HiZPyramid
+{
+	uint32_t width;
+	uint32_t height;
+	std::vector<std::vector<float>> levels;
+
+	uint32_t GetLevelWidth(uint32_t level) const { return width >> level ? width >> level : 1; }
+	uint32_t GetLevelHeight(uint32_t level) const { return height >> level ? height >> level : 1; }
+};
+
+// CPU reference of the culling compute shader in culling.hlsl. Both have to agree test for test,
+// the reference exists to validate the GPU output and to try changes without a GPU.
+class InstanceCuller
+{
+public:
+	static bool IsInsideFrustum(const CullingObject& object, const CullingConstants& constants);
+
+	// True when the box is behind the pyramid everywhere it covers. Boxes crossing the near plane
+	// and boxes too large for the coarsest level are never occluded.
+	static bool IsOccluded(const CullingObject& object, const CullingConstants& constants, const HiZPyramid& pyramid);
+
+	// Draws in object order, the GPU writes the same set in any order
+	static void Cull(const CullingConstants& constants, const std::vector<CullingObject>& objects, const HiZPyramid* pyramid,
+		std::vector<IndirectDraw>& draws);
+
+	static void BuildHiZ(const float* depth, uint32_t width, uint32_t height, HiZPyramid& pyramid);
+};
@@ -0,0 +1,140 @@
+#include "instance_set.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+void InstanceSet::Add(const InstanceData* added, size_t count, InstanceHandle* handles)
+{
+	instances.reserve(instances.size() + count);
+	instance_slots.reserve(instance_slots.size() + count);
+	for (size_t i = 0; i < count; i++)
+	{
+		uint32_t slot;
+		if (free_slots.empty())
+		{
+			slot = static_cast<uint32_t>(slot_instances.size());
+			slot_instances.push_back(no_instance);
+			slot_generations.push_back(0);
+		}
+		else
+		{
+			slot = free_slots.back();
+			free_slots.pop_back();
+		}
+
+		slot_instances[slot] = static_cast<uint32_t>(instances.size());
+		instances.push_back(added[i]);
+		instance_slots.push_back(slot);
+		handles[i] = { slot, slot_generations[slot] };
+	}
+	version++;
+}
+
+size_t InstanceSet::Remove(const InstanceHandle* handles, size_t count)
+{
+	size_t removed = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (!IsAlive(handles[i]))
+		{
+			continue;
+		}
+
+		// The last instance fills the gap, its slot follows it
+		const uint32_t slot = handles[i].slot;
+		const uint32_t index = slot_instances[slot];
+		const uint32_t lastSlot = instance_slots.back();
+		instances[index] = instances.back();
+		instance_slots[index] = lastSlot;
+		slot_instances[lastSlot] = index;
+		instances.pop_back();
+		instance_slots.pop_back();
+
+		slot_instances[slot] = no_instance;
+		slot_generations[slot]++;
+		free_slots.push_back(slot);
+		removed++;
+	}
+	if (removed)
+	{
+		version++;
+	}
+	return removed;
+}
+
+size_t InstanceSet::Update(const InstanceHandle* handles, const InstanceData* updated, size_t count)
+{
+	size_t applied = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (IsAlive(handles[i]))
+		{
+			instances[slot_instances[handles[i].slot]] = updated[i];
+			applied++;
+		}
+	}
+	if (applied)
+	{
+		version++;
+	}
+	return applied;
+}
+
+void InstanceSet::Clear()
+{
+	// Every live slot moves to the next generation, so no handle survives the clear
+	for (uint32_t slot : instance_slots)
+	{
+		slot_instances[slot] = no_instance;
+		slot_generations[slot]++;
+		free_slots.push_back(slot);
+	}
+	instances.clear();
+	instance_slots.clear();
+	version++;
+}
+
+bool InstanceSet::IsAlive(InstanceHandle handle) const
+{
+	return handle.slot < slot_instances.size() && slot_instances[handle.slot] != no_instance && slot_generations[handle.slot] == handle.generation;
+}
+
+void InstanceSet::TransformBounds(const float aabb_min[3], const float aabb_max[3], float bounds_min[3], float bounds_max[3]) const
+{
+	float center[3], extent[3];
+	for (size_t k = 0; k < 3; k++)
+	{
+		center[k] = 0.5f * (aabb_min[k] + aabb_max[k]);
+		extent[k] = 0.5f * (aabb_max[k] - aabb_min[k]);
+		bounds_min[k] = FLT_MAX;
+		bounds_max[k] = -FLT_MAX;
+	}
+
+	// The transformed center plus the extent projected on every axis gives the box around the transformed box
+	for (const InstanceData& instance : instances)
+	{
+		for (size_t j = 0; j < 3; j++)
+		{
+			float transformedCenter = instance.world[3][j];
+			float transformedExtent = 0.f;
+			for (size_t k = 0; k < 3; k++)
+			{
+				transformedCenter += center[k] * instance.world[k][j];
+				transformedExtent += extent[k] * std::fabs(instance.world[k][j]);
+			}
+			bounds_min[j] = std::min(bounds_min[j], transformedCenter - transformedExtent);
+			bounds_max[j] = std::max(bounds_max[j], transformedCenter + transformedExtent);
+		}
+	}
+}
+
+InstanceData InstanceSet::MakeIdentity()
+{
+	InstanceData instance = {};
+	instance.world[0][0] = 1.f;
+	instance.world[1][1] = 1.f;
+	instance.world[2][2] = 1.f;
+	instance.material_override = no_material_override;
+	return instance;
+}
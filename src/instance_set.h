@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+constexpr uint32_t no_material_override = UINT32_MAX;
+
+// Element of the instance buffer in shaders.hlsl
+struct InstanceData
+{
+	float world[4][3];			// row vector transform (v * M), the last row is the translation
+	uint32_t material_override;	// material table index for every triangle, or no_material_override
+	uint32_t padding[3];
+};
+static_assert(sizeof(InstanceData) == 64, "InstanceData must match shaders.hlsl");
+
+// Stays with its instance until it is removed, a stale handle is never taken for a later instance
+struct InstanceHandle
+{
+	uint32_t slot;
+	uint32_t generation;
+};
+
+// Copies of one mesh, kept dense in draw order so one instanced draw covers all of them. Removal
+// moves the last instance into the gap, handles follow their instance through such moves.
+class InstanceSet
+{
+public:
+	InstanceSet() : version(0) {};
+	virtual ~InstanceSet() {};
+
+	// Writes one handle per instance
+	void Add(const InstanceData* added, size_t count, InstanceHandle* handles);
+
+	// Both skip handles of removed instances and return how many they applied
+	size_t Remove(const InstanceHandle* handles, size_t count);
+	size_t Update(const InstanceHandle* handles, const InstanceData* updated, size_t count);
+
+	void Clear();
+
+	bool IsAlive(InstanceHandle handle) const;
+	size_t GetCount() const { return instances.size(); }
+	const std::vector<InstanceData>& GetInstances() const { return instances; }
+
+	// Changes with every modification, mirrors of the set compare it to know when to refresh
+	uint64_t GetVersion() const { return version; }
+
+	// Box around an object space box under every instance transform, inverted when the set is empty
+	void TransformBounds(const float aabb_min[3], const float aabb_max[3], float bounds_min[3], float bounds_max[3]) const;
+
+	static InstanceData MakeIdentity();
+
+protected:
+	static constexpr uint32_t no_instance = UINT32_MAX;
+
+	std::vector<InstanceData> instances;
+	std::vector<uint32_t> instance_slots;		// slot of every dense instance
+	std::vector<uint32_t> slot_instances;		// dense index of every slot, no_instance when free
+	std::vector<uint32_t> slot_generations;
+	std::vector<uint32_t> free_slots;
+	uint64_t version;
+};
@@ -0,0 +1,114 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool MappedFile::Open(const std::string& file_name)
+{
+	Close();
+
+#ifdef _WIN32
+	HANDLE fileHandle = CreateFileA(file_name.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (fileHandle == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	file = fileHandle;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(fileHandle, &fileSize))
+	{
+		Close();
+		return false;
+	}
+	size = static_cast<size_t>(fileSize.QuadPart);
+
+	// Empty files can't be mapped but are still valid input
+	if (size == 0)
+	{
+		return true;
+	}
+
+	mapping = CreateFileMapping(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr)
+	{
+		Close();
+		return false;
+	}
+	data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+	int descriptor = open(file_name.c_str(), O_RDONLY);
+	if (descriptor < 0)
+	{
+		return false;
+	}
+	file = reinterpret_cast<void*>(static_cast<intptr_t>(descriptor) + 1);
+
+	struct stat fileStat;
+	if (fstat(descriptor, &fileStat) != 0)
+	{
+		Close();
+		return false;
+	}
+	size = static_cast<size_t>(fileStat.st_size);
+
+	if (size == 0)
+	{
+		return true;
+	}
+
+	void* view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+	data = view == MAP_FAILED ? nullptr : static_cast<const char*>(view);
+	if (data)
+	{
+		madvise(view, size, MADV_SEQUENTIAL);
+	}
+#endif
+
+	if (data == nullptr)
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::Close()
+{
+#ifdef _WIN32
+	if (data)
+	{
+		UnmapViewOfFile(data);
+	}
+	if (mapping)
+	{
+		CloseHandle(mapping);
+	}
+	if (file)
+	{
+		CloseHandle(file);
+	}
+#else
+	if (data)
+	{
+		munmap(const_cast<char*>(data), size);
+	}
+	if (file)
+	{
+		close(static_cast<int>(reinterpret_cast<intptr_t>(file) - 1));
+	}
+#endif
+	data = nullptr;
+	size = 0;
+	file = nullptr;
+	mapping = nullptr;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+	MappedFile() : data(nullptr), size(0), file(nullptr), mapping(nullptr) {};
+	virtual ~MappedFile() { Close(); };
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool Open(const std::string& file_name);
+	void Close();
+
+	const char* GetData() const { return data; }
+	size_t GetSize() const { return size; }
+
+protected:
+	const char* data;
+	size_t size;
+
+	// Native handles, HANDLE on Windows and a file descriptor elsewhere
+	void* file;
+	void* mapping;
+};
@@ -0,0 +1,321 @@
+#include "mesh_cache.h"
+
+#include <cstddef>
+#include <cstring>
+
+static UINT64 HashBytes(UINT64 hash, const UINT8* data, UINT64 size)
+{
+	// FNV-1a over 64-bit words, the shift folds the high bits back into the low ones the next xor hits.
+	// The tail goes byte by byte.
+	UINT64 i = 0;
+	for (; i + sizeof(UINT64) <= size; i += sizeof(UINT64))
+	{
+		UINT64 word;
+		memcpy(&word, data + i, sizeof(word));
+		hash ^= word;
+		hash *= 1099511628211ull;
+		hash ^= hash >> 29;
+	}
+	for (; i < size; i++)
+	{
+		hash ^= data[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+static bool GetFileStamp(const std::wstring& file_name, UINT64* mtime, UINT64* size)
+{
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (!GetFileAttributesEx(file_name.c_str(), GetFileExInfoStandard, &attributes))
+	{
+		return false;
+	}
+	*mtime = (static_cast<UINT64>(attributes.ftLastWriteTime.dwHighDateTime) << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+	*size = (static_cast<UINT64>(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow;
+	return true;
+}
+
+static bool HashFile(const std::wstring& file_name, UINT64* hash)
+{
+	HANDLE file = CreateFile(file_name.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize))
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	// Empty files can't be mapped, they only contribute their length
+	UINT64 size = static_cast<UINT64>(fileSize.QuadPart);
+	*hash = HashBytes(*hash, reinterpret_cast<const UINT8*>(&size), sizeof(size));
+	if (size > 0)
+	{
+		HANDLE mapping = CreateFileMapping(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		const UINT8* data = mapping ? static_cast<const UINT8*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+		if (data)
+		{
+			*hash = HashBytes(*hash, data, size);
+			UnmapViewOfFile(data);
+		}
+		if (mapping)
+		{
+			CloseHandle(mapping);
+		}
+		if (!data)
+		{
+			CloseHandle(file);
+			return false;
+		}
+	}
+	CloseHandle(file);
+	return true;
+}
+
+// Rewrites the stamp in place through a second handle, the mapped view sees the new values
+static bool WriteSourceStamp(const std::wstring& cache_file, UINT64 mtime, UINT64 size)
+{
+	static_assert(offsetof(MeshCacheHeader, source_size) == offsetof(MeshCacheHeader, source_mtime) + sizeof(UINT64), "stamp fields are adjacent");
+	HANDLE out = CreateFile(cache_file.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (out == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	const UINT64 stamp[2] = { mtime, size };
+	OVERLAPPED position = {};
+	position.Offset = offsetof(MeshCacheHeader, source_mtime);
+	DWORD done = 0;
+	const bool written = WriteFile(out, stamp, sizeof(stamp), &done, &position) && done == sizeof(stamp);
+	CloseHandle(out);
+	return written;
+}
+
+bool MeshCache::ComputeSourceStamp(const std::vector<std::wstring>& source_files, UINT64* mtime, UINT64* size)
+{
+	*mtime = 0;
+	*size = 0;
+	for (const std::wstring& source : source_files)
+	{
+		UINT64 fileMtime, fileSize;
+		if (!GetFileStamp(source, &fileMtime, &fileSize))
+		{
+			return false;
+		}
+		*mtime = max(*mtime, fileMtime);
+		*size += fileSize;
+	}
+	return true;
+}
+
+bool MeshCache::ComputeSourceHash(const std::vector<std::wstring>& source_files, UINT64* hash)
+{
+	*hash = 14695981039346656037ull;
+	for (const std::wstring& source : source_files)
+	{
+		if (!HashFile(source, hash))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool MeshCache::Open(const std::vector<std::wstring>& source_files)
+{
+	Close();
+
+	UINT64 sourceMtime, sourceSize;
+	if (!ComputeSourceStamp(source_files, &sourceMtime, &sourceSize))
+	{
+		return false;
+	}
+
+	// Write sharing lets a stale stamp be refreshed while the cache is mapped
+	file = CreateFile(cache_file.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || static_cast<UINT64>(fileSize.QuadPart) < sizeof(MeshCacheHeader))
+	{
+		Close();
+		return false;
+	}
+	view_size = static_cast<UINT64>(fileSize.QuadPart);
+
+	mapping = CreateFileMapping(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr)
+	{
+		Close();
+		return false;
+	}
+	view = static_cast<const UINT8*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	if (view == nullptr)
+	{
+		Close();
+		return false;
+	}
+
+	const MeshCacheHeader* header = GetHeader();
+	if (header->magic != magic || header->version != version || header->section_count > MESH_CACHE_SECTION_COUNT)
+	{
+		OutputDebugString(L"Mesh cache is stale or has an old format\n");
+		Close();
+		return false;
+	}
+
+	for (UINT32 i = 0; i < header->section_count; i++)
+	{
+		const MeshCacheSection& section = header->sections[i];
+		if (section.offset % section_alignment != 0 || section.offset > view_size || section.size > view_size - section.offset)
+		{
+			OutputDebugString(L"Mesh cache is truncated\n");
+			Close();
+			return false;
+		}
+	}
+
+	// Matching mtime and size are trusted so warm starts never read the sources. Only a changed stamp
+	// pays for hashing, which keeps the cache of a touched or copied file with the same content. The new
+	// stamp is stored then, so only the first start after the change hashes.
+	if (header->source_mtime != sourceMtime || header->source_size != sourceSize)
+	{
+		UINT64 sourceHash;
+		if (!ComputeSourceHash(source_files, &sourceHash) || header->source_hash != sourceHash)
+		{
+			OutputDebugString(L"Mesh cache source hash mismatch\n");
+			Close();
+			return false;
+		}
+		if (!WriteSourceStamp(cache_file, sourceMtime, sourceSize))
+		{
+			OutputDebugString(L"Mesh cache source stamp could not be updated\n");
+		}
+	}
+
+	return true;
+}
+
+void MeshCache::Close()
+{
+	if (view)
+	{
+		UnmapViewOfFile(view);
+		view = nullptr;
+	}
+	if (mapping)
+	{
+		CloseHandle(mapping);
+		mapping = nullptr;
+	}
+	if (file != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(file);
+		file = INVALID_HANDLE_VALUE;
+	}
+	view_size = 0;
+}
+
+const void* MeshCache::GetSection(MeshCacheSectionType type, UINT64* size, UINT32* stride) const
+{
+	if (view == nullptr)
+	{
+		return nullptr;
+	}
+
+	const MeshCacheHeader* header = GetHeader();
+	for (UINT32 i = 0; i < header->section_count; i++)
+	{
+		const MeshCacheSection& section = header->sections[i];
+		if (section.type == type)
+		{
+			*size = section.size;
+			*stride = section.stride;
+			return view + section.offset;
+		}
+	}
+	return nullptr;
+}
+
+bool MeshCache::Write(const std::vector<std::wstring>& source_files, const std::vector<MeshCacheBlob>& blobs) const
+{
+	if (blobs.size() > MESH_CACHE_SECTION_COUNT)
+	{
+		return false;
+	}
+
+	MeshCacheHeader header = {};
+	header.magic = magic;
+	header.version = version;
+	header.section_count = static_cast<UINT32>(blobs.size());
+	if (!ComputeSourceStamp(source_files, &header.source_mtime, &header.source_size) ||
+		!ComputeSourceHash(source_files, &header.source_hash))
+	{
+		return false;
+	}
+
+	UINT64 offset = (sizeof(MeshCacheHeader) + section_alignment - 1) & ~(section_alignment - 1);
+	for (size_t i = 0; i < blobs.size(); i++)
+	{
+		header.sections[i].type = blobs[i].type;
+		header.sections[i].stride = blobs[i].stride;
+		header.sections[i].offset = offset;
+		header.sections[i].size = blobs[i].size;
+		offset = (offset + blobs[i].size + section_alignment - 1) & ~(section_alignment - 1);
+	}
+
+	// Write into a temporary file first so a crash never leaves a half written cache behind
+	std::wstring tempFile = cache_file + L".tmp";
+	HANDLE out = CreateFile(tempFile.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (out == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	bool written = true;
+	UINT64 position = 0;
+	auto writeBytes = [&](const void* data, UINT64 size)
+	{
+		const UINT8* bytes = static_cast<const UINT8*>(data);
+		while (written && size > 0)
+		{
+			DWORD chunk = static_cast<DWORD>(min(size, static_cast<UINT64>(1u << 30)));
+			DWORD done = 0;
+			written = WriteFile(out, bytes, chunk, &done, nullptr) && done == chunk;
+			bytes += chunk;
+			size -= chunk;
+			position += chunk;
+		}
+	};
+	auto pad = [&](UINT64 target)
+	{
+		static const UINT8 zeros[section_alignment] = {};
+		while (written && position < target)
+		{
+			writeBytes(zeros, min(target - position, section_alignment));
+		}
+	};
+
+	writeBytes(&header, sizeof(header));
+	for (size_t i = 0; i < blobs.size(); i++)
+	{
+		pad(header.sections[i].offset);
+		writeBytes(blobs[i].data, blobs[i].size);
+	}
+	CloseHandle(out);
+
+	if (!written || !MoveFileEx(tempFile.c_str(), cache_file.c_str(), MOVEFILE_REPLACE_EXISTING))
+	{
+		DeleteFile(tempFile.c_str());
+		return false;
+	}
+	return true;
+}
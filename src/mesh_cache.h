@@ -0,0 +1,85 @@
+#pragma once
+
+#include "dx12_labs.h"
+
+#include <string>
+#include <vector>
+
+// Binary cache of GPU-ready mesh data stored next to the source OBJ.
+// Sections are aligned so a mapped view can be copied straight into an upload buffer.
+enum MeshCacheSectionType : UINT32
+{
+	MESH_CACHE_SECTION_VERTICES = 0,
+	MESH_CACHE_SECTION_INDICES = 1,
+	MESH_CACHE_SECTION_QUANTIZATION = 2,
+	MESH_CACHE_SECTION_MATERIALS = 3,
+	MESH_CACHE_SECTION_MESHLETS = 4,
+	MESH_CACHE_SECTION_LODS = 5,
+	MESH_CACHE_SECTION_TRIANGLE_MATERIALS = 6,
+	MESH_CACHE_SECTION_SUBMESHES = 7,
+	MESH_CACHE_SECTION_COUNT
+};
+
+struct MeshCacheSection
+{
+	UINT32 type;
+	UINT32 stride;
+	UINT64 offset;
+	UINT64 size;
+};
+
+struct MeshCacheHeader
+{
+	UINT32 magic;
+	UINT32 version;
+	UINT64 source_hash;
+	UINT64 source_mtime;
+	UINT64 source_size;		// of all source files together
+	UINT32 section_count;
+	UINT32 reserved;
+	MeshCacheSection sections[MESH_CACHE_SECTION_COUNT];
+};
+
+struct MeshCacheBlob
+{
+	MeshCacheSectionType type;
+	UINT32 stride;
+	const void* data;
+	UINT64 size;
+};
+
+class MeshCache
+{
+public:
+	static constexpr UINT32 magic = 0x4348534D; // "MSHC"
+	static constexpr UINT32 version = 8;
+	static constexpr UINT64 section_alignment = 256;
+
+	MeshCache(std::wstring cache_file) : cache_file(cache_file), file(INVALID_HANDLE_VALUE), mapping(nullptr), view(nullptr), view_size(0) {};
+	virtual ~MeshCache() { Close(); };
+
+	// Maps the cache and validates it against the current state of the source files
+	bool Open(const std::vector<std::wstring>& source_files);
+	void Close();
+
+	// Returns the mapped section or nullptr if it is absent
+	const void* GetSection(MeshCacheSectionType type, UINT64* size, UINT32* stride) const;
+
+	// Writes a fresh cache keyed by the source files, replacing the old one atomically
+	bool Write(const std::vector<std::wstring>& source_files, const std::vector<MeshCacheBlob>& blobs) const;
+
+	// Newest mtime and summed size, cheap enough for every start
+	static bool ComputeSourceStamp(const std::vector<std::wstring>& source_files, UINT64* mtime, UINT64* size);
+	// Reads every byte, only needed when the stamp changed
+	static bool ComputeSourceHash(const std::vector<std::wstring>& source_files, UINT64* hash);
+
+protected:
+	std::wstring cache_file;
+
+	HANDLE file;
+	HANDLE mapping;
+	const UINT8* view;
+	UINT64 view_size;
+
+	const MeshCacheHeader* GetHeader() const { return reinterpret_cast<const MeshCacheHeader*>(view); }
+};
@@ -0,0 +1,324 @@
+#include "mesh_loader.h"
+#include "mesh_cache.h"
+#include "mesh_optimizer.h"
+#include "obj_parser.h"
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+// Key used to weld face corners that share a position, a normal and a material
+struct VertexKey
+{
+	float x, y, z;
+	float nx, ny, nz;
+	int material_id;
+
+	bool operator==(const VertexKey& other) const
+	{
+		return x == other.x && y == other.y && z == other.z &&
+			nx == other.nx && ny == other.ny && nz == other.nz && material_id == other.material_id;
+	}
+};
+
+struct VertexKeyHash
+{
+	size_t operator()(const VertexKey& key) const
+	{
+		// FNV-1a over the key bytes, adding 0 folds -0.0 into +0.0 so equal keys hash equally
+		const VertexKey normalized = { key.x + 0.f, key.y + 0.f, key.z + 0.f, key.nx + 0.f, key.ny + 0.f, key.nz + 0.f, key.material_id };
+		const UINT8* bytes = reinterpret_cast<const UINT8*>(&normalized);
+		size_t hash = 14695981039346656037ull;
+		for (size_t i = 0; i < sizeof(VertexKey); i++)
+		{
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+};
+
+static std::string Narrow(const std::wstring& text)
+{
+	return std::string(text.begin(), text.end());
+}
+
+static GpuMaterial ConvertMaterial(const tinyobj::material_t& material)
+{
+	GpuMaterial gpuMaterial;
+	gpuMaterial.diffuse = XMFLOAT3(material.diffuse[0], material.diffuse[1], material.diffuse[2]);
+	gpuMaterial.shininess = material.shininess;
+	gpuMaterial.specular = XMFLOAT3(material.specular[0], material.specular[1], material.specular[2]);
+	gpuMaterial.optical_density = material.ior;
+	gpuMaterial.emission = XMFLOAT3(material.emission[0], material.emission[1], material.emission[2]);
+	gpuMaterial.illumination_model = static_cast<UINT>(max(material.illum, 0));
+	return gpuMaterial;
+}
+
+static void LogReport(const std::string& report)
+{
+	OutputDebugString(std::wstring(report.begin(), report.end()).c_str());
+}
+
+std::vector<std::wstring> MeshLoader::GetSourceFiles(const std::wstring& obj_path)
+{
+	std::wstring mtlPath = obj_path.substr(0, obj_path.find_last_of(L'.')) + L".mtl";
+	return { obj_path, mtlPath };
+}
+
+bool MeshLoader::ReadCache(const std::wstring& obj_path, MeshData& data) const
+{
+	MeshCache meshCache(obj_path + L".cache");
+	if (!meshCache.Open(GetSourceFiles(obj_path)))
+	{
+		return false;
+	}
+
+	UINT64 vertexDataSize = 0;
+	UINT64 indexDataSize = 0;
+	UINT64 quantizationSize = 0;
+	UINT64 materialDataSize = 0;
+	UINT64 meshletDataSize = 0;
+	UINT64 lodDataSize = 0;
+	UINT64 triangleMaterialDataSize = 0;
+	UINT64 submeshDataSize = 0;
+	UINT32 vertexStride = 0;
+	UINT32 indexStride = 0;
+	UINT32 quantizationStride = 0;
+	UINT32 materialStride = 0;
+	UINT32 meshletStride = 0;
+	UINT32 lodStride = 0;
+	UINT32 triangleMaterialStride = 0;
+	UINT32 submeshStride = 0;
+	const void* vertexData = meshCache.GetSection(MESH_CACHE_SECTION_VERTICES, &vertexDataSize, &vertexStride);
+	const void* indexData = meshCache.GetSection(MESH_CACHE_SECTION_INDICES, &indexDataSize, &indexStride);
+	const void* quantizationData = meshCache.GetSection(MESH_CACHE_SECTION_QUANTIZATION, &quantizationSize, &quantizationStride);
+	const void* materialData = meshCache.GetSection(MESH_CACHE_SECTION_MATERIALS, &materialDataSize, &materialStride);
+	const void* meshletData = meshCache.GetSection(MESH_CACHE_SECTION_MESHLETS, &meshletDataSize, &meshletStride);
+	const void* lodData = meshCache.GetSection(MESH_CACHE_SECTION_LODS, &lodDataSize, &lodStride);
+	const void* triangleMaterialData = meshCache.GetSection(MESH_CACHE_SECTION_TRIANGLE_MATERIALS, &triangleMaterialDataSize, &triangleMaterialStride);
+	const void* submeshData = meshCache.GetSection(MESH_CACHE_SECTION_SUBMESHES, &submeshDataSize, &submeshStride);
+
+	if (!vertexData || !indexData || !quantizationData || !materialData || !meshletData || !lodData || !triangleMaterialData || !submeshData ||
+		vertexStride != sizeof(PackedVertex) || (indexStride != sizeof(UINT16) && indexStride != sizeof(UINT)) ||
+		quantizationSize != sizeof(QuantizationParameters) || materialStride != sizeof(GpuMaterial) || meshletStride != sizeof(Meshlet) ||
+		lodStride != sizeof(MeshLod) || triangleMaterialStride != sizeof(UINT16) || submeshStride != sizeof(Submesh) ||
+		triangleMaterialDataSize / triangleMaterialStride != indexDataSize / indexStride / 3)
+	{
+		return false;
+	}
+
+	const PackedVertex* vertices = static_cast<const PackedVertex*>(vertexData);
+	data.vertices.assign(vertices, vertices + vertexDataSize / vertexStride);
+	const UINT8* indices = static_cast<const UINT8*>(indexData);
+	data.index_data.assign(indices, indices + indexDataSize);
+	data.index_stride = indexStride;
+	data.quantization = *static_cast<const QuantizationParameters*>(quantizationData);
+	const GpuMaterial* materials = static_cast<const GpuMaterial*>(materialData);
+	data.materials.assign(materials, materials + materialDataSize / materialStride);
+	const UINT16* triangleMaterials = static_cast<const UINT16*>(triangleMaterialData);
+	data.triangle_materials.assign(triangleMaterials, triangleMaterials + triangleMaterialDataSize / triangleMaterialStride);
+	const Submesh* submeshes = static_cast<const Submesh*>(submeshData);
+	data.submeshes.assign(submeshes, submeshes + submeshDataSize / submeshStride);
+	const Meshlet* meshlets = static_cast<const Meshlet*>(meshletData);
+	data.meshlets.assign(meshlets, meshlets + meshletDataSize / meshletStride);
+	const MeshLod* lods = static_cast<const MeshLod*>(lodData);
+	data.lods.assign(lods, lods + lodDataSize / lodStride);
+	return true;
+}
+
+void MeshLoader::Parse(const std::wstring& obj_path, ObjData& obj) const
+{
+	std::string warn;
+	std::string err;
+
+	std::string objFile = Narrow(obj_path);
+	std::string objDirectory = objFile.substr(0, objFile.find_last_of("\\/") + 1);
+	ObjParser objParser(thread_pool);
+	bool ret = objParser.Load(&obj.attrib, &obj.shapes, &obj.materials, &warn, &err, objFile.c_str(), objDirectory.c_str());
+
+	if (!warn.empty())
+	{
+		std::wstring w_warn(warn.begin(), warn.end());
+		w_warn = L"Tiny OBJ reader warning: " + w_warn + L"\n";
+		OutputDebugString(w_warn.c_str());
+	}
+
+	if (!err.empty())
+	{
+		std::wstring e_err(err.begin(), err.end());
+		e_err = L"Tiny OBJ reader error: " + e_err + L"\n";
+		OutputDebugString(e_err.c_str());
+	}
+
+	if (!ret) {
+		ThrowIfFailed(-1);
+	}
+}
+
+void MeshLoader::Process(const ObjData& obj, MeshData& data) const
+{
+	const tinyobj::attrib_t& attrib = obj.attrib;
+	const std::vector<tinyobj::shape_t>& shapes = obj.shapes;
+	const std::vector<tinyobj::material_t>& materials = obj.materials;
+
+	// Material table without duplicates, corners without a material use a white default entry
+	data.materials.clear();
+	std::vector<UINT> materialRemap(materials.size() + 1);
+	for (size_t m = 0; m <= materials.size(); m++)
+	{
+		GpuMaterial gpuMaterial = { { 1.f, 1.f, 1.f }, 0.f, { 0.f, 0.f, 0.f }, 1.f, { 0.f, 0.f, 0.f }, 0 };
+		if (m < materials.size())
+		{
+			gpuMaterial = ConvertMaterial(materials[m]);
+		}
+		auto found = std::find_if(data.materials.begin(), data.materials.end(),
+			[&gpuMaterial](const GpuMaterial& other) { return memcmp(&gpuMaterial, &other, sizeof(GpuMaterial)) == 0; });
+		materialRemap[m] = static_cast<UINT>(found - data.materials.begin());
+		if (found == data.materials.end())
+		{
+			data.materials.push_back(gpuMaterial);
+		}
+	}
+	if (data.materials.size() > max_material_count)
+	{
+		ThrowIfFailed(E_INVALIDARG);
+	}
+	const int defaultMaterial = static_cast<int>(materials.size());
+
+	// Loop over shapes
+	std::vector<MeshVertex> verteces;
+	std::vector<UINT> indices;
+	std::unordered_map<VertexKey, UINT, VertexKeyHash> uniqueVertices;
+	std::vector<IndexRange> shapeRanges;
+	size_t cornerCount = 0;
+	for (size_t s = 0; s < shapes.size(); s++)
+	{
+		shapeRanges.push_back({ indices.size(), 0 });
+
+		// Loop over faces(polygon)
+		size_t index_offset = 0;
+		for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++)
+		{
+			int fv = shapes[s].mesh.num_face_vertices[f];
+
+			// Loop over vertices in the face.
+			int materialIds = shapes[s].mesh.material_ids[f];
+			if (materialIds < 0 || materialIds >= static_cast<int>(materials.size()))
+			{
+				materialIds = defaultMaterial;
+			}
+			materialIds = static_cast<int>(materialRemap[materialIds]);
+			for (size_t v = 0; v < fv; v++) {
+				// access to vertex
+				tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
+				tinyobj::real_t vx = attrib.vertices[3 * idx.vertex_index + 0];
+				tinyobj::real_t vy = attrib.vertices[3 * idx.vertex_index + 1];
+				tinyobj::real_t vz = attrib.vertices[3 * idx.vertex_index + 2];
+				tinyobj::real_t nx = 0.f;
+				tinyobj::real_t ny = 0.f;
+				tinyobj::real_t nz = 0.f;
+				if (idx.normal_index >= 0)
+				{
+					nx = attrib.normals[3 * idx.normal_index + 0];
+					ny = attrib.normals[3 * idx.normal_index + 1];
+					nz = attrib.normals[3 * idx.normal_index + 2];
+				}
+
+				// Weld corners with the same position, normal and material
+				VertexKey key = { vx, vy, vz, nx, ny, nz, materialIds };
+				auto found = uniqueVertices.find(key);
+				if (found == uniqueVertices.end())
+				{
+					MeshVertex vertex = { {vx, vy, vz}, {nx, ny, nz}, static_cast<UINT>(materialIds) };
+					found = uniqueVertices.emplace(key, static_cast<UINT>(verteces.size())).first;
+					verteces.push_back(vertex);
+				}
+				indices.push_back(found->second);
+				cornerCount++;
+			}
+			index_offset += fv;
+		}
+		shapeRanges.back().count = indices.size() - shapeRanges.back().first;
+	}
+
+	WCHAR loadLog[256];
+	swprintf_s(loadLog, L"Loaded %zu corners into %zu unique vertices (dedup ratio %.2fx)\n",
+		cornerCount, verteces.size(), verteces.empty() ? 0.0 : static_cast<double>(cornerCount) / verteces.size());
+	OutputDebugString(loadLog);
+
+	// Reorder triangles inside every shape for the post-transform cache and overdraw, then vertices for fetch locality
+	MeshOptimizer meshOptimizer;
+	verteces.resize(meshOptimizer.Optimize(indices, verteces.data(), verteces.size(), sizeof(MeshVertex), offsetof(MeshVertex, position), shapeRanges));
+	LogReport(meshOptimizer.FormatReport());
+
+	// Split the shapes into meshlets for cluster culling
+	const float* positions = verteces.empty() ? nullptr : &verteces[0].position.x;
+	MeshletBuilder meshletBuilder;
+	meshletBuilder.Build(indices.data(), shapeRanges, positions, sizeof(MeshVertex), verteces.size(), data.meshlets);
+	LogReport(meshletBuilder.FormatReport(data.meshlets));
+
+	// Append the LOD chain of every shape after the full resolution indices
+	MeshSimplifier meshSimplifier(thread_pool);
+	meshSimplifier.Simplify(indices, shapeRanges, positions, sizeof(MeshVertex), data.lods);
+	LogReport(meshSimplifier.FormatReport(data.lods));
+
+	// Every corner of a triangle shares the material, so the first one names it. This covers the LOD triangles too.
+	data.triangle_materials.resize(indices.size() / 3);
+	for (size_t t = 0; t < data.triangle_materials.size(); t++)
+	{
+		data.triangle_materials[t] = static_cast<UINT16>(verteces[indices[t * 3]].material_id);
+	}
+
+	// Keep every shape as a submesh with its own draw range and bounds
+	SubmeshBuilder submeshBuilder;
+	submeshBuilder.Build(indices.data(), shapeRanges, data.triangle_materials.data(), positions, sizeof(MeshVertex), data.meshlets, data.submeshes);
+	LogReport(submeshBuilder.FormatReport(data.submeshes));
+
+	WCHAR materialLog[128];
+	swprintf_s(materialLog, L"Material table: %zu materials from %zu in the MTL file, %zu bytes per vertex\n",
+		data.materials.size(), materials.size(), sizeof(PackedVertex));
+	OutputDebugString(materialLog);
+
+	// Quantize into the compact GPU layout
+	VertexQuantizer vertexQuantizer;
+	data.vertices.resize(verteces.size());
+	if (!verteces.empty())
+	{
+		vertexQuantizer.Quantize(&verteces[0].position.x, sizeof(MeshVertex), &verteces[0].normal.x, sizeof(MeshVertex),
+			verteces.size(), data.vertices.data());
+	}
+	data.quantization = vertexQuantizer.GetParameters();
+	LogReport(vertexQuantizer.FormatReport());
+
+	// 16 bit indices whenever every vertex is addressable with them
+	if (verteces.size() <= 0xFFFF)
+	{
+		std::vector<UINT16> indices16(indices.begin(), indices.end());
+		data.index_stride = sizeof(UINT16);
+		data.index_data.assign(reinterpret_cast<const UINT8*>(indices16.data()), reinterpret_cast<const UINT8*>(indices16.data() + indices16.size()));
+	}
+	else
+	{
+		data.index_stride = sizeof(UINT);
+		data.index_data.assign(reinterpret_cast<const UINT8*>(indices.data()), reinterpret_cast<const UINT8*>(indices.data() + indices.size()));
+	}
+}
+
+bool MeshLoader::WriteCache(const std::wstring& obj_path, const MeshData& data) const
+{
+	MeshCache meshCache(obj_path + L".cache");
+	std::vector<MeshCacheBlob> blobs = {
+		{ MESH_CACHE_SECTION_VERTICES, sizeof(PackedVertex), data.vertices.data(), sizeof(PackedVertex) * data.vertices.size() },
+		{ MESH_CACHE_SECTION_INDICES, data.index_stride, data.index_data.data(), data.index_data.size() },
+		{ MESH_CACHE_SECTION_QUANTIZATION, sizeof(QuantizationParameters), &data.quantization, sizeof(QuantizationParameters) },
+		{ MESH_CACHE_SECTION_MATERIALS, sizeof(GpuMaterial), data.materials.data(), sizeof(GpuMaterial) * data.materials.size() },
+		{ MESH_CACHE_SECTION_MESHLETS, sizeof(Meshlet), data.meshlets.data(), sizeof(Meshlet) * data.meshlets.size() },
+		{ MESH_CACHE_SECTION_LODS, sizeof(MeshLod), data.lods.data(), sizeof(MeshLod) * data.lods.size() },
+		{ MESH_CACHE_SECTION_TRIANGLE_MATERIALS, sizeof(UINT16), data.triangle_materials.data(), sizeof(UINT16) * data.triangle_materials.size() },
+		{ MESH_CACHE_SECTION_SUBMESHES, sizeof(Submesh), data.submeshes.data(), sizeof(Submesh) * data.submeshes.size() }
+	};
+	return meshCache.Write(GetSourceFiles(obj_path), blobs);
+}
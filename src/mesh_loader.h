@@ -0,0 +1,59 @@
+#pragma once
+
+#include "dx12_labs.h"
+#include "mesh_simplifier.h"
+#include "meshlet_builder.h"
+#include "submesh_builder.h"
+#include "thread_pool.h"
+#include "vertex_quantizer.h"
+
+#include "tiny_obj_loader.h"
+
+#include <string>
+#include <vector>
+
+// CPU side of a loaded mesh, laid out the way it is uploaded and cached
+struct MeshData
+{
+	std::vector<PackedVertex> vertices;
+	std::vector<UINT8> index_data;
+	UINT index_stride;
+	std::vector<GpuMaterial> materials;
+	std::vector<UINT16> triangle_materials;	// one material index per triangle of index_data
+	QuantizationParameters quantization;
+	std::vector<Meshlet> meshlets;
+	std::vector<MeshLod> lods;
+	std::vector<Submesh> submeshes;
+};
+
+struct ObjData
+{
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::shape_t> shapes;
+	std::vector<tinyobj::material_t> materials;
+};
+
+// Loading stages of an OBJ mesh. None of them touch the device, so they can run on any thread,
+// and the object keeps no state between calls so several meshes can load at the same time.
+class MeshLoader
+{
+public:
+	MeshLoader(ThreadPool& thread_pool) : thread_pool(thread_pool) {};
+	virtual ~MeshLoader() {};
+
+	// Fills data from the binary cache next to the OBJ when it is still up to date
+	bool ReadCache(const std::wstring& obj_path, MeshData& data) const;
+
+	// Parses the OBJ and its MTL file, throws on failure
+	void Parse(const std::wstring& obj_path, ObjData& obj) const;
+
+	// Welds, optimizes, clusters, simplifies and quantizes the parsed mesh
+	void Process(const ObjData& obj, MeshData& data) const;
+
+	bool WriteCache(const std::wstring& obj_path, const MeshData& data) const;
+
+	static std::vector<std::wstring> GetSourceFiles(const std::wstring& obj_path);
+
+protected:
+	ThreadPool& thread_pool;
+};
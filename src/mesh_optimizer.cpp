@@ -0,0 +1,406 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+
+VertexCacheStatistics MeshOptimizer::AnalyzeVertexCache(const unsigned int* indices, size_t index_count, size_t vertex_count, unsigned int cache_size)
+{
+	// A vertex is still cached while fewer than cache_size misses happened after it was loaded
+	std::vector<size_t> cacheTimestamps(vertex_count, 0);
+	size_t timestamp = cache_size + 1;
+	size_t misses = 0;
+	for (size_t i = 0; i < index_count; i++)
+	{
+		unsigned int vertex = indices[i];
+		if (timestamp - cacheTimestamps[vertex] > cache_size)
+		{
+			cacheTimestamps[vertex] = timestamp++;
+			misses++;
+		}
+	}
+
+	size_t usedVertices = 0;
+	for (size_t v = 0; v < vertex_count; v++)
+	{
+		usedVertices += cacheTimestamps[v] != 0;
+	}
+
+	VertexCacheStatistics statistics = {};
+	statistics.vertices_transformed = misses;
+	statistics.acmr = index_count ? static_cast<float>(misses) / (index_count / 3) : 0.f;
+	statistics.atvr = usedVertices ? static_cast<float>(misses) / usedVertices : 0.f;
+	return statistics;
+}
+
+void MeshOptimizer::OptimizeVertexCache(unsigned int* indices, size_t index_count, size_t vertex_count, unsigned int cache_size,
+	std::vector<unsigned int>* clusters)
+{
+	const size_t triangleCount = index_count / 3;
+	if (clusters)
+	{
+		clusters->clear();
+	}
+	if (triangleCount == 0)
+	{
+		return;
+	}
+
+	// Vertex to triangle adjacency
+	std::vector<unsigned int> liveTriangles(vertex_count, 0);
+	for (size_t i = 0; i < index_count; i++)
+	{
+		liveTriangles[indices[i]]++;
+	}
+	std::vector<size_t> adjacencyOffsets(vertex_count + 1, 0);
+	for (size_t v = 0; v < vertex_count; v++)
+	{
+		adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+	}
+	std::vector<unsigned int> adjacency(index_count);
+	std::vector<size_t> adjacencyFill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		for (size_t k = 0; k < 3; k++)
+		{
+			adjacency[adjacencyFill[indices[3 * t + k]]++] = static_cast<unsigned int>(t);
+		}
+	}
+
+	std::vector<unsigned int> source(indices, indices + index_count);
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<size_t> cacheTimestamps(vertex_count, 0);
+	std::vector<unsigned int> deadEnd;
+	std::vector<unsigned int> candidates;
+	size_t timestamp = cache_size + 1;
+	size_t cursor = 0;
+	size_t written = 0;
+
+	long long fanning = source[0];
+	bool discontinuity = true;
+	while (fanning >= 0)
+	{
+		if (discontinuity && clusters)
+		{
+			clusters->push_back(static_cast<unsigned int>(written / 3));
+		}
+
+		// Emit every remaining triangle around the fanning vertex
+		candidates.clear();
+		for (size_t a = adjacencyOffsets[fanning]; a < adjacencyOffsets[fanning + 1]; a++)
+		{
+			unsigned int triangle = adjacency[a];
+			if (emitted[triangle])
+			{
+				continue;
+			}
+			for (size_t k = 0; k < 3; k++)
+			{
+				unsigned int vertex = source[3 * triangle + k];
+				indices[written++] = vertex;
+				deadEnd.push_back(vertex);
+				candidates.push_back(vertex);
+				liveTriangles[vertex]--;
+				if (timestamp - cacheTimestamps[vertex] > cache_size)
+				{
+					cacheTimestamps[vertex] = timestamp++;
+				}
+			}
+			emitted[triangle] = true;
+		}
+
+		// Prefer the candidate that stays in the cache for all of its remaining triangles
+		fanning = -1;
+		long long bestPriority = -1;
+		for (unsigned int vertex : candidates)
+		{
+			if (liveTriangles[vertex] == 0)
+			{
+				continue;
+			}
+			long long priority = 0;
+			if (timestamp - cacheTimestamps[vertex] + 2 * liveTriangles[vertex] <= cache_size)
+			{
+				priority = static_cast<long long>(timestamp - cacheTimestamps[vertex]);
+			}
+			if (priority > bestPriority)
+			{
+				bestPriority = priority;
+				fanning = vertex;
+			}
+		}
+
+		discontinuity = fanning < 0;
+		if (fanning < 0)
+		{
+			// Dead end, try recently used vertices first and then scan in input order
+			while (!deadEnd.empty() && fanning < 0)
+			{
+				unsigned int vertex = deadEnd.back();
+				deadEnd.pop_back();
+				if (liveTriangles[vertex] > 0)
+				{
+					fanning = vertex;
+				}
+			}
+			while (fanning < 0 && cursor < index_count)
+			{
+				unsigned int vertex = source[cursor++];
+				if (liveTriangles[vertex] > 0)
+				{
+					fanning = vertex;
+				}
+			}
+		}
+	}
+}
+
+void MeshOptimizer::OptimizeOverdraw(unsigned int* indices, size_t index_count, const float* positions, size_t position_stride, size_t vertex_count,
+	const std::vector<unsigned int>& clusters, unsigned int cache_size, float threshold)
+{
+	const size_t triangleCount = index_count / 3;
+	if (triangleCount == 0 || clusters.empty())
+	{
+		return;
+	}
+
+	auto position = [&](unsigned int vertex)
+	{
+		return reinterpret_cast<const float*>(reinterpret_cast<const char*>(positions) + vertex * position_stride);
+	};
+
+	// Split the hard clusters further wherever the local ACMR already paid for the cold start
+	const float targetAcmr = AnalyzeVertexCache(indices, index_count, vertex_count, cache_size).acmr * threshold;
+	std::vector<unsigned int> splits;
+	std::vector<size_t> cacheTimestamps(vertex_count, 0);
+	size_t timestamp = cache_size + 1;
+	for (size_t c = 0; c < clusters.size(); c++)
+	{
+		const size_t begin = clusters[c];
+		const size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+		timestamp += cache_size + 1;
+
+		splits.push_back(static_cast<unsigned int>(begin));
+		size_t misses = 0;
+		size_t start = begin;
+		for (size_t t = begin; t < end; t++)
+		{
+			for (size_t k = 0; k < 3; k++)
+			{
+				unsigned int vertex = indices[3 * t + k];
+				if (timestamp - cacheTimestamps[vertex] > cache_size)
+				{
+					cacheTimestamps[vertex] = timestamp++;
+					misses++;
+				}
+			}
+
+			if (t + 1 < end && static_cast<float>(misses) / (t + 1 - start) <= targetAcmr)
+			{
+				splits.push_back(static_cast<unsigned int>(t + 1));
+				start = t + 1;
+				misses = 0;
+				timestamp += cache_size + 1;
+			}
+		}
+	}
+
+	// Mesh centroid, area weighted
+	double meshCentroid[3] = {};
+	double meshArea = 0.0;
+	std::vector<float> triangleData(triangleCount * 7);
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		const float* p0 = position(indices[3 * t + 0]);
+		const float* p1 = position(indices[3 * t + 1]);
+		const float* p2 = position(indices[3 * t + 2]);
+		float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+		float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+		float* data = &triangleData[7 * t];
+		data[0] = e1[1] * e2[2] - e1[2] * e2[1];
+		data[1] = e1[2] * e2[0] - e1[0] * e2[2];
+		data[2] = e1[0] * e2[1] - e1[1] * e2[0];
+		data[3] = std::sqrt(data[0] * data[0] + data[1] * data[1] + data[2] * data[2]) * 0.5f;
+		for (size_t k = 0; k < 3; k++)
+		{
+			data[4 + k] = (p0[k] + p1[k] + p2[k]) / 3.f;
+			meshCentroid[k] += data[4 + k] * data[3];
+		}
+		meshArea += data[3];
+	}
+	for (size_t k = 0; k < 3; k++)
+	{
+		meshCentroid[k] = meshArea > 0.0 ? meshCentroid[k] / meshArea : 0.0;
+	}
+
+	// Outward facing clusters far from the centroid are likely occluders, draw them first
+	struct ClusterSort
+	{
+		float key;
+		size_t begin;
+		size_t end;
+	};
+	std::vector<ClusterSort> sorted(splits.size());
+	for (size_t c = 0; c < splits.size(); c++)
+	{
+		ClusterSort& cluster = sorted[c];
+		cluster.begin = splits[c];
+		cluster.end = c + 1 < splits.size() ? splits[c + 1] : triangleCount;
+
+		double normal[3] = {};
+		double centroid[3] = {};
+		double area = 0.0;
+		for (size_t t = cluster.begin; t < cluster.end; t++)
+		{
+			const float* data = &triangleData[7 * t];
+			for (size_t k = 0; k < 3; k++)
+			{
+				normal[k] += data[k];
+				centroid[k] += data[4 + k] * data[3];
+			}
+			area += data[3];
+		}
+
+		double key = 0.0;
+		if (area > 0.0)
+		{
+			for (size_t k = 0; k < 3; k++)
+			{
+				key += (centroid[k] / area - meshCentroid[k]) * normal[k];
+			}
+			double normalLength = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+			key = normalLength > 0.0 ? key / normalLength : 0.0;
+		}
+		cluster.key = static_cast<float>(key);
+	}
+	std::stable_sort(sorted.begin(), sorted.end(), [](const ClusterSort& a, const ClusterSort& b) { return a.key > b.key; });
+
+	std::vector<unsigned int> source(indices, indices + index_count);
+	size_t written = 0;
+	for (const ClusterSort& cluster : sorted)
+	{
+		const size_t count = (cluster.end - cluster.begin) * 3;
+		memcpy(indices + written, source.data() + cluster.begin * 3, count * sizeof(unsigned int));
+		written += count;
+	}
+}
+
+size_t MeshOptimizer::OptimizeVertexFetch(unsigned int* indices, size_t index_count, void* vertices, size_t vertex_count, size_t vertex_stride)
+{
+	std::vector<unsigned int> remap(vertex_count, ~0u);
+	unsigned int nextVertex = 0;
+	for (size_t i = 0; i < index_count; i++)
+	{
+		unsigned int& target = remap[indices[i]];
+		if (target == ~0u)
+		{
+			target = nextVertex++;
+		}
+		indices[i] = target;
+	}
+
+	std::vector<char> source(static_cast<char*>(vertices), static_cast<char*>(vertices) + vertex_count * vertex_stride);
+	for (size_t v = 0; v < vertex_count; v++)
+	{
+		if (remap[v] != ~0u)
+		{
+			memcpy(static_cast<char*>(vertices) + remap[v] * vertex_stride, source.data() + v * vertex_stride, vertex_stride);
+		}
+	}
+	return nextVertex;
+}
+
+size_t MeshOptimizer::Optimize(std::vector<unsigned int>& indices, void* vertices, size_t vertex_count, size_t vertex_stride, size_t position_offset,
+	const std::vector<IndexRange>& ranges)
+{
+	report.clear();
+	auto analyze = [&]() { return AnalyzeVertexCache(indices.data(), indices.size(), vertex_count, cache_size); };
+	const float* positions = reinterpret_cast<const float*>(static_cast<const char*>(vertices) + position_offset);
+
+	// Triangles never move between ranges. Every range is compacted to local vertex ids so the
+	// per-vertex work of a stage is proportional to the range and not to the whole mesh.
+	std::vector<IndexRange> wholeMesh = { { 0, indices.size() } };
+	const std::vector<IndexRange>& stageRanges = ranges.empty() ? wholeMesh : ranges;
+	std::vector<unsigned int> localIds(vertex_count, ~0u);
+	std::vector<unsigned int> globalIds;
+	std::vector<float> localPositions;
+	auto forEachRange = [&](const std::function<void(size_t, unsigned int*, size_t, const float*, size_t)>& stage)
+	{
+		for (size_t r = 0; r < stageRanges.size(); r++)
+		{
+			unsigned int* rangeIndices = indices.data() + stageRanges[r].first;
+			const size_t count = stageRanges[r].count;
+			globalIds.clear();
+			localPositions.clear();
+			for (size_t i = 0; i < count; i++)
+			{
+				unsigned int& local = localIds[rangeIndices[i]];
+				if (local == ~0u)
+				{
+					local = static_cast<unsigned int>(globalIds.size());
+					globalIds.push_back(rangeIndices[i]);
+					const float* position = reinterpret_cast<const float*>(reinterpret_cast<const char*>(positions) + rangeIndices[i] * vertex_stride);
+					localPositions.insert(localPositions.end(), position, position + 3);
+				}
+				rangeIndices[i] = local;
+			}
+
+			stage(r, rangeIndices, count, localPositions.data(), globalIds.size());
+
+			for (size_t i = 0; i < count; i++)
+			{
+				rangeIndices[i] = globalIds[rangeIndices[i]];
+			}
+			for (unsigned int global : globalIds)
+			{
+				localIds[global] = ~0u;
+			}
+		}
+	};
+
+	MeshOptimizerStage stage;
+	stage.name = "vertex cache";
+	stage.before = analyze();
+	std::vector<std::vector<unsigned int>> clusters(stageRanges.size());
+	forEachRange([&](size_t range, unsigned int* range_indices, size_t index_count, const float*, size_t local_vertex_count)
+	{
+		OptimizeVertexCache(range_indices, index_count, local_vertex_count, cache_size, &clusters[range]);
+	});
+	stage.after = analyze();
+	report.push_back(stage);
+
+	if (optimize_overdraw)
+	{
+		stage.name = "overdraw";
+		stage.before = stage.after;
+		forEachRange([&](size_t range, unsigned int* range_indices, size_t index_count, const float* local_positions, size_t local_vertex_count)
+		{
+			OptimizeOverdraw(range_indices, index_count, local_positions, 3 * sizeof(float), local_vertex_count, clusters[range], cache_size, overdraw_threshold);
+		});
+		stage.after = analyze();
+		report.push_back(stage);
+	}
+
+	stage.name = "vertex fetch";
+	stage.before = stage.after;
+	vertex_count = OptimizeVertexFetch(indices.data(), indices.size(), vertices, vertex_count, vertex_stride);
+	stage.after = analyze();
+	report.push_back(stage);
+
+	return vertex_count;
+}
+
+std::string MeshOptimizer::FormatReport() const
+{
+	std::string result;
+	for (const MeshOptimizerStage& stage : report)
+	{
+		char line[256];
+		snprintf(line, sizeof(line), "Mesh optimizer %-12s ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", stage.name.c_str(),
+			stage.before.acmr, stage.after.acmr, stage.before.atvr, stage.after.atvr);
+		result += line;
+	}
+	return result;
+}
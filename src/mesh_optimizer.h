@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Post-transform vertex cache statistics from a FIFO cache simulation.
+// ACMR is transformed vertices per triangle, ATVR is transformed vertices per unique vertex.
+struct VertexCacheStatistics
+{
+	float acmr;
+	float atvr;
+	size_t vertices_transformed;
+};
+
+// Contiguous part of an index buffer, in indices
+struct IndexRange
+{
+	size_t first;
+	size_t count;
+};
+
+struct MeshOptimizerStage
+{
+	std::string name;
+	VertexCacheStatistics before;
+	VertexCacheStatistics after;
+};
+
+// Reorders triangle lists for the post-transform cache (Tipsify), optionally sorts the
+// resulting clusters against overdraw, then reorders vertices by first use for fetch locality.
+// Everything is CPU only so the statistics can be checked without a GPU.
+class MeshOptimizer
+{
+public:
+	MeshOptimizer(unsigned int cache_size = 16, bool optimize_overdraw = true, float overdraw_threshold = 1.05f) :
+		cache_size(cache_size), optimize_overdraw(optimize_overdraw), overdraw_threshold(overdraw_threshold) {};
+	virtual ~MeshOptimizer() {};
+
+	// Runs all stages in place. Positions are three floats at position_offset inside every vertex.
+	// Triangles are only reordered inside each range, an empty list is the whole buffer.
+	// Returns the vertex count after unreferenced vertices are dropped.
+	size_t Optimize(std::vector<unsigned int>& indices, void* vertices, size_t vertex_count, size_t vertex_stride, size_t position_offset = 0,
+		const std::vector<IndexRange>& ranges = std::vector<IndexRange>());
+
+	const std::vector<MeshOptimizerStage>& GetReport() const { return report; }
+	std::string FormatReport() const;
+
+	static VertexCacheStatistics AnalyzeVertexCache(const unsigned int* indices, size_t index_count, size_t vertex_count, unsigned int cache_size);
+
+	// Tipsify, fills clusters with the first triangle of every cache discontinuity
+	static void OptimizeVertexCache(unsigned int* indices, size_t index_count, size_t vertex_count, unsigned int cache_size,
+		std::vector<unsigned int>* clusters);
+
+	// Splits the clusters where the local ACMR allows it and sorts them by view-independent occlusion potential
+	static void OptimizeOverdraw(unsigned int* indices, size_t index_count, const float* positions, size_t position_stride, size_t vertex_count,
+		const std::vector<unsigned int>& clusters, unsigned int cache_size, float threshold);
+
+	// Reorders vertices by first use and drops unreferenced ones, returns the new vertex count
+	static size_t OptimizeVertexFetch(unsigned int* indices, size_t index_count, void* vertices, size_t vertex_count, size_t vertex_stride);
+
+protected:
+	unsigned int cache_size;
+	bool optimize_overdraw;
+	float overdraw_threshold;
+
+	std::vector<MeshOptimizerStage> report;
+};
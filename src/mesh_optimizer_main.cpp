@@ -0,0 +1,102 @@
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
+
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+#include "obj_parser.h"
+
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+
+struct ReportVertex
+{
+	float position[3];
+	int material_id;
+};
+
+struct ReportVertexHash
+{
+	size_t operator()(const ReportVertex& vertex) const
+	{
+		size_t hash = 14695981039346656037ull;
+		const float position[3] = { vertex.position[0] + 0.f, vertex.position[1] + 0.f, vertex.position[2] + 0.f };
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(position);
+		for (size_t i = 0; i < sizeof(position); i++)
+		{
+			hash = (hash ^ bytes[i]) * 1099511628211ull;
+		}
+		return hash ^ static_cast<size_t>(vertex.material_id);
+	}
+};
+
+struct ReportVertexEqual
+{
+	bool operator()(const ReportVertex& a, const ReportVertex& b) const
+	{
+		return a.position[0] == b.position[0] && a.position[1] == b.position[1] && a.position[2] == b.position[2] && a.material_id == b.material_id;
+	}
+};
+
+// Headless check of the mesh optimizer: welds the model like the renderer does, prints the cache statistics per stage
+// and the LOD chain, which has to come out the same on a single thread and on the whole pool
+int main(int argc, char** argv)
+{
+	std::string objFile = argc > 1 ? argv[1] : "CornellBox-Original.obj";
+	unsigned int cacheSize = argc > 2 ? static_cast<unsigned int>(std::stoul(argv[2])) : 16;
+	std::string directory = objFile.substr(0, objFile.find_last_of("\\/") + 1);
+
+	ThreadPool pool;
+	ObjParser parser(pool);
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::shape_t> shapes;
+	std::vector<tinyobj::material_t> materials;
+	std::string warn;
+	std::string err;
+	if (!parser.Load(&attrib, &shapes, &materials, &warn, &err, objFile.c_str(), directory.c_str()))
+	{
+		std::cout << "Failed to load " << objFile << ": " << err << std::endl;
+		return 1;
+	}
+
+	std::vector<ReportVertex> vertices;
+	std::vector<unsigned int> indices;
+	std::vector<IndexRange> shapeRanges;
+	std::unordered_map<ReportVertex, unsigned int, ReportVertexHash, ReportVertexEqual> uniqueVertices;
+	for (const tinyobj::shape_t& shape : shapes)
+	{
+		shapeRanges.push_back({ indices.size(), shape.mesh.indices.size() });
+		for (size_t i = 0; i < shape.mesh.indices.size(); i++)
+		{
+			const float* position = &attrib.vertices[3 * shape.mesh.indices[i].vertex_index];
+			ReportVertex vertex = { { position[0], position[1], position[2] }, shape.mesh.material_ids[i / 3] };
+			auto found = uniqueVertices.emplace(vertex, static_cast<unsigned int>(vertices.size())).first;
+			if (found->second == vertices.size())
+			{
+				vertices.push_back(vertex);
+			}
+			indices.push_back(found->second);
+		}
+	}
+
+	std::cout << objFile << ": " << indices.size() / 3 << " triangles, " << vertices.size() << " vertices, cache size " << cacheSize << std::endl;
+	MeshOptimizer optimizer(cacheSize);
+	optimizer.Optimize(indices, vertices.data(), vertices.size(), sizeof(ReportVertex), offsetof(ReportVertex, position), shapeRanges);
+	std::cout << optimizer.FormatReport();
+
+	std::vector<unsigned int> lodIndices = indices;
+	std::vector<MeshLod> lods;
+	MeshSimplifier simplifier(pool);
+	simplifier.Simplify(lodIndices, shapeRanges, vertices[0].position, sizeof(ReportVertex), lods);
+	std::cout << simplifier.FormatReport(lods);
+
+	ThreadPool singleThread(1);
+	std::vector<unsigned int> referenceIndices = indices;
+	std::vector<MeshLod> referenceLods;
+	MeshSimplifier(singleThread).Simplify(referenceIndices, shapeRanges, vertices[0].position, sizeof(ReportVertex), referenceLods);
+	bool deterministic = referenceIndices == lodIndices && referenceLods.size() == lods.size() &&
+		memcmp(referenceLods.data(), lods.data(), sizeof(MeshLod) * lods.size()) == 0;
+	std::cout << "LOD chain " << (deterministic ? "matches" : "DIFFERS FROM") << " the single threaded run" << std::endl;
+	return deterministic ? 0 : 1;
+}
@@ -0,0 +1,448 @@
+#include "mesh_simplifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <numeric>
+
+// Sum of squared plane distances, divided by weight it is the mean squared distance
+struct Quadric
+{
+	double a2, b2, c2, ab, ac, bc, ad, bd, cd, d2;
+	double weight;
+};
+
+struct Collapse
+{
+	double cost;
+	unsigned int from;
+	unsigned int to;
+};
+
+enum VertexKind : unsigned char
+{
+	VERTEX_KIND_FREE = 0,
+	VERTEX_KIND_BORDER = 1,
+	VERTEX_KIND_LOCKED = 2
+};
+
+static void AddPlane(Quadric& quadric, double a, double b, double c, double d, double weight)
+{
+	quadric.a2 += weight * a * a;
+	quadric.b2 += weight * b * b;
+	quadric.c2 += weight * c * c;
+	quadric.ab += weight * a * b;
+	quadric.ac += weight * a * c;
+	quadric.bc += weight * b * c;
+	quadric.ad += weight * a * d;
+	quadric.bd += weight * b * d;
+	quadric.cd += weight * c * d;
+	quadric.d2 += weight * d * d;
+	quadric.weight += weight;
+}
+
+static void AddQuadric(Quadric& quadric, const Quadric& other)
+{
+	quadric.a2 += other.a2;
+	quadric.b2 += other.b2;
+	quadric.c2 += other.c2;
+	quadric.ab += other.ab;
+	quadric.ac += other.ac;
+	quadric.bc += other.bc;
+	quadric.ad += other.ad;
+	quadric.bd += other.bd;
+	quadric.cd += other.cd;
+	quadric.d2 += other.d2;
+	quadric.weight += other.weight;
+}
+
+static double EvaluateQuadric(const Quadric& quadric, const float* position)
+{
+	const double x = position[0];
+	const double y = position[1];
+	const double z = position[2];
+	double error = quadric.a2 * x * x + quadric.b2 * y * y + quadric.c2 * z * z +
+		2.0 * (quadric.ab * x * y + quadric.ac * x * z + quadric.bc * y * z) +
+		2.0 * (quadric.ad * x + quadric.bd * y + quadric.cd * z) + quadric.d2;
+	return quadric.weight > 0.0 ? std::fabs(error) / quadric.weight : 0.0;
+}
+
+static void TriangleNormal(const float* p0, const float* p1, const float* p2, double normal[3])
+{
+	const double e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+	const double e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+	normal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+	normal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+	normal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+static unsigned long long EdgeKey(unsigned int a, unsigned int b)
+{
+	return (static_cast<unsigned long long>((std::min)(a, b)) << 32) | (std::max)(a, b);
+}
+
+// Simplifies one shape in local vertex ids, indices holds the source on entry and the last level on exit
+static void SimplifyShape(std::vector<unsigned int>& indices, const std::vector<float>& positions, const std::vector<size_t>& target_index_counts,
+	std::vector<std::vector<unsigned int>>& levels, std::vector<float>& errors)
+{
+	const size_t vertexCount = positions.size() / 3;
+	auto position = [&](unsigned int vertex) { return &positions[3 * vertex]; };
+
+	// Vertices sharing a position with another vertex sit on a material or normal seam
+	std::vector<unsigned char> kinds(vertexCount, VERTEX_KIND_FREE);
+	std::vector<unsigned int> byPosition(vertexCount);
+	std::iota(byPosition.begin(), byPosition.end(), 0u);
+	auto positionLess = [&](unsigned int a, unsigned int b)
+	{
+		return std::lexicographical_compare(position(a), position(a) + 3, position(b), position(b) + 3);
+	};
+	std::sort(byPosition.begin(), byPosition.end(), [&](unsigned int a, unsigned int b)
+	{
+		return positionLess(a, b) || (!positionLess(b, a) && a < b);
+	});
+	for (size_t begin = 0, end = 0; begin < vertexCount; begin = end)
+	{
+		for (end = begin + 1; end < vertexCount && !positionLess(byPosition[begin], byPosition[end]); end++)
+		{
+		}
+		for (size_t i = begin; end - begin > 1 && i < end; i++)
+		{
+			kinds[byPosition[i]] = VERTEX_KIND_LOCKED;
+		}
+	}
+
+	// Edges used by a single triangle, recomputed after every pass since collapses move the borders
+	std::vector<unsigned long long> edges;
+	std::vector<unsigned long long> borderEdges;
+	auto findBorders = [&]()
+	{
+		edges.clear();
+		borderEdges.clear();
+		for (size_t i = 0; i < indices.size(); i += 3)
+		{
+			for (size_t k = 0; k < 3; k++)
+			{
+				edges.push_back(EdgeKey(indices[i + k], indices[i + (k + 1) % 3]));
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+		for (size_t begin = 0, end = 0; begin < edges.size(); begin = end)
+		{
+			for (end = begin + 1; end < edges.size() && edges[end] == edges[begin]; end++)
+			{
+			}
+			if (end - begin == 1)
+			{
+				borderEdges.push_back(edges[begin]);
+			}
+		}
+		for (unsigned char& kind : kinds)
+		{
+			if (kind == VERTEX_KIND_BORDER)
+			{
+				kind = VERTEX_KIND_FREE;
+			}
+		}
+		for (unsigned long long edge : borderEdges)
+		{
+			for (unsigned int vertex : { static_cast<unsigned int>(edge >> 32), static_cast<unsigned int>(edge & 0xFFFFFFFFu) })
+			{
+				if (kinds[vertex] != VERTEX_KIND_LOCKED)
+				{
+					kinds[vertex] = VERTEX_KIND_BORDER;
+				}
+			}
+		}
+	};
+	auto isBorderEdge = [&](unsigned int a, unsigned int b)
+	{
+		return std::binary_search(borderEdges.begin(), borderEdges.end(), EdgeKey(a, b));
+	};
+	findBorders();
+
+	// Area weighted face planes, borders get an extra plane through the edge to keep the outline
+	const double borderWeight = 10.0;
+	std::vector<Quadric> quadrics(vertexCount, Quadric());
+	for (size_t i = 0; i < indices.size(); i += 3)
+	{
+		double normal[3];
+		TriangleNormal(position(indices[i]), position(indices[i + 1]), position(indices[i + 2]), normal);
+		const double length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		if (length == 0.0)
+		{
+			continue;
+		}
+		for (size_t k = 0; k < 3; k++)
+		{
+			normal[k] /= length;
+		}
+		const float* p0 = position(indices[i]);
+		const double d = -(normal[0] * p0[0] + normal[1] * p0[1] + normal[2] * p0[2]);
+		for (size_t k = 0; k < 3; k++)
+		{
+			AddPlane(quadrics[indices[i + k]], normal[0], normal[1], normal[2], d, length * 0.5);
+		}
+
+		for (size_t k = 0; k < 3; k++)
+		{
+			const unsigned int a = indices[i + k];
+			const unsigned int b = indices[i + (k + 1) % 3];
+			if (!isBorderEdge(a, b))
+			{
+				continue;
+			}
+			const float* pa = position(a);
+			const float* pb = position(b);
+			const double edge[3] = { pb[0] - pa[0], pb[1] - pa[1], pb[2] - pa[2] };
+			double side[3] = { edge[1] * normal[2] - edge[2] * normal[1], edge[2] * normal[0] - edge[0] * normal[2], edge[0] * normal[1] - edge[1] * normal[0] };
+			const double sideLength = std::sqrt(side[0] * side[0] + side[1] * side[1] + side[2] * side[2]);
+			if (sideLength == 0.0)
+			{
+				continue;
+			}
+			for (size_t j = 0; j < 3; j++)
+			{
+				side[j] /= sideLength;
+			}
+			const double sideD = -(side[0] * pa[0] + side[1] * pa[1] + side[2] * pa[2]);
+			const double weight = (edge[0] * edge[0] + edge[1] * edge[1] + edge[2] * edge[2]) * borderWeight;
+			AddPlane(quadrics[a], side[0], side[1], side[2], sideD, weight);
+			AddPlane(quadrics[b], side[0], side[1], side[2], sideD, weight);
+		}
+	}
+
+	std::vector<size_t> adjacencyOffsets;
+	std::vector<unsigned int> adjacency;
+	std::vector<Collapse> collapses;
+	std::vector<unsigned int> remap(vertexCount);
+	std::iota(remap.begin(), remap.end(), 0u);
+	std::vector<bool> touched(vertexCount);
+	double maxError = 0.0;
+
+	for (size_t target : target_index_counts)
+	{
+		while (indices.size() > target)
+		{
+			// Vertex to triangle adjacency of the current mesh
+			adjacencyOffsets.assign(vertexCount + 1, 0);
+			for (unsigned int vertex : indices)
+			{
+				adjacencyOffsets[vertex + 1]++;
+			}
+			for (size_t v = 0; v < vertexCount; v++)
+			{
+				adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+			}
+			adjacency.resize(indices.size());
+			std::vector<size_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+			for (size_t i = 0; i < indices.size(); i++)
+			{
+				adjacency[fill[indices[i]]++] = static_cast<unsigned int>(i / 3);
+			}
+
+			// Every allowed half-edge collapse, cheapest first
+			collapses.clear();
+			for (size_t i = 0; i < indices.size(); i++)
+			{
+				const unsigned int v0 = indices[i];
+				const unsigned int v1 = indices[i - i % 3 + (i + 1) % 3];
+				for (unsigned int direction = 0; direction < 2; direction++)
+				{
+					const unsigned int from = direction ? v1 : v0;
+					const unsigned int to = direction ? v0 : v1;
+					if (kinds[from] == VERTEX_KIND_LOCKED || (kinds[from] == VERTEX_KIND_BORDER && !isBorderEdge(from, to)))
+					{
+						continue;
+					}
+					Quadric merged = quadrics[from];
+					AddQuadric(merged, quadrics[to]);
+					collapses.push_back({ EvaluateQuadric(merged, position(to)), from, to });
+				}
+			}
+			std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b)
+			{
+				return a.cost < b.cost || (a.cost == b.cost && (a.from < b.from || (a.from == b.from && a.to < b.to)));
+			});
+			collapses.erase(std::unique(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b)
+			{
+				return a.from == b.from && a.to == b.to;
+			}), collapses.end());
+
+			// Independent collapses only, so the flip test of one never sees another one half applied
+			std::fill(touched.begin(), touched.end(), false);
+			const size_t triangleGoal = (indices.size() - target) / 3;
+			size_t removed = 0;
+			size_t collapsed = 0;
+			for (const Collapse& collapse : collapses)
+			{
+				if (removed >= triangleGoal)
+				{
+					break;
+				}
+				if (touched[collapse.from] || touched[collapse.to])
+				{
+					continue;
+				}
+
+				bool flips = false;
+				size_t collapsedTriangles = 0;
+				for (size_t a = adjacencyOffsets[collapse.from]; a < adjacencyOffsets[collapse.from + 1] && !flips; a++)
+				{
+					const unsigned int* triangle = &indices[3 * adjacency[a]];
+					if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+					{
+						collapsedTriangles++;
+						continue;
+					}
+					const float* before[3];
+					const float* after[3];
+					for (size_t k = 0; k < 3; k++)
+					{
+						before[k] = position(triangle[k]);
+						after[k] = position(triangle[k] == collapse.from ? collapse.to : triangle[k]);
+					}
+					double normalBefore[3];
+					double normalAfter[3];
+					TriangleNormal(before[0], before[1], before[2], normalBefore);
+					TriangleNormal(after[0], after[1], after[2], normalAfter);
+					flips = normalBefore[0] * normalAfter[0] + normalBefore[1] * normalAfter[1] + normalBefore[2] * normalAfter[2] <= 0.0;
+				}
+				if (flips)
+				{
+					continue;
+				}
+
+				for (size_t a = adjacencyOffsets[collapse.from]; a < adjacencyOffsets[collapse.from + 1]; a++)
+				{
+					const unsigned int* triangle = &indices[3 * adjacency[a]];
+					touched[triangle[0]] = touched[triangle[1]] = touched[triangle[2]] = true;
+				}
+				touched[collapse.to] = true;
+				remap[collapse.from] = collapse.to;
+				AddQuadric(quadrics[collapse.to], quadrics[collapse.from]);
+				maxError = (std::max)(maxError, collapse.cost);
+				removed += collapsedTriangles;
+				collapsed++;
+			}
+			if (collapsed == 0)
+			{
+				break;
+			}
+
+			// Apply the pass and drop the triangles that became degenerate
+			size_t written = 0;
+			for (size_t i = 0; i < indices.size(); i += 3)
+			{
+				const unsigned int a = remap[indices[i]];
+				const unsigned int b = remap[indices[i + 1]];
+				const unsigned int c = remap[indices[i + 2]];
+				if (a != b && b != c && c != a)
+				{
+					indices[written++] = a;
+					indices[written++] = b;
+					indices[written++] = c;
+				}
+			}
+			indices.resize(written);
+			std::iota(remap.begin(), remap.end(), 0u);
+			findBorders();
+		}
+
+		levels.push_back(indices);
+		errors.push_back(static_cast<float>(std::sqrt(maxError)));
+	}
+}
+
+void MeshSimplifier::Simplify(std::vector<unsigned int>& indices, const std::vector<IndexRange>& ranges, const float* positions, size_t position_stride,
+	std::vector<MeshLod>& lods)
+{
+	struct ShapeResult
+	{
+		std::vector<unsigned int> global_ids;
+		std::vector<std::vector<unsigned int>> levels;
+		std::vector<float> errors;
+	};
+	std::vector<ShapeResult> results(ranges.size());
+
+	thread_pool.ParallelFor(ranges.size(), [&](size_t s)
+	{
+		// Compact the shape to local vertex ids, sorted so the numbering is the same on every run
+		ShapeResult& result = results[s];
+		const unsigned int* shapeIndices = indices.data() + ranges[s].first;
+		const size_t indexCount = ranges[s].count / 3 * 3;
+		result.global_ids.assign(shapeIndices, shapeIndices + indexCount);
+		std::sort(result.global_ids.begin(), result.global_ids.end());
+		result.global_ids.erase(std::unique(result.global_ids.begin(), result.global_ids.end()), result.global_ids.end());
+
+		std::vector<unsigned int> localIndices(indexCount);
+		for (size_t i = 0; i < indexCount; i++)
+		{
+			localIndices[i] = static_cast<unsigned int>(std::lower_bound(result.global_ids.begin(), result.global_ids.end(), shapeIndices[i]) - result.global_ids.begin());
+		}
+		std::vector<float> localPositions(result.global_ids.size() * 3);
+		for (size_t v = 0; v < result.global_ids.size(); v++)
+		{
+			const float* position = reinterpret_cast<const float*>(reinterpret_cast<const char*>(positions) + result.global_ids[v] * position_stride);
+			std::copy(position, position + 3, &localPositions[3 * v]);
+		}
+
+		std::vector<size_t> targets;
+		for (float ratio : target_ratios)
+		{
+			targets.push_back(static_cast<size_t>(std::lround(indexCount / 3 * static_cast<double>(ratio))) * 3);
+		}
+		SimplifyShape(localIndices, localPositions, targets, result.levels, result.errors);
+	});
+
+	lods.clear();
+	for (size_t s = 0; s < ranges.size(); s++)
+	{
+		lods.push_back({ 0, static_cast<uint32_t>(s), static_cast<uint32_t>(ranges[s].first), static_cast<uint32_t>(ranges[s].count), 1.f, 0.f });
+	}
+	for (size_t level = 0; level < target_ratios.size(); level++)
+	{
+		for (size_t s = 0; s < ranges.size(); s++)
+		{
+			const ShapeResult& result = results[s];
+			MeshLod lod = {};
+			lod.level = static_cast<uint32_t>(level + 1);
+			lod.shape = static_cast<uint32_t>(s);
+			lod.index_offset = static_cast<uint32_t>(indices.size());
+			lod.index_count = static_cast<uint32_t>(result.levels[level].size());
+			lod.target_ratio = target_ratios[level];
+			lod.max_error = result.errors[level];
+			for (unsigned int local : result.levels[level])
+			{
+				indices.push_back(result.global_ids[local]);
+			}
+			lods.push_back(lod);
+		}
+	}
+}
+
+std::string MeshSimplifier::FormatReport(const std::vector<MeshLod>& lods) const
+{
+	std::string result;
+	size_t sourceIndices = 0;
+	for (uint32_t level = 0; level <= target_ratios.size(); level++)
+	{
+		size_t levelIndices = 0;
+		float levelError = 0.f;
+		for (const MeshLod& lod : lods)
+		{
+			if (lod.level == level)
+			{
+				levelIndices += lod.index_count;
+				levelError = (std::max)(levelError, lod.max_error);
+			}
+		}
+		sourceIndices = level == 0 ? levelIndices : sourceIndices;
+
+		char line[256];
+		snprintf(line, sizeof(line), "Mesh simplifier LOD %u: %zu triangles (%.1f%% of the source, target %.1f%%), max error %g\n", level,
+			levelIndices / 3, sourceIndices ? 100.0 * levelIndices / sourceIndices : 0.0,
+			level == 0 ? 100.0 : 100.0 * target_ratios[level - 1], levelError);
+		result += line;
+	}
+	return result;
+}
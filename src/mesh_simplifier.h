@@ -0,0 +1,44 @@
+#pragma once
+
+#include "mesh_optimizer.h"
+#include "thread_pool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// One shape at one level of detail, drawn as an index range of the mesh index buffer
+struct MeshLod
+{
+	uint32_t level;
+	uint32_t shape;
+	uint32_t index_offset;
+	uint32_t index_count;
+	float target_ratio;
+	float max_error;	// quadric error in position units, accumulated along the chain
+};
+
+// Quadric error metric simplifier built on half-edge collapses, so every level reuses the source
+// vertices and only needs a new index list. Vertices that share a position with another vertex
+// (material or normal seams) are locked and open borders only collapse along themselves.
+// Shapes are simplified in parallel and every shape is processed in a fixed order, so the
+// result does not depend on the thread count.
+class MeshSimplifier
+{
+public:
+	MeshSimplifier(ThreadPool& thread_pool, const std::vector<float>& target_ratios = { 0.5f, 0.25f, 0.125f }) :
+		thread_pool(thread_pool), target_ratios(target_ratios) {};
+	virtual ~MeshSimplifier() {};
+
+	// Appends the indices of every level after the source ones and fills one entry per shape and level.
+	// Level 0 describes the source ranges with zero error.
+	void Simplify(std::vector<unsigned int>& indices, const std::vector<IndexRange>& ranges, const float* positions, size_t position_stride,
+		std::vector<MeshLod>& lods);
+
+	std::string FormatReport(const std::vector<MeshLod>& lods) const;
+
+protected:
+	ThreadPool& thread_pool;
+	std::vector<float> target_ratios;
+};
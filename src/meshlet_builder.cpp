@@ -0,0 +1,200 @@
+#include "meshlet_builder.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+
+static const float* Stride(const float* data, size_t stride, size_t index)
+{
+	return reinterpret_cast<const float*>(reinterpret_cast<const char*>(data) + index * stride);
+}
+
+void MeshletBuilder::Build(const unsigned int* indices, const std::vector<IndexRange>& ranges, const float* positions, size_t position_stride,
+	size_t vertex_count, std::vector<Meshlet>& meshlets) const
+{
+	meshlets.clear();
+
+	// A vertex belongs to the open meshlet when its stamp matches the meshlet number
+	std::vector<uint32_t> stamps(vertex_count, 0);
+	uint32_t stamp = 0;
+	for (size_t r = 0; r < ranges.size(); r++)
+	{
+		const size_t rangeEnd = ranges[r].first + ranges[r].count / 3 * 3;
+		size_t meshletBegin = ranges[r].first;
+		size_t meshletVertices = 0;
+		stamp++;
+
+		auto close = [&](size_t end)
+		{
+			if (end == meshletBegin)
+			{
+				return;
+			}
+			Meshlet meshlet = {};
+			meshlet.index_offset = static_cast<uint32_t>(meshletBegin);
+			meshlet.triangle_count = static_cast<uint32_t>((end - meshletBegin) / 3);
+			meshlet.vertex_count = static_cast<uint32_t>(meshletVertices);
+			meshlet.shape = static_cast<uint32_t>(r);
+			ComputeBounds(indices + meshletBegin, end - meshletBegin, positions, position_stride, meshlet);
+			meshlets.push_back(meshlet);
+
+			meshletBegin = end;
+			meshletVertices = 0;
+			stamp++;
+		};
+
+		for (size_t i = ranges[r].first; i < rangeEnd; i += 3)
+		{
+			size_t newVertices = 0;
+			for (size_t k = 0; k < 3; k++)
+			{
+				const unsigned int vertex = indices[i + k];
+				bool repeated = (k > 0 && indices[i] == vertex) || (k > 1 && indices[i + 1] == vertex);
+				newVertices += stamps[vertex] != stamp && !repeated;
+			}
+			if (meshletVertices + newVertices > max_vertices || (i - meshletBegin) / 3 + 1 > max_triangles)
+			{
+				close(i);
+			}
+			for (size_t k = 0; k < 3; k++)
+			{
+				const unsigned int vertex = indices[i + k];
+				if (stamps[vertex] != stamp)
+				{
+					stamps[vertex] = stamp;
+					meshletVertices++;
+				}
+			}
+		}
+		close(rangeEnd);
+	}
+}
+
+void MeshletBuilder::ComputeBounds(const unsigned int* indices, size_t index_count, const float* positions, size_t position_stride, Meshlet& meshlet)
+{
+	// Bounding sphere around the center of the bounding box
+	float minimum[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float maximum[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (size_t i = 0; i < index_count; i++)
+	{
+		const float* position = Stride(positions, position_stride, indices[i]);
+		for (size_t k = 0; k < 3; k++)
+		{
+			minimum[k] = (std::min)(minimum[k], position[k]);
+			maximum[k] = (std::max)(maximum[k], position[k]);
+		}
+	}
+	float radiusSquared = 0.f;
+	for (size_t k = 0; k < 3; k++)
+	{
+		meshlet.center[k] = (minimum[k] + maximum[k]) * 0.5f;
+	}
+	for (size_t i = 0; i < index_count; i++)
+	{
+		const float* position = Stride(positions, position_stride, indices[i]);
+		float dx = position[0] - meshlet.center[0];
+		float dy = position[1] - meshlet.center[1];
+		float dz = position[2] - meshlet.center[2];
+		radiusSquared = (std::max)(radiusSquared, dx * dx + dy * dy + dz * dz);
+	}
+	meshlet.radius = std::sqrt(radiusSquared);
+
+	// Normal cone around the average triangle normal, degenerate triangles do not vote
+	const size_t triangleCount = index_count / 3;
+	std::vector<float> normals(triangleCount * 3, 0.f);
+	float axis[3] = {};
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		const float* p0 = Stride(positions, position_stride, indices[3 * t + 0]);
+		const float* p1 = Stride(positions, position_stride, indices[3 * t + 1]);
+		const float* p2 = Stride(positions, position_stride, indices[3 * t + 2]);
+		float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+		float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+		float* normal = &normals[3 * t];
+		normal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+		normal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+		normal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+		float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		float invLength = length > 0.f ? 1.f / length : 0.f;
+		for (size_t k = 0; k < 3; k++)
+		{
+			normal[k] *= invLength;
+			axis[k] += normal[k];
+		}
+	}
+
+	for (size_t k = 0; k < 3; k++)
+	{
+		meshlet.cone_apex[k] = meshlet.center[k];
+		meshlet.cone_axis[k] = 0.f;
+	}
+	meshlet.cone_cutoff = 1.f;
+
+	float axisLength = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+	if (axisLength == 0.f)
+	{
+		return;
+	}
+	for (size_t k = 0; k < 3; k++)
+	{
+		axis[k] /= axisLength;
+	}
+
+	float minimumDot = 1.f;
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		const float* normal = &normals[3 * t];
+		if (normal[0] != 0.f || normal[1] != 0.f || normal[2] != 0.f)
+		{
+			minimumDot = (std::min)(minimumDot, normal[0] * axis[0] + normal[1] * axis[1] + normal[2] * axis[2]);
+		}
+	}
+
+	// Some triangle faces sideways or backwards relative to the axis, no viewpoint sees only back faces
+	if (minimumDot <= 0.1f)
+	{
+		return;
+	}
+
+	// Move the apex back until every triangle plane lies in front of it
+	float maximumDistance = 0.f;
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		const float* normal = &normals[3 * t];
+		const float* p0 = Stride(positions, position_stride, indices[3 * t + 0]);
+		float denominator = normal[0] * axis[0] + normal[1] * axis[1] + normal[2] * axis[2];
+		if (denominator <= 0.f)
+		{
+			continue;
+		}
+		float numerator = (meshlet.center[0] - p0[0]) * normal[0] + (meshlet.center[1] - p0[1]) * normal[1] + (meshlet.center[2] - p0[2]) * normal[2];
+		maximumDistance = (std::max)(maximumDistance, numerator / denominator);
+	}
+
+	for (size_t k = 0; k < 3; k++)
+	{
+		meshlet.cone_apex[k] = meshlet.center[k] - axis[k] * maximumDistance;
+		meshlet.cone_axis[k] = axis[k];
+	}
+	meshlet.cone_cutoff = std::sqrt(1.f - minimumDot * minimumDot);
+}
+
+std::string MeshletBuilder::FormatReport(const std::vector<Meshlet>& meshlets) const
+{
+	size_t triangles = 0;
+	size_t vertices = 0;
+	size_t cones = 0;
+	for (const Meshlet& meshlet : meshlets)
+	{
+		triangles += meshlet.triangle_count;
+		vertices += meshlet.vertex_count;
+		cones += meshlet.cone_cutoff < 1.f;
+	}
+
+	char report[256];
+	const double count = meshlets.empty() ? 1.0 : static_cast<double>(meshlets.size());
+	snprintf(report, sizeof(report), "Meshlet builder: %zu meshlets, %.1f triangles and %.1f vertices on average (limits %zu/%zu), %zu with a normal cone\n",
+		meshlets.size(), triangles / count, vertices / count, max_triangles, max_vertices, cones);
+	return report;
+}
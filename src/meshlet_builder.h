@@ -0,0 +1,47 @@
+#pragma once
+
+#include "mesh_optimizer.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Contiguous run of triangles in the mesh index buffer with its culling bounds.
+// The cone follows the clockwise front face of the default rasterizer state: the whole cluster
+// faces away from a viewer when dot(normalize(cone_apex - eye), cone_axis) >= cone_cutoff.
+struct Meshlet
+{
+	uint32_t index_offset;
+	uint32_t triangle_count;
+	uint32_t vertex_count;
+	uint32_t shape;
+	float center[3];
+	float radius;
+	float cone_apex[3];
+	float cone_axis[3];
+	float cone_cutoff;	// 1 when the normals are too spread out for a cone
+};
+static_assert(sizeof(Meshlet) == 60, "Meshlet is stored in the mesh cache, keep it packed");
+
+// Splits every shape range of an optimized index buffer into meshlets without reordering it,
+// so each meshlet can be drawn as an index range of the existing buffer.
+class MeshletBuilder
+{
+public:
+	MeshletBuilder(size_t max_vertices = 64, size_t max_triangles = 124) :
+		max_vertices(max_vertices), max_triangles(max_triangles) {};
+	virtual ~MeshletBuilder() {};
+
+	// Positions are three floats per vertex, ranges are in indices and name the shape of each meshlet
+	void Build(const unsigned int* indices, const std::vector<IndexRange>& ranges, const float* positions, size_t position_stride,
+		size_t vertex_count, std::vector<Meshlet>& meshlets) const;
+
+	std::string FormatReport(const std::vector<Meshlet>& meshlets) const;
+
+	static void ComputeBounds(const unsigned int* indices, size_t index_count, const float* positions, size_t position_stride, Meshlet& meshlet);
+
+protected:
+	size_t max_vertices;
+	size_t max_triangles;
+};
@@ -0,0 +1,706 @@
+#include "obj_parser.h"
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+// The number and index parsers mirror tinyobjloader so the results are bit identical
+
+#define IS_SPACE(x) (((x) == ' ') || ((x) == '\t'))
+#define IS_DIGIT(x) (static_cast<unsigned int>((x) - '0') < static_cast<unsigned int>(10))
+#define IS_NEW_LINE(x) (((x) == '\r') || ((x) == '\n') || ((x) == '\0'))
+
+static bool TryParseDouble(const char* s, const char* s_end, double* result)
+{
+	if (s >= s_end)
+	{
+		return false;
+	}
+
+	double mantissa = 0.0;
+	int exponent = 0;
+	char sign = '+';
+	char expSign = '+';
+	const char* curr = s;
+	int read = 0;
+	bool endNotReached = false;
+	bool leadingDecimalDots = false;
+
+	if (*curr == '+' || *curr == '-')
+	{
+		sign = *curr;
+		curr++;
+		if ((curr != s_end) && (*curr == '.'))
+		{
+			leadingDecimalDots = true;
+		}
+	}
+	else if (*curr == '.')
+	{
+		leadingDecimalDots = true;
+	}
+	else if (!IS_DIGIT(*curr))
+	{
+		return false;
+	}
+
+	// Integer part
+	endNotReached = (curr != s_end);
+	if (!leadingDecimalDots)
+	{
+		while (endNotReached && IS_DIGIT(*curr))
+		{
+			mantissa *= 10;
+			mantissa += static_cast<int>(*curr - 0x30);
+			curr++;
+			read++;
+			endNotReached = (curr != s_end);
+		}
+		if (read == 0)
+		{
+			return false;
+		}
+	}
+
+	// Decimal part
+	if (endNotReached && *curr == '.')
+	{
+		static const double powLut[] = { 1.0, 0.1, 0.01, 0.001, 0.0001, 0.00001, 0.000001, 0.0000001 };
+		const int lutEntries = sizeof(powLut) / sizeof(powLut[0]);
+
+		curr++;
+		read = 1;
+		endNotReached = (curr != s_end);
+		while (endNotReached && IS_DIGIT(*curr))
+		{
+			mantissa += static_cast<int>(*curr - 0x30) * (read < lutEntries ? powLut[read] : std::pow(10.0, -read));
+			read++;
+			curr++;
+			endNotReached = (curr != s_end);
+		}
+	}
+
+	// Exponent part
+	if (endNotReached && (*curr == 'e' || *curr == 'E'))
+	{
+		curr++;
+		endNotReached = (curr != s_end);
+		if (endNotReached && (*curr == '+' || *curr == '-'))
+		{
+			expSign = *curr;
+			curr++;
+		}
+		else if (!IS_DIGIT(*curr))
+		{
+			return false;
+		}
+
+		read = 0;
+		endNotReached = (curr != s_end);
+		while (endNotReached && IS_DIGIT(*curr))
+		{
+			if (exponent > (2147483647 / 10))
+			{
+				return false;
+			}
+			exponent *= 10;
+			exponent += static_cast<int>(*curr - 0x30);
+			curr++;
+			read++;
+			endNotReached = (curr != s_end);
+		}
+		exponent *= (expSign == '+' ? 1 : -1);
+		if (read == 0)
+		{
+			return false;
+		}
+	}
+
+	*result = (sign == '+' ? 1 : -1) * (exponent ? std::ldexp(mantissa * std::pow(5.0, exponent), exponent) : mantissa);
+	return true;
+}
+
+static bool ParseReal(const char** token, tinyobj::real_t* out)
+{
+	(*token) += strspn((*token), " \t");
+	const char* end = (*token) + strcspn((*token), " \t\r");
+	double value = 0.0;
+	bool parsed = TryParseDouble((*token), end, &value);
+	if (parsed)
+	{
+		*out = static_cast<tinyobj::real_t>(value);
+	}
+	(*token) = end;
+	return parsed;
+}
+
+static tinyobj::real_t ParseReal(const char** token)
+{
+	tinyobj::real_t value = 0.f;
+	ParseReal(token, &value);
+	return value;
+}
+
+static std::string ParseString(const char** token)
+{
+	(*token) += strspn((*token), " \t");
+	size_t length = strcspn((*token), " \t\r");
+	std::string result((*token), length);
+	(*token) += length;
+	return result;
+}
+
+// Negative indices are kept relative to the chunk and flagged, the merge pass adds the chunk base
+static bool FixIndex(int index, size_t local_count, unsigned char relative_flag, int* out, unsigned char* flags)
+{
+	if (index > 0)
+	{
+		*out = index - 1;
+		return true;
+	}
+	if (index == 0)
+	{
+		return false;
+	}
+	*out = static_cast<int>(local_count) + index;
+	*flags |= relative_flag;
+	return true;
+}
+
+void ObjParser::ParseChunk(Chunk& chunk)
+{
+	// Lines are copied into a terminated buffer so the C string scanners can't run past the mapping
+	std::string line;
+	const char* cursor = chunk.begin;
+	while (cursor < chunk.end)
+	{
+		const char* lineEnd = cursor;
+		while (lineEnd < chunk.end && *lineEnd != '\n' && *lineEnd != '\r')
+		{
+			lineEnd++;
+		}
+		line.assign(cursor, lineEnd);
+		chunk.line_count++;
+
+		// Same terminators as tinyobj: "\n", "\r\n" and a lone "\r"
+		cursor = lineEnd;
+		if (cursor < chunk.end && *cursor == '\r')
+		{
+			cursor++;
+		}
+		if (cursor < chunk.end && *cursor == '\n' && (cursor == lineEnd || *lineEnd == '\r'))
+		{
+			cursor++;
+		}
+
+		const char* token = line.c_str();
+		token += strspn(token, " \t");
+		if (token[0] == '\0' || token[0] == '#')
+		{
+			continue;
+		}
+
+		if (token[0] == 'v' && IS_SPACE(token[1]))
+		{
+			token += 2;
+			tinyobj::real_t x = ParseReal(&token);
+			tinyobj::real_t y = ParseReal(&token);
+			tinyobj::real_t z = ParseReal(&token);
+			tinyobj::real_t r, g, b;
+			if (!(ParseReal(&token, &r) && ParseReal(&token, &g) && ParseReal(&token, &b)))
+			{
+				r = g = b = 1.f;
+			}
+			chunk.vertices.push_back(x);
+			chunk.vertices.push_back(y);
+			chunk.vertices.push_back(z);
+			chunk.colors.push_back(r);
+			chunk.colors.push_back(g);
+			chunk.colors.push_back(b);
+			continue;
+		}
+
+		if (token[0] == 'v' && token[1] == 'n' && IS_SPACE(token[2]))
+		{
+			token += 3;
+			tinyobj::real_t x = ParseReal(&token);
+			tinyobj::real_t y = ParseReal(&token);
+			tinyobj::real_t z = ParseReal(&token);
+			chunk.normals.push_back(x);
+			chunk.normals.push_back(y);
+			chunk.normals.push_back(z);
+			continue;
+		}
+
+		if (token[0] == 'v' && token[1] == 't' && IS_SPACE(token[2]))
+		{
+			token += 3;
+			tinyobj::real_t x = ParseReal(&token);
+			tinyobj::real_t y = ParseReal(&token);
+			chunk.texcoords.push_back(x);
+			chunk.texcoords.push_back(y);
+			continue;
+		}
+
+		if (token[0] == 'f' && IS_SPACE(token[1]))
+		{
+			token += 2;
+			token += strspn(token, " \t");
+
+			const size_t vertexCount = chunk.vertices.size() / 3;
+			const size_t normalCount = chunk.normals.size() / 3;
+			const size_t texcoordCount = chunk.texcoords.size() / 2;
+			while (!IS_NEW_LINE(token[0]))
+			{
+				Corner corner = { -1, -1, -1, 0 };
+				bool valid = FixIndex(atoi(token), vertexCount, CORNER_RELATIVE_V, &corner.v, &corner.flags);
+				token += strcspn(token, "/ \t\r");
+				if (valid && token[0] == '/')
+				{
+					token++;
+					if (token[0] == '/')
+					{
+						// i//k
+						token++;
+						valid = FixIndex(atoi(token), normalCount, CORNER_RELATIVE_VN, &corner.vn, &corner.flags);
+						token += strcspn(token, "/ \t\r");
+					}
+					else
+					{
+						// i/j or i/j/k
+						valid = FixIndex(atoi(token), texcoordCount, CORNER_RELATIVE_VT, &corner.vt, &corner.flags);
+						token += strcspn(token, "/ \t\r");
+						if (valid && token[0] == '/')
+						{
+							token++;
+							valid = FixIndex(atoi(token), normalCount, CORNER_RELATIVE_VN, &corner.vn, &corner.flags);
+							token += strcspn(token, "/ \t\r");
+						}
+					}
+				}
+
+				if (!valid)
+				{
+					chunk.failed = true;
+					chunk.error_line = chunk.line_count;
+					return;
+				}
+
+				chunk.corners.push_back(corner);
+				token += strspn(token, " \t\r");
+			}
+			chunk.face_offsets.push_back(chunk.corners.size());
+			continue;
+		}
+
+		Event event = { EVENT_GROUP, chunk.face_offsets.size() - 1, chunk.vertices.size() / 3, chunk.line_count, 0, std::string() };
+		if (strncmp(token, "usemtl", 6) == 0 && IS_SPACE(token[6]))
+		{
+			event.type = EVENT_USEMTL;
+			event.text = token + 7;
+		}
+		else if (strncmp(token, "mtllib", 6) == 0 && IS_SPACE(token[6]))
+		{
+			event.type = EVENT_MTLLIB;
+			event.text = token + 7;
+		}
+		else if (token[0] == 'g' && IS_SPACE(token[1]))
+		{
+			// Multiple group names are joined with a space, the leading "g" is dropped
+			std::vector<std::string> names;
+			while (!IS_NEW_LINE(token[0]))
+			{
+				names.push_back(ParseString(&token));
+				token += strspn(token, " \t\r");
+			}
+			event.type = EVENT_GROUP;
+			for (size_t i = 1; i < names.size(); i++)
+			{
+				event.text += (i > 1 ? " " : "") + names[i];
+			}
+		}
+		else if (token[0] == 'o' && IS_SPACE(token[1]))
+		{
+			event.type = EVENT_OBJECT;
+			event.text = token + 2;
+		}
+		else if (token[0] == 's' && IS_SPACE(token[1]))
+		{
+			token += 2;
+			token += strspn(token, " \t");
+			if (token[0] == '\0' || token[0] == '\r' || token[1] == '\n')
+			{
+				continue;
+			}
+			event.type = EVENT_SMOOTHING;
+			if (strlen(token) >= 3 && token[0] == 'o' && token[1] == 'f' && token[2] == 'f')
+			{
+				event.value = 0;
+			}
+			else
+			{
+				int group = atoi(token);
+				event.value = group < 0 ? 0 : static_cast<unsigned int>(group);
+			}
+		}
+		else
+		{
+			// Lines, points, tags and unknown statements
+			continue;
+		}
+		chunk.events.push_back(std::move(event));
+	}
+}
+
+size_t ObjParser::Triangulate(const Chunk& chunk, size_t face, size_t export_vertex_count,
+	const std::vector<tinyobj::real_t>& vertices, tinyobj::index_t* out)
+{
+	const size_t begin = chunk.face_offsets[face];
+	const size_t cornerCount = chunk.face_offsets[face + 1] - begin;
+	if (cornerCount < 3)
+	{
+		return 0;
+	}
+
+	auto resolve = [&](size_t corner)
+	{
+		const Corner& raw = chunk.corners[begin + corner];
+		tinyobj::index_t index;
+		index.vertex_index = raw.v + ((raw.flags & CORNER_RELATIVE_V) ? static_cast<int>(chunk.vertex_base) : 0);
+		index.texcoord_index = raw.vt + ((raw.flags & CORNER_RELATIVE_VT) ? static_cast<int>(chunk.texcoord_base) : 0);
+		index.normal_index = raw.vn + ((raw.flags & CORNER_RELATIVE_VN) ? static_cast<int>(chunk.normal_base) : 0);
+		return index;
+	};
+
+	if (cornerCount == 3)
+	{
+		if (out)
+		{
+			out[0] = resolve(0);
+			out[1] = resolve(1);
+			out[2] = resolve(2);
+		}
+		return 1;
+	}
+
+	// Polygons need positions that were already defined when tinyobj exported the group
+	tinyobj::index_t polygon[4];
+	for (size_t i = 0; i < cornerCount; i++)
+	{
+		tinyobj::index_t index = resolve(i);
+		if (index.vertex_index < 0 || static_cast<size_t>(index.vertex_index) >= export_vertex_count)
+		{
+			return 0;
+		}
+		if (i < 4)
+		{
+			polygon[i] = index;
+		}
+	}
+
+	if (cornerCount == 4)
+	{
+		if (out)
+		{
+			// Split along the shorter diagonal
+			const tinyobj::real_t* v0 = &vertices[3 * polygon[0].vertex_index];
+			const tinyobj::real_t* v1 = &vertices[3 * polygon[1].vertex_index];
+			const tinyobj::real_t* v2 = &vertices[3 * polygon[2].vertex_index];
+			const tinyobj::real_t* v3 = &vertices[3 * polygon[3].vertex_index];
+			tinyobj::real_t e02x = v2[0] - v0[0];
+			tinyobj::real_t e02y = v2[1] - v0[1];
+			tinyobj::real_t e02z = v2[2] - v0[2];
+			tinyobj::real_t e13x = v3[0] - v1[0];
+			tinyobj::real_t e13y = v3[1] - v1[1];
+			tinyobj::real_t e13z = v3[2] - v1[2];
+			tinyobj::real_t sqr02 = e02x * e02x + e02y * e02y + e02z * e02z;
+			tinyobj::real_t sqr13 = e13x * e13x + e13y * e13y + e13z * e13z;
+			if (sqr02 < sqr13)
+			{
+				out[0] = polygon[0]; out[1] = polygon[1]; out[2] = polygon[2];
+				out[3] = polygon[0]; out[4] = polygon[2]; out[5] = polygon[3];
+			}
+			else
+			{
+				out[0] = polygon[0]; out[1] = polygon[1]; out[2] = polygon[3];
+				out[3] = polygon[1]; out[4] = polygon[2]; out[5] = polygon[3];
+			}
+		}
+		return 2;
+	}
+
+	if (out)
+	{
+		tinyobj::index_t first = resolve(0);
+		for (size_t i = 1; i + 1 < cornerCount; i++)
+		{
+			*out++ = first;
+			*out++ = resolve(i);
+			*out++ = resolve(i + 1);
+		}
+	}
+	return cornerCount - 2;
+}
+
+bool ObjParser::Load(tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes, std::vector<tinyobj::material_t>* materials,
+	std::string* warn, std::string* err, const char* filename, const char* mtl_basedir)
+{
+	attrib->vertices.clear();
+	attrib->normals.clear();
+	attrib->texcoords.clear();
+	attrib->colors.clear();
+	shapes->clear();
+
+	MappedFile file;
+	if (!file.Open(filename))
+	{
+		if (err)
+		{
+			(*err) += "Cannot open file [" + std::string(filename) + "]\n";
+		}
+		return false;
+	}
+
+	// Split on line boundaries
+	const char* data = file.GetData();
+	const size_t size = file.GetSize();
+	size_t chunkCount = (std::min)((std::max)(size / min_chunk_size, static_cast<size_t>(1)), thread_pool.GetThreadCount() * 4);
+	std::vector<Chunk> chunks;
+	chunks.reserve(chunkCount);
+	size_t chunkBegin = 0;
+	for (size_t i = 0; i < chunkCount && chunkBegin < size; i++)
+	{
+		size_t chunkEnd = (i + 1 == chunkCount) ? size : (std::max)(chunkBegin + 1, size * (i + 1) / chunkCount);
+		while (chunkEnd < size && data[chunkEnd - 1] != '\n')
+		{
+			chunkEnd++;
+		}
+
+		Chunk chunk = {};
+		chunk.begin = data + chunkBegin;
+		chunk.end = data + chunkEnd;
+		chunk.face_offsets.push_back(0);
+		chunks.push_back(std::move(chunk));
+		chunkBegin = chunkEnd;
+	}
+
+	thread_pool.ParallelFor(chunks.size(), [&](size_t i) { ParseChunk(chunks[i]); });
+
+	// Prefix attribute counts give every chunk its base for relative indices
+	size_t vertexCount = 0;
+	size_t normalCount = 0;
+	size_t texcoordCount = 0;
+	size_t lineCount = 0;
+	for (Chunk& chunk : chunks)
+	{
+		chunk.vertex_base = vertexCount;
+		chunk.normal_base = normalCount;
+		chunk.texcoord_base = texcoordCount;
+		chunk.line_base = lineCount;
+		if (chunk.failed)
+		{
+			if (err)
+			{
+				std::stringstream ss;
+				ss << "Failed parse `f' line(e.g. zero value for face index. line " << chunk.line_base + chunk.error_line << ".)\n";
+				(*err) += ss.str();
+			}
+			return false;
+		}
+		vertexCount += chunk.vertices.size() / 3;
+		normalCount += chunk.normals.size() / 3;
+		texcoordCount += chunk.texcoords.size() / 2;
+		lineCount += chunk.line_count;
+	}
+
+	attrib->vertices.resize(vertexCount * 3);
+	attrib->colors.resize(vertexCount * 3);
+	attrib->normals.resize(normalCount * 3);
+	attrib->texcoords.resize(texcoordCount * 2);
+	thread_pool.ParallelFor(chunks.size(), [&](size_t i)
+	{
+		const Chunk& chunk = chunks[i];
+		std::copy(chunk.vertices.begin(), chunk.vertices.end(), attrib->vertices.begin() + chunk.vertex_base * 3);
+		std::copy(chunk.colors.begin(), chunk.colors.end(), attrib->colors.begin() + chunk.vertex_base * 3);
+		std::copy(chunk.normals.begin(), chunk.normals.end(), attrib->normals.begin() + chunk.normal_base * 3);
+		std::copy(chunk.texcoords.begin(), chunk.texcoords.end(), attrib->texcoords.begin() + chunk.texcoord_base * 2);
+	});
+
+	// Replay group, material and smoothing state in file order
+	std::vector<Run> runs;
+	std::vector<PendingShape> pendingShapes(1);
+	std::vector<size_t> pendingRuns;
+	std::map<std::string, int> materialMap;
+	int materialId = -1;
+	unsigned int smoothingGroupId = 0;
+	std::string name;
+
+	auto exportGroup = [&](size_t export_vertex_count)
+	{
+		for (size_t run : pendingRuns)
+		{
+			runs[run].export_vertex_count = export_vertex_count;
+			runs[run].shape = pendingShapes.size() - 1;
+			pendingShapes.back().runs.push_back(run);
+		}
+		pendingShapes.back().name = name;
+		bool exported = !pendingRuns.empty();
+		pendingRuns.clear();
+		return exported;
+	};
+	auto addRun = [&](size_t chunk, size_t face_begin, size_t face_end)
+	{
+		if (face_end > face_begin)
+		{
+			Run run = { chunk, face_begin, face_end, materialId, smoothingGroupId, 0, 0, 0, 0 };
+			pendingRuns.push_back(runs.size());
+			runs.push_back(run);
+		}
+	};
+
+	for (size_t c = 0; c < chunks.size(); c++)
+	{
+		const Chunk& chunk = chunks[c];
+		size_t faceCursor = 0;
+		for (const Event& event : chunk.events)
+		{
+			addRun(c, faceCursor, event.face_index);
+			faceCursor = event.face_index;
+
+			const size_t eventVertexCount = chunk.vertex_base + event.vertex_count;
+			switch (event.type)
+			{
+			case EVENT_SMOOTHING:
+				smoothingGroupId = event.value;
+				break;
+
+			case EVENT_USEMTL:
+			{
+				int newMaterialId = -1;
+				auto found = materialMap.find(event.text);
+				if (found != materialMap.end())
+				{
+					newMaterialId = found->second;
+				}
+				else if (warn)
+				{
+					(*warn) += "material [ '" + event.text + "' ] not found in .mtl\n";
+				}
+				if (newMaterialId != materialId)
+				{
+					exportGroup(eventVertexCount);
+					materialId = newMaterialId;
+				}
+				break;
+			}
+
+			case EVENT_MTLLIB:
+			{
+				std::vector<std::string> fileNames;
+				std::stringstream ss(event.text);
+				std::string item;
+				while (std::getline(ss, item, ' '))
+				{
+					fileNames.push_back(item);
+				}
+
+				bool found = false;
+				for (const std::string& fileName : fileNames)
+				{
+					std::ifstream mtlStream((mtl_basedir ? std::string(mtl_basedir) : std::string()) + fileName);
+					if (mtlStream)
+					{
+						std::string mtlWarn;
+						std::string mtlErr;
+						tinyobj::LoadMtl(&materialMap, materials, &mtlStream, &mtlWarn, &mtlErr);
+						if (warn)
+						{
+							(*warn) += mtlWarn;
+						}
+						if (err)
+						{
+							(*err) += mtlErr;
+						}
+						found = true;
+						break;
+					}
+				}
+				if (!found && warn)
+				{
+					(*warn) += "Failed to load material file(s). Use default material.\n";
+				}
+				break;
+			}
+
+			case EVENT_GROUP:
+			case EVENT_OBJECT:
+				// A group only survives with triangles, an object also when it had faces
+				pendingShapes.back().keep_empty = exportGroup(eventVertexCount) && event.type == EVENT_OBJECT;
+				pendingShapes.emplace_back();
+				name = event.text;
+				break;
+			}
+		}
+		addRun(c, faceCursor, chunk.face_offsets.size() - 1);
+	}
+	pendingShapes.back().keep_empty = exportGroup(vertexCount);
+
+	// Count, lay out and write triangles
+	thread_pool.ParallelFor(runs.size(), [&](size_t i)
+	{
+		Run& run = runs[i];
+		for (size_t face = run.face_begin; face < run.face_end; face++)
+		{
+			run.triangle_count += Triangulate(chunks[run.chunk], face, run.export_vertex_count, attrib->vertices, nullptr);
+		}
+	});
+
+	std::vector<size_t> shapeSlots(pendingShapes.size(), SIZE_MAX);
+	for (size_t s = 0; s < pendingShapes.size(); s++)
+	{
+		size_t triangleCount = 0;
+		for (size_t run : pendingShapes[s].runs)
+		{
+			runs[run].triangle_offset = triangleCount;
+			triangleCount += runs[run].triangle_count;
+		}
+		if (triangleCount == 0 && !pendingShapes[s].keep_empty)
+		{
+			continue;
+		}
+
+		shapeSlots[s] = shapes->size();
+		shapes->emplace_back();
+		tinyobj::shape_t& shape = shapes->back();
+		shape.name = pendingShapes[s].name;
+		shape.mesh.indices.resize(triangleCount * 3);
+		shape.mesh.num_face_vertices.resize(triangleCount, 3);
+		shape.mesh.material_ids.resize(triangleCount);
+		shape.mesh.smoothing_group_ids.resize(triangleCount);
+	}
+
+	thread_pool.ParallelFor(runs.size(), [&](size_t i)
+	{
+		const Run& run = runs[i];
+		if (shapeSlots[run.shape] == SIZE_MAX)
+		{
+			return;
+		}
+
+		tinyobj::mesh_t& mesh = (*shapes)[shapeSlots[run.shape]].mesh;
+		tinyobj::index_t* out = mesh.indices.data() + run.triangle_offset * 3;
+		for (size_t face = run.face_begin; face < run.face_end; face++)
+		{
+			out += 3 * Triangulate(chunks[run.chunk], face, run.export_vertex_count, attrib->vertices, out);
+		}
+		std::fill_n(mesh.material_ids.begin() + run.triangle_offset, run.triangle_count, run.material_id);
+		std::fill_n(mesh.smoothing_group_ids.begin() + run.triangle_offset, run.triangle_count, run.smoothing_group_id);
+	});
+
+	return true;
+}
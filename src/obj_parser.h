@@ -0,0 +1,113 @@
+#pragma once
+
+#include "thread_pool.h"
+
+#include "tiny_obj_loader.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Parallel drop-in for tinyobj::LoadObj with triangulation enabled.
+// The memory-mapped file is split on line boundaries and every chunk is tokenized on the pool,
+// then a serial merge pass resolves relative indices, mtllib/usemtl and group state,
+// and the faces are triangulated into the shapes in parallel again.
+// Lines and points ('l', 'p') are skipped, polygons with more than four corners are fan triangulated.
+class ObjParser
+{
+public:
+	ObjParser(ThreadPool& thread_pool) : thread_pool(thread_pool), min_chunk_size(1 << 20) {};
+	virtual ~ObjParser() {};
+
+	bool Load(tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes, std::vector<tinyobj::material_t>* materials,
+		std::string* warn, std::string* err, const char* filename, const char* mtl_basedir = nullptr);
+
+	// Smaller chunks expose more parallelism on small files at the cost of merge overhead
+	void SetMinChunkSize(size_t size) { min_chunk_size = size; }
+
+protected:
+	enum EventType
+	{
+		EVENT_GROUP,
+		EVENT_OBJECT,
+		EVENT_USEMTL,
+		EVENT_MTLLIB,
+		EVENT_SMOOTHING
+	};
+
+	struct Event
+	{
+		EventType type;
+		size_t face_index;
+		size_t vertex_count;
+		size_t line;
+		unsigned int value;
+		std::string text;
+	};
+
+	// Relative corners are stored against the chunk-local attribute counts and flagged for rebasing
+	enum CornerFlags : unsigned char
+	{
+		CORNER_RELATIVE_V = 1,
+		CORNER_RELATIVE_VT = 2,
+		CORNER_RELATIVE_VN = 4
+	};
+
+	struct Corner
+	{
+		int v, vt, vn;
+		unsigned char flags;
+	};
+
+	struct Chunk
+	{
+		const char* begin;
+		const char* end;
+		size_t line_count;
+		size_t error_line;
+		bool failed;
+
+		std::vector<tinyobj::real_t> vertices;
+		std::vector<tinyobj::real_t> normals;
+		std::vector<tinyobj::real_t> texcoords;
+		std::vector<tinyobj::real_t> colors;
+		std::vector<Corner> corners;
+		std::vector<size_t> face_offsets;
+		std::vector<Event> events;
+
+		size_t vertex_base;
+		size_t normal_base;
+		size_t texcoord_base;
+		size_t line_base;
+	};
+
+	// Consecutive faces of one chunk sharing material and smoothing group
+	struct Run
+	{
+		size_t chunk;
+		size_t face_begin;
+		size_t face_end;
+		int material_id;
+		unsigned int smoothing_group_id;
+		size_t export_vertex_count;
+		size_t shape;
+		size_t triangle_offset;
+		size_t triangle_count;
+	};
+
+	struct PendingShape
+	{
+		std::string name;
+		std::vector<size_t> runs;
+		bool keep_empty;
+	};
+
+	ThreadPool& thread_pool;
+	size_t min_chunk_size;
+
+	static void ParseChunk(Chunk& chunk);
+
+	// Returns the triangle count of a face and writes its corners when out is not null
+	static size_t Triangulate(const Chunk& chunk, size_t face, size_t export_vertex_count, const std::vector<tinyobj::real_t>& vertices,
+		tinyobj::index_t* out);
+};
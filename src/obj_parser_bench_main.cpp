@@ -0,0 +1,146 @@
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
+
+#include "obj_parser.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+struct ObjResult
+{
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::shape_t> shapes;
+	std::vector<tinyobj::material_t> materials;
+};
+
+static bool SameIndex(const tinyobj::index_t& a, const tinyobj::index_t& b)
+{
+	return a.vertex_index == b.vertex_index && a.normal_index == b.normal_index && a.texcoord_index == b.texcoord_index;
+}
+
+static bool SameResult(const ObjResult& a, const ObjResult& b, std::string* difference)
+{
+	if (a.attrib.vertices != b.attrib.vertices) { *difference = "vertices"; return false; }
+	if (a.attrib.normals != b.attrib.normals) { *difference = "normals"; return false; }
+	if (a.attrib.texcoords != b.attrib.texcoords) { *difference = "texcoords"; return false; }
+	if (a.attrib.colors != b.attrib.colors) { *difference = "colors"; return false; }
+	if (a.materials.size() != b.materials.size()) { *difference = "material count"; return false; }
+	if (a.shapes.size() != b.shapes.size()) { *difference = "shape count"; return false; }
+
+	for (size_t s = 0; s < a.shapes.size(); s++)
+	{
+		const tinyobj::mesh_t& meshA = a.shapes[s].mesh;
+		const tinyobj::mesh_t& meshB = b.shapes[s].mesh;
+		if (a.shapes[s].name != b.shapes[s].name ||
+			meshA.num_face_vertices != meshB.num_face_vertices ||
+			meshA.material_ids != meshB.material_ids ||
+			meshA.smoothing_group_ids != meshB.smoothing_group_ids ||
+			meshA.indices.size() != meshB.indices.size() ||
+			!std::equal(meshA.indices.begin(), meshA.indices.end(), meshB.indices.begin(), SameIndex))
+		{
+			*difference = "shape " + a.shapes[s].name;
+			return false;
+		}
+	}
+	return true;
+}
+
+// Repeats the model, mtllib is kept only once so both parsers see the same material list
+static size_t WriteScaledModel(const std::string& source_file, const std::string& scaled_file, size_t copies)
+{
+	std::ifstream source(source_file, std::ios::binary);
+	std::stringstream content;
+	content << source.rdbuf();
+
+	std::string body;
+	std::string header;
+	std::string line;
+	while (std::getline(content, line))
+	{
+		(line.compare(0, 7, "mtllib ") == 0 ? header : body) += line + "\n";
+	}
+
+	std::ofstream scaled(scaled_file, std::ios::binary);
+	scaled << header;
+	for (size_t i = 0; i < copies; i++)
+	{
+		scaled << body;
+	}
+	return header.size() + body.size() * copies;
+}
+
+template <typename Load>
+static double BestOfRuns(int runs, ObjResult* result, Load load)
+{
+	double best = 1e30;
+	for (int i = 0; i < runs; i++)
+	{
+		*result = ObjResult();
+		auto start = std::chrono::high_resolution_clock::now();
+		load(result);
+		std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+		best = (std::min)(best, elapsed.count());
+	}
+	return best;
+}
+
+int main(int argc, char** argv)
+{
+	std::string sourceFile = argc > 1 ? argv[1] : "CornellBox-Original.obj";
+	size_t copies = argc > 2 ? static_cast<size_t>(std::stoull(argv[2])) : 20000;
+	const int runs = 3;
+
+	std::string directory = sourceFile.substr(0, sourceFile.find_last_of("\\/") + 1);
+	std::string scaledFile = sourceFile + ".scaled.obj";
+	size_t bytes = WriteScaledModel(sourceFile, scaledFile, copies);
+	double megabytes = bytes / (1024.0 * 1024.0);
+	std::cout << "Model " << sourceFile << " x" << copies << " = " << megabytes << " MB" << std::endl;
+
+	ObjResult reference;
+	std::string warn;
+	std::string err;
+	bool loaded = true;
+	double referenceTime = BestOfRuns(runs, &reference, [&](ObjResult* result)
+	{
+		warn.clear();
+		err.clear();
+		loaded = tinyobj::LoadObj(&result->attrib, &result->shapes, &result->materials, &warn, &err, scaledFile.c_str(), directory.c_str());
+	});
+	if (!loaded)
+	{
+		std::cout << "tinyobj failed: " << err << std::endl;
+		return 1;
+	}
+	std::cout << "tinyobj          " << referenceTime * 1000.0 << " ms, " << megabytes / referenceTime << " MB/s" << std::endl;
+
+	int exitCode = 0;
+	size_t maxThreads = (std::max)(std::thread::hardware_concurrency(), 1u);
+	for (size_t threads = 1; threads <= maxThreads; threads = (threads * 2 > maxThreads && threads != maxThreads) ? maxThreads : threads * 2)
+	{
+		ThreadPool pool(threads);
+		ObjParser parser(pool);
+		ObjResult result;
+		double time = BestOfRuns(runs, &result, [&](ObjResult* result)
+		{
+			warn.clear();
+			err.clear();
+			loaded = parser.Load(&result->attrib, &result->shapes, &result->materials, &warn, &err, scaledFile.c_str(), directory.c_str());
+		});
+
+		std::string difference;
+		bool same = loaded && SameResult(reference, result, &difference);
+		std::cout << "ObjParser " << threads << " threads " << time * 1000.0 << " ms, " << megabytes / time << " MB/s, "
+			<< referenceTime / time << "x vs tinyobj, " << (same ? "identical" : "MISMATCH in " + difference + err) << std::endl;
+		if (!same)
+		{
+			exitCode = 1;
+		}
+	}
+
+	std::remove(scaledFile.c_str());
+	return exitCode;
+}
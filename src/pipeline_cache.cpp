@@ -0,0 +1,289 @@
+#include "pipeline_cache.h"
+
+static bool ReadFileBytes(const std::wstring& file_name, std::vector<UINT8>& data)
+{
+	HANDLE file = CreateFile(file_name.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	DWORD done = 0;
+	bool read = GetFileSizeEx(file, &fileSize) && fileSize.QuadPart < (1ll << 31);
+	if (read)
+	{
+		data.resize(static_cast<size_t>(fileSize.QuadPart));
+		read = data.empty() || (ReadFile(file, data.data(), static_cast<DWORD>(data.size()), &done, nullptr) && done == data.size());
+	}
+	CloseHandle(file);
+	return read;
+}
+
+static bool WriteFileBytes(const std::wstring& file_name, const std::vector<UINT8>& data)
+{
+	// Write into a temporary file first so a crash never leaves a half written cache behind
+	std::wstring tempFile = file_name + L".tmp";
+	HANDLE out = CreateFile(tempFile.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (out == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	DWORD done = 0;
+	const bool written = WriteFile(out, data.data(), static_cast<DWORD>(data.size()), &done, nullptr) && done == data.size();
+	CloseHandle(out);
+	if (!written || !MoveFileEx(tempFile.c_str(), file_name.c_str(), MOVEFILE_REPLACE_EXISTING))
+	{
+		DeleteFile(tempFile.c_str());
+		return false;
+	}
+	return true;
+}
+
+#ifdef DX12_RUNTIME_SHADERS
+static std::wstring Widen(const std::string& value)
+{
+	std::wstring result(value.size(), L'\0');
+	result.resize(MultiByteToWideChar(CP_UTF8, 0, value.data(), static_cast<int>(value.size()), result.data(), static_cast<int>(result.size())));
+	return result;
+}
+
+static std::string Narrow(const std::wstring& value)
+{
+	std::string result(value.size() * 3, '\0');
+	result.resize(WideCharToMultiByte(CP_UTF8, 0, value.data(), static_cast<int>(value.size()), result.data(), static_cast<int>(result.size()), nullptr, nullptr));
+	return result;
+}
+
+// Resolves includes next to the shader and records what they contained
+class RecordingInclude : public ID3DInclude
+{
+public:
+	RecordingInclude(std::wstring shader_directory) : shader_directory(shader_directory) {}
+
+	HRESULT __stdcall Open(D3D_INCLUDE_TYPE, LPCSTR file_name, LPCVOID, LPCVOID* data, UINT* size) override
+	{
+		std::vector<UINT8>* contents = new std::vector<UINT8>();
+		if (!ReadFileBytes(shader_directory + Widen(file_name), *contents))
+		{
+			delete contents;
+			return E_FAIL;
+		}
+		dependencies.push_back({ file_name, PipelineCacheFormat::Hash(contents->data(), contents->size()) });
+		open_files.push_back(contents);
+		*data = contents->data();
+		*size = static_cast<UINT>(contents->size());
+		return S_OK;
+	}
+
+	HRESULT __stdcall Close(LPCVOID data) override
+	{
+		for (size_t i = 0; i < open_files.size(); i++)
+		{
+			if (open_files[i]->data() == data)
+			{
+				delete open_files[i];
+				open_files.erase(open_files.begin() + i);
+				break;
+			}
+		}
+		return S_OK;
+	}
+
+	std::vector<ShaderCacheDependency> dependencies;
+
+private:
+	std::wstring shader_directory;
+	std::vector<std::vector<UINT8>*> open_files;
+};
+
+ShaderCache::ShaderCache(std::wstring cache_directory) : cache_directory(cache_directory), hits(0), misses(0)
+{
+	CreateDirectory(cache_directory.c_str(), nullptr);
+}
+
+ComPtr<ID3DBlob> ShaderCache::Compile(const std::wstring& shader_file, const char* entry_point, const char* target, UINT flags,
+	const D3D_SHADER_MACRO* defines)
+{
+	std::vector<UINT8> source;
+	if (!ReadFileBytes(shader_file, source))
+	{
+		ThrowIfFailed(HRESULT_FROM_WIN32(GetLastError()));
+	}
+
+	ShaderCacheKeyInput keyInput;
+	keyInput.source.assign(source.begin(), source.end());
+	for (const D3D_SHADER_MACRO* define = defines; define && define->Name; define++)
+	{
+		keyInput.defines.push_back({ define->Name, define->Definition ? define->Definition : "" });
+	}
+	keyInput.entry_point = entry_point;
+	keyInput.target = target;
+	keyInput.flags = flags;
+	keyInput.compiler_version = D3D_COMPILER_VERSION;
+	const UINT64 key = PipelineCacheFormat::ComputeShaderKey(keyInput);
+
+	const std::wstring::size_type separator = shader_file.find_last_of(L"\\/");
+	const std::wstring shaderDirectory = shader_file.substr(0, separator + 1);
+	const std::wstring cacheFile = cache_directory + L"\\" + shader_file.substr(separator + 1) + L"." + Widen(entry_point) + L"." + Widen(target) + L".cso";
+
+	// Warm path, no compiler involved
+	std::vector<UINT8> entry;
+	std::vector<ShaderCacheDependency> dependencies;
+	const UINT8* bytecode = nullptr;
+	size_t bytecodeSize = 0;
+	if (ReadFileBytes(cacheFile, entry) &&
+		PipelineCacheFormat::ReadShaderEntry(entry.data(), entry.size(), key, dependencies, &bytecode, &bytecodeSize) &&
+		DependenciesMatch(shaderDirectory, dependencies))
+	{
+		ComPtr<ID3DBlob> blob;
+		ThrowIfFailed(D3DCreateBlob(bytecodeSize, &blob));
+		memcpy(blob->GetBufferPointer(), bytecode, bytecodeSize);
+		hits++;
+		return blob;
+	}
+
+	misses++;
+	RecordingInclude include(shaderDirectory);
+	ComPtr<ID3DBlob> blob;
+	ComPtr<ID3DBlob> error;
+	const HRESULT hr = D3DCompile(source.data(), source.size(), Narrow(shader_file).c_str(), defines, &include, entry_point, target,
+		flags, 0, &blob, &error);
+	if (error)
+	{
+		OutputDebugStringA(static_cast<const char*>(error->GetBufferPointer()));
+	}
+	ThrowIfFailed(hr);
+
+	// A cache that can't be written only costs the next start a compile
+	if (!WriteFileBytes(cacheFile, PipelineCacheFormat::WriteShaderEntry(key, include.dependencies, blob->GetBufferPointer(), blob->GetBufferSize())))
+	{
+		OutputDebugString((L"Failed to write shader cache " + cacheFile + L"\n").c_str());
+	}
+	return blob;
+}
+
+bool ShaderCache::DependenciesMatch(const std::wstring& shader_directory, const std::vector<ShaderCacheDependency>& dependencies) const
+{
+	for (const ShaderCacheDependency& dependency : dependencies)
+	{
+		std::vector<UINT8> contents;
+		if (!ReadFileBytes(shader_directory + Widen(dependency.path), contents) ||
+			PipelineCacheFormat::Hash(contents.data(), contents.size()) != dependency.content_hash)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+#endif
+
+PipelineLibrary::PipelineLibrary(ID3D12Device* device, IDXGIAdapter1* adapter, std::wstring cache_file) :
+	device(device), cache_file(cache_file), identity(), dirty(false), stale(false), hits(0), misses(0)
+{
+	DXGI_ADAPTER_DESC1 adapterDescriptor;
+	ThrowIfFailed(adapter->GetDesc1(&adapterDescriptor));
+	identity.vendor_id = adapterDescriptor.VendorId;
+	identity.device_id = adapterDescriptor.DeviceId;
+	LARGE_INTEGER driverVersion = {};
+	if (SUCCEEDED(adapter->CheckInterfaceSupport(__uuidof(IDXGIDevice), &driverVersion)))
+	{
+		identity.driver_version = static_cast<UINT64>(driverVersion.QuadPart);
+	}
+
+	ComPtr<ID3D12Device1> device1;
+	if (FAILED(device->QueryInterface(IID_PPV_ARGS(&device1))))
+	{
+		OutputDebugString(L"Pipeline libraries are not supported, pipelines are created on every start\n");
+		return;
+	}
+
+	// The driver has the final say, a blob it rejects is dropped and the library starts empty
+	std::vector<UINT8> data;
+	const UINT8* blob = nullptr;
+	size_t blobSize = 0;
+	if (ReadFileBytes(cache_file, data) && PipelineCacheFormat::ReadPipelineCache(data.data(), data.size(), identity, &blob, &blobSize))
+	{
+		library_data.assign(blob, blob + blobSize);
+		if (FAILED(device1->CreatePipelineLibrary(library_data.data(), library_data.size(), IID_PPV_ARGS(&library))))
+		{
+			OutputDebugString(L"Pipeline cache rejected by the driver\n");
+			library_data.clear();
+		}
+	}
+	if (!library && FAILED(device1->CreatePipelineLibrary(nullptr, 0, IID_PPV_ARGS(&library))))
+	{
+		OutputDebugString(L"Failed to create a pipeline library, pipelines are created on every start\n");
+	}
+}
+
+ComPtr<ID3D12PipelineState> PipelineLibrary::CreateGraphicsPipeline(const wchar_t* name, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& descriptor)
+{
+	ComPtr<ID3D12PipelineState> pipelineState;
+	if (library && SUCCEEDED(library->LoadGraphicsPipeline(name, &descriptor, IID_PPV_ARGS(&pipelineState))))
+	{
+		hits++;
+		return pipelineState;
+	}
+
+	misses++;
+	ThrowIfFailed(device->CreateGraphicsPipelineState(&descriptor, IID_PPV_ARGS(&pipelineState)));
+	Store(name, pipelineState.Get());
+	return pipelineState;
+}
+
+ComPtr<ID3D12PipelineState> PipelineLibrary::CreateComputePipeline(const wchar_t* name, const D3D12_COMPUTE_PIPELINE_STATE_DESC& descriptor)
+{
+	ComPtr<ID3D12PipelineState> pipelineState;
+	if (library && SUCCEEDED(library->LoadComputePipeline(name, &descriptor, IID_PPV_ARGS(&pipelineState))))
+	{
+		hits++;
+		return pipelineState;
+	}
+
+	misses++;
+	ThrowIfFailed(device->CreateComputePipelineState(&descriptor, IID_PPV_ARGS(&pipelineState)));
+	Store(name, pipelineState.Get());
+	return pipelineState;
+}
+
+bool PipelineLibrary::Save()
+{
+	if (stale)
+	{
+		return DeleteFile(cache_file.c_str()) || GetLastError() == ERROR_FILE_NOT_FOUND;
+	}
+	if (!library || !dirty)
+	{
+		return true;
+	}
+
+	std::vector<UINT8> blob(library->GetSerializedSize());
+	if (FAILED(library->Serialize(blob.data(), blob.size())))
+	{
+		return false;
+	}
+	dirty = false;
+	return WriteFileBytes(cache_file, PipelineCacheFormat::WritePipelineCache(identity, blob.data(), blob.size()));
+}
+
+void PipelineLibrary::Store(const wchar_t* name, ID3D12PipelineState* pipeline_state)
+{
+	if (!library)
+	{
+		return;
+	}
+
+	// A name already stored with another descriptor can't be replaced, the library is rebuilt next start
+	if (SUCCEEDED(library->StorePipeline(name, pipeline_state)))
+	{
+		dirty = true;
+	}
+	else
+	{
+		OutputDebugString((std::wstring(L"Pipeline cache entry is stale: ") + name + L"\n").c_str());
+		stale = true;
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "dx12_labs.h"
+#include "pipeline_cache_format.h"
+
+#include <string>
+#include <vector>
+
+#ifdef DX12_RUNTIME_SHADERS
+// Compiles shaders through an on-disk cache of bytecode, only built in the runtime shader mode. An entry is reused when the source,
+// defines, entry point, target, flags and compiler version hash to the same key and every file
+// the shader included still has the content it had when the entry was written.
+class ShaderCache
+{
+public:
+	ShaderCache(std::wstring cache_directory);
+	virtual ~ShaderCache() {}
+
+	ComPtr<ID3DBlob> Compile(const std::wstring& shader_file, const char* entry_point, const char* target, UINT flags,
+		const D3D_SHADER_MACRO* defines = nullptr);
+
+	UINT GetHits() const { return hits; }
+	UINT GetMisses() const { return misses; }
+
+protected:
+	std::wstring cache_directory;
+	UINT hits;
+	UINT misses;
+
+	bool DependenciesMatch(const std::wstring& shader_directory, const std::vector<ShaderCacheDependency>& dependencies) const;
+};
+#endif
+
+// Pipeline states backed by an ID3D12PipelineLibrary that is serialized at shutdown and loaded at
+// startup. A cache from another adapter or driver, or a driver that rejects it, starts an empty
+// library, and without library support pipelines are simply created every time.
+class PipelineLibrary
+{
+public:
+	PipelineLibrary(ID3D12Device* device, IDXGIAdapter1* adapter, std::wstring cache_file);
+	virtual ~PipelineLibrary() {}
+
+	PipelineLibrary(const PipelineLibrary&) = delete;
+	PipelineLibrary& operator=(const PipelineLibrary&) = delete;
+
+	// The name identifies the pipeline in the library, a changed descriptor under the same name misses
+	ComPtr<ID3D12PipelineState> CreateGraphicsPipeline(const wchar_t* name, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& descriptor);
+	ComPtr<ID3D12PipelineState> CreateComputePipeline(const wchar_t* name, const D3D12_COMPUTE_PIPELINE_STATE_DESC& descriptor);
+
+	// Writes the library back when pipelines were added since it was loaded, or drops it when an entry went stale
+	bool Save();
+
+	UINT GetHits() const { return hits; }
+	UINT GetMisses() const { return misses; }
+
+protected:
+	ComPtr<ID3D12Device> device;
+	std::wstring cache_file;
+	PipelineCacheIdentity identity;
+
+	std::vector<UINT8> library_data;	// the library reads from it for as long as it lives
+	ComPtr<ID3D12PipelineLibrary> library;
+	bool dirty;
+	bool stale;
+	UINT hits;
+	UINT misses;
+
+	void Store(const wchar_t* name, ID3D12PipelineState* pipeline_state);
+};
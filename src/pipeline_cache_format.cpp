@@ -0,0 +1,153 @@
+#include "pipeline_cache_format.h"
+
+#include <cstring>
+
+uint64_t PipelineCacheFormat::Hash(uint64_t hash, const void* data, size_t size)
+{
+	// FNV-1a, same as the mesh cache
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+uint64_t PipelineCacheFormat::ComputeShaderKey(const ShaderCacheKeyInput& input)
+{
+	// Strings are hashed with their length so adjacent fields can't shift into each other
+	uint64_t hash = hash_seed;
+	auto hashString = [&hash](const std::string& value)
+	{
+		const uint64_t length = value.size();
+		hash = Hash(hash, &length, sizeof(length));
+		hash = Hash(hash, value.data(), value.size());
+	};
+
+	hashString(input.source);
+	hashString(input.entry_point);
+	hashString(input.target);
+	hash = Hash(hash, &input.flags, sizeof(input.flags));
+	hash = Hash(hash, &input.compiler_version, sizeof(input.compiler_version));
+
+	const uint64_t defineCount = input.defines.size();
+	hash = Hash(hash, &defineCount, sizeof(defineCount));
+	for (const std::pair<std::string, std::string>& define : input.defines)
+	{
+		hashString(define.first);
+		hashString(define.second);
+	}
+	return hash;
+}
+
+std::vector<uint8_t> PipelineCacheFormat::WriteShaderEntry(uint64_t key, const std::vector<ShaderCacheDependency>& dependencies, const void* bytecode, size_t bytecode_size)
+{
+	ShaderEntryHeader header = {};
+	header.magic = shader_magic;
+	header.version = version;
+	header.key = key;
+	header.dependency_count = static_cast<uint32_t>(dependencies.size());
+	header.bytecode_size = bytecode_size;
+	header.bytecode_hash = Hash(bytecode, bytecode_size);
+
+	std::vector<uint8_t> data;
+	auto append = [&data](const void* bytes, size_t size)
+	{
+		data.insert(data.end(), static_cast<const uint8_t*>(bytes), static_cast<const uint8_t*>(bytes) + size);
+	};
+	append(&header, sizeof(header));
+	for (const ShaderCacheDependency& dependency : dependencies)
+	{
+		const uint32_t pathLength = static_cast<uint32_t>(dependency.path.size());
+		append(&dependency.content_hash, sizeof(dependency.content_hash));
+		append(&pathLength, sizeof(pathLength));
+		append(dependency.path.data(), dependency.path.size());
+	}
+	append(bytecode, bytecode_size);
+	return data;
+}
+
+bool PipelineCacheFormat::ReadShaderEntry(const uint8_t* data, size_t size, uint64_t key, std::vector<ShaderCacheDependency>& dependencies,
+	const uint8_t** bytecode, size_t* bytecode_size)
+{
+	ShaderEntryHeader header;
+	if (size < sizeof(header))
+	{
+		return false;
+	}
+	memcpy(&header, data, sizeof(header));
+	if (header.magic != shader_magic || header.version != version || header.key != key)
+	{
+		return false;
+	}
+
+	size_t offset = sizeof(header);
+	dependencies.clear();
+	for (uint32_t i = 0; i < header.dependency_count; i++)
+	{
+		ShaderCacheDependency dependency;
+		uint32_t pathLength;
+		if (size - offset < sizeof(dependency.content_hash) + sizeof(pathLength))
+		{
+			return false;
+		}
+		memcpy(&dependency.content_hash, data + offset, sizeof(dependency.content_hash));
+		memcpy(&pathLength, data + offset + sizeof(dependency.content_hash), sizeof(pathLength));
+		offset += sizeof(dependency.content_hash) + sizeof(pathLength);
+		if (size - offset < pathLength)
+		{
+			return false;
+		}
+		dependency.path.assign(reinterpret_cast<const char*>(data + offset), pathLength);
+		offset += pathLength;
+		dependencies.push_back(dependency);
+	}
+
+	if (size - offset != header.bytecode_size || Hash(data + offset, static_cast<size_t>(header.bytecode_size)) != header.bytecode_hash)
+	{
+		return false;
+	}
+	*bytecode = data + offset;
+	*bytecode_size = static_cast<size_t>(header.bytecode_size);
+	return true;
+}
+
+std::vector<uint8_t> PipelineCacheFormat::WritePipelineCache(const PipelineCacheIdentity& identity, const void* blob, size_t blob_size)
+{
+	PipelineCacheHeader header = {};
+	header.magic = pipeline_magic;
+	header.version = version;
+	header.vendor_id = identity.vendor_id;
+	header.device_id = identity.device_id;
+	header.driver_version = identity.driver_version;
+	header.blob_size = blob_size;
+	header.blob_hash = Hash(blob, blob_size);
+
+	std::vector<uint8_t> data(sizeof(header) + blob_size);
+	memcpy(data.data(), &header, sizeof(header));
+	memcpy(data.data() + sizeof(header), blob, blob_size);
+	return data;
+}
+
+bool PipelineCacheFormat::ReadPipelineCache(const uint8_t* data, size_t size, const PipelineCacheIdentity& identity, const uint8_t** blob, size_t* blob_size)
+{
+	PipelineCacheHeader header;
+	if (size < sizeof(header))
+	{
+		return false;
+	}
+	memcpy(&header, data, sizeof(header));
+	if (header.magic != pipeline_magic || header.version != version || header.vendor_id != identity.vendor_id ||
+		header.device_id != identity.device_id || header.driver_version != identity.driver_version)
+	{
+		return false;
+	}
+	if (size - sizeof(header) != header.blob_size || Hash(data + sizeof(header), static_cast<size_t>(header.blob_size)) != header.blob_hash)
+	{
+		return false;
+	}
+	*blob = data + sizeof(header);
+	*blob_size = static_cast<size_t>(header.blob_size);
+	return true;
+}
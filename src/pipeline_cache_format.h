@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Everything that decides the bytecode before the compiler runs. Included files are only known
+// after compiling, so they are stored as dependencies of the cache entry instead.
+struct ShaderCacheKeyInput
+{
+	std::string source;
+	std::vector<std::pair<std::string, std::string>> defines;
+	std::string entry_point;
+	std::string target;
+	uint32_t flags;
+	uint32_t compiler_version;
+};
+
+struct ShaderCacheDependency
+{
+	std::string path;
+	uint64_t content_hash;
+};
+
+// Adapter and driver the serialized pipeline library was created on
+struct PipelineCacheIdentity
+{
+	uint32_t vendor_id;
+	uint32_t device_id;
+	uint64_t driver_version;
+};
+
+// On-disk layout of the shader and pipeline caches. Kept free of D3D so it builds anywhere.
+//
+// Shader entry: header, dependency_count x { content_hash, path_length, path }, bytecode
+// Pipeline cache: header, serialized library blob
+class PipelineCacheFormat
+{
+public:
+	static constexpr uint32_t shader_magic = 0x43484453; // "SDHC"
+	static constexpr uint32_t pipeline_magic = 0x434C5350; // "PSLC"
+	static constexpr uint32_t version = 1;
+
+	static uint64_t Hash(uint64_t hash, const void* data, size_t size);
+	static uint64_t Hash(const void* data, size_t size) { return Hash(hash_seed, data, size); }
+	static uint64_t ComputeShaderKey(const ShaderCacheKeyInput& input);
+
+	static std::vector<uint8_t> WriteShaderEntry(uint64_t key, const std::vector<ShaderCacheDependency>& dependencies, const void* bytecode, size_t bytecode_size);
+
+	// Fails on a different key, an old version or a damaged file. The bytecode points into data.
+	static bool ReadShaderEntry(const uint8_t* data, size_t size, uint64_t key, std::vector<ShaderCacheDependency>& dependencies,
+		const uint8_t** bytecode, size_t* bytecode_size);
+
+	static std::vector<uint8_t> WritePipelineCache(const PipelineCacheIdentity& identity, const void* blob, size_t blob_size);
+
+	// Fails when the cache was written on another adapter or driver, the blob points into data
+	static bool ReadPipelineCache(const uint8_t* data, size_t size, const PipelineCacheIdentity& identity, const uint8_t** blob, size_t* blob_size);
+
+protected:
+	static constexpr uint64_t hash_seed = 14695981039346656037ull;
+
+	struct ShaderEntryHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t key;
+		uint32_t dependency_count;
+		uint32_t reserved;
+		uint64_t bytecode_size;
+		uint64_t bytecode_hash;
+	};
+
+	struct PipelineCacheHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t vendor_id;
+		uint32_t device_id;
+		uint64_t driver_version;
+		uint64_t blob_size;
+		uint64_t blob_hash;
+	};
+};
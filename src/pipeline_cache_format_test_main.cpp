@@ -0,0 +1,184 @@
+#include "pipeline_cache_format.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what)
+{
+	if (!condition)
+	{
+		std::cout << "FAILED: " << what << std::endl;
+		failures++;
+	}
+}
+
+static ShaderCacheKeyInput MakeKeyInput()
+{
+	ShaderCacheKeyInput input;
+	input.source = "float4 PSMain() : SV_TARGET { return 1; }";
+	input.defines = { { "SHADOWS", "1" }, { "LIGHT_COUNT", "4" } };
+	input.entry_point = "PSMain";
+	input.target = "ps_6_0";
+	input.flags = 0x1;
+	input.compiler_version = 0x10007;
+	return input;
+}
+
+// Every field that decides the bytecode has to change the key, and moving text between fields must not collide
+static void TestShaderKey()
+{
+	const ShaderCacheKeyInput base = MakeKeyInput();
+	const uint64_t key = PipelineCacheFormat::ComputeShaderKey(base);
+	Check(key == PipelineCacheFormat::ComputeShaderKey(MakeKeyInput()), "same input gives the same key");
+
+	ShaderCacheKeyInput input = base;
+	input.source += " ";
+	Check(PipelineCacheFormat::ComputeShaderKey(input) != key, "key changes with the source");
+
+	input = base;
+	input.defines[1].second = "8";
+	Check(PipelineCacheFormat::ComputeShaderKey(input) != key, "key changes with a define value");
+	input = base;
+	input.defines.pop_back();
+	Check(PipelineCacheFormat::ComputeShaderKey(input) != key, "key changes with the define count");
+
+	input = base;
+	input.entry_point = "VSMain";
+	Check(PipelineCacheFormat::ComputeShaderKey(input) != key, "key changes with the entry point");
+
+	input = base;
+	input.target = "ps_6_6";
+	Check(PipelineCacheFormat::ComputeShaderKey(input) != key, "key changes with the target");
+
+	input = base;
+	input.flags = 0x3;
+	Check(PipelineCacheFormat::ComputeShaderKey(input) != key, "key changes with the flags");
+
+	input = base;
+	input.compiler_version++;
+	Check(PipelineCacheFormat::ComputeShaderKey(input) != key, "key changes with the compiler version");
+
+	ShaderCacheKeyInput shifted = base;
+	shifted.entry_point = "PSMainps_6";
+	shifted.target = "_0";
+	Check(PipelineCacheFormat::ComputeShaderKey(shifted) != key, "text moved between fields changes the key");
+}
+
+static void TestShaderEntry()
+{
+	const uint64_t key = PipelineCacheFormat::ComputeShaderKey(MakeKeyInput());
+	const std::vector<ShaderCacheDependency> dependencies = { { "common.hlsli", 0x1234567890ABCDEFull }, { "lighting.hlsli", 42 } };
+	std::vector<uint8_t> bytecode(1000);
+	for (size_t i = 0; i < bytecode.size(); i++)
+	{
+		bytecode[i] = static_cast<uint8_t>(i * 7);
+	}
+	const std::vector<uint8_t> entry = PipelineCacheFormat::WriteShaderEntry(key, dependencies, bytecode.data(), bytecode.size());
+
+	std::vector<ShaderCacheDependency> readDependencies;
+	const uint8_t* readBytecode = nullptr;
+	size_t readBytecodeSize = 0;
+	const bool read = PipelineCacheFormat::ReadShaderEntry(entry.data(), entry.size(), key, readDependencies, &readBytecode, &readBytecodeSize);
+	Check(read, "written entry reads back");
+	if (read)
+	{
+		Check(readBytecodeSize == bytecode.size() && std::equal(bytecode.begin(), bytecode.end(), readBytecode), "same bytecode");
+		Check(readDependencies.size() == dependencies.size(), "same dependency count");
+		for (size_t i = 0; i < dependencies.size() && i < readDependencies.size(); i++)
+		{
+			Check(readDependencies[i].path == dependencies[i].path && readDependencies[i].content_hash == dependencies[i].content_hash,
+				"same dependencies");
+		}
+	}
+
+	Check(!PipelineCacheFormat::ReadShaderEntry(entry.data(), entry.size(), key + 1, readDependencies, &readBytecode, &readBytecodeSize),
+		"wrong key is rejected");
+
+	// The version follows the magic in the header
+	std::vector<uint8_t> badVersion = entry;
+	badVersion[sizeof(uint32_t)]++;
+	Check(!PipelineCacheFormat::ReadShaderEntry(badVersion.data(), badVersion.size(), key, readDependencies, &readBytecode, &readBytecodeSize),
+		"bad version is rejected");
+
+	// Cut inside the header, inside the dependencies and inside the bytecode
+	for (size_t size : { size_t(0), size_t(16), size_t(45), entry.size() - bytecode.size() - 3, entry.size() - 1 })
+	{
+		Check(!PipelineCacheFormat::ReadShaderEntry(entry.data(), size, key, readDependencies, &readBytecode, &readBytecodeSize),
+			"truncated entry is rejected");
+	}
+
+	std::vector<uint8_t> corrupted = entry;
+	corrupted[entry.size() - bytecode.size() / 2] ^= 0x10;
+	Check(!PipelineCacheFormat::ReadShaderEntry(corrupted.data(), corrupted.size(), key, readDependencies, &readBytecode, &readBytecodeSize),
+		"corrupted bytecode is rejected");
+
+	std::vector<uint8_t> extended = entry;
+	extended.push_back(0);
+	Check(!PipelineCacheFormat::ReadShaderEntry(extended.data(), extended.size(), key, readDependencies, &readBytecode, &readBytecodeSize),
+		"trailing bytes are rejected");
+}
+
+static void TestPipelineCache()
+{
+	const PipelineCacheIdentity identity = { 0x10DE, 0x2684, 0x0020000F00A1B2C3ull };
+	std::vector<uint8_t> blob(4096);
+	for (size_t i = 0; i < blob.size(); i++)
+	{
+		blob[i] = static_cast<uint8_t>(i ^ (i >> 8));
+	}
+	const std::vector<uint8_t> cache = PipelineCacheFormat::WritePipelineCache(identity, blob.data(), blob.size());
+
+	const uint8_t* readBlob = nullptr;
+	size_t readBlobSize = 0;
+	const bool read = PipelineCacheFormat::ReadPipelineCache(cache.data(), cache.size(), identity, &readBlob, &readBlobSize);
+	Check(read, "written pipeline cache reads back");
+	if (read)
+	{
+		Check(readBlobSize == blob.size() && std::equal(blob.begin(), blob.end(), readBlob), "same library blob");
+	}
+
+	PipelineCacheIdentity other = identity;
+	other.vendor_id = 0x1002;
+	Check(!PipelineCacheFormat::ReadPipelineCache(cache.data(), cache.size(), other, &readBlob, &readBlobSize), "other vendor is rejected");
+	other = identity;
+	other.device_id++;
+	Check(!PipelineCacheFormat::ReadPipelineCache(cache.data(), cache.size(), other, &readBlob, &readBlobSize), "other adapter is rejected");
+	other = identity;
+	other.driver_version++;
+	Check(!PipelineCacheFormat::ReadPipelineCache(cache.data(), cache.size(), other, &readBlob, &readBlobSize), "other driver is rejected");
+
+	std::vector<uint8_t> badVersion = cache;
+	badVersion[sizeof(uint32_t)]++;
+	Check(!PipelineCacheFormat::ReadPipelineCache(badVersion.data(), badVersion.size(), identity, &readBlob, &readBlobSize),
+		"bad pipeline cache version is rejected");
+
+	for (size_t size : { size_t(0), size_t(20), cache.size() - blob.size(), cache.size() - 1 })
+	{
+		Check(!PipelineCacheFormat::ReadPipelineCache(cache.data(), size, identity, &readBlob, &readBlobSize), "truncated pipeline cache is rejected");
+	}
+
+	std::vector<uint8_t> corrupted = cache;
+	corrupted.back() ^= 0x01;
+	Check(!PipelineCacheFormat::ReadPipelineCache(corrupted.data(), corrupted.size(), identity, &readBlob, &readBlobSize),
+		"corrupted pipeline cache is rejected");
+}
+
+// Checks the shader and pipeline cache formats on buffers in memory. Has no Windows dependencies.
+int main()
+{
+	TestShaderKey();
+	TestShaderEntry();
+	TestPipelineCache();
+
+	if (failures)
+	{
+		std::cout << failures << " checks failed" << std::endl;
+		return 1;
+	}
+	std::cout << "Pipeline cache format: all checks passed" << std::endl;
+	return 0;
+}
@@ -0,0 +1,158 @@
+#include "presenter.h"
+
+Presenter::Presenter(IDXGIFactory4* factory, ID3D12CommandQueue* queue, HWND hwnd, UINT width, UINT height, DXGI_FORMAT format, UINT buffer_count,
+	UINT max_frame_latency) :
+	frame_latency_waitable(nullptr), tearing_supported(false), mode(PRESENT_MODE_NO_VSYNC), max_frame_latency(0), counter_frequency(0), sample_time(0),
+	pending_input_time(0), frame_input_time(0), statistics()
+{
+	// Tearing needs the DXGI 1.5 factory and a system that allows it
+	ComPtr<IDXGIFactory5> factory5;
+	BOOL allowTearing = FALSE;
+	if (SUCCEEDED(factory->QueryInterface(IID_PPV_ARGS(&factory5))) &&
+		SUCCEEDED(factory5->CheckFeatureSupport(DXGI_FEATURE_PRESENT_ALLOW_TEARING, &allowTearing, sizeof(allowTearing))))
+	{
+		tearing_supported = allowTearing == TRUE;
+	}
+
+	DXGI_SWAP_CHAIN_DESC1 swapChainDescriptor = {};
+	swapChainDescriptor.BufferCount = buffer_count;
+	swapChainDescriptor.Width = width;
+	swapChainDescriptor.Height = height;
+	swapChainDescriptor.Format = format;
+	swapChainDescriptor.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
+	swapChainDescriptor.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD;
+	swapChainDescriptor.SampleDesc.Count = 1;
+	swapChainDescriptor.Flags = DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT;
+	if (tearing_supported)
+	{
+		swapChainDescriptor.Flags |= DXGI_SWAP_CHAIN_FLAG_ALLOW_TEARING;
+	}
+
+	ComPtr<IDXGISwapChain1> tempSwapChain;
+	ThrowIfFailed(factory->CreateSwapChainForHwnd(queue, hwnd, &swapChainDescriptor, nullptr, nullptr, &tempSwapChain));
+	ThrowIfFailed(factory->MakeWindowAssociation(hwnd, DXGI_MWA_NO_ALT_ENTER));
+	ThrowIfFailed(tempSwapChain.As(&swap_chain));
+
+	SetMaximumFrameLatency(max_frame_latency);
+	frame_latency_waitable = swap_chain->GetFrameLatencyWaitableObject();
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	counter_frequency = static_cast<UINT64>(frequency.QuadPart);
+}
+
+Presenter::~Presenter()
+{
+	if (frame_latency_waitable)
+	{
+		CloseHandle(frame_latency_waitable);
+	}
+}
+
+void Presenter::WaitForFrame()
+{
+	const UINT64 waitStart = GetCounter();
+	WaitForSingleObjectEx(frame_latency_waitable, 1000, TRUE);
+
+	sample_time = GetCounter();
+	statistics[mode].wait_milliseconds += ToMilliseconds(sample_time - waitStart);
+	frame_input_time = pending_input_time;
+	pending_input_time = 0;
+}
+
+void Presenter::OnInput()
+{
+	if (pending_input_time == 0)
+	{
+		pending_input_time = GetCounter();
+	}
+}
+
+void Presenter::Present()
+{
+	// Tearing is only allowed with a sync interval of 0
+	switch (mode)
+	{
+	case PRESENT_MODE_VSYNC:
+		ThrowIfFailed(swap_chain->Present(1, 0));
+		break;
+	case PRESENT_MODE_TEARING:
+		ThrowIfFailed(swap_chain->Present(0, DXGI_PRESENT_ALLOW_TEARING));
+		break;
+	default:
+		ThrowIfFailed(swap_chain->Present(0, 0));
+		break;
+	}
+
+	const UINT64 presentTime = GetCounter();
+	PresentLatencyStatistics& modeStatistics = statistics[mode];
+	modeStatistics.frame_count++;
+	modeStatistics.sample_to_present_milliseconds += ToMilliseconds(presentTime - sample_time);
+	if (frame_input_time != 0)
+	{
+		const double latency = ToMilliseconds(presentTime - frame_input_time);
+		modeStatistics.input_count++;
+		modeStatistics.input_to_present_milliseconds += latency;
+		modeStatistics.max_input_to_present_milliseconds = max(modeStatistics.max_input_to_present_milliseconds, latency);
+		frame_input_time = 0;
+	}
+}
+
+void Presenter::SetMode(PresentMode mode)
+{
+	if (mode >= PRESENT_MODE_COUNT)
+	{
+		ThrowIfFailed(E_INVALIDARG);
+	}
+	this->mode = mode == PRESENT_MODE_TEARING && !tearing_supported ? PRESENT_MODE_NO_VSYNC : mode;
+}
+
+void Presenter::SetMaximumFrameLatency(UINT latency)
+{
+	max_frame_latency = min(max(latency, 1u), static_cast<UINT>(DXGI_MAX_SWAP_CHAIN_BUFFERS));
+	ThrowIfFailed(swap_chain->SetMaximumFrameLatency(max_frame_latency));
+}
+
+std::string Presenter::FormatReport() const
+{
+	std::string result;
+	for (UINT m = 0; m < PRESENT_MODE_COUNT; m++)
+	{
+		const PresentLatencyStatistics& modeStatistics = statistics[m];
+		if (modeStatistics.frame_count == 0)
+		{
+			continue;
+		}
+		const double frames = static_cast<double>(modeStatistics.frame_count);
+		char report[256];
+		snprintf(report, sizeof(report), "Present %s: %zu frames, wait %.3f ms, sample to present %.3f ms, input to present %.3f ms (max %.3f ms) over %zu inputs\n",
+			GetModeName(static_cast<PresentMode>(m)), modeStatistics.frame_count, modeStatistics.wait_milliseconds / frames,
+			modeStatistics.sample_to_present_milliseconds / frames,
+			modeStatistics.input_count ? modeStatistics.input_to_present_milliseconds / modeStatistics.input_count : 0.0,
+			modeStatistics.max_input_to_present_milliseconds, modeStatistics.input_count);
+		result += report;
+	}
+	return result;
+}
+
+const char* Presenter::GetModeName(PresentMode mode)
+{
+	switch (mode)
+	{
+	case PRESENT_MODE_VSYNC:
+		return "vsync";
+	case PRESENT_MODE_NO_VSYNC:
+		return "no vsync";
+	case PRESENT_MODE_TEARING:
+		return "tearing";
+	default:
+		return "unknown";
+	}
+}
+
+UINT64 Presenter::GetCounter()
+{
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return static_cast<UINT64>(counter.QuadPart);
+}
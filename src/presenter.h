@@ -0,0 +1,80 @@
+#pragma once
+
+#include "dx12_labs.h"
+
+#include <dxgi1_5.h>
+#include <string>
+
+enum PresentMode
+{
+	PRESENT_MODE_VSYNC,		// every frame waits for a vertical blank
+	PRESENT_MODE_NO_VSYNC,	// the newest frame is shown at the next blank, frames queued before it are dropped
+	PRESENT_MODE_TEARING,	// shown right away, uncapped, for benchmarks
+	PRESENT_MODE_COUNT
+};
+
+// Sums over the frames presented in one mode
+struct PresentLatencyStatistics
+{
+	size_t frame_count;
+	double wait_milliseconds;				// blocked on the frame latency waitable object
+	double sample_to_present_milliseconds;	// from input sampling to the return of Present
+	size_t input_count;
+	double input_to_present_milliseconds;	// from the input event to the return of Present of the frame that saw it
+	double max_input_to_present_milliseconds;
+};
+
+// Owns the swap chain and decides when a frame may start. The frame latency waitable object blocks
+// before input is sampled rather than in Present after the frame was recorded, so the frame sees
+// input as fresh as the present queue allows. Latency is measured per mode with the performance counter.
+class Presenter
+{
+public:
+	Presenter(IDXGIFactory4* factory, ID3D12CommandQueue* queue, HWND hwnd, UINT width, UINT height, DXGI_FORMAT format, UINT buffer_count,
+		UINT max_frame_latency);
+	virtual ~Presenter();
+
+	Presenter(const Presenter&) = delete;
+	Presenter& operator=(const Presenter&) = delete;
+
+	// Blocks until the swap chain takes another frame, input is sampled right after
+	void WaitForFrame();
+
+	// Input events are assigned to the next frame that waits
+	void OnInput();
+
+	void Present();
+
+	// Tearing falls back to PRESENT_MODE_NO_VSYNC where the system does not support it
+	void SetMode(PresentMode mode);
+	PresentMode GetMode() const { return mode; }
+	bool IsTearingSupported() const { return tearing_supported; }
+
+	// Frames queued for presentation at most, 1 gives the lowest latency
+	void SetMaximumFrameLatency(UINT latency);
+	UINT GetMaximumFrameLatency() const { return max_frame_latency; }
+
+	IDXGISwapChain3* GetSwapChain() const { return swap_chain.Get(); }
+	const PresentLatencyStatistics& GetStatistics(PresentMode statistics_mode) const { return statistics[statistics_mode]; }
+
+	// One line per mode that presented a frame
+	std::string FormatReport() const;
+
+	static const char* GetModeName(PresentMode mode);
+
+protected:
+	ComPtr<IDXGISwapChain3> swap_chain;
+	HANDLE frame_latency_waitable;
+	bool tearing_supported;
+	PresentMode mode;
+	UINT max_frame_latency;
+
+	UINT64 counter_frequency;
+	UINT64 sample_time;			// when the current frame sampled input
+	UINT64 pending_input_time;	// first input event since the last sample, 0 when there was none
+	UINT64 frame_input_time;	// the event the current frame saw
+	PresentLatencyStatistics statistics[PRESENT_MODE_COUNT];
+
+	static UINT64 GetCounter();
+	double ToMilliseconds(UINT64 ticks) const { return 1000.0 * ticks / counter_frequency; }
+};
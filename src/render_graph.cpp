@@ -0,0 +1,646 @@
+#include "render_graph.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+static UINT64 AlignUp(UINT64 value, UINT64 alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+bool RenderGraphDevice::IsSameDesc(const D3D12_RESOURCE_DESC& a, const D3D12_RESOURCE_DESC& b)
+{
+	return a.Dimension == b.Dimension && a.Alignment == b.Alignment && a.Width == b.Width && a.Height == b.Height &&
+		a.DepthOrArraySize == b.DepthOrArraySize && a.MipLevels == b.MipLevels && a.Format == b.Format && a.SampleDesc.Count == b.SampleDesc.Count &&
+		a.SampleDesc.Quality == b.SampleDesc.Quality && a.Layout == b.Layout && a.Flags == b.Flags;
+}
+
+D3D12_RESOURCE_ALLOCATION_INFO D3D12RenderGraphDevice::GetAllocationInfo(const D3D12_RESOURCE_DESC& desc)
+{
+	return device->GetResourceAllocationInfo(0, 1, &desc);
+}
+
+bool D3D12RenderGraphDevice::ReserveHeap(UINT64 size)
+{
+	if (heap && size <= heap_size)
+	{
+		return false;
+	}
+
+	// Frames in flight may still render into the old heap
+	if (heap)
+	{
+		RetiredHeap retired = { heap, {}, 0 };
+		for (auto& placed : placed_resources)
+		{
+			retired.resources.push_back(placed.second);
+		}
+		retired_heaps.push_back(retired);
+		placed_resources.clear();
+	}
+
+	// Grow with some headroom so a resize doesn't replace the heap on every step
+	heap_size = size + size / 4;
+	CD3DX12_HEAP_DESC heapDescriptor(heap_size, D3D12_HEAP_TYPE_DEFAULT, D3D12_DEFAULT_MSAA_RESOURCE_PLACEMENT_ALIGNMENT,
+		D3D12_HEAP_FLAG_ALLOW_ONLY_RT_DS_TEXTURES);
+	ThrowIfFailed(device->CreateHeap(&heapDescriptor, IID_PPV_ARGS(&heap)));
+	return true;
+}
+
+ID3D12Resource* D3D12RenderGraphDevice::GetPlacedResource(const D3D12_RESOURCE_DESC& desc, const D3D12_CLEAR_VALUE* clear_value, UINT64 heap_offset,
+	D3D12_RESOURCE_STATES initial_state, bool* created)
+{
+	auto range = placed_resources.equal_range(heap_offset);
+	for (auto placed = range.first; placed != range.second; ++placed)
+	{
+		if (IsSameDesc(placed->second.desc, desc) &&
+			(clear_value == nullptr || memcmp(&placed->second.clear_value, clear_value, sizeof(*clear_value)) == 0))
+		{
+			*created = false;
+			return placed->second.resource.Get();
+		}
+	}
+
+	PlacedResource placed = {};
+	placed.desc = desc;
+	if (clear_value)
+	{
+		placed.clear_value = *clear_value;
+	}
+	ThrowIfFailed(device->CreatePlacedResource(heap.Get(), heap_offset, &desc, initial_state, clear_value, IID_PPV_ARGS(&placed.resource)));
+	placed_resources.insert({ heap_offset, placed });
+	*created = true;
+	return placed.resource.Get();
+}
+
+void D3D12RenderGraphDevice::FinishFrame(UINT64 fence_value)
+{
+	for (RetiredHeap& retired : retired_heaps)
+	{
+		if (retired.fence_value == 0)
+		{
+			retired.fence_value = fence_value;
+		}
+	}
+}
+
+void D3D12RenderGraphDevice::Reclaim(UINT64 completed_fence_value)
+{
+	while (!retired_heaps.empty() && retired_heaps.front().fence_value != 0 && retired_heaps.front().fence_value <= completed_fence_value)
+	{
+		retired_heaps.pop_front();
+	}
+}
+
+ID3D12GraphicsCommandList* RenderGraphContext::GetCommandList()
+{
+	return graph.OpenList(queue);
+}
+
+ID3D12Resource* RenderGraphContext::GetResource(RenderGraphResource resource) const
+{
+	return graph.GetResource(resource);
+}
+
+void RenderGraphContext::Submit(ID3D12CommandList* command_list)
+{
+	graph.CloseList();
+	graph.submission.push_back(command_list);
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::Read(RenderGraphResource resource, D3D12_RESOURCE_STATES state)
+{
+	Pass& target = graph.passes[pass];
+	if (pass + 1 != graph.pass_count || resource >= graph.resources.size())
+	{
+		ThrowIfFailed(E_INVALIDARG);
+	}
+	graph.accesses.push_back({ resource, state, false });
+	target.access_count++;
+	return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::Write(RenderGraphResource resource, D3D12_RESOURCE_STATES state)
+{
+	Pass& target = graph.passes[pass];
+	if (pass + 1 != graph.pass_count || resource >= graph.resources.size())
+	{
+		ThrowIfFailed(E_INVALIDARG);
+	}
+	graph.accesses.push_back({ resource, state, true });
+	target.access_count++;
+	return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::SideEffect()
+{
+	graph.passes[pass].side_effect = true;
+	return *this;
+}
+
+RenderGraph::RenderGraph(RenderGraphDevice& graph_device, ResourceStateTracker& imported_states) :
+	graph_device(graph_device), imported_states(imported_states), pass_count(0), final_wait_batch(no_batch),
+	compile_milliseconds(0.0), culled_pass_count(0), transient_heap_size(0), fence_value(0), list_pools(), execution(nullptr), open_list(nullptr)
+{
+}
+
+void RenderGraph::Reset()
+{
+	pass_count = 0;
+	accesses.clear();
+	resources.clear();
+	batches.clear();
+	final_barriers.clear();
+	transient_order.clear();
+}
+
+RenderGraphResource RenderGraph::ImportResource(const char* name, ID3D12Resource* resource, D3D12_RESOURCE_STATES final_state)
+{
+	Resource imported = {};
+	imported.name = name;
+	imported.imported = true;
+	imported.resource = resource;
+	imported.state = imported_states.GetState(resource);
+	imported.final_state = final_state;
+	resources.push_back(imported);
+	return static_cast<RenderGraphResource>(resources.size() - 1);
+}
+
+RenderGraphResource RenderGraph::CreateTexture(const char* name, const D3D12_RESOURCE_DESC& desc, const D3D12_CLEAR_VALUE* clear_value)
+{
+	// Transients share a heap that only takes render targets and depth stencils
+	if ((desc.Flags & (D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET | D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL)) == 0)
+	{
+		ThrowIfFailed(E_INVALIDARG);
+	}
+
+	Resource transient = {};
+	transient.name = name;
+	transient.desc = desc;
+	transient.has_clear_value = clear_value != nullptr;
+	if (clear_value)
+	{
+		transient.clear_value = *clear_value;
+	}
+	resources.push_back(transient);
+	return static_cast<RenderGraphResource>(resources.size() - 1);
+}
+
+RenderGraph::PassBuilder RenderGraph::AddPass(const char* name, RenderGraphQueue queue, std::function<void(RenderGraphContext&)> execute)
+{
+	if (pass_count == passes.size())
+	{
+		passes.emplace_back();
+	}
+	Pass& pass = passes[pass_count];
+	pass.name = name;
+	pass.queue = queue;
+	pass.execute = std::move(execute);
+	pass.side_effect = false;
+	pass.alive = false;
+	pass.access_offset = static_cast<UINT>(accesses.size());
+	pass.access_count = 0;
+	pass.batch = no_batch;
+	pass.barriers.clear();
+	pass.after_barriers.clear();
+	pass.discards.clear();
+	return PassBuilder(*this, pass_count++);
+}
+
+void RenderGraph::Compile(bool async_compute)
+{
+	auto compileStart = std::chrono::high_resolution_clock::now();
+
+	CullPasses();
+	PlaceTransients();
+	BuildBatches(async_compute);
+
+	compile_milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - compileStart).count();
+}
+
+void RenderGraph::CullPasses()
+{
+	// Walk back from the imported resources: a pass lives when it has side effects or writes something a living pass or
+	// the outside world needs, and then everything it touches is needed. Writes are treated as partial, so earlier
+	// writers of the same resource stay alive as well.
+	for (Resource& resource : resources)
+	{
+		resource.needed = resource.imported;
+	}
+
+	culled_pass_count = 0;
+	for (UINT p = pass_count; p-- > 0;)
+	{
+		Pass& pass = passes[p];
+		pass.alive = pass.side_effect;
+		for (UINT a = pass.access_offset; a < pass.access_offset + pass.access_count && !pass.alive; a++)
+		{
+			pass.alive = accesses[a].write && resources[accesses[a].resource].needed;
+		}
+
+		if (!pass.alive)
+		{
+			culled_pass_count++;
+			continue;
+		}
+		for (UINT a = pass.access_offset; a < pass.access_offset + pass.access_count; a++)
+		{
+			resources[accesses[a].resource].needed = true;
+		}
+	}
+}
+
+void RenderGraph::PlaceTransients()
+{
+	for (Resource& resource : resources)
+	{
+		resource.first_pass = no_pass;
+		resource.last_pass = 0;
+		resource.aliased = false;
+	}
+
+	// Lifetimes over the passes that survived culling
+	for (UINT p = 0; p < pass_count; p++)
+	{
+		if (!passes[p].alive)
+		{
+			continue;
+		}
+		MergeAccesses(passes[p], merged_accesses);
+		for (const Access& access : merged_accesses)
+		{
+			Resource& resource = resources[access.resource];
+			if (resource.first_pass == no_pass)
+			{
+				resource.first_pass = p;
+				resource.first_state = access.state;
+				if (!resource.imported)
+				{
+					transient_order.push_back(access.resource);
+				}
+			}
+			resource.last_pass = p;
+		}
+	}
+
+	// First fit in order of first use: a texture may take any range that no texture alive at the same time covers.
+	// Taking memory from a texture whose lifetime ended needs an aliasing barrier on first use.
+	transient_heap_size = 0;
+	for (size_t i = 0; i < transient_order.size(); i++)
+	{
+		Resource& resource = resources[transient_order[i]];
+		const D3D12_RESOURCE_ALLOCATION_INFO allocation = graph_device.GetAllocationInfo(resource.desc);
+		resource.size = allocation.SizeInBytes;
+		resource.alignment = allocation.Alignment;
+
+		UINT64 offset = 0;
+		for (bool moved = true; moved;)
+		{
+			moved = false;
+			for (size_t j = 0; j < i; j++)
+			{
+				const Resource& placed = resources[transient_order[j]];
+				if (placed.last_pass >= resource.first_pass && offset < placed.heap_offset + placed.size && placed.heap_offset < offset + resource.size)
+				{
+					offset = AlignUp(placed.heap_offset + placed.size, resource.alignment);
+					moved = true;
+				}
+			}
+		}
+		resource.heap_offset = offset;
+
+		for (size_t j = 0; j < i && !resource.aliased; j++)
+		{
+			const Resource& placed = resources[transient_order[j]];
+			resource.aliased = offset < placed.heap_offset + placed.size && placed.heap_offset < offset + resource.size;
+		}
+		transient_heap_size = max(transient_heap_size, offset + resource.size);
+	}
+
+	if (transient_order.empty())
+	{
+		return;
+	}
+	if (graph_device.ReserveHeap(transient_heap_size))
+	{
+		transient_states.clear();
+	}
+
+	// Transients keep their state across frames, a new one starts in the state of its first use. Transients with the same
+	// descriptor at the same offset get the same placed resource, the later one takes over the state the earlier one left.
+	for (size_t i = 0; i < transient_order.size(); i++)
+	{
+		Resource& resource = resources[transient_order[i]];
+		bool created = false;
+		resource.resource = graph_device.GetPlacedResource(resource.desc, resource.has_clear_value ? &resource.clear_value : nullptr,
+			resource.heap_offset, resource.first_state, &created);
+		auto state = transient_states.find(resource.resource);
+		resource.state = created || state == transient_states.end() ? resource.first_state : state->second;
+
+		resource.previous_user = no_resource;
+		for (size_t j = i; j-- > 0 && resource.previous_user == no_resource;)
+		{
+			if (resources[transient_order[j]].resource == resource.resource)
+			{
+				resource.previous_user = transient_order[j];
+			}
+		}
+	}
+}
+
+void RenderGraph::BuildBatches(bool async_compute)
+{
+	for (Resource& resource : resources)
+	{
+		resource.last_batch = no_batch;
+		resource.last_uav_write = false;
+	}
+
+	auto wait = [this](UINT batch, UINT other)
+	{
+		batches[batch].wait_batch = batches[batch].wait_batch == no_batch ? other : max(batches[batch].wait_batch, other);
+		batches[other].signal = true;
+	};
+
+	UINT lastDirectPass = no_pass;
+	for (UINT p = 0; p < pass_count; p++)
+	{
+		Pass& pass = passes[p];
+		if (!pass.alive)
+		{
+			continue;
+		}
+		MergeAccesses(pass, merged_accesses);
+
+		// Compute lists can't transition from or to graphics states, the last direct pass before records those.
+		// Without one the pass runs on the direct queue.
+		RenderGraphQueue queue = async_compute ? pass.queue : RENDER_GRAPH_QUEUE_DIRECT;
+		if (queue == RENDER_GRAPH_QUEUE_COMPUTE && lastDirectPass == no_pass)
+		{
+			for (const Access& access : merged_accesses)
+			{
+				const Resource& resource = resources[access.resource];
+				if (!ResourceStateTracker::IsSatisfied(resource.state, access.state) && (!IsComputeState(resource.state) || !IsComputeState(access.state)))
+				{
+					queue = RENDER_GRAPH_QUEUE_DIRECT;
+				}
+			}
+		}
+		pass.queue = queue;
+
+		if (batches.empty() || batches.back().queue != queue)
+		{
+			batches.push_back({ queue, p, p + 1, no_batch, false, 0 });
+		}
+		batches.back().end_pass = p + 1;
+		const UINT batch = static_cast<UINT>(batches.size() - 1);
+		pass.batch = batch;
+
+		for (const Access& access : merged_accesses)
+		{
+			Resource& resource = resources[access.resource];
+			if (!resource.imported && resource.first_pass == p && resource.previous_user != no_resource)
+			{
+				const Resource& previous = resources[resource.previous_user];
+				resource.state = previous.state;
+				resource.last_batch = previous.last_batch;
+				resource.last_uav_write = previous.last_uav_write;
+			}
+			if (!resource.imported && resource.first_pass == p && resource.aliased)
+			{
+				pass.barriers.push_back(CD3DX12_RESOURCE_BARRIER::Aliasing(nullptr, resource.resource));
+				if (access.state & (D3D12_RESOURCE_STATE_RENDER_TARGET | D3D12_RESOURCE_STATE_DEPTH_WRITE))
+				{
+					pass.discards.push_back(resource.resource);
+				}
+			}
+
+			if (!ResourceStateTracker::IsSatisfied(resource.state, access.state))
+			{
+				const D3D12_RESOURCE_BARRIER transition = CD3DX12_RESOURCE_BARRIER::Transition(resource.resource, resource.state, access.state);
+				if (queue == RENDER_GRAPH_QUEUE_COMPUTE && (!IsComputeState(resource.state) || !IsComputeState(access.state)))
+				{
+					passes[lastDirectPass].after_barriers.push_back(transition);
+					wait(batch, passes[lastDirectPass].batch);
+				}
+				else
+				{
+					pass.barriers.push_back(transition);
+				}
+				resource.state = access.state;
+			}
+			else if (access.write && access.state == D3D12_RESOURCE_STATE_UNORDERED_ACCESS && resource.last_uav_write)
+			{
+				pass.barriers.push_back(CD3DX12_RESOURCE_BARRIER::UAV(resource.resource));
+			}
+			resource.last_uav_write = access.write && access.state == D3D12_RESOURCE_STATE_UNORDERED_ACCESS;
+
+			if (resource.last_batch != no_batch && batches[resource.last_batch].queue != queue)
+			{
+				wait(batch, resource.last_batch);
+			}
+			resource.last_batch = batch;
+		}
+
+		if (queue == RENDER_GRAPH_QUEUE_DIRECT)
+		{
+			lastDirectPass = p;
+		}
+	}
+
+	// Imported resources leave in the state the caller asked for, recorded on the direct queue after everything else
+	final_wait_batch = no_batch;
+	for (Resource& resource : resources)
+	{
+		if (resource.imported)
+		{
+			if (resource.state != resource.final_state)
+			{
+				final_barriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(resource.resource, resource.state, resource.final_state));
+			}
+			if (resource.last_batch != no_batch && batches[resource.last_batch].queue == RENDER_GRAPH_QUEUE_COMPUTE)
+			{
+				final_wait_batch = final_wait_batch == no_batch ? resource.last_batch : max(final_wait_batch, resource.last_batch);
+				batches[resource.last_batch].signal = true;
+			}
+			imported_states.SetState(resource.resource, resource.final_state);
+		}
+	}
+
+	// In order of first use, so the last transient on a shared placed resource decides its state
+	for (RenderGraphResource index : transient_order)
+	{
+		transient_states[resources[index].resource] = resources[index].state;
+	}
+}
+
+void RenderGraph::MergeAccesses(const Pass& pass, std::vector<Access>& merged) const
+{
+	// One access per resource: reads combine their states, a write decides the state on its own
+	merged.clear();
+	for (UINT a = pass.access_offset; a < pass.access_offset + pass.access_count; a++)
+	{
+		const Access& access = accesses[a];
+		auto existing = std::find_if(merged.begin(), merged.end(), [&access](const Access& m) { return m.resource == access.resource; });
+		if (existing == merged.end())
+		{
+			merged.push_back(access);
+		}
+		else if (access.write)
+		{
+			*existing = access;
+		}
+		else if (!existing->write)
+		{
+			existing->state |= access.state;
+		}
+	}
+}
+
+void RenderGraph::Execute(const RenderGraphExecution& frame_execution)
+{
+	execution = &frame_execution;
+	if (!fence)
+	{
+		ThrowIfFailed(execution->device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&fence)));
+	}
+	for (CommandListPool& pool : list_pools)
+	{
+		pool.used = 0;
+	}
+
+	// The final barriers ride along with the last batch when it is on the direct queue and waits for nothing new
+	const bool finalInLastBatch = final_wait_batch == no_batch && !batches.empty() && batches.back().queue == RENDER_GRAPH_QUEUE_DIRECT;
+	for (size_t b = 0; b < batches.size(); b++)
+	{
+		SubmitBatch(batches[b], finalInLastBatch && b + 1 == batches.size());
+	}
+
+	if (!finalInLastBatch && !final_barriers.empty())
+	{
+		if (final_wait_batch != no_batch)
+		{
+			ThrowIfFailed(execution->direct_queue->Wait(fence.Get(), batches[final_wait_batch].fence_value));
+		}
+		submission.clear();
+		OpenList(RENDER_GRAPH_QUEUE_DIRECT)->ResourceBarrier(static_cast<UINT>(final_barriers.size()), final_barriers.data());
+		CloseList();
+		execution->direct_queue->ExecuteCommandLists(static_cast<UINT>(submission.size()), submission.data());
+	}
+	execution = nullptr;
+}
+
+void RenderGraph::SubmitBatch(Batch& batch, bool record_final_barriers)
+{
+	ID3D12CommandQueue* queue = batch.queue == RENDER_GRAPH_QUEUE_DIRECT ? execution->direct_queue : execution->compute_queue;
+	if (batch.wait_batch != no_batch)
+	{
+		ThrowIfFailed(queue->Wait(fence.Get(), batches[batch.wait_batch].fence_value));
+	}
+
+	submission.clear();
+	for (UINT p = batch.first_pass; p < batch.end_pass; p++)
+	{
+		Pass& pass = passes[p];
+		if (!pass.alive)
+		{
+			continue;
+		}
+		if (!pass.barriers.empty())
+		{
+			OpenList(batch.queue)->ResourceBarrier(static_cast<UINT>(pass.barriers.size()), pass.barriers.data());
+		}
+		for (ID3D12Resource* resource : pass.discards)
+		{
+			OpenList(batch.queue)->DiscardResource(resource, nullptr);
+		}
+
+		RenderGraphContext context(*this, batch.queue);
+		pass.execute(context);
+
+		if (!pass.after_barriers.empty())
+		{
+			OpenList(batch.queue)->ResourceBarrier(static_cast<UINT>(pass.after_barriers.size()), pass.after_barriers.data());
+		}
+	}
+	if (record_final_barriers && !final_barriers.empty())
+	{
+		OpenList(batch.queue)->ResourceBarrier(static_cast<UINT>(final_barriers.size()), final_barriers.data());
+	}
+	CloseList();
+
+	if (!submission.empty())
+	{
+		queue->ExecuteCommandLists(static_cast<UINT>(submission.size()), submission.data());
+	}
+	if (batch.signal)
+	{
+		batch.fence_value = ++fence_value;
+		ThrowIfFailed(queue->Signal(fence.Get(), batch.fence_value));
+	}
+}
+
+ID3D12GraphicsCommandList* RenderGraph::OpenList(RenderGraphQueue queue)
+{
+	if (open_list)
+	{
+		return open_list;
+	}
+
+	// Lists are reused every frame, they only need the allocator of the current frame
+	CommandListPool& pool = list_pools[queue];
+	ID3D12CommandAllocator* allocator = queue == RENDER_GRAPH_QUEUE_DIRECT ? execution->direct_allocator : execution->compute_allocator;
+	if (pool.used == pool.lists.size())
+	{
+		ComPtr<ID3D12GraphicsCommandList> list;
+		const D3D12_COMMAND_LIST_TYPE type = queue == RENDER_GRAPH_QUEUE_DIRECT ? D3D12_COMMAND_LIST_TYPE_DIRECT : D3D12_COMMAND_LIST_TYPE_COMPUTE;
+		ThrowIfFailed(execution->device->CreateCommandList(0, type, allocator, nullptr, IID_PPV_ARGS(&list)));
+		pool.lists.push_back(list);
+	}
+	else
+	{
+		ThrowIfFailed(pool.lists[pool.used]->Reset(allocator, nullptr));
+	}
+
+	open_list = pool.lists[pool.used++].Get();
+	submission.push_back(open_list);
+	return open_list;
+}
+
+void RenderGraph::CloseList()
+{
+	if (open_list)
+	{
+		ThrowIfFailed(open_list->Close());
+		open_list = nullptr;
+	}
+}
+
+bool RenderGraph::IsComputeState(D3D12_RESOURCE_STATES state)
+{
+	const D3D12_RESOURCE_STATES computeStates = D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER | D3D12_RESOURCE_STATE_UNORDERED_ACCESS |
+		D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT | D3D12_RESOURCE_STATE_COPY_DEST |
+		D3D12_RESOURCE_STATE_COPY_SOURCE;
+	return (state & ~computeStates) == 0;
+}
+
+std::string RenderGraph::FormatReport() const
+{
+	UINT barriers = static_cast<UINT>(final_barriers.size());
+	for (UINT p = 0; p < pass_count; p++)
+	{
+		barriers += static_cast<UINT>(passes[p].barriers.size() + passes[p].after_barriers.size());
+	}
+	UINT64 unaliasedSize = 0;
+	for (RenderGraphResource index : transient_order)
+	{
+		unaliasedSize += resources[index].size;
+	}
+
+	char report[256];
+	snprintf(report, sizeof(report), "Render graph: %u passes (%u culled) in %zu batches, %u barriers, %zu transient textures in %.2f MB (%.2f MB without aliasing), compiled in %.3f ms\n",
+		pass_count, culled_pass_count, batches.size(), barriers, transient_order.size(), transient_heap_size / (1024.0 * 1024.0),
+		unaliasedSize / (1024.0 * 1024.0), compile_milliseconds);
+	return report;
+}
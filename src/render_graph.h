@@ -0,0 +1,282 @@
+#pragma once
+
+#include "dx12_labs.h"
+#include "resource_state_tracker.h"
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum RenderGraphQueue
+{
+	RENDER_GRAPH_QUEUE_DIRECT,
+	RENDER_GRAPH_QUEUE_COMPUTE
+};
+
+typedef UINT RenderGraphResource;
+
+// Where transient textures live. The graph only asks for sizes and placed resources, so it can
+// be compiled against a mock without a GPU.
+class RenderGraphDevice
+{
+public:
+	virtual ~RenderGraphDevice() {}
+
+	virtual D3D12_RESOURCE_ALLOCATION_INFO GetAllocationInfo(const D3D12_RESOURCE_DESC& desc) = 0;
+
+	// Makes the heap at least heap_size bytes, returns true when that replaced every placed resource
+	virtual bool ReserveHeap(UINT64 heap_size) = 0;
+
+	// Placed resources are cached by descriptor and offset, created is set when a new one was made in initial_state
+	virtual ID3D12Resource* GetPlacedResource(const D3D12_RESOURCE_DESC& desc, const D3D12_CLEAR_VALUE* clear_value, UINT64 heap_offset,
+		D3D12_RESOURCE_STATES initial_state, bool* created) = 0;
+
+	// Field by field, the padding after Dimension is not copied reliably so memcmp can tell equal descriptors apart
+	static bool IsSameDesc(const D3D12_RESOURCE_DESC& a, const D3D12_RESOURCE_DESC& b);
+};
+
+// Transient textures in one render target and depth stencil heap. A heap that has to grow is kept,
+// together with its resources, until the frames that used it are done.
+class D3D12RenderGraphDevice : public RenderGraphDevice
+{
+public:
+	D3D12RenderGraphDevice(ID3D12Device* device) : device(device), heap_size(0) {}
+	virtual ~D3D12RenderGraphDevice() {}
+
+	D3D12_RESOURCE_ALLOCATION_INFO GetAllocationInfo(const D3D12_RESOURCE_DESC& desc) override;
+	bool ReserveHeap(UINT64 heap_size) override;
+	ID3D12Resource* GetPlacedResource(const D3D12_RESOURCE_DESC& desc, const D3D12_CLEAR_VALUE* clear_value, UINT64 heap_offset,
+		D3D12_RESOURCE_STATES initial_state, bool* created) override;
+
+	// Same protocol as the upload ring
+	void FinishFrame(UINT64 fence_value);
+	void Reclaim(UINT64 completed_fence_value);
+
+protected:
+	struct PlacedResource
+	{
+		D3D12_RESOURCE_DESC desc;
+		D3D12_CLEAR_VALUE clear_value;
+		ComPtr<ID3D12Resource> resource;
+	};
+
+	struct RetiredHeap
+	{
+		ComPtr<ID3D12Heap> heap;
+		std::vector<PlacedResource> resources;
+		UINT64 fence_value;	// 0 until the frame that still uses it is finished
+	};
+
+	ComPtr<ID3D12Device> device;
+	ComPtr<ID3D12Heap> heap;
+	UINT64 heap_size;
+	std::multimap<UINT64, PlacedResource> placed_resources;
+	std::deque<RetiredHeap> retired_heaps;
+};
+
+class RenderGraph;
+
+// Handed to a pass while it records
+class RenderGraphContext
+{
+public:
+	RenderGraphContext(RenderGraph& graph, RenderGraphQueue queue) : graph(graph), queue(queue) {}
+
+	ID3D12GraphicsCommandList* GetCommandList();
+	ID3D12Resource* GetResource(RenderGraphResource resource) const;
+
+	// Submits lists recorded elsewhere, e.g. on worker threads, right after what the pass recorded so far
+	void Submit(ID3D12CommandList* command_list);
+
+protected:
+	RenderGraph& graph;
+	RenderGraphQueue queue;
+};
+
+// Queues and per-frame allocators the graph records and submits with
+struct RenderGraphExecution
+{
+	ID3D12Device* device;
+	ID3D12CommandQueue* direct_queue;
+	ID3D12CommandAllocator* direct_allocator;
+	ID3D12CommandQueue* compute_queue;	// may be null when the graph was compiled without async compute
+	ID3D12CommandAllocator* compute_allocator;
+};
+
+// Frame graph rebuilt every frame: passes declare what they read and write, Compile culls passes
+// whose results nobody uses, places transient textures with disjoint lifetimes at the same heap
+// offsets, derives every transition, aliasing and UAV barrier and splits the passes into batches
+// per queue with fence waits where a batch needs the results of the other queue. Imported
+// resources start in, and end up in, the state the ResourceStateTracker has for them.
+class RenderGraph
+{
+public:
+	static constexpr UINT no_batch = UINT_MAX;
+
+	class PassBuilder
+	{
+	public:
+		PassBuilder(RenderGraph& graph, UINT pass) : graph(graph), pass(pass) {}
+
+		PassBuilder& Read(RenderGraphResource resource, D3D12_RESOURCE_STATES state);
+		PassBuilder& Write(RenderGraphResource resource, D3D12_RESOURCE_STATES state);
+
+		// Kept even when nothing reads what it writes
+		PassBuilder& SideEffect();
+
+	protected:
+		RenderGraph& graph;
+		UINT pass;
+	};
+
+	RenderGraph(RenderGraphDevice& graph_device, ResourceStateTracker& imported_states);
+	virtual ~RenderGraph() {}
+
+	RenderGraph(const RenderGraph&) = delete;
+	RenderGraph& operator=(const RenderGraph&) = delete;
+
+	// Drops the passes and resources of the last frame, the storage is kept
+	void Reset();
+
+	RenderGraphResource ImportResource(const char* name, ID3D12Resource* resource, D3D12_RESOURCE_STATES final_state);
+
+	// Transient render target or depth stencil texture, only valid between its first and last use
+	RenderGraphResource CreateTexture(const char* name, const D3D12_RESOURCE_DESC& desc, const D3D12_CLEAR_VALUE* clear_value = nullptr);
+
+	// Accesses are declared on the returned builder before the next AddPass
+	PassBuilder AddPass(const char* name, RenderGraphQueue queue, std::function<void(RenderGraphContext&)> execute);
+
+	// Without async compute every pass runs on the direct queue
+	void Compile(bool async_compute);
+	void Execute(const RenderGraphExecution& execution);
+
+	ID3D12Resource* GetResource(RenderGraphResource resource) const { return resources[resource].resource; }
+	double GetCompileMilliseconds() const { return compile_milliseconds; }
+
+	// What Compile decided, for inspection without executing
+	bool IsPassAlive(UINT pass) const { return passes[pass].alive; }
+	UINT64 GetHeapOffset(RenderGraphResource resource) const { return resources[resource].heap_offset; }
+	const std::vector<D3D12_RESOURCE_BARRIER>& GetBarriers(UINT pass) const { return passes[pass].barriers; }
+	const std::vector<D3D12_RESOURCE_BARRIER>& GetAfterBarriers(UINT pass) const { return passes[pass].after_barriers; }
+	const std::vector<D3D12_RESOURCE_BARRIER>& GetFinalBarriers() const { return final_barriers; }
+
+	// Batches in submission order. A batch waits for the fence of at most one batch of the other queue, no_batch when it doesn't.
+	UINT GetBatchCount() const { return static_cast<UINT>(batches.size()); }
+	UINT GetPassBatch(UINT pass) const { return passes[pass].batch; }
+	RenderGraphQueue GetBatchQueue(UINT batch) const { return batches[batch].queue; }
+	UINT GetBatchWait(UINT batch) const { return batches[batch].wait_batch; }
+	bool IsBatchSignaled(UINT batch) const { return batches[batch].signal; }
+	UINT GetFinalWaitBatch() const { return final_wait_batch; }
+
+	UINT GetCulledPassCount() const { return culled_pass_count; }
+	UINT64 GetTransientHeapSize() const { return transient_heap_size; }
+	std::string FormatReport() const;
+
+protected:
+	friend class RenderGraphContext;
+
+	static constexpr UINT no_pass = UINT_MAX;
+	static constexpr RenderGraphResource no_resource = UINT_MAX;
+
+	struct Access
+	{
+		RenderGraphResource resource;
+		D3D12_RESOURCE_STATES state;
+		bool write;
+	};
+
+	struct Pass
+	{
+		const char* name;
+		RenderGraphQueue queue;
+		std::function<void(RenderGraphContext&)> execute;
+		bool side_effect;
+		bool alive;
+		UINT access_offset;
+		UINT access_count;
+		UINT batch;
+		std::vector<D3D12_RESOURCE_BARRIER> barriers;		// recorded before the pass
+		std::vector<D3D12_RESOURCE_BARRIER> after_barriers;	// recorded after it, on behalf of a later compute pass
+		std::vector<ID3D12Resource*> discards;
+	};
+
+	struct Resource
+	{
+		const char* name;
+		bool imported;
+		ID3D12Resource* resource;
+		D3D12_RESOURCE_STATES state;
+		D3D12_RESOURCE_STATES final_state;
+		D3D12_RESOURCE_DESC desc;
+		bool has_clear_value;
+		D3D12_CLEAR_VALUE clear_value;
+
+		bool needed;
+		UINT first_pass;
+		UINT last_pass;
+		D3D12_RESOURCE_STATES first_state;
+		UINT64 size;
+		UINT64 alignment;
+		UINT64 heap_offset;
+		bool aliased;
+		RenderGraphResource previous_user;	// earlier transient of this frame that got the same placed resource
+		UINT last_batch;
+		bool last_uav_write;
+	};
+
+	struct Batch
+	{
+		RenderGraphQueue queue;
+		UINT first_pass;
+		UINT end_pass;
+		UINT wait_batch;	// batch of the other queue to wait for
+		bool signal;
+		UINT64 fence_value;
+	};
+
+	struct CommandListPool
+	{
+		std::vector<ComPtr<ID3D12GraphicsCommandList>> lists;
+		UINT used;
+	};
+
+	RenderGraphDevice& graph_device;
+	ResourceStateTracker& imported_states;
+
+	std::vector<Pass> passes;	// grows only, pass_count are in use
+	UINT pass_count;
+	std::vector<Access> accesses;
+	std::vector<Resource> resources;
+	std::vector<Batch> batches;
+	std::vector<D3D12_RESOURCE_BARRIER> final_barriers;
+	UINT final_wait_batch;
+	std::vector<RenderGraphResource> transient_order;
+	std::unordered_map<ID3D12Resource*, D3D12_RESOURCE_STATES> transient_states;
+	double compile_milliseconds;
+	UINT culled_pass_count;
+	UINT64 transient_heap_size;
+
+	// Execution
+	ComPtr<ID3D12Fence> fence;
+	UINT64 fence_value;
+	CommandListPool list_pools[2];
+	const RenderGraphExecution* execution;
+	ID3D12GraphicsCommandList* open_list;
+	std::vector<ID3D12CommandList*> submission;
+
+	void CullPasses();
+	void PlaceTransients();
+	void BuildBatches(bool async_compute);
+	void MergeAccesses(const Pass& pass, std::vector<Access>& merged) const;
+
+	ID3D12GraphicsCommandList* OpenList(RenderGraphQueue queue);
+	void CloseList();
+	void SubmitBatch(Batch& batch, bool record_final_barriers);
+
+	static bool IsComputeState(D3D12_RESOURCE_STATES state);
+
+	std::vector<Access> merged_accesses;
+};
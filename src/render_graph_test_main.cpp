@@ -0,0 +1,386 @@
+#include "render_graph.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <vector>
+
+// Hands out fake placed resources, cached by descriptor and offset like the D3D12 device, and sizes
+// every texture as four bytes per pixel in 64 KB pages
+class MockRenderGraphDevice : public RenderGraphDevice
+{
+public:
+	static constexpr UINT64 page_size = 64 * 1024;
+
+	MockRenderGraphDevice() : heap_size(0), next_id(1) {}
+	virtual ~MockRenderGraphDevice() {}
+
+	D3D12_RESOURCE_ALLOCATION_INFO GetAllocationInfo(const D3D12_RESOURCE_DESC& desc) override
+	{
+		const UINT64 size = desc.Width * desc.Height * 4;
+		return { (size + page_size - 1) / page_size * page_size, page_size };
+	}
+
+	bool ReserveHeap(UINT64 size) override
+	{
+		if (size <= heap_size)
+		{
+			return false;
+		}
+		heap_size = size;
+		placed.clear();
+		return true;
+	}
+
+	ID3D12Resource* GetPlacedResource(const D3D12_RESOURCE_DESC& desc, const D3D12_CLEAR_VALUE*, UINT64 heap_offset,
+		D3D12_RESOURCE_STATES initial_state, bool* created) override
+	{
+		auto range = placed.equal_range(heap_offset);
+		for (auto existing = range.first; existing != range.second; ++existing)
+		{
+			if (IsSameDesc(existing->second.desc, desc))
+			{
+				*created = false;
+				return existing->second.resource;
+			}
+		}
+		ID3D12Resource* resource = reinterpret_cast<ID3D12Resource*>(static_cast<uintptr_t>(next_id++) * 0x100);
+		placed.insert({ heap_offset, { desc, resource } });
+		initial_states[resource] = initial_state;
+		*created = true;
+		return resource;
+	}
+
+	UINT64 heap_size;
+	std::map<ID3D12Resource*, D3D12_RESOURCE_STATES> initial_states;	// of every resource ever created
+
+protected:
+	struct Placed
+	{
+		D3D12_RESOURCE_DESC desc;
+		ID3D12Resource* resource;
+	};
+
+	std::multimap<UINT64, Placed> placed;
+	uintptr_t next_id;
+};
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what)
+{
+	if (!condition)
+	{
+		printf("FAILED: %s\n", what);
+		failures++;
+	}
+}
+
+// Replays barriers in recording order like the debug layer would see them, every transition has to start in the
+// state the resource is in
+class BarrierReplay
+{
+public:
+	bool Apply(const std::vector<D3D12_RESOURCE_BARRIER>& barriers, UINT* aliasing_count)
+	{
+		bool valid = true;
+		for (const D3D12_RESOURCE_BARRIER& barrier : barriers)
+		{
+			if (barrier.Type == D3D12_RESOURCE_BARRIER_TYPE_ALIASING)
+			{
+				(*aliasing_count)++;
+			}
+			if (barrier.Type != D3D12_RESOURCE_BARRIER_TYPE_TRANSITION)
+			{
+				continue;
+			}
+			auto state = states.find(barrier.Transition.pResource);
+			valid = valid && state != states.end() && state->second == barrier.Transition.StateBefore;
+			states[barrier.Transition.pResource] = barrier.Transition.StateAfter;
+		}
+		return valid;
+	}
+
+	std::map<ID3D12Resource*, D3D12_RESOURCE_STATES> states;
+};
+
+static const UINT pass_count = 50;
+static const UINT post_pass_count = 42;
+static const UINT unused_pass_count = 5;
+
+struct TestFrame
+{
+	RenderGraphResource back_buffer;
+	RenderGraphResource depth;
+	RenderGraphResource chain[post_pass_count + 1];
+	RenderGraphResource unused[unused_pass_count];
+};
+
+// A scene pass, a chain of post passes that each read the last target and write a new one, passes whose output
+// nobody reads, a pass that only has side effects and the copy to the back buffer: 50 passes in all
+static TestFrame BuildFrame(RenderGraph& graph, ID3D12Resource* back_buffer)
+{
+	TestFrame frame = {};
+	const D3D12_RESOURCE_DESC colorDesc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R8G8B8A8_UNORM, 1920, 1080, 1, 1, 1, 0,
+		D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET);
+	const D3D12_RESOURCE_DESC depthDesc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_D32_FLOAT, 1920, 1080, 1, 1, 1, 0,
+		D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL);
+	auto noop = [](RenderGraphContext&) {};
+
+	frame.back_buffer = graph.ImportResource("back buffer", back_buffer, D3D12_RESOURCE_STATE_PRESENT);
+	frame.depth = graph.CreateTexture("depth", depthDesc);
+	for (UINT i = 0; i <= post_pass_count; i++)
+	{
+		frame.chain[i] = graph.CreateTexture("post target", colorDesc);
+	}
+	for (UINT i = 0; i < unused_pass_count; i++)
+	{
+		frame.unused[i] = graph.CreateTexture("unused target", colorDesc);
+	}
+
+	graph.AddPass("scene", RENDER_GRAPH_QUEUE_DIRECT, noop)
+		.Write(frame.chain[0], D3D12_RESOURCE_STATE_RENDER_TARGET)
+		.Write(frame.depth, D3D12_RESOURCE_STATE_DEPTH_WRITE);
+	for (UINT i = 1; i <= post_pass_count; i++)
+	{
+		graph.AddPass("post", RENDER_GRAPH_QUEUE_DIRECT, noop)
+			.Read(frame.chain[i - 1], D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE)
+			.Write(frame.chain[i], D3D12_RESOURCE_STATE_RENDER_TARGET);
+	}
+	for (UINT i = 0; i < unused_pass_count; i++)
+	{
+		graph.AddPass("unused", RENDER_GRAPH_QUEUE_DIRECT, noop)
+			.Read(frame.chain[i], D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE)
+			.Write(frame.unused[i], D3D12_RESOURCE_STATE_RENDER_TARGET);
+	}
+	graph.AddPass("side effect", RENDER_GRAPH_QUEUE_DIRECT, noop).SideEffect();
+	graph.AddPass("present", RENDER_GRAPH_QUEUE_DIRECT, noop)
+		.Read(frame.chain[post_pass_count], D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE)
+		.Write(frame.back_buffer, D3D12_RESOURCE_STATE_RENDER_TARGET);
+	return frame;
+}
+
+static bool HasTransition(const std::vector<D3D12_RESOURCE_BARRIER>& barriers, ID3D12Resource* resource, D3D12_RESOURCE_STATES before,
+	D3D12_RESOURCE_STATES after)
+{
+	for (const D3D12_RESOURCE_BARRIER& barrier : barriers)
+	{
+		if (barrier.Type == D3D12_RESOURCE_BARRIER_TYPE_TRANSITION && barrier.Transition.pResource == resource &&
+			barrier.Transition.StateBefore == before && barrier.Transition.StateAfter == after)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// The culling frame of the renderer with async compute: the direct queue writes depth and resets the draw arguments,
+// the compute queue builds the hi-z pyramid from depth and culls into the draw arguments, and the direct queue draws
+// with them. Depth starts in DEPTH_WRITE, which compute lists can't transition from, so the first direct pass has to
+// move it to a shader resource on behalf of the compute queue.
+static void TestAsyncCompute()
+{
+	MockRenderGraphDevice device;
+	ResourceStateTracker importedStates;
+	RenderGraph graph(device, importedStates);
+	auto fake = [](uintptr_t id) { return reinterpret_cast<ID3D12Resource*>(id * 0x10000); };
+	ID3D12Resource* backBuffer = fake(1);
+	ID3D12Resource* depthBuffer = fake(2);
+	ID3D12Resource* drawBuffer = fake(3);
+	ID3D12Resource* pyramidTexture = fake(4);
+	importedStates.Register(backBuffer, D3D12_RESOURCE_STATE_PRESENT);
+	importedStates.Register(depthBuffer, D3D12_RESOURCE_STATE_DEPTH_WRITE);
+	importedStates.Register(drawBuffer, D3D12_RESOURCE_STATE_COMMON);
+	importedStates.Register(pyramidTexture, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+
+	BarrierReplay replay;
+	replay.states[backBuffer] = D3D12_RESOURCE_STATE_PRESENT;
+	replay.states[depthBuffer] = D3D12_RESOURCE_STATE_DEPTH_WRITE;
+	replay.states[drawBuffer] = D3D12_RESOURCE_STATE_COMMON;
+	replay.states[pyramidTexture] = D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE;
+
+	for (UINT frameIndex = 0; frameIndex < 2; frameIndex++)
+	{
+		graph.Reset();
+		auto noop = [](RenderGraphContext&) {};
+		const RenderGraphResource backBufferResource = graph.ImportResource("back buffer", backBuffer, D3D12_RESOURCE_STATE_PRESENT);
+		const RenderGraphResource depth = graph.ImportResource("depth", depthBuffer, D3D12_RESOURCE_STATE_DEPTH_WRITE);
+		const RenderGraphResource draws = graph.ImportResource("draws", drawBuffer, D3D12_RESOURCE_STATE_COMMON);
+		const RenderGraphResource pyramid = graph.ImportResource("pyramid", pyramidTexture, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+		graph.AddPass("depth prepass", RENDER_GRAPH_QUEUE_DIRECT, noop)
+			.Write(depth, D3D12_RESOURCE_STATE_DEPTH_WRITE)
+			.Write(draws, D3D12_RESOURCE_STATE_COPY_DEST);
+		graph.AddPass("build hi-z", RENDER_GRAPH_QUEUE_COMPUTE, noop)
+			.Read(depth, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE)
+			.Write(pyramid, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+		graph.AddPass("cull", RENDER_GRAPH_QUEUE_COMPUTE, noop)
+			.Read(pyramid, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE)
+			.Write(draws, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+		graph.AddPass("draw", RENDER_GRAPH_QUEUE_DIRECT, noop)
+			.Read(draws, D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT)
+			.Write(depth, D3D12_RESOURCE_STATE_DEPTH_WRITE)
+			.Write(backBufferResource, D3D12_RESOURCE_STATE_RENDER_TARGET);
+		graph.Compile(true);
+
+		// Batches: direct, compute with both compute passes, direct
+		Check(graph.GetBatchCount() == 3, "async compute splits the frame into three batches");
+		if (graph.GetBatchCount() != 3)
+		{
+			return;
+		}
+		Check(graph.GetBatchQueue(0) == RENDER_GRAPH_QUEUE_DIRECT && graph.GetBatchQueue(1) == RENDER_GRAPH_QUEUE_COMPUTE &&
+			graph.GetBatchQueue(2) == RENDER_GRAPH_QUEUE_DIRECT, "batches alternate between the direct and the compute queue");
+		Check(graph.GetPassBatch(0) == 0 && graph.GetPassBatch(1) == 1 && graph.GetPassBatch(2) == 1 && graph.GetPassBatch(3) == 2,
+			"the compute passes share one batch");
+
+		// Waits: compute needs depth and the reset draws from the first direct batch, the draw needs both compute results
+		Check(graph.GetBatchWait(0) == RenderGraph::no_batch, "the first batch waits for nothing");
+		Check(graph.GetBatchWait(1) == 0 && graph.IsBatchSignaled(0), "the compute batch waits for the depth prepass");
+		Check(graph.GetBatchWait(2) == 1 && graph.IsBatchSignaled(1), "the draw batch waits for the compute batch");
+		Check(!graph.IsBatchSignaled(2), "nothing waits for the last batch");
+
+		// The graphics state of depth is left by the depth prepass, the compute passes only see compute states
+		Check(graph.GetAfterBarriers(0).size() == 1 &&
+			HasTransition(graph.GetAfterBarriers(0), depthBuffer, D3D12_RESOURCE_STATE_DEPTH_WRITE, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE),
+			"the depth prepass moves depth to a shader resource for the compute queue");
+		Check(HasTransition(graph.GetBarriers(0), drawBuffer, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_COPY_DEST),
+			"the draws are reset on the direct queue");
+		Check(HasTransition(graph.GetBarriers(1), pyramidTexture, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS) &&
+			HasTransition(graph.GetBarriers(2), drawBuffer, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS),
+			"compute to compute transitions stay on the compute queue");
+		Check(HasTransition(graph.GetBarriers(3), depthBuffer, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_DEPTH_WRITE) &&
+			HasTransition(graph.GetBarriers(3), drawBuffer, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT),
+			"the draw pass takes depth back and reads the culled draws");
+		for (UINT p = 1; p <= 2; p++)
+		{
+			Check(graph.GetAfterBarriers(p).empty(), "compute passes record no barriers after themselves");
+			for (const D3D12_RESOURCE_BARRIER& barrier : graph.GetBarriers(p))
+			{
+				Check(barrier.Type != D3D12_RESOURCE_BARRIER_TYPE_TRANSITION || barrier.Transition.pResource != depthBuffer,
+					"no depth transition on the compute queue");
+			}
+		}
+
+		// The pyramid is last used on the compute queue, so the final barriers wait for the compute batch
+		Check(graph.GetFinalWaitBatch() == 1, "the final barriers wait for the compute batch");
+
+		UINT aliasingCount = 0;
+		bool valid = true;
+		for (UINT p = 0; p < 4; p++)
+		{
+			valid = replay.Apply(graph.GetBarriers(p), &aliasingCount) && valid;
+			valid = replay.Apply(graph.GetAfterBarriers(p), &aliasingCount) && valid;
+		}
+		valid = replay.Apply(graph.GetFinalBarriers(), &aliasingCount) && valid;
+		Check(valid, "every async compute transition starts in the state its resource is in");
+		Check(replay.states[backBuffer] == D3D12_RESOURCE_STATE_PRESENT && replay.states[depthBuffer] == D3D12_RESOURCE_STATE_DEPTH_WRITE &&
+			replay.states[drawBuffer] == D3D12_RESOURCE_STATE_COMMON && replay.states[pyramidTexture] == D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE,
+			"imported resources leave the async compute frame in their final states");
+		Check(importedStates.GetState(depthBuffer) == D3D12_RESOURCE_STATE_DEPTH_WRITE, "the tracker has the final depth state");
+	}
+}
+
+// Headless check of the render graph compiler against a mock device: culling, aliasing offsets, barriers and the
+// compile time of a 50 pass frame, which has to stay under 0.1 ms in release builds
+int main()
+{
+	MockRenderGraphDevice device;
+	ResourceStateTracker importedStates;
+	RenderGraph graph(device, importedStates);
+	ID3D12Resource* backBuffer = reinterpret_cast<ID3D12Resource*>(static_cast<uintptr_t>(0x10000));
+	importedStates.Register(backBuffer, D3D12_RESOURCE_STATE_PRESENT);
+
+	BarrierReplay replay;
+	replay.states[backBuffer] = D3D12_RESOURCE_STATE_PRESENT;
+
+	const UINT warmupFrames = 10;
+	const UINT measuredFrames = 1000;
+	double compileMilliseconds = 0.0;
+	for (UINT frameIndex = 0; frameIndex < warmupFrames + measuredFrames; frameIndex++)
+	{
+		graph.Reset();
+		const TestFrame frame = BuildFrame(graph, backBuffer);
+		graph.Compile(false);
+		if (frameIndex >= warmupFrames)
+		{
+			compileMilliseconds += graph.GetCompileMilliseconds();
+		}
+
+		// New placed resources start in the state they were created in
+		for (const auto& created : device.initial_states)
+		{
+			replay.states.insert(created);
+		}
+
+		UINT aliasingCount = 0;
+		bool valid = true;
+		for (UINT p = 0; p < pass_count; p++)
+		{
+			if (graph.IsPassAlive(p))
+			{
+				valid = replay.Apply(graph.GetBarriers(p), &aliasingCount) && valid;
+				valid = replay.Apply(graph.GetAfterBarriers(p), &aliasingCount) && valid;
+			}
+		}
+		valid = replay.Apply(graph.GetFinalBarriers(), &aliasingCount) && valid;
+		Check(valid, "every transition starts in the state its resource is in");
+		Check(replay.states[backBuffer] == D3D12_RESOURCE_STATE_PRESENT && importedStates.GetState(backBuffer) == D3D12_RESOURCE_STATE_PRESENT,
+			"the back buffer leaves in its final state");
+
+		if (frameIndex > 0)
+		{
+			continue;
+		}
+
+		// Culling: only the passes whose output nobody reads go
+		Check(graph.GetCulledPassCount() == unused_pass_count, "five passes culled");
+		for (UINT p = 0; p < pass_count; p++)
+		{
+			const bool unused = p > post_pass_count && p <= post_pass_count + unused_pass_count;
+			Check(graph.IsPassAlive(p) != unused, "the unused passes are the culled ones");
+		}
+
+		// Aliasing: the chain alternates between two targets, depth is dead after the scene pass and its memory is reused
+		const UINT64 targetSize = device.GetAllocationInfo(CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R8G8B8A8_UNORM, 1920, 1080)).SizeInBytes;
+		Check(graph.GetHeapOffset(frame.chain[0]) == 0, "the scene target at the start of the heap");
+		Check(graph.GetHeapOffset(frame.depth) == targetSize, "depth after the scene target");
+		for (UINT i = 1; i <= post_pass_count; i++)
+		{
+			Check(graph.GetHeapOffset(frame.chain[i]) == (i % 2 ? targetSize : 0), "post targets alternate between two offsets");
+		}
+		Check(graph.GetTransientHeapSize() == 2 * targetSize, "two targets worth of heap");
+
+		// Barriers: every post pass moves its input to a shader resource and aliases its output. From the second one on the
+		// output is the placed resource the pass before last read from, so it also goes back to a render target. The present
+		// pass adds one for the back buffer and the frame ends with one back to present.
+		Check(graph.GetBarriers(0).empty(), "new targets start in the state of their first use");
+		for (UINT i = 1; i <= post_pass_count; i++)
+		{
+			const std::vector<D3D12_RESOURCE_BARRIER>& barriers = graph.GetBarriers(i);
+			Check(barriers.size() == (i == 1 ? 2 : 3) && barriers[0].Type == D3D12_RESOURCE_BARRIER_TYPE_TRANSITION &&
+				barriers[1].Type == D3D12_RESOURCE_BARRIER_TYPE_ALIASING, "a transition for the input, aliasing and a transition for the output");
+			Check(i == 1 || (barriers.size() == 3 && barriers[2].Transition.pResource == graph.GetResource(frame.chain[i - 2]) &&
+				barriers[2].Transition.StateBefore == D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE), "a reused target comes back from where its last user left it");
+		}
+		Check(aliasingCount == post_pass_count, "one aliasing barrier per reused target");
+		Check(graph.GetBarriers(pass_count - 1).size() == 2, "two transitions before present");
+		Check(graph.GetFinalBarriers().size() == 1, "the back buffer goes back to present");
+	}
+
+	const double averageMilliseconds = compileMilliseconds / measuredFrames;
+	printf("Render graph: %u passes compiled in %.4f ms on average\n", pass_count, averageMilliseconds);
+	printf("%s", graph.FormatReport().c_str());
+#ifdef NDEBUG
+	Check(averageMilliseconds < 0.1, "a 50 pass frame compiles in under 0.1 ms");
+#endif
+
+	TestAsyncCompute();
+
+	if (failures)
+	{
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+	printf("Render graph: all checks passed\n");
+	return 0;
+}
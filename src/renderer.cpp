@@ -1,9 +1,11 @@
 #include "renderer.h"
-
-#define TINYOBJLOADER_IMPLEMENTATION
-#include "tiny_obj_loader.h"
 #include "atlstr.h"
 
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <fstream>
+
 void Renderer::OnInit()
 {
 	LoadPipeline();
@@ -12,6 +14,9 @@ void Renderer::OnInit()
 
 void Renderer::OnUpdate()
 {
+	// Wait for the swap chain before anything samples input, not in Present after the frame is recorded
+	presenter->WaitForFrame();
+
 	angle += delta_rotation;
 	eye_position += XMVECTOR{ sin(angle), 0.f, cos(angle) } * delta_forward;
 
@@ -20,29 +25,57 @@ void Renderer::OnUpdate()
 	XMVECTOR upDirection = { 0.f, 1.f, 0.f };
 	view = XMMatrixLookAtLH(eye_position, focusPos, upDirection);
 	mwp = projection * view * world;
-
-	memcpy(constant_buffer_data_begin, &mwp, sizeof(mwp));
+	scene_constants.mwp = mwp;
+	UpdateStreaming();
 }
 
 void Renderer::OnRender()
 {
-	PopulateCommandList();
-	ID3D12CommandList* commandList[] = { command_list.Get() };
+	BuildRenderGraph();
 
-	command_queue->ExecuteCommandLists(_countof(commandList), commandList);
+	// The graph records its own lists and submits them together with the worker lists, in pass order. The direct
+	// queue waits for every compute batch before the frame ends, so its fence covers both queues.
+	const RenderGraphExecution execution = { device.Get(), command_queue.Get(), frames[frame_index].command_allocator.Get(),
+		compute_queue.Get(), frames[frame_index].compute_allocator.Get() };
+	render_graph->Execute(execution);
 
-	ThrowIfFailed(swap_chain->Present(0, 0));
-	WaitForPreviousFrame();
+	presenter->Present();
+	MoveToNextFrame();
 }
 
 void Renderer::OnDestroy()
 {
-	WaitForPreviousFrame();
+	if (asset_streamer)
+	{
+		asset_streamer->CancelAll();
+	}
+	WaitForGpu();
 	CloseHandle(fence_event);
+	if (presenter)
+	{
+		OutputDebugStringA(presenter->FormatReport().c_str());
+	}
+	if (gpu_memory)
+	{
+		gpu_memory->Free(instance_buffer);
+		resource_states.Unregister(depth_buffer.resource.Get());
+		gpu_memory->Free(depth_buffer);
+		descriptor_heap->Free(depth_descriptor);
+	}
+
+	if (pipeline_library && !pipeline_library->Save())
+	{
+		OutputDebugString(L"Failed to write pipeline cache\n");
+	}
 }
 
 void Renderer::OnKeyDown(CString key)
 {
+	if (presenter)
+	{
+		presenter->OnInput();
+	}
+
 	if (key == _T("W")) {
 		delta_forward = -0.001f;
 	}
@@ -55,11 +88,34 @@ void Renderer::OnKeyDown(CString key)
 	else if (key == _T("D")) {
 		delta_rotation = 0.001f;
 	}
+	else if (key == _T("C") && mesh) {
+		mesh->cancellation.Cancel();
+	}
+	else if (key == _T("G")) {
+		gpu_culling = !gpu_culling;
+	}
+	else if (key == _T("P")) {
+		depth_prepass = !depth_prepass;
+	}
+	else if (key == _T("V") && presenter) {
+		// The latency of the mode that is left goes to the log before the next one starts
+		OutputDebugStringA(presenter->FormatReport().c_str());
+		const PresentMode next = static_cast<PresentMode>((presenter->GetMode() + 1) % PRESENT_MODE_COUNT);
+		presenter->SetMode(next == PRESENT_MODE_TEARING && !presenter->IsTearingSupported() ? PRESENT_MODE_VSYNC : next);
+	}
+	else if (key == _T("L") && presenter) {
+		presenter->SetMaximumFrameLatency(presenter->GetMaximumFrameLatency() % frame_count + 1);
+	}
 
 }
 
 void Renderer::OnKeyUp(CString key)
 {
+	if (presenter)
+	{
+		presenter->OnInput();
+	}
+
 	if (key == _T("W")) {
 		delta_forward = 0.f;
 	}
@@ -95,61 +151,127 @@ void Renderer::LoadPipeline()
 	ThrowIfFailed(dxgiFactory->EnumAdapters1(0, &hardwareAdapter));
 	ThrowIfFailed(D3D12CreateDevice(hardwareAdapter.Get(), D3D_FEATURE_LEVEL_12_0, IID_PPV_ARGS(&device)));
 
+	// Compiled shaders and pipelines are kept next to the binary between runs
+#ifdef DX12_RUNTIME_SHADERS
+	shader_cache = std::make_unique<ShaderCache>(GetBinPath(std::wstring(L"shader_cache")));
+#endif
+	pipeline_library = std::make_unique<PipelineLibrary>(device.Get(), hardwareAdapter.Get(), GetBinPath(std::wstring(L"pipelines.cache")));
+
 	// Create a direct command queue 
 	D3D12_COMMAND_QUEUE_DESC queueDescriptor = {};
 	queueDescriptor.Type = D3D12_COMMAND_LIST_TYPE_DIRECT;
 	queueDescriptor.Flags = D3D12_COMMAND_QUEUE_FLAG_NONE;
 	ThrowIfFailed(device->CreateCommandQueue(&queueDescriptor, IID_PPV_ARGS(&command_queue)));
 
-	// Create swap chain
-	DXGI_SWAP_CHAIN_DESC1 swapChainDescriptor = {};
-	swapChainDescriptor.BufferCount = frame_number;
-	swapChainDescriptor.Width = GetWidth();
-	swapChainDescriptor.Height = GetHeight();
-	swapChainDescriptor.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-	swapChainDescriptor.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
-	swapChainDescriptor.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD;
-	swapChainDescriptor.SampleDesc.Count = 1;
-
-	ComPtr<IDXGISwapChain1> tempSwapChain;
-	ThrowIfFailed(dxgiFactory->CreateSwapChainForHwnd(
-		command_queue.Get(),
-		Win32Window::GetHwnd(),
-		&swapChainDescriptor,
-		nullptr,
-		nullptr,
-		&tempSwapChain
-	));
-	ThrowIfFailed(dxgiFactory->MakeWindowAssociation(Win32Window::GetHwnd(), DXGI_MWA_NO_ALT_ENTER));
-	ThrowIfFailed(tempSwapChain.As(&swap_chain));
-
-	frame_index = swap_chain->GetCurrentBackBufferIndex();
+	// The render graph runs the culling passes on a compute queue, overlapped with the direct queue where dependencies allow
+	queueDescriptor.Type = D3D12_COMMAND_LIST_TYPE_COMPUTE;
+	ThrowIfFailed(device->CreateCommandQueue(&queueDescriptor, IID_PPV_ARGS(&compute_queue)));
+
+	// The presenter creates the swap chain with the frame latency waitable object, and with tearing where the system allows it
+	presenter = std::make_unique<Presenter>(dxgiFactory.Get(), command_queue.Get(), Win32Window::GetHwnd(), GetWidth(), GetHeight(),
+		DXGI_FORMAT_R8G8B8A8_UNORM, frame_count, max_frame_latency);
+	presenter->SetMode(present_mode);
+
+	frame_index = presenter->GetSwapChain()->GetCurrentBackBufferIndex();
 
 	// Create descriptor heap for render target view
 	D3D12_DESCRIPTOR_HEAP_DESC rtvHeapDescriptor = {};
-	rtvHeapDescriptor.NumDescriptors = frame_number;
+	rtvHeapDescriptor.NumDescriptors = frame_count;
 	rtvHeapDescriptor.Type = D3D12_DESCRIPTOR_HEAP_TYPE_RTV;
 	rtvHeapDescriptor.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
 	ThrowIfFailed(device->CreateDescriptorHeap(&rtvHeapDescriptor, IID_PPV_ARGS(&rtv_heap)));
 	rtv_descriptor_size = device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_RTV);
 
-	D3D12_DESCRIPTOR_HEAP_DESC cbvHeapDescriptor = {};
-	cbvHeapDescriptor.NumDescriptors = 1;
-	cbvHeapDescriptor.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
-	cbvHeapDescriptor.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
-	ThrowIfFailed(device->CreateDescriptorHeap(&cbvHeapDescriptor, IID_PPV_ARGS(&cbv_heap)));
+	// One shader-visible heap for every CBV/SRV/UAV, views are created in the staging heap and copied in
+	descriptor_heap = std::make_unique<DescriptorHeap>(device.Get(), persistent_descriptor_count, dynamic_descriptor_count);
+	staging_descriptors = std::make_unique<StagingDescriptorHeap>(device.Get(), D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+
+	// Buffers are placed in shared heaps instead of one implicit heap each
+	gpu_memory = std::make_unique<GpuMemoryAllocator>(device.Get());
+	// Timestamps of the compute queue passes are converted with the direct queue's frequency
+	gpu_timer = std::make_unique<GpuTimer>(device.Get(), command_queue.Get(), *gpu_memory, frame_count, GPU_TIMER_COUNT);
+
+	// Depth buffer with a writable view for the passes that lay down depth and a read-only one for the scene after the prepass
+	D3D12_DESCRIPTOR_HEAP_DESC dsvHeapDescriptor = {};
+	dsvHeapDescriptor.NumDescriptors = 2;
+	dsvHeapDescriptor.Type = D3D12_DESCRIPTOR_HEAP_TYPE_DSV;
+	dsvHeapDescriptor.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
+	ThrowIfFailed(device->CreateDescriptorHeap(&dsvHeapDescriptor, IID_PPV_ARGS(&dsv_heap)));
+	dsv_descriptor_size = device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_DSV);
+
+	// Typeless, so the pyramid build can read last frame's depth through a float view
+	const D3D12_RESOURCE_DESC depthDescriptor = CD3DX12_RESOURCE_DESC::Tex2D(depth_resource_format, GetWidth(), GetHeight(), 1, 1, 1, 0,
+		D3D12_RESOURCE_FLAG_ALLOW_DEPTH_STENCIL);
+	const CD3DX12_CLEAR_VALUE depthClearValue(depth_format, 1.f, 0);
+	depth_buffer = gpu_memory->CreateTexture(depthDescriptor, D3D12_RESOURCE_STATE_DEPTH_WRITE, &depthClearValue);
+	resource_states.Register(depth_buffer.resource.Get(), D3D12_RESOURCE_STATE_DEPTH_WRITE);
 
-	// Create render target view for each frame
+	D3D12_DEPTH_STENCIL_VIEW_DESC dsvDescriptor = {};
+	dsvDescriptor.Format = depth_format;
+	dsvDescriptor.ViewDimension = D3D12_DSV_DIMENSION_TEXTURE2D;
+	dsvDescriptor.Flags = D3D12_DSV_FLAG_NONE;
+	device->CreateDepthStencilView(depth_buffer.resource.Get(), &dsvDescriptor, GetDepthStencilView(false));
+	dsvDescriptor.Flags = D3D12_DSV_FLAG_READ_ONLY_DEPTH;
+	device->CreateDepthStencilView(depth_buffer.resource.Get(), &dsvDescriptor, GetDepthStencilView(true));
+
+	D3D12_SHADER_RESOURCE_VIEW_DESC depthSrvDescriptor = {};
+	depthSrvDescriptor.Format = depth_srv_format;
+	depthSrvDescriptor.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+	depthSrvDescriptor.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	depthSrvDescriptor.Texture2D.MipLevels = 1;
+	const D3D12_CPU_DESCRIPTOR_HANDLE depthSrvHandle = staging_descriptors->Allocate();
+	device->CreateShaderResourceView(depth_buffer.resource.Get(), &depthSrvDescriptor, depthSrvHandle);
+	depth_descriptor = descriptor_heap->Allocate(1);
+	descriptor_heap->Copy(depth_descriptor, 0, depthSrvHandle);
+	staging_descriptors->Free(depthSrvHandle);
+
+	// Back buffers are imported into the graph every frame, it keeps their states in resource_states
+	render_graph_device = std::make_unique<D3D12RenderGraphDevice>(device.Get());
+	render_graph = std::make_unique<RenderGraph>(*render_graph_device, resource_states);
+
+	// Create render target view and command allocator for each frame
 	CD3DX12_CPU_DESCRIPTOR_HANDLE rtvHandle(rtv_heap->GetCPUDescriptorHandleForHeapStart());
-	for (UINT i = 0; i < frame_number; i++)
+	for (UINT i = 0; i < frame_count; i++)
 	{
-		ThrowIfFailed(swap_chain->GetBuffer(i, IID_PPV_ARGS(&render_targets[i])));
+		ThrowIfFailed(presenter->GetSwapChain()->GetBuffer(i, IID_PPV_ARGS(&render_targets[i])));
 		device->CreateRenderTargetView(render_targets[i].Get(), nullptr, rtvHandle);
 		rtvHandle.Offset(1, rtv_descriptor_size);
+		resource_states.Register(render_targets[i].Get(), D3D12_RESOURCE_STATE_PRESENT);
+
+		ThrowIfFailed(device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&frames[i].command_allocator)));
+		ThrowIfFailed(device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_COMPUTE, IID_PPV_ARGS(&frames[i].compute_allocator)));
+	}
+
+	// Scene draws are recorded on their own pool so streaming work never delays a frame.
+	// The render thread records too, so the pool has one thread less than there are lists.
+	if (recording_thread_count == 0)
+	{
+		recording_thread_count = static_cast<UINT>(thread_pool.GetThreadCount());
+	}
+	recording_thread_count = min(max(recording_thread_count, 1u), max_recording_threads);
+	recording_pool = std::make_unique<ThreadPool>(recording_thread_count - 1);
+
+	// Allocators per frame and per recording thread, an allocator is only reset after the GPU finished its frame
+	for (UINT i = 0; i < frame_count; i++)
+	{
+		frames[i].recording_allocators.resize(recording_thread_count);
+		for (ComPtr<ID3D12CommandAllocator>& allocator : frames[i].recording_allocators)
+		{
+			ThrowIfFailed(device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&allocator)));
+		}
 	}
 
-	// Create command allocator
-	ThrowIfFailed(device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&command_allocator)));
+	// The benchmark walks the thread counts up to the configured one with many draws per submesh
+	if (benchmark_enabled)
+	{
+		for (UINT threads = 1; threads < recording_thread_count; threads *= 2)
+		{
+			benchmark_thread_counts.push_back(threads);
+		}
+		benchmark_thread_counts.push_back(recording_thread_count);
+		recording_thread_count = benchmark_thread_counts.front();
+		draw_repeat = benchmark_draw_repeat;
+	}
 }
 
 void Renderer::LoadAssets()
@@ -162,17 +284,24 @@ void Renderer::LoadAssets()
 		rsFeatureData.HighestVersion = D3D_ROOT_SIGNATURE_VERSION_1_0;
 	}
 
-	CD3DX12_DESCRIPTOR_RANGE1 ranges[1];
-	CD3DX12_ROOT_PARAMETER1 rootParameters[1];
+	CD3DX12_DESCRIPTOR_RANGE1 ranges[2];
+	CD3DX12_ROOT_PARAMETER1 rootParameters[ROOT_PARAMETER_COUNT];
 
-	ranges[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_CBV, 1, 0, 0, D3D12_DESCRIPTOR_RANGE_FLAG_DATA_STATIC);
-	rootParameters[0].InitAsDescriptorTable(1, &ranges[0], D3D12_SHADER_VISIBILITY_VERTEX);
+	// Per-frame scene constants as a root CBV into the upload ring and per-draw data as root constants,
+	// so a draw only writes a few root arguments. The instances are a root SRV indexed with SV_InstanceID.
+	// The table spans the whole shader-visible heap and shaders index it with descriptor indices from the
+	// draw constants.
+	ranges[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, UINT_MAX, 0, 1, D3D12_DESCRIPTOR_RANGE_FLAG_DESCRIPTORS_VOLATILE, 0);
+	ranges[1].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, UINT_MAX, 0, 2, D3D12_DESCRIPTOR_RANGE_FLAG_DESCRIPTORS_VOLATILE, 0);
+	rootParameters[ROOT_SCENE_CONSTANTS].InitAsConstantBufferView(0, 0, D3D12_ROOT_DESCRIPTOR_FLAG_DATA_STATIC, D3D12_SHADER_VISIBILITY_ALL);
+	rootParameters[ROOT_DRAW_CONSTANTS].InitAsConstants(sizeof(DrawConstants) / sizeof(UINT), 1, 0, D3D12_SHADER_VISIBILITY_ALL);
+	rootParameters[ROOT_INSTANCES].InitAsShaderResourceView(0, 0, D3D12_ROOT_DESCRIPTOR_FLAG_DATA_STATIC_WHILE_SET_AT_EXECUTE, D3D12_SHADER_VISIBILITY_ALL);
+	rootParameters[ROOT_BINDLESS_TABLE].InitAsDescriptorTable(_countof(ranges), ranges, D3D12_SHADER_VISIBILITY_ALL);
 
 	D3D12_ROOT_SIGNATURE_FLAGS rsFlags = D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT
 		| D3D12_ROOT_SIGNATURE_FLAG_DENY_HULL_SHADER_ROOT_ACCESS
 		| D3D12_ROOT_SIGNATURE_FLAG_DENY_DOMAIN_SHADER_ROOT_ACCESS
-		| D3D12_ROOT_SIGNATURE_FLAG_DENY_GEOMETRY_SHADER_ROOT_ACCESS
-		| D3D12_ROOT_SIGNATURE_FLAG_DENY_PIXEL_SHADER_ROOT_ACCESS;
+		| D3D12_ROOT_SIGNATURE_FLAG_DENY_GEOMETRY_SHADER_ROOT_ACCESS;
 
 	CD3DX12_VERSIONED_ROOT_SIGNATURE_DESC rootSignatureDescriptor;
 	rootSignatureDescriptor.Init_1_1(_countof(rootParameters), rootParameters, 0, nullptr, rsFlags);
@@ -183,214 +312,759 @@ void Renderer::LoadAssets()
 		&signature, &error));
 	ThrowIfFailed(device->CreateRootSignature(0, signature->GetBufferPointer(), signature->GetBufferSize(), IID_PPV_ARGS(&root_signature)));
 
-	// Create full PSO
-	ComPtr<ID3D10Blob> vertexShader;
-	ComPtr<ID3D10Blob> pixelShader;
-
+	// Create full PSO. Shaders are compiled at build time and embedded, the runtime shader mode
+	// compiles the copy next to the binary instead so shader edits only need a restart.
+#ifdef DX12_RUNTIME_SHADERS
 	UINT compile_flags = 0;
 #ifdef _DEBUG
 	compile_flags |= D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION;
 #endif
 
 	std::wstring shaderPath = GetBinPath(std::wstring(L"shaders.hlsl"));
-	ThrowIfFailed(D3DCompileFromFile(shaderPath.c_str(), nullptr, nullptr, "VSMain", "vs_5_0",
-		compile_flags, 0, &vertexShader, &error));
-	ThrowIfFailed(D3DCompileFromFile(shaderPath.c_str(), nullptr, nullptr, "PSMain", "ps_5_0",
-		compile_flags, 0, &pixelShader, &error));
+	ComPtr<ID3D10Blob> vertexShader = shader_cache->Compile(shaderPath, "VSMain", "vs_5_1", compile_flags);
+	ComPtr<ID3D10Blob> depthVertexShader = shader_cache->Compile(shaderPath, "VSDepth", "vs_5_1", compile_flags);
+	ComPtr<ID3D10Blob> pixelShader = shader_cache->Compile(shaderPath, "PSMain", "ps_5_1", compile_flags);
+	ComPtr<ID3D10Blob> cullingShader = shader_cache->Compile(GetBinPath(std::wstring(L"culling.hlsl")), "CSCull", "cs_5_1", compile_flags);
+	ComPtr<ID3D10Blob> hizShader = shader_cache->Compile(GetBinPath(std::wstring(L"culling.hlsl")), "CSBuildHiZ", "cs_5_1", compile_flags);
+	const D3D12_SHADER_BYTECODE vertexShaderBytecode = CD3DX12_SHADER_BYTECODE(vertexShader.Get());
+	const D3D12_SHADER_BYTECODE depthVertexShaderBytecode = CD3DX12_SHADER_BYTECODE(depthVertexShader.Get());
+	const D3D12_SHADER_BYTECODE pixelShaderBytecode = CD3DX12_SHADER_BYTECODE(pixelShader.Get());
+	const D3D12_SHADER_BYTECODE cullingShaderBytecode = CD3DX12_SHADER_BYTECODE(cullingShader.Get());
+	const D3D12_SHADER_BYTECODE hizShaderBytecode = CD3DX12_SHADER_BYTECODE(hizShader.Get());
+#else
+	const D3D12_SHADER_BYTECODE vertexShaderBytecode = GetEmbeddedShader("shaders.hlsl", "VSMain");
+	const D3D12_SHADER_BYTECODE depthVertexShaderBytecode = GetEmbeddedShader("shaders.hlsl", "VSDepth");
+	const D3D12_SHADER_BYTECODE pixelShaderBytecode = GetEmbeddedShader("shaders.hlsl", "PSMain");
+	const D3D12_SHADER_BYTECODE cullingShaderBytecode = GetEmbeddedShader("culling.hlsl", "CSCull");
+	const D3D12_SHADER_BYTECODE hizShaderBytecode = GetEmbeddedShader("culling.hlsl", "CSBuildHiZ");
+#endif
 
 	D3D12_INPUT_ELEMENT_DESC inputElementDescriptor[] = {
-		{"POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0},
-		{"COLOR", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0}
+		{"PACKED", 0, DXGI_FORMAT_R16G16B16A16_UINT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0}
 	};
 
 	D3D12_GRAPHICS_PIPELINE_STATE_DESC psoDescriptor = {};
 	psoDescriptor.InputLayout = { inputElementDescriptor, _countof(inputElementDescriptor) };
 	psoDescriptor.pRootSignature = root_signature.Get();
-	psoDescriptor.VS = CD3DX12_SHADER_BYTECODE(vertexShader.Get());
-	psoDescriptor.PS = CD3DX12_SHADER_BYTECODE(pixelShader.Get());
+	psoDescriptor.VS = vertexShaderBytecode;
+	psoDescriptor.PS = pixelShaderBytecode;
 	psoDescriptor.RasterizerState = CD3DX12_RASTERIZER_DESC(D3D12_DEFAULT);
 	psoDescriptor.RasterizerState.CullMode = D3D12_CULL_MODE_NONE;
-	psoDescriptor.RasterizerState.FillMode = D3D12_FILL_MODE_WIREFRAME;
+	psoDescriptor.RasterizerState.FillMode = D3D12_FILL_MODE_SOLID;
 	psoDescriptor.RasterizerState.DepthClipEnable = FALSE;
 	psoDescriptor.BlendState = CD3DX12_BLEND_DESC(D3D12_DEFAULT);
-	psoDescriptor.DepthStencilState.DepthEnable = FALSE;
+	psoDescriptor.DepthStencilState = CD3DX12_DEPTH_STENCIL_DESC(D3D12_DEFAULT);
 	psoDescriptor.DepthStencilState.StencilEnable = FALSE;
+	psoDescriptor.DSVFormat = depth_format;
 	psoDescriptor.SampleMask = UINT_MAX;
 	psoDescriptor.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
 	psoDescriptor.NumRenderTargets = 1;
 	psoDescriptor.RTVFormats[0] = DXGI_FORMAT_R8G8B8A8_UNORM;
 	psoDescriptor.SampleDesc.Count = 1;
-	ThrowIfFailed(device->CreateGraphicsPipelineState(&psoDescriptor, IID_PPV_ARGS(&pipeline_state)));
+	pipeline_state = pipeline_library->CreateGraphicsPipeline(L"scene", psoDescriptor);
+
+	// After the prepass the depth is final, so the pixel shader only runs for the surface that is visible
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC equalDepthDescriptor = psoDescriptor;
+	equalDepthDescriptor.DepthStencilState.DepthFunc = D3D12_COMPARISON_FUNC_EQUAL;
+	equalDepthDescriptor.DepthStencilState.DepthWriteMask = D3D12_DEPTH_WRITE_MASK_ZERO;
+	equal_depth_pipeline_state = pipeline_library->CreateGraphicsPipeline(L"scene after depth prepass", equalDepthDescriptor);
+
+	// Position only, without pixel shader and render target
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC depthPrepassDescriptor = psoDescriptor;
+	depthPrepassDescriptor.VS = depthVertexShaderBytecode;
+	depthPrepassDescriptor.PS = {};
+	depthPrepassDescriptor.NumRenderTargets = 0;
+	depthPrepassDescriptor.RTVFormats[0] = DXGI_FORMAT_UNKNOWN;
+	depth_prepass_pipeline_state = pipeline_library->CreateGraphicsPipeline(L"depth prepass", depthPrepassDescriptor);
+	cull_backfaces = psoDescriptor.RasterizerState.CullMode == D3D12_CULL_MODE_BACK;
+	gpu_culler = std::make_unique<GpuCuller>(device.Get(), *gpu_memory, resource_states, *pipeline_library, *descriptor_heap, *staging_descriptors,
+		cullingShaderBytecode, hizShaderBytecode, root_signature.Get(), ROOT_DRAW_CONSTANTS, frame_count);
+	gpu_culler->SetPyramidSize(GetWidth(), GetHeight());
+
+	WCHAR cacheReport[128];
+#ifdef DX12_RUNTIME_SHADERS
+	swprintf_s(cacheReport, L"Shader cache: %u hits, %u misses; pipeline cache: %u hits, %u misses\n",
+		shader_cache->GetHits(), shader_cache->GetMisses(), pipeline_library->GetHits(), pipeline_library->GetMisses());
+#else
+	swprintf_s(cacheReport, L"Embedded shaders; pipeline cache: %u hits, %u misses\n", pipeline_library->GetHits(), pipeline_library->GetMisses());
+#endif
+	OutputDebugString(cacheReport);
+
+	// The render graph records the frame's own lists, the draws go to the recording lists
+	recording_command_lists.resize(frames[frame_index].recording_allocators.size());
+	for (UINT i = 0; i < recording_command_lists.size(); i++)
+	{
+		ThrowIfFailed(device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, frames[frame_index].recording_allocators[i].Get(),
+			pipeline_state.Get(), IID_PPV_ARGS(&recording_command_lists[i])));
+		ThrowIfFailed(recording_command_lists[i]->Close());
+	}
+
+	// Per-frame data is written into the upload ring, the mesh fills in dequantization once it is streamed in
+	upload_ring = std::make_unique<UploadRing>(device.Get(), upload_ring_capacity);
+	scene_constants.mwp = mwp;
+	scene_constants.position_offset = XMFLOAT4(0.f, 0.f, 0.f, 0.f);
+	scene_constants.position_scale = XMFLOAT4(0.f, 0.f, 0.f, 0.f);
+	scene_constants.fade = XMFLOAT4(0.f, 0.f, 0.f, 0.f);
+
+	// Create synchronization objects, the first frame is recorded against fence value 1
+	ThrowIfFailed(device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&fence)));
+	frames[frame_index].fence_value = 1;
+	fence_event = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+	if (fence_event == nullptr)
+	{
+		ThrowIfFailed(HRESULT_FROM_WIN32(GetLastError()));
+	}
+
+	// Stream the mesh in the background, frames are presented without it until its upload is submitted
+	upload_scheduler = std::make_unique<UploadScheduler>(device.Get());
+	asset_streamer = std::make_unique<AssetStreamer>(*gpu_memory, thread_pool, *upload_scheduler, streaming_memory_budget);
+	mesh = asset_streamer->LoadMesh(GetBinPath(std::wstring(L"CornellBox-Original.obj")));
+}
+
+void Renderer::UpdateStreaming()
+{
+	if (!mesh)
+	{
+		return;
+	}
+
+	// The streamer reports ready once the copies are submitted, the direct and compute queues wait for them on the GPU
+	if (!mesh_visible && mesh->state == STREAMING_READY)
+	{
+		PlaceInstances();
+		const UINT64 uploadFenceValue = max(mesh->upload_fence_value, UploadInstances());
+		upload_scheduler->WaitOnQueue(command_queue.Get(), uploadFenceValue);
+		upload_scheduler->WaitOnQueue(compute_queue.Get(), uploadFenceValue);
+		cluster_culler.SetMeshlets(mesh->data.meshlets);
+
+		scene_constants.position_offset = XMFLOAT4(mesh->data.quantization.position_offset);
+		scene_constants.position_scale = XMFLOAT4(mesh->data.quantization.position_scale);
+
+		// The material views get a persistent range for as long as the mesh lives
+		D3D12_CPU_DESCRIPTOR_HANDLE srvHandles[] = { staging_descriptors->Allocate(), staging_descriptors->Allocate() };
+		D3D12_SHADER_RESOURCE_VIEW_DESC srvDescriptor = {};
+		srvDescriptor.ViewDimension = D3D12_SRV_DIMENSION_BUFFER;
+		srvDescriptor.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+		srvDescriptor.Format = DXGI_FORMAT_UNKNOWN;
+		srvDescriptor.Buffer.FirstElement = mesh->material_buffer.offset / sizeof(GpuMaterial);
+		srvDescriptor.Buffer.NumElements = static_cast<UINT>(mesh->data.materials.size());
+		srvDescriptor.Buffer.StructureByteStride = sizeof(GpuMaterial);
+		device->CreateShaderResourceView(mesh->material_buffer.resource.Get(), &srvDescriptor, srvHandles[0]);
+
+		srvDescriptor.Format = DXGI_FORMAT_R16_UINT;
+		srvDescriptor.Buffer.FirstElement = mesh->triangle_material_buffer.offset / sizeof(UINT16);
+		srvDescriptor.Buffer.NumElements = static_cast<UINT>(mesh->triangle_material_buffer.size / sizeof(UINT16));
+		srvDescriptor.Buffer.StructureByteStride = 0;
+		device->CreateShaderResourceView(mesh->triangle_material_buffer.resource.Get(), &srvDescriptor, srvHandles[1]);
+
+		mesh_descriptors = descriptor_heap->Allocate(_countof(srvHandles));
+		for (UINT i = 0; i < _countof(srvHandles); i++)
+		{
+			descriptor_heap->Copy(mesh_descriptors, i, srvHandles[i]);
+			staging_descriptors->Free(srvHandles[i]);
+		}
+
+		mesh_visible = true;
+		mesh_fade_start = GetTickCount64();
+		OutputDebugStringA(gpu_memory->FormatReport().c_str());
+	}
+	else if (mesh_visible && instances.GetVersion() != instance_buffer_version)
+	{
+		const UINT64 uploadFenceValue = UploadInstances();
+		upload_scheduler->WaitOnQueue(command_queue.Get(), uploadFenceValue);
+		upload_scheduler->WaitOnQueue(compute_queue.Get(), uploadFenceValue);
+	}
+
+	if (mesh_visible)
+	{
+		const float opacity = min(static_cast<float>(GetTickCount64() - mesh_fade_start) / mesh_fade_milliseconds, 1.f);
+		scene_constants.fade = XMFLOAT4(opacity, opacity, opacity, 1.f);
+	}
+}
+
+void Renderer::PlaceInstances()
+{
+	// One copy draws the mesh where it is, more copies share its area in a grid of scaled down cells
+	std::vector<InstanceData> placed(placed_instance_count, InstanceSet::MakeIdentity());
+	if (placed_instance_count > 1)
+	{
+		XMVECTOR meshMin = XMVectorReplicate(FLT_MAX);
+		XMVECTOR meshMax = XMVectorReplicate(-FLT_MAX);
+		for (const Submesh& submesh : mesh->data.submeshes)
+		{
+			meshMin = XMVectorMin(meshMin, XMLoadFloat3(reinterpret_cast<const XMFLOAT3*>(submesh.aabb_min)));
+			meshMax = XMVectorMax(meshMax, XMLoadFloat3(reinterpret_cast<const XMFLOAT3*>(submesh.aabb_max)));
+		}
+
+		const UINT columns = static_cast<UINT>(ceil(sqrt(static_cast<double>(placed_instance_count))));
+		const float scale = 1.f / columns;
+		const XMVECTOR cellSize = (meshMax - meshMin) * scale;
+		for (UINT i = 0; i < placed_instance_count; i++)
+		{
+			const XMVECTOR cell = XMVectorSet(static_cast<float>(i % columns), static_cast<float>(i / columns), 0.f, 0.f);
+			const XMMATRIX instanceWorld = XMMatrixScaling(scale, scale, scale) * XMMatrixTranslationFromVector(meshMin * (1.f - scale) + cell * cellSize);
+			XMStoreFloat4x3(reinterpret_cast<XMFLOAT4X3*>(placed[i].world), instanceWorld);
+		}
+	}
+
+	std::vector<InstanceHandle> handles(placed.size());
+	instances.Clear();
+	instances.Add(placed.data(), placed.size(), handles.data());
+}
 
-	// Create command list
-	ThrowIfFailed(device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, command_allocator.Get(), \
-		pipeline_state.Get(), IID_PPV_ARGS(&command_list)));
-	ThrowIfFailed(command_list->Close());
+UINT64 Renderer::UploadInstances()
+{
+	gpu_memory->Free(instance_buffer);
+	instance_buffer_version = instances.GetVersion();
+	culling_objects.clear();
+	const std::vector<InstanceData>& instanceData = instances.GetInstances();
+	if (instanceData.empty())
+	{
+		return 0;
+	}
 
-	// Create and upload vertex buffer
-	std::wstring objDirectory = GetBinPath(std::wstring());
-	std::string objPath(objDirectory.begin(), objDirectory.end());
-	std::string objFile = objPath + "CornellBox-Original.obj";
-	tinyobj::attrib_t attrib;
-	std::vector<tinyobj::shape_t> shapes;
-	std::vector<tinyobj::material_t> materials;
+	const UINT64 instanceDataSize = sizeof(InstanceData) * instanceData.size();
+	instance_buffer = gpu_memory->CreateBuffer(D3D12_HEAP_TYPE_DEFAULT, instanceDataSize, sizeof(InstanceData));
+	upload_scheduler->Enqueue(instance_buffer.resource.Get(), instance_buffer.offset, instanceData.data(), instanceDataSize);
 
-	std::string warn;
-	std::string err;
+	// Every submesh is one object for the culling passes, bounded over all instances
+	for (uint32_t s = 0; s < mesh->data.submeshes.size(); s++)
+	{
+		const Submesh& submesh = mesh->data.submeshes[s];
+		CullingObject object = {};
+		instances.TransformBounds(submesh.aabb_min, submesh.aabb_max, object.aabb_min, object.aabb_max);
+		object.index_offset = submesh.index_offset;
+		object.index_count = submesh.index_count;
+		object.object_index = s;
+		culling_objects.push_back(object);
+	}
 
-	bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, objFile.c_str(), objPath.c_str());
+	// The flush also submits the instance copy
+	return gpu_culler->SetObjects(culling_objects, *upload_scheduler);
+}
 
-	if (!warn.empty()) 
+void Renderer::BuildRenderGraph()
+{
+	// MoveToNextFrame made sure the GPU is done with this frame's allocators and timestamps
+	FrameResources& frame = frames[frame_index];
+	ThrowIfFailed(frame.command_allocator->Reset());
+	ThrowIfFailed(frame.compute_allocator->Reset());
+	gpu_timer->BeginFrame(frame_index);
+	for (UINT i = 0; i < GPU_TIMER_COUNT; i++)
 	{
-		std::wstring w_warn(warn.begin(), warn.end());
-		w_warn = L"Tiny OBJ reader warning: " + w_warn + L"\n";
-		OutputDebugString(w_warn.c_str());
+		double passMilliseconds;
+		if (gpu_timer->GetMilliseconds(i, passMilliseconds))
+		{
+			gpu_pass_totals_milliseconds[i] += passMilliseconds;
+			gpu_pass_frame_counts[i]++;
+		}
 	}
 
-	if (!err.empty()) 
+	render_graph->Reset();
+	const RenderGraphResource backBuffer = render_graph->ImportResource("back buffer", render_targets[frame_index].Get(), D3D12_RESOURCE_STATE_PRESENT);
+	const RenderGraphResource depthBuffer = render_graph->ImportResource("depth", depth_buffer.resource.Get(), D3D12_RESOURCE_STATE_DEPTH_WRITE);
+	const D3D12_GPU_VIRTUAL_ADDRESS sceneConstants = upload_ring->Push(scene_constants).gpu_address;
+
+	// GPU-driven frames reset the draw count, cull into the draw buffer and draw it with one ExecuteIndirect.
+	// The recording benchmark times the CPU path, so it always culls on the CPU.
+	const bool gpuDriven = IsGpuCulling() && mesh_visible && !culling_objects.empty();
+	RenderGraphResource drawBuffer = 0;
+	RenderGraphResource pyramid = 0;
+	UINT drawCount;
+	if (gpu_culler->GetReadback(frame_index, &drawCount, readback_draws, readback_pyramid))
 	{
-		std::wstring e_err(err.begin(), err.end());
-		e_err = L"Tiny OBJ reader error: " + e_err + L"\n";
-		OutputDebugString(e_err.c_str());
+		gpu_draw_count = drawCount;
+		if (frame.validate_culling && frame.culling_instance_version == instance_buffer_version)
+		{
+			ValidateCulling(frame.culling_constants, drawCount);
+		}
 	}
+	frame.validate_culling = false;
+	const bool occlusion = gpuDriven && depth_written;
+	if (gpuDriven)
+	{
+		submesh_statistics = {};
+		submesh_statistics.total = culling_objects.size();
+		submesh_statistics.visible = min(static_cast<size_t>(gpu_draw_count), culling_objects.size());
+
+		drawBuffer = render_graph->ImportResource("indirect draws", gpu_culler->GetDrawBuffer(), D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT);
+		render_graph->AddPass("reset draw count", RENDER_GRAPH_QUEUE_DIRECT, [this](RenderGraphContext& context)
+		{
+			gpu_culler->RecordReset(context.GetCommandList());
+		}).Write(drawBuffer, D3D12_RESOURCE_STATE_COPY_DEST);
+
+		// Last frame's depth is the occluder, so the pyramid is reduced from it before the prepass overwrites it.
+		// The first frame has no depth yet and culls against the frustum only.
+		if (occlusion)
+		{
+			pyramid = render_graph->ImportResource("hi-z pyramid", gpu_culler->GetPyramid(), D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+			render_graph->AddPass("build hi-z", RENDER_GRAPH_QUEUE_COMPUTE, [this](RenderGraphContext& context)
+			{
+				ID3D12GraphicsCommandList* commandList = context.GetCommandList();
+				gpu_timer->Begin(commandList, GPU_TIMER_HIZ);
+				gpu_culler->RecordBuildHiZ(commandList, depth_descriptor.offset);
+				gpu_timer->End(commandList, GPU_TIMER_HIZ);
+			})
+			.Read(depthBuffer, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE)
+			.Write(pyramid, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+		}
 
-	if (!ret) {
-		ThrowIfFailed(-1);
+		const CullingConstants constants = BuildCullingConstants(occlusion);
+		const D3D12_GPU_VIRTUAL_ADDRESS cullingConstants = upload_ring->Push(constants).gpu_address;
+		frame.culling_constants = constants;
+		frame.validate_culling = culling_validation;
+		frame.culling_instance_version = instance_buffer_version;
+		RenderGraph::PassBuilder cullPass = render_graph->AddPass("cull", RENDER_GRAPH_QUEUE_COMPUTE, [this, cullingConstants](RenderGraphContext& context)
+		{
+			ID3D12GraphicsCommandList* commandList = context.GetCommandList();
+			gpu_timer->Begin(commandList, GPU_TIMER_CULL);
+			gpu_culler->RecordCull(commandList, cullingConstants, *descriptor_heap);
+			gpu_timer->End(commandList, GPU_TIMER_CULL);
+		});
+		cullPass.Write(drawBuffer, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+		if (occlusion)
+		{
+			cullPass.Read(pyramid, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+		}
+	}
+	else
+	{
+		// The CPU culls up front, so the prepass and the scene pass draw the same list
+		CullScene();
+		CollectDraws();
 	}
 
-	// Loop over shapes
-	for (size_t s = 0; s < shapes.size(); s++) 
+	if (depth_prepass)
 	{
-		// Loop over faces(polygon)
-		size_t index_offset = 0;
-		for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) 
+		RenderGraph::PassBuilder prepass = render_graph->AddPass("depth prepass", RENDER_GRAPH_QUEUE_DIRECT, [this, gpuDriven, sceneConstants](RenderGraphContext& context)
 		{
-			int fv = shapes[s].mesh.num_face_vertices[f];
-
-			// Loop over vertices in the face.
-			int materialIds = shapes[s].mesh.material_ids[f];
-			for (size_t v = 0; v < fv; v++) {
-				// access to vertex
-				tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
-				tinyobj::real_t vx = attrib.vertices[3 * idx.vertex_index + 0];
-				tinyobj::real_t vy = attrib.vertices[3 * idx.vertex_index + 1];
-				tinyobj::real_t vz = attrib.vertices[3 * idx.vertex_index + 2];
-				materials[materialIds].diffuse;
-				ColorVertex vertex = { 
-					{vx, vy, vz} , 
-					{materials[materialIds].diffuse[0], materials[materialIds].diffuse[1], materials[materialIds].diffuse[2], 1.f}
-				};
-				verteces.push_back(vertex);
+			ID3D12GraphicsCommandList* commandList = context.GetCommandList();
+			gpu_timer->Begin(commandList, GPU_TIMER_DEPTH_PREPASS);
+			const D3D12_CPU_DESCRIPTOR_HANDLE dsvHandle = GetDepthStencilView(false);
+			commandList->ClearDepthStencilView(dsvHandle, D3D12_CLEAR_FLAG_DEPTH, 1.f, 0, 0, nullptr);
+			commandList->SetPipelineState(depth_prepass_pipeline_state.Get());
+			SetSceneState(commandList, sceneConstants);
+			commandList->OMSetRenderTargets(0, nullptr, FALSE, &dsvHandle);
+			if (gpuDriven)
+			{
+				gpu_culler->RecordDraws(commandList);
+			}
+			else
+			{
+				RecordDepthDraws(commandList);
 			}
-			index_offset += fv;
+			gpu_timer->End(commandList, GPU_TIMER_DEPTH_PREPASS);
+		});
+		prepass.Write(depthBuffer, D3D12_RESOURCE_STATE_DEPTH_WRITE);
+		if (gpuDriven)
+		{
+			prepass.Read(drawBuffer, D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT);
 		}
 	}
 
-	const UINT vertexBufferSize = sizeof(ColorVertex) * verteces.size();
-	ThrowIfFailed(device->CreateCommittedResource(
-		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
-		D3D12_HEAP_FLAG_NONE,
-		&CD3DX12_RESOURCE_DESC::Buffer(vertexBufferSize),
-		D3D12_RESOURCE_STATE_GENERIC_READ,
-		nullptr,
-		IID_PPV_ARGS(&vertex_buffer)
-	));
-
-	UINT8* vertexDataBegin;
-	CD3DX12_RANGE readRange(0, 0);
-	ThrowIfFailed(vertex_buffer->Map(0, &readRange, reinterpret_cast<void**>(&vertexDataBegin)));
-	memcpy(vertexDataBegin, verteces.data(), sizeof(ColorVertex) * verteces.size());
-	vertex_buffer->Unmap(0, nullptr);
-
-	vertex_buffer_view.BufferLocation = vertex_buffer->GetGPUVirtualAddress();
-	vertex_buffer_view.StrideInBytes = sizeof(ColorVertex);
-	vertex_buffer_view.SizeInBytes = vertexBufferSize;
-
-	// Constant buffer init
-	ThrowIfFailed(device->CreateCommittedResource(
-		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
-		D3D12_HEAP_FLAG_NONE,
-		&CD3DX12_RESOURCE_DESC::Buffer(1024 * 64),
-		D3D12_RESOURCE_STATE_GENERIC_READ,
-		nullptr,
-		IID_PPV_ARGS(&constant_buffer)
-	));
-
-	D3D12_CONSTANT_BUFFER_VIEW_DESC cbvDescriptor = {};
-	cbvDescriptor.BufferLocation = constant_buffer->GetGPUVirtualAddress();
-	cbvDescriptor.SizeInBytes = (sizeof(mwp) + 255) & ~255;
-	device->CreateConstantBufferView(&cbvDescriptor, cbv_heap->GetCPUDescriptorHandleForHeapStart());
-
-	ThrowIfFailed(constant_buffer->Map(0, &readRange, reinterpret_cast<void**>(&constant_buffer_data_begin)));
-	memcpy(constant_buffer_data_begin, &mwp, sizeof(mwp));
-
-	// Create synchronization objects
-	ThrowIfFailed(device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&fence)));
-	fence_value = 1;
-	fence_event = CreateEvent(nullptr, FALSE, FALSE, nullptr);
-	if (fence_event == nullptr)
+	// Otherwise scene draws are split into contiguous chunks, one list per worker, submitted in worker order after the clear
+	RenderGraph::PassBuilder scenePass = render_graph->AddPass("scene", RENDER_GRAPH_QUEUE_DIRECT, [this, gpuDriven, sceneConstants](RenderGraphContext& context)
 	{
-		ThrowIfFailed(HRESULT_FROM_WIN32(GetLastError()));
+		ID3D12GraphicsCommandList* commandList = context.GetCommandList();
+		gpu_timer->Begin(commandList, GPU_TIMER_SCENE);
+		CD3DX12_CPU_DESCRIPTOR_HANDLE rtvHandler(rtv_heap->GetCPUDescriptorHandleForHeapStart(), frame_index, rtv_descriptor_size);
+		const float clearColor[] = { 0.f, 0.f, 0.f, 1.f };
+		commandList->ClearRenderTargetView(rtvHandler, clearColor, 0, nullptr);
+		if (!depth_prepass)
+		{
+			commandList->ClearDepthStencilView(GetDepthStencilView(false), D3D12_CLEAR_FLAG_DEPTH, 1.f, 0, 0, nullptr);
+		}
+
+		if (gpuDriven)
+		{
+			commandList->SetPipelineState(GetScenePipeline());
+			SetSceneState(commandList, sceneConstants);
+			gpu_culler->RecordDraws(commandList);
+			gpu_timer->End(commandList, GPU_TIMER_SCENE);
+			UpdateStats({});
+			return;
+		}
+
+		recording_list_count = static_cast<UINT>(min(static_cast<size_t>(recording_thread_count), (draws.size() + min_draws_per_list - 1) / min_draws_per_list));
+		recording_list_count = max(recording_list_count, 1u);
+
+		auto recordStart = std::chrono::high_resolution_clock::now();
+		recording_pool->ParallelFor(recording_list_count, [&](size_t list)
+		{
+			RecordDraws(static_cast<UINT>(list), sceneConstants);
+		});
+		const double recordMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - recordStart).count();
+		recording_totals_milliseconds += recordMilliseconds;
+		UpdateRecordingBenchmark(recordMilliseconds);
+
+		for (UINT i = 0; i < recording_list_count; i++)
+		{
+			context.Submit(recording_command_lists[i].Get());
+		}
+		gpu_timer->End(context.GetCommandList(), GPU_TIMER_SCENE);
+	});
+	scenePass.Write(backBuffer, D3D12_RESOURCE_STATE_RENDER_TARGET);
+	if (depth_prepass)
+	{
+		scenePass.Read(depthBuffer, D3D12_RESOURCE_STATE_DEPTH_READ);
+	}
+	else
+	{
+		scenePass.Write(depthBuffer, D3D12_RESOURCE_STATE_DEPTH_WRITE);
+	}
+	if (gpuDriven)
+	{
+		scenePass.Read(drawBuffer, D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT);
+	}
+
+	// The draw count goes to the CPU for the statistics, it is read once the frame slot comes around again.
+	// Validation also reads back the draws and the pyramid they were culled against.
+	if (gpuDriven)
+	{
+		const bool withDraws = frame.validate_culling;
+		const bool withPyramid = withDraws && occlusion;
+		RenderGraph::PassBuilder readbackPass = render_graph->AddPass("read back draws", RENDER_GRAPH_QUEUE_DIRECT, [this, withDraws, withPyramid](RenderGraphContext& context)
+		{
+			gpu_culler->RecordReadback(context.GetCommandList(), frame_index, withDraws, withPyramid);
+		});
+		readbackPass.Read(drawBuffer, D3D12_RESOURCE_STATE_COPY_SOURCE).SideEffect();
+		if (withPyramid)
+		{
+			readbackPass.Read(pyramid, D3D12_RESOURCE_STATE_COPY_SOURCE);
+		}
+	}
+
+	// After every timed pass, the worker lists included
+	render_graph->AddPass("resolve timings", RENDER_GRAPH_QUEUE_DIRECT, [this](RenderGraphContext& context)
+	{
+		gpu_timer->Resolve(context.GetCommandList());
+	}).SideEffect();
+
+	render_graph->Compile(true);
+	render_graph_totals_milliseconds += render_graph->GetCompileMilliseconds();
+	depth_written = true;
+	if (stats_start_time == 0)
+	{
+		OutputDebugStringA(render_graph->FormatReport().c_str());
 	}
 }
 
-void Renderer::PopulateCommandList()
+void Renderer::CollectDraws()
 {
-	// Reset allocators and lists
-	ThrowIfFailed(command_allocator->Reset());
+	// One draw per visible submesh, trimmed to the span of its visible meshlets. Nothing is visible until the mesh streamed in.
+	draws.clear();
+	for (uint32_t s : visible_submeshes)
+	{
+		const Submesh& submesh = mesh->data.submeshes[s];
+		auto firstVisible = std::lower_bound(visible_meshlets.begin(), visible_meshlets.end(), submesh.meshlet_offset);
+		auto endVisible = std::lower_bound(firstVisible, visible_meshlets.end(), submesh.meshlet_offset + submesh.meshlet_count);
+		if (firstVisible == endVisible)
+		{
+			continue;
+		}
 
-	ThrowIfFailed(command_list->Reset(command_allocator.Get(), pipeline_state.Get()));
+		const Meshlet& first = mesh->data.meshlets[*firstVisible];
+		const Meshlet& last = mesh->data.meshlets[*(endVisible - 1)];
+		const DrawRange draw = { first.index_offset, last.index_offset + last.triangle_count * 3 - first.index_offset, s };
+		draws.insert(draws.end(), draw_repeat, draw);
+	}
+}
 
-	// Set initial state
+void Renderer::SetSceneState(ID3D12GraphicsCommandList* command_list, D3D12_GPU_VIRTUAL_ADDRESS scene_constants_address)
+{
 	command_list->SetGraphicsRootSignature(root_signature.Get());
-	ID3D12DescriptorHeap* heaps[] = {cbv_heap.Get()};
+	ID3D12DescriptorHeap* heaps[] = { descriptor_heap->GetHeap() };
 	command_list->SetDescriptorHeaps(_countof(heaps), heaps);
-	command_list->SetGraphicsRootDescriptorTable(0, cbv_heap->GetGPUDescriptorHandleForHeapStart());
+	command_list->SetGraphicsRootConstantBufferView(ROOT_SCENE_CONSTANTS, scene_constants_address);
+	command_list->SetGraphicsRootDescriptorTable(ROOT_BINDLESS_TABLE, descriptor_heap->GetGpuStart());
 	command_list->RSSetViewports(1, &view_port);
 	command_list->RSSetScissorRects(1, &scissor_rect);
-
-	// Resource barrier from present to RT
-	command_list->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(
-		render_targets[frame_index].Get(),
-		D3D12_RESOURCE_STATE_PRESENT,
-		D3D12_RESOURCE_STATE_RENDER_TARGET
-	));
-
-	// Record commands
 	CD3DX12_CPU_DESCRIPTOR_HANDLE rtvHandler(rtv_heap->GetCPUDescriptorHandleForHeapStart(), frame_index, rtv_descriptor_size);
-	command_list->OMSetRenderTargets(1, &rtvHandler, FALSE, nullptr);
-	const float clearColor[] = { 0.f, 0.f, 0.f, 1.f };
-	command_list->ClearRenderTargetView(rtvHandler, clearColor, 0, nullptr);
+	const D3D12_CPU_DESCRIPTOR_HANDLE dsvHandle = GetDepthStencilView(depth_prepass);
+	command_list->OMSetRenderTargets(1, &rtvHandler, FALSE, &dsvHandle);
 	command_list->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-	command_list->IASetVertexBuffers(0, 1, &vertex_buffer_view);
-	command_list->DrawInstanced(verteces.size(), 1, 0, 0);
-
-	// Resource barrier from RT to present
-	command_list->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(
-		render_targets[frame_index].Get(),
-		D3D12_RESOURCE_STATE_RENDER_TARGET,
-		D3D12_RESOURCE_STATE_PRESENT
-	));
-
-	// Close command list
-	ThrowIfFailed(command_list->Close());
+	if (instance_buffer.IsValid())
+	{
+		command_list->SetGraphicsRootShaderResourceView(ROOT_INSTANCES, instance_buffer.GetGpuAddress());
+	}
+	if (mesh_visible)
+	{
+		command_list->IASetVertexBuffers(0, 1, &mesh->vertex_buffer_view);
+		command_list->IASetIndexBuffer(&mesh->index_buffer_view);
+	}
+}
+
+D3D12_CPU_DESCRIPTOR_HANDLE Renderer::GetDepthStencilView(bool read_only) const
+{
+	return CD3DX12_CPU_DESCRIPTOR_HANDLE(dsv_heap->GetCPUDescriptorHandleForHeapStart(), read_only ? 1 : 0, dsv_descriptor_size);
 }
 
-void Renderer::WaitForPreviousFrame()
+void Renderer::RecordDraws(UINT list, D3D12_GPU_VIRTUAL_ADDRESS scene_constants_address)
 {
-	// WAITING FOR THE FRAME TO COMPLETE BEFORE CONTINUING IS NOT BEST PRACTICE.
-	// Signal and increment the fence value.
-	const UINT64 prevFenceValue = fence_value;
-	ThrowIfFailed(command_queue->Signal(fence.Get(), prevFenceValue));
-	fence_value++;
+	ID3D12CommandAllocator* allocator = frames[frame_index].recording_allocators[list].Get();
+	ID3D12GraphicsCommandList* commandList = recording_command_lists[list].Get();
+	ThrowIfFailed(allocator->Reset());
+	ThrowIfFailed(commandList->Reset(allocator, GetScenePipeline()));
+
+	// Every list starts without state, so each one sets everything it draws with
+	SetSceneState(commandList, scene_constants_address);
 
-	if (fence->GetCompletedValue() < prevFenceValue)
+	const size_t first = draws.size() * list / recording_list_count;
+	const size_t end = draws.size() * (list + 1) / recording_list_count;
+	for (size_t d = first; d < end; d++)
 	{
-		ThrowIfFailed(fence->SetEventOnCompletion(prevFenceValue, fence_event));
+		const DrawConstants drawConstants = { draws[d].index_offset / 3, draws[d].object_index, mesh_descriptors.offset };
+		commandList->SetGraphicsRoot32BitConstants(ROOT_DRAW_CONSTANTS, sizeof(DrawConstants) / sizeof(UINT), &drawConstants, 0);
+		commandList->DrawIndexedInstanced(draws[d].index_count, static_cast<UINT>(instances.GetCount()), draws[d].index_offset, 0, 0);
+	}
+
+	ThrowIfFailed(commandList->Close());
+}
+
+void Renderer::RecordDepthDraws(ID3D12GraphicsCommandList* command_list)
+{
+	// The depth vertex shader reads no draw constants, so the whole list goes out on the render thread as plain draws
+	for (const DrawRange& draw : draws)
+	{
+		command_list->DrawIndexedInstanced(draw.index_count, static_cast<UINT>(instances.GetCount()), draw.index_offset, 0, 0);
+	}
+}
+
+void Renderer::UpdateRecordingBenchmark(double record_milliseconds)
+{
+	// Frames before the mesh streamed in record no draws and would time an empty list
+	if (benchmark_thread_counts.empty() || !mesh_visible || draws.empty())
+	{
+		return;
+	}
+
+	// Skip a few frames after switching so the workers are warm
+	benchmark_frame++;
+	if (benchmark_frame > benchmark_warmup_frames)
+	{
+		benchmark_milliseconds += record_milliseconds;
+	}
+	if (benchmark_frame < benchmark_warmup_frames + benchmark_measured_frames)
+	{
+		return;
+	}
+
+	const double average = benchmark_milliseconds / benchmark_measured_frames;
+	if (benchmark_results.empty())
+	{
+		benchmark_results += L"Command list recording benchmark, " + std::to_wstring(draws.size()) + L" draws\n";
+	}
+	WCHAR line[128];
+	swprintf_s(line, L"%u threads: %.3f ms/frame (%.2fx)\n", recording_thread_count, average,
+		benchmark_single_thread_milliseconds > 0.0 ? benchmark_single_thread_milliseconds / average : 1.0);
+	benchmark_results += line;
+	if (benchmark_single_thread_milliseconds == 0.0)
+	{
+		benchmark_single_thread_milliseconds = average;
+	}
+
+	// Move to the next thread count, the last one stays in use when the benchmark ends
+	benchmark_thread_counts.erase(benchmark_thread_counts.begin());
+	benchmark_frame = 0;
+	benchmark_milliseconds = 0.0;
+	if (benchmark_thread_counts.empty())
+	{
+		OutputDebugString(benchmark_results.c_str());
+		std::wofstream report(GetBinPath(std::wstring(L"recording_benchmark.txt")));
+		report << benchmark_results;
+		draw_repeat = 1;
+	}
+	else
+	{
+		recording_thread_count = benchmark_thread_counts.front();
+	}
+}
+
+void Renderer::CullScene()
+{
+	// Whole submeshes first, with the same bounds and planes as the GPU pass. Meshlets then only matter inside the visible ones.
+	const CullingConstants constants = BuildCullingConstants();
+	visible_submeshes.clear();
+	submesh_statistics = {};
+	if (mesh_visible)
+	{
+		for (uint32_t s = 0; s < culling_objects.size(); s++)
+		{
+			if (InstanceCuller::IsInsideFrustum(culling_objects[s], constants))
+			{
+				visible_submeshes.push_back(s);
+			}
+		}
+		submesh_statistics.total = culling_objects.size();
+		submesh_statistics.visible = visible_submeshes.size();
+		submesh_statistics.frustum_culled = culling_objects.size() - visible_submeshes.size();
+	}
+
+	// Meshlet bounds are in object space, so a single instance culls them in its own space. With more
+	// instances one draw covers all of them, so every meshlet of a visible submesh is kept.
+	ClusterCullingView cullingView = {};
+	if (instances.GetCount() == 1)
+	{
+		const XMMATRIX instanceWorld = XMLoadFloat4x3(reinterpret_cast<const XMFLOAT4X3*>(instances.GetInstances()[0].world));
+		XMFLOAT4X4 clipTransform;
+		XMStoreFloat4x4(&clipTransform, instanceWorld);
+		ClusterCuller::ExtractFrustumPlanes(&clipTransform.m[0][0], false, cullingView);
+		cullingView.cull_backfaces = cull_backfaces;
+		cullingView.orthographic = true;
+		const XMVECTOR viewDirection = XMVector3Normalize(XMVector3TransformNormal(XMVectorSet(0.f, 0.f, 1.f, 0.f), XMMatrixInverse(nullptr, instanceWorld)));
+		XMStoreFloat3(reinterpret_cast<XMFLOAT3*>(cullingView.view_direction), viewDirection);
+	}
+
+	cluster_culler.Cull(cullingView, visible_meshlets);
+	UpdateStats(cluster_culler.GetStatistics());
+}
+
+CullingConstants Renderer::BuildCullingConstants(bool occlusion) const
+{
+	// The vertex shader only applies the instance transforms, so the clip volume is the identity frustum.
+	// Depth clip is off in the PSO, so only the side planes reject anything. The same transform maps onto
+	// the pyramid, whose level 0 is the depth buffer.
+	CullingConstants constants = {};
+	XMFLOAT4X4 clipTransform;
+	XMStoreFloat4x4(&clipTransform, XMMatrixIdentity());
+	memcpy(constants.transform, &clipTransform.m[0][0], sizeof(constants.transform));
+
+	ClusterCullingView cullingView = {};
+	ClusterCuller::ExtractFrustumPlanes(&clipTransform.m[0][0], false, cullingView);
+	memcpy(constants.planes, cullingView.planes, sizeof(constants.planes));
+	constants.plane_count = cullingView.plane_count;
+	constants.object_count = static_cast<uint32_t>(culling_objects.size());
+	constants.material_table = mesh_descriptors.offset;
+	constants.max_draw_count = static_cast<uint32_t>(culling_objects.size());
+	constants.instance_count = static_cast<uint32_t>(instances.GetCount());
+	if (occlusion)
+	{
+		constants.hiz_mip_count = gpu_culler->GetPyramidMipCount();
+		constants.hiz_width = gpu_culler->GetPyramidWidth();
+		constants.hiz_height = gpu_culler->GetPyramidHeight();
+		constants.hiz_descriptor = gpu_culler->GetPyramidDescriptor();
+	}
+	return constants;
+}
+
+void Renderer::ValidateCulling(const CullingConstants& constants, UINT draw_count)
+{
+	// The GPU pyramid has to be the reduction of its own level 0, which is the depth it was built from
+	const HiZPyramid* pyramid = nullptr;
+	if (constants.hiz_mip_count > 0 && !readback_pyramid.levels.empty())
+	{
+		HiZPyramid reference;
+		InstanceCuller::BuildHiZ(readback_pyramid.levels[0].data(), readback_pyramid.width, readback_pyramid.height, reference);
+		if (reference.levels != readback_pyramid.levels)
+		{
+			OutputDebugString(L"GPU culling: the hi-z pyramid differs from InstanceCuller::BuildHiZ\n");
+		}
+		pyramid = &readback_pyramid;
+	}
+
+	// The same survivors with the same arguments, the GPU appends them in any order
+	std::vector<IndirectDraw> expected;
+	InstanceCuller::Cull(constants, culling_objects, pyramid, expected);
+	auto byObject = [](const IndirectDraw& a, const IndirectDraw& b) { return a.object_index < b.object_index; };
+	std::sort(expected.begin(), expected.end(), byObject);
+	std::sort(readback_draws.begin(), readback_draws.end(), byObject);
+	const bool sameDraws = std::equal(expected.begin(), expected.end(), readback_draws.begin(), readback_draws.end(),
+		[](const IndirectDraw& a, const IndirectDraw& b) { return memcmp(&a, &b, sizeof(IndirectDraw)) == 0; });
+	if (!sameDraws || min(draw_count, constants.max_draw_count) != expected.size())
+	{
+		WCHAR message[128];
+		swprintf_s(message, L"GPU culling: %u draws differ from the %zu InstanceCuller expects\n", draw_count, expected.size());
+		OutputDebugString(message);
+	}
+}
+
+void Renderer::UpdateStats(const ClusterCullingStatistics& cluster_statistics)
+{
+	culling_totals.total += cluster_statistics.total;
+	culling_totals.visible += cluster_statistics.visible;
+	culling_totals.frustum_culled += cluster_statistics.frustum_culled;
+	culling_totals.cone_culled += cluster_statistics.cone_culled;
+	culling_totals.milliseconds += cluster_statistics.milliseconds;
+	submesh_totals.total += submesh_statistics.total;
+	submesh_totals.visible += submesh_statistics.visible;
+	stats_frame_count++;
+
+	const ULONGLONG now = GetTickCount64();
+	if (stats_start_time == 0)
+	{
+		stats_start_time = now;
+	}
+	if (now - stats_start_time < 1000)
+	{
+		return;
+	}
+
+	const double frames = static_cast<double>(stats_frame_count);
+	const double culled = culling_totals.total ? 100.0 * (culling_totals.total - culling_totals.visible) / culling_totals.total : 0.0;
+	double gpuPassMilliseconds[GPU_TIMER_COUNT];
+	for (UINT i = 0; i < GPU_TIMER_COUNT; i++)
+	{
+		gpuPassMilliseconds[i] = gpu_pass_frame_counts[i] ? gpu_pass_totals_milliseconds[i] / gpu_pass_frame_counts[i] : 0.0;
+	}
+	// What an input that arrives right before sampling waits for, averaged over the whole time in the mode
+	const PresentLatencyStatistics& presentStatistics = presenter->GetStatistics(presenter->GetMode());
+	const double sampleToPresent = presentStatistics.frame_count ? presentStatistics.sample_to_present_milliseconds / presentStatistics.frame_count : 0.0;
+	WCHAR stats[768];
+	swprintf_s(stats, L"%s - %.0f fps, submeshes %.0f/%.0f visible, clusters %.0f/%.0f visible (%.1f%% culled: frustum %.0f, cone %.0f), culling %.3f ms/frame, recording %.3f ms/frame on %u threads, graph %.3f ms/frame, culling on %s, depth prepass %s, GPU hi-z %.3f ms, cull %.3f ms, prepass %.3f ms, scene %.3f ms, present %S with latency %u (sample to present %.2f ms), %u frames in flight, %u loads streaming",
+		title.c_str(), frames * 1000.0 / (now - stats_start_time), submesh_totals.visible / frames, submesh_totals.total / frames, culling_totals.visible / frames, culling_totals.total / frames, culled,
+		culling_totals.frustum_culled / frames, culling_totals.cone_culled / frames, culling_totals.milliseconds / frames,
+		recording_totals_milliseconds / frames, recording_thread_count, render_graph_totals_milliseconds / frames, IsGpuCulling() ? L"GPU" : L"CPU",
+		depth_prepass ? L"on" : L"off", gpuPassMilliseconds[GPU_TIMER_HIZ], gpuPassMilliseconds[GPU_TIMER_CULL], gpuPassMilliseconds[GPU_TIMER_DEPTH_PREPASS], gpuPassMilliseconds[GPU_TIMER_SCENE],
+		Presenter::GetModeName(presenter->GetMode()), presenter->GetMaximumFrameLatency(), sampleToPresent,
+		frame_count, asset_streamer ? asset_streamer->GetLoadsInFlight() : 0);
+	SetWindowText(Win32Window::GetHwnd(), stats);
+
+	culling_totals = {};
+	submesh_totals = {};
+	recording_totals_milliseconds = 0.0;
+	render_graph_totals_milliseconds = 0.0;
+	for (UINT i = 0; i < GPU_TIMER_COUNT; i++)
+	{
+		gpu_pass_totals_milliseconds[i] = 0.0;
+		gpu_pass_frame_counts[i] = 0;
+	}
+	stats_frame_count = 0;
+	stats_start_time = now;
+}
+
+void Renderer::MoveToNextFrame()
+{
+	// Mark the end of the submitted frame
+	const UINT64 currentFenceValue = frames[frame_index].fence_value;
+	ThrowIfFailed(command_queue->Signal(fence.Get(), currentFenceValue));
+	upload_ring->FinishFrame(currentFenceValue);
+	gpu_memory->FinishFrame(currentFenceValue);
+	descriptor_heap->FinishFrame(currentFenceValue);
+	render_graph_device->FinishFrame(currentFenceValue);
+
+	// Only block when the next back buffer's resources are still used by the GPU
+	frame_index = presenter->GetSwapChain()->GetCurrentBackBufferIndex();
+	if (fence->GetCompletedValue() < frames[frame_index].fence_value)
+	{
+		ThrowIfFailed(fence->SetEventOnCompletion(frames[frame_index].fence_value, fence_event));
 		WaitForSingleObject(fence_event, INFINITE);
 	}
+	upload_ring->Reclaim(fence->GetCompletedValue());
+	gpu_memory->Reclaim(fence->GetCompletedValue());
+	descriptor_heap->Reclaim(fence->GetCompletedValue());
+	render_graph_device->Reclaim(fence->GetCompletedValue());
+
+	frames[frame_index].fence_value = currentFenceValue + 1;
+}
+
+void Renderer::WaitForGpu()
+{
+	// Drain the queue, used before resources of frames in flight are released
+	ThrowIfFailed(command_queue->Signal(fence.Get(), frames[frame_index].fence_value));
+	ThrowIfFailed(fence->SetEventOnCompletion(frames[frame_index].fence_value, fence_event));
+	WaitForSingleObject(fence_event, INFINITE);
 
-	frame_index = swap_chain->GetCurrentBackBufferIndex();
+	frames[frame_index].fence_value++;
 }
 
 std::wstring Renderer::GetBinPath(std::wstring shader_file) const
@@ -1,6 +1,21 @@
 #pragma once
 
 #include "dx12_labs.h"
+#include "asset_streamer.h"
+#include "cluster_culling.h"
+#include "descriptor_allocator.h"
+#include "gpu_culling.h"
+#include "gpu_memory_allocator.h"
+#include "gpu_timer.h"
+#include "instance_set.h"
+#include "pipeline_cache.h"
+#include "presenter.h"
+#include "render_graph.h"
+#include "resource_state_tracker.h"
+#include "shader_pack.h"
+#include "submesh_builder.h"
+#include "thread_pool.h"
+#include "upload_ring.h"
 
 #include "win32_window.h"
 #include "atlstr.h"
@@ -8,15 +23,60 @@
 class Renderer
 {
 public:
-	Renderer(UINT width, UINT height) : width(width), height(height), title(L"DX12 renderer"), frame_index(0), rtv_descriptor_size(0)
+	// frame_count is the number of back buffers and of frames the CPU may record ahead of the GPU
+	Renderer(UINT width, UINT height, UINT frame_count = 2) : width(width), height(height), title(L"DX12 renderer"),
+		frame_count(min(max(frame_count, 2u), max_frame_count)), frame_index(0), rtv_descriptor_size(0), dsv_descriptor_size(0)
 	{
 		view_port = CD3DX12_VIEWPORT(0.0f, 0.0f, static_cast<float>(width), static_cast<float>(height));
 		scissor_rect = CD3DX12_RECT(0, 0, static_cast<LONG>(width), static_cast<LONG>(height));
-		vertex_buffer_view = {};
-		fence_value = 0;
+		for (FrameResources& frame : frames)
+		{
+			frame.fence_value = 0;
+			frame.culling_constants = {};
+			frame.validate_culling = false;
+			frame.culling_instance_version = 0;
+		}
 		fence_event = nullptr;
 		aspect_ratio = static_cast<float>(width) / static_cast<float>(height);
-		verteces.clear();
+		mesh_visible = false;
+		mesh_descriptors = {};
+		mesh_fade_start = 0;
+		instance_buffer_version = 0;
+		placed_instance_count = 1;
+		visible_submeshes.clear();
+		submesh_statistics = {};
+		visible_meshlets.clear();
+		cull_backfaces = false;
+		gpu_culling = false;
+		gpu_draw_count = 0;
+#ifdef _DEBUG
+		culling_validation = true;
+#else
+		culling_validation = false;
+#endif
+		depth_prepass = true;
+		depth_descriptor = {};
+		depth_written = false;
+		present_mode = PRESENT_MODE_NO_VSYNC;
+		max_frame_latency = 1;
+		for (UINT i = 0; i < GPU_TIMER_COUNT; i++)
+		{
+			gpu_pass_totals_milliseconds[i] = 0.0;
+			gpu_pass_frame_counts[i] = 0;
+		}
+		culling_totals = {};
+		submesh_totals = {};
+		stats_frame_count = 0;
+		stats_start_time = 0;
+		draw_repeat = 1;
+		recording_thread_count = 0;
+		recording_list_count = 0;
+		recording_totals_milliseconds = 0.0;
+		render_graph_totals_milliseconds = 0.0;
+		benchmark_enabled = false;
+		benchmark_frame = 0;
+		benchmark_milliseconds = 0.0;
+		benchmark_single_thread_milliseconds = 0.0;
 
 		mwp = XMMatrixIdentity();
 		world = XMMatrixTranslation(0.f, 0.f, 0.f) * XMMatrixScaling(0.5f, 0.5f, 0.5f);
@@ -28,6 +88,20 @@ public:
 	};
 	virtual ~Renderer() {};
 
+	// Both take effect in OnInit, 0 threads records on as many threads as the shared pool has
+	void SetRecordingThreads(UINT thread_count) { recording_thread_count = thread_count; }
+	void EnableRecordingBenchmark() { benchmark_enabled = true; }
+
+	// Both take effect in OnInit, V and L switch them at runtime
+	void SetPresentMode(PresentMode mode) { present_mode = mode; }
+	void SetMaximumFrameLatency(UINT latency) { max_frame_latency = latency; }
+
+	// Copies of the mesh laid out in a grid once it streamed in, load tests place thousands
+	void SetInstanceCount(UINT instance_count) { placed_instance_count = instance_count; }
+
+	// Checks every GPU cull against InstanceCuller, on by default in debug builds
+	void EnableCullingValidation() { culling_validation = true; }
+
 	virtual void OnInit();
 	virtual void OnUpdate();
 	virtual void OnRender();
@@ -45,31 +119,122 @@ protected:
 	UINT height;
 	std::wstring title;
 
-	static const UINT frame_number = 2;
+	static constexpr UINT max_frame_count = 4;
+	const UINT frame_count;
+
+	// Resources that belong to one back buffer and can only be reused once the GPU passed its fence value
+	struct FrameResources
+	{
+		ComPtr<ID3D12CommandAllocator> command_allocator;
+		ComPtr<ID3D12CommandAllocator> compute_allocator;	// for the render graph's compute batches
+		std::vector<ComPtr<ID3D12CommandAllocator>> recording_allocators;
+		UINT64 fence_value;
+
+		// What the GPU culled with, checked against InstanceCuller once the readback of the frame comes in
+		CullingConstants culling_constants;
+		bool validate_culling;
+		uint64_t culling_instance_version;
+	};
+	FrameResources frames[max_frame_count];
 
 	// Pipeline objects.
 	ComPtr<ID3D12Device> device;
 	ComPtr<ID3D12CommandQueue> command_queue;
-	ComPtr<IDXGISwapChain3> swap_chain;
+	ComPtr<ID3D12CommandQueue> compute_queue;
+	std::unique_ptr<Presenter> presenter;	// owns the swap chain
+	PresentMode present_mode;
+	UINT max_frame_latency;
 	ComPtr<ID3D12DescriptorHeap> rtv_heap;
-	ComPtr<ID3D12DescriptorHeap> cbv_heap;
 	UINT rtv_descriptor_size;
-	ComPtr<ID3D12Resource> render_targets[frame_number];
-	ComPtr<ID3D12CommandAllocator> command_allocator;
+	static constexpr UINT persistent_descriptor_count = 65536;
+	static constexpr UINT dynamic_descriptor_count = 16384;
+	std::unique_ptr<DescriptorHeap> descriptor_heap;
+	std::unique_ptr<StagingDescriptorHeap> staging_descriptors;
+	std::unique_ptr<GpuMemoryAllocator> gpu_memory;	// declared before the mesh, which returns its buffers on release
+	ComPtr<ID3D12Resource> render_targets[max_frame_count];
+	ResourceStateTracker resource_states;	// transitions are recorded on the render thread only
 	ComPtr<ID3D12PipelineState> pipeline_state;
-	ComPtr<ID3D12GraphicsCommandList> command_list;
 
+	// One depth buffer for all frames, they run one after the other on the direct queue.
+	// The prepass lays down the final depth, the scene pass then shades each pixel once with an
+	// EQUAL test against a read-only view. Toggled with P, without it the scene pass tests LESS.
+	static constexpr DXGI_FORMAT depth_format = DXGI_FORMAT_D32_FLOAT;
+	static constexpr DXGI_FORMAT depth_resource_format = DXGI_FORMAT_R32_TYPELESS;	// viewed as depth_format and depth_srv_format
+	static constexpr DXGI_FORMAT depth_srv_format = DXGI_FORMAT_R32_FLOAT;
+	ComPtr<ID3D12DescriptorHeap> dsv_heap;	// the writable view, then the read-only one
+	UINT dsv_descriptor_size;
+	GpuAllocation depth_buffer;
+	DescriptorRange depth_descriptor;	// shader view in the bindless heap
+	bool depth_written;	// by a frame before, the GPU culler builds its pyramid from that depth
+	ComPtr<ID3D12PipelineState> depth_prepass_pipeline_state;
+	ComPtr<ID3D12PipelineState> equal_depth_pipeline_state;
+	bool depth_prepass;
+
+	// GPU time of the passes, averaged in the window title next to the CPU timings
+	enum GpuTimerPass
+	{
+		GPU_TIMER_HIZ,
+		GPU_TIMER_CULL,
+		GPU_TIMER_DEPTH_PREPASS,
+		GPU_TIMER_SCENE,
+		GPU_TIMER_COUNT
+	};
+	std::unique_ptr<GpuTimer> gpu_timer;
+	double gpu_pass_totals_milliseconds[GPU_TIMER_COUNT];
+	UINT gpu_pass_frame_counts[GPU_TIMER_COUNT];
+
+	// The frame is described as a render graph and rebuilt every frame, transient textures live in the graph device's heap
+	std::unique_ptr<D3D12RenderGraphDevice> render_graph_device;
+	std::unique_ptr<RenderGraph> render_graph;
+	double render_graph_totals_milliseconds;
+
+	enum RootParameter
+	{
+		ROOT_SCENE_CONSTANTS,	// b0 root CBV
+		ROOT_DRAW_CONSTANTS,	// b1 root constants
+		ROOT_INSTANCES,			// t0 root SRV
+		ROOT_BINDLESS_TABLE,	// the whole shader-visible heap
+		ROOT_PARAMETER_COUNT
+	};
 	ComPtr<ID3D12RootSignature> root_signature;
+#ifdef DX12_RUNTIME_SHADERS
+	std::unique_ptr<ShaderCache> shader_cache;
+#endif
+	std::unique_ptr<PipelineLibrary> pipeline_library;
 	CD3DX12_VIEWPORT view_port;
 	CD3DX12_RECT scissor_rect;
 
 	// Resources
-	std::vector<ColorVertex> verteces;
-	ComPtr<ID3D12Resource> vertex_buffer;
-	D3D12_VERTEX_BUFFER_VIEW vertex_buffer_view;
+	static constexpr UINT64 streaming_memory_budget = 256ull * 1024 * 1024;
+	static constexpr float mesh_fade_milliseconds = 500.f;
+	std::shared_ptr<StreamingMesh> mesh;
+	bool mesh_visible;
+	DescriptorRange mesh_descriptors;	// material table (t0) and triangle materials (t1)
+	ULONGLONG mesh_fade_start;
+
+	// Every copy of the mesh is an instance, each submesh is one instanced draw for all of them.
+	// The buffer is replaced on every change, frames in flight keep drawing with the old one.
+	InstanceSet instances;
+	GpuAllocation instance_buffer;
+	uint64_t instance_buffer_version;
+	UINT placed_instance_count;
+	std::vector<CullingObject> culling_objects;	// submesh bounds over all instances
+
+	std::vector<uint32_t> visible_submeshes;
+	ClusterCullingStatistics submesh_statistics;
+	std::vector<uint32_t> visible_meshlets;
+	ClusterCuller cluster_culler;
+	bool cull_backfaces;
+	std::unique_ptr<GpuCuller> gpu_culler;
+	bool gpu_culling;	// toggled with G, otherwise the CPU culls and the recording threads draw
+	UINT gpu_draw_count;	// survivors of the last GPU cull that was read back, frame_count frames late
+	bool culling_validation;	// the draws and the pyramid are read back too and compared on the CPU
+	std::vector<IndirectDraw> readback_draws;
+	HiZPyramid readback_pyramid;
 	
-	ComPtr<ID3D12Resource> constant_buffer;
-	UINT8* constant_buffer_data_begin;
+	static constexpr UINT64 upload_ring_capacity = 1024 * 1024;
+	std::unique_ptr<UploadRing> upload_ring;
+	SceneConstants scene_constants;
 
 	XMMATRIX mwp;
 	XMMATRIX world;
@@ -85,13 +250,66 @@ protected:
 	UINT frame_index;
 	HANDLE fence_event;
 	ComPtr<ID3D12Fence> fence;
-	UINT64 fence_value;
 
 	float aspect_ratio;
 
+	// Frame statistics, shown in the window title about once per second
+	ClusterCullingStatistics culling_totals;
+	ClusterCullingStatistics submesh_totals;
+	UINT stats_frame_count;
+	ULONGLONG stats_start_time;
+
+	ThreadPool thread_pool;
+	std::unique_ptr<UploadScheduler> upload_scheduler;
+	std::unique_ptr<AssetStreamer> asset_streamer;
+
+	// Parallel recording of the scene draws, one list per recording thread
+	struct DrawRange
+	{
+		UINT index_offset;
+		UINT index_count;
+		UINT object_index;
+	};
+	static constexpr UINT max_recording_threads = 8;
+	static constexpr size_t min_draws_per_list = 64;
+	std::vector<DrawRange> draws;
+	UINT draw_repeat;
+	std::unique_ptr<ThreadPool> recording_pool;
+	std::vector<ComPtr<ID3D12GraphicsCommandList>> recording_command_lists;
+	UINT recording_thread_count;
+	UINT recording_list_count;
+	double recording_totals_milliseconds;
+
+	// Recording benchmark, measures every thread count in turn and writes recording_benchmark.txt
+	static constexpr UINT benchmark_warmup_frames = 30;
+	static constexpr UINT benchmark_measured_frames = 200;
+	static constexpr UINT benchmark_draw_repeat = 2000;
+	bool benchmark_enabled;
+	std::vector<UINT> benchmark_thread_counts;
+	UINT benchmark_frame;
+	double benchmark_milliseconds;
+	double benchmark_single_thread_milliseconds;
+	std::wstring benchmark_results;
+
 	void LoadPipeline();
 	void LoadAssets();
-	void PopulateCommandList();
-	void WaitForPreviousFrame();
+	void UpdateStreaming();
+	void PlaceInstances();
+	UINT64 UploadInstances();
+	void BuildRenderGraph();
+	bool IsGpuCulling() const { return gpu_culling && benchmark_thread_counts.empty(); }	// the benchmark times CPU culling
+	void CollectDraws();
+	void SetSceneState(ID3D12GraphicsCommandList* command_list, D3D12_GPU_VIRTUAL_ADDRESS scene_constants_address);
+	ID3D12PipelineState* GetScenePipeline() const { return depth_prepass ? equal_depth_pipeline_state.Get() : pipeline_state.Get(); }
+	D3D12_CPU_DESCRIPTOR_HANDLE GetDepthStencilView(bool read_only) const;
+	void RecordDraws(UINT list, D3D12_GPU_VIRTUAL_ADDRESS scene_constants_address);
+	void RecordDepthDraws(ID3D12GraphicsCommandList* command_list);
+	CullingConstants BuildCullingConstants(bool occlusion) const;
+	void ValidateCulling(const CullingConstants& constants, UINT draw_count);
+	void UpdateRecordingBenchmark(double record_milliseconds);
+	void CullScene();
+	void UpdateStats(const ClusterCullingStatistics& cluster_statistics);
+	void MoveToNextFrame();
+	void WaitForGpu();
 	std::wstring GetBinPath(std::wstring shader_file) const;
 };
\ No newline at end of file
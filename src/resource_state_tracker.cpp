@@ -0,0 +1,163 @@
+#include "resource_state_tracker.h"
+
+#include <algorithm>
+
+void ResourceStateTracker::Register(ID3D12Resource* resource, D3D12_RESOURCE_STATES state, UINT subresource_count)
+{
+	resources[resource] = { state, {}, subresource_count };
+}
+
+void ResourceStateTracker::Unregister(ID3D12Resource* resource)
+{
+	resources.erase(resource);
+	pending_barriers.erase(std::remove_if(pending_barriers.begin(), pending_barriers.end(), [resource](const D3D12_RESOURCE_BARRIER& barrier)
+	{
+		return barrier.Type == D3D12_RESOURCE_BARRIER_TYPE_TRANSITION ? barrier.Transition.pResource == resource : barrier.UAV.pResource == resource;
+	}), pending_barriers.end());
+}
+
+void ResourceStateTracker::Transition(ID3D12Resource* resource, D3D12_RESOURCE_STATES state, UINT subresource)
+{
+	auto found = resources.find(resource);
+	if (found == resources.end())
+	{
+		ThrowIfFailed(E_INVALIDARG);
+	}
+	TrackedResource& tracked = found->second;
+
+	if (subresource == D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES)
+	{
+		if (tracked.subresource_states.empty())
+		{
+			if (!IsSatisfied(tracked.state, state))
+			{
+				QueueTransition(resource, subresource, tracked.state, state);
+				tracked.state = state;
+			}
+			return;
+		}
+
+		// Subresources diverged, bring each one over on its own and collapse back to one state
+		for (UINT i = 0; i < tracked.subresource_count; i++)
+		{
+			if (tracked.subresource_states[i] != state)
+			{
+				QueueTransition(resource, i, tracked.subresource_states[i], state);
+			}
+		}
+		tracked.subresource_states.clear();
+		tracked.state = state;
+		return;
+	}
+
+	if (subresource >= tracked.subresource_count)
+	{
+		ThrowIfFailed(E_INVALIDARG);
+	}
+	if (tracked.subresource_states.empty())
+	{
+		if (IsSatisfied(tracked.state, state))
+		{
+			return;
+		}
+		tracked.subresource_states.assign(tracked.subresource_count, tracked.state);
+	}
+	if (!IsSatisfied(tracked.subresource_states[subresource], state))
+	{
+		QueueTransition(resource, subresource, tracked.subresource_states[subresource], state);
+		tracked.subresource_states[subresource] = state;
+	}
+
+	// Back to the compact form when every subresource agrees again
+	if (std::all_of(tracked.subresource_states.begin(), tracked.subresource_states.end(), [state](D3D12_RESOURCE_STATES s) { return s == state; }))
+	{
+		tracked.subresource_states.clear();
+		tracked.state = state;
+	}
+}
+
+void ResourceStateTracker::UavBarrier(ID3D12Resource* resource)
+{
+	pending_barriers.push_back(CD3DX12_RESOURCE_BARRIER::UAV(resource));
+}
+
+void ResourceStateTracker::Flush(ID3D12GraphicsCommandList* command_list)
+{
+	if (!pending_barriers.empty())
+	{
+		command_list->ResourceBarrier(static_cast<UINT>(pending_barriers.size()), pending_barriers.data());
+		pending_barriers.clear();
+	}
+}
+
+void ResourceStateTracker::TakeBarriers(std::vector<D3D12_RESOURCE_BARRIER>& barriers)
+{
+	barriers.insert(barriers.end(), pending_barriers.begin(), pending_barriers.end());
+	pending_barriers.clear();
+}
+
+D3D12_RESOURCE_STATES ResourceStateTracker::GetState(ID3D12Resource* resource, UINT subresource) const
+{
+	auto found = resources.find(resource);
+	if (found == resources.end())
+	{
+		ThrowIfFailed(E_INVALIDARG);
+	}
+	const TrackedResource& tracked = found->second;
+	return tracked.subresource_states.empty() ? tracked.state : tracked.subresource_states[subresource];
+}
+
+void ResourceStateTracker::SetState(ID3D12Resource* resource, D3D12_RESOURCE_STATES state)
+{
+	auto found = resources.find(resource);
+	if (found == resources.end())
+	{
+		ThrowIfFailed(E_INVALIDARG);
+	}
+	found->second.state = state;
+	found->second.subresource_states.clear();
+}
+
+void ResourceStateTracker::QueueTransition(ID3D12Resource* resource, UINT subresource, D3D12_RESOURCE_STATES before, D3D12_RESOURCE_STATES after)
+{
+	// A transition still waiting in the batch is extended instead of chained, and dropped if it ends where it started.
+	// Only the newest barrier on the resource may be changed: once a whole-resource barrier and a per-subresource one
+	// overlap, or a UAV barrier sits in between, moving the older one would reorder them.
+	for (size_t i = pending_barriers.size(); i-- > 0;)
+	{
+		D3D12_RESOURCE_BARRIER& barrier = pending_barriers[i];
+		if (barrier.Type == D3D12_RESOURCE_BARRIER_TYPE_UAV && barrier.UAV.pResource == resource)
+		{
+			break;
+		}
+		if (barrier.Type != D3D12_RESOURCE_BARRIER_TYPE_TRANSITION || barrier.Transition.pResource != resource)
+		{
+			continue;
+		}
+		if (barrier.Transition.Subresource == subresource)
+		{
+			barrier.Transition.StateAfter = after;
+			if (barrier.Transition.StateBefore == after)
+			{
+				pending_barriers.erase(pending_barriers.begin() + i);
+			}
+			return;
+		}
+		if (barrier.Transition.Subresource == D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES || subresource == D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES)
+		{
+			break;
+		}
+	}
+	pending_barriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(resource, before, after, subresource));
+}
+
+bool ResourceStateTracker::IsSatisfied(D3D12_RESOURCE_STATES current, D3D12_RESOURCE_STATES requested)
+{
+	// A combined read state already covers any of its read bits, writes always need the exact state
+	if (current == requested)
+	{
+		return true;
+	}
+	const D3D12_RESOURCE_STATES readStates = D3D12_RESOURCE_STATE_GENERIC_READ | D3D12_RESOURCE_STATE_DEPTH_READ;
+	return requested != D3D12_RESOURCE_STATE_COMMON && (requested & ~readStates) == 0 && (current & ~readStates) == 0 && (current & requested) == requested;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "dx12_labs.h"
+
+#include <unordered_map>
+#include <vector>
+
+// Tracks the state of registered resources, per subresource where they diverge, and turns
+// Transition requests into the barriers actually needed. Requests that change nothing are
+// dropped, requests that undo a pending one cancel it, and everything queued goes out in one
+// ResourceBarrier call on Flush. States follow recording order, so transitions have to be
+// recorded on one thread into lists that are submitted in the same order.
+class ResourceStateTracker
+{
+public:
+	ResourceStateTracker() {}
+	virtual ~ResourceStateTracker() {}
+
+	void Register(ID3D12Resource* resource, D3D12_RESOURCE_STATES state, UINT subresource_count = 1);
+	void Unregister(ID3D12Resource* resource);
+
+	void Transition(ID3D12Resource* resource, D3D12_RESOURCE_STATES state, UINT subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES);
+	void UavBarrier(ID3D12Resource* resource);
+
+	// Records the queued barriers into the list as one batch, call right before the draw or dispatch that needs them
+	void Flush(ID3D12GraphicsCommandList* command_list);
+
+	// Hands out the queued batch instead of recording it, Flush is built on this
+	void TakeBarriers(std::vector<D3D12_RESOURCE_BARRIER>& barriers);
+
+	D3D12_RESOURCE_STATES GetState(ID3D12Resource* resource, UINT subresource = 0) const;
+	size_t GetPendingCount() const { return pending_barriers.size(); }
+
+	// For barriers recorded elsewhere, such as by the render graph, moves every subresource to state
+	void SetState(ID3D12Resource* resource, D3D12_RESOURCE_STATES state);
+
+	// True when a resource in current can be used as requested without a transition
+	static bool IsSatisfied(D3D12_RESOURCE_STATES current, D3D12_RESOURCE_STATES requested);
+
+protected:
+	struct TrackedResource
+	{
+		D3D12_RESOURCE_STATES state;	// shared by every subresource while subresource_states is empty
+		std::vector<D3D12_RESOURCE_STATES> subresource_states;
+		UINT subresource_count;
+	};
+
+	std::unordered_map<ID3D12Resource*, TrackedResource> resources;
+	std::vector<D3D12_RESOURCE_BARRIER> pending_barriers;
+
+	void QueueTransition(ID3D12Resource* resource, UINT subresource, D3D12_RESOURCE_STATES before, D3D12_RESOURCE_STATES after);
+};
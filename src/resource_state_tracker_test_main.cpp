@@ -0,0 +1,224 @@
+#include "resource_state_tracker.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <vector>
+
+// Stands in for a command list: takes the batched barriers and replays them in order on its own copy of every
+// subresource state, failing on a transition whose before state is not the state the subresource is in
+class RecordingBackend
+{
+public:
+	void Register(ID3D12Resource* resource, D3D12_RESOURCE_STATES state, UINT subresource_count)
+	{
+		states[resource].assign(subresource_count, state);
+	}
+
+	bool Flush(ResourceStateTracker& tracker)
+	{
+		batch.clear();
+		tracker.TakeBarriers(batch);
+		bool valid = true;
+		for (const D3D12_RESOURCE_BARRIER& barrier : batch)
+		{
+			if (barrier.Type != D3D12_RESOURCE_BARRIER_TYPE_TRANSITION)
+			{
+				continue;
+			}
+			std::vector<D3D12_RESOURCE_STATES>& subresources = states[barrier.Transition.pResource];
+			const UINT first = barrier.Transition.Subresource == D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES ? 0 : barrier.Transition.Subresource;
+			const UINT end = barrier.Transition.Subresource == D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES ? static_cast<UINT>(subresources.size()) : first + 1;
+			for (UINT i = first; i < end; i++)
+			{
+				valid = valid && subresources[i] == barrier.Transition.StateBefore;
+				subresources[i] = barrier.Transition.StateAfter;
+			}
+		}
+		return valid;
+	}
+
+	// The replayed states have to end where the tracker thinks they are
+	bool Matches(const ResourceStateTracker& tracker) const
+	{
+		for (const auto& resource : states)
+		{
+			for (UINT i = 0; i < resource.second.size(); i++)
+			{
+				if (tracker.GetState(resource.first, i) != resource.second[i])
+				{
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	std::vector<D3D12_RESOURCE_BARRIER> batch;
+
+protected:
+	std::map<ID3D12Resource*, std::vector<D3D12_RESOURCE_STATES>> states;
+};
+
+static int failures = 0;
+
+static void Check(bool condition, const char* test, const char* what)
+{
+	if (!condition)
+	{
+		printf("FAILED %s: %s\n", test, what);
+		failures++;
+	}
+}
+
+// Only compared and stored, never dereferenced
+static ID3D12Resource* FakeResource(uintptr_t id)
+{
+	return reinterpret_cast<ID3D12Resource*>(id * 0x100);
+}
+
+static void TestRedundantTransitions()
+{
+	const char* test = "redundant transitions";
+	ResourceStateTracker tracker;
+	RecordingBackend backend;
+	ID3D12Resource* buffer = FakeResource(1);
+	tracker.Register(buffer, D3D12_RESOURCE_STATE_COPY_DEST);
+	backend.Register(buffer, D3D12_RESOURCE_STATE_COPY_DEST, 1);
+
+	tracker.Transition(buffer, D3D12_RESOURCE_STATE_COPY_DEST);
+	Check(tracker.GetPendingCount() == 0, test, "a transition to the current state queues nothing");
+
+	tracker.Transition(buffer, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
+	tracker.Transition(buffer, D3D12_RESOURCE_STATE_COPY_DEST);
+	Check(tracker.GetPendingCount() == 0, test, "a transition and its reverse cancel");
+
+	tracker.Transition(buffer, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER);
+	tracker.Transition(buffer, D3D12_RESOURCE_STATE_INDEX_BUFFER);
+	Check(backend.Flush(tracker), test, "replay");
+	Check(backend.batch.size() == 1, test, "a chain of transitions becomes one barrier");
+	Check(backend.batch.size() == 1 && backend.batch[0].Transition.StateBefore == D3D12_RESOURCE_STATE_COPY_DEST &&
+		backend.batch[0].Transition.StateAfter == D3D12_RESOURCE_STATE_INDEX_BUFFER, test, "the chain goes from the first to the last state");
+	Check(backend.Matches(tracker), test, "replayed states");
+}
+
+static void TestReadStateMerging()
+{
+	const char* test = "read state merging";
+	ResourceStateTracker tracker;
+	RecordingBackend backend;
+	ID3D12Resource* buffer = FakeResource(2);
+	tracker.Register(buffer, D3D12_RESOURCE_STATE_COPY_DEST);
+	backend.Register(buffer, D3D12_RESOURCE_STATE_COPY_DEST, 1);
+
+	const D3D12_RESOURCE_STATES bothShaders = D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE;
+	tracker.Transition(buffer, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+	tracker.Transition(buffer, bothShaders);
+	Check(backend.Flush(tracker), test, "replay");
+	Check(backend.batch.size() == 1 && backend.batch[0].Transition.StateAfter == bothShaders, test, "reads in one batch end in the combined state");
+
+	tracker.Transition(buffer, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+	tracker.Transition(buffer, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+	Check(tracker.GetPendingCount() == 0, test, "a combined read state covers each of its reads");
+
+	tracker.Transition(buffer, D3D12_RESOURCE_STATE_COPY_DEST);
+	Check(tracker.GetPendingCount() == 1, test, "a write needs its exact state");
+	Check(backend.Flush(tracker), test, "replay");
+	Check(backend.Matches(tracker), test, "replayed states");
+
+	Check(ResourceStateTracker::IsSatisfied(D3D12_RESOURCE_STATE_GENERIC_READ, D3D12_RESOURCE_STATE_COPY_SOURCE), test, "generic read covers copy source");
+	Check(!ResourceStateTracker::IsSatisfied(D3D12_RESOURCE_STATE_GENERIC_READ, D3D12_RESOURCE_STATE_COMMON), test, "nothing covers common");
+}
+
+static void TestSubresources()
+{
+	const char* test = "subresources";
+	ResourceStateTracker tracker;
+	RecordingBackend backend;
+	ID3D12Resource* texture = FakeResource(3);
+	const UINT mips = 4;
+	tracker.Register(texture, D3D12_RESOURCE_STATE_RENDER_TARGET, mips);
+	backend.Register(texture, D3D12_RESOURCE_STATE_RENDER_TARGET, mips);
+
+	// Diverge: one mip is read while the rest stay render targets
+	tracker.Transition(texture, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, 1);
+	Check(tracker.GetState(texture, 0) == D3D12_RESOURCE_STATE_RENDER_TARGET && tracker.GetState(texture, 1) == D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE,
+		test, "only the requested mip moves");
+	Check(backend.Flush(tracker), test, "replay");
+	Check(backend.batch.size() == 1 && backend.batch[0].Transition.Subresource == 1, test, "a per-subresource barrier");
+
+	// Reconverge with a whole-resource request: only the mips that differ get a barrier
+	tracker.Transition(texture, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+	Check(backend.Flush(tracker), test, "replay");
+	Check(backend.batch.size() == mips - 1, test, "the mip already there is skipped");
+	Check(backend.Matches(tracker), test, "replayed states");
+
+	// Reconverge one mip at a time: the last one brings the resource back to a single state
+	for (UINT mip = 0; mip < mips; mip++)
+	{
+		tracker.Transition(texture, D3D12_RESOURCE_STATE_RENDER_TARGET, mip);
+	}
+	Check(backend.Flush(tracker), test, "replay");
+	Check(backend.batch.size() == mips, test, "one barrier per mip");
+	tracker.Transition(texture, D3D12_RESOURCE_STATE_RENDER_TARGET);
+	Check(tracker.GetPendingCount() == 0, test, "collapsed back to one state");
+	Check(backend.Matches(tracker), test, "replayed states");
+}
+
+static void TestMixedBatch()
+{
+	const char* test = "whole-resource and per-subresource barriers in one batch";
+	ResourceStateTracker tracker;
+	RecordingBackend backend;
+	ID3D12Resource* texture = FakeResource(4);
+	const UINT mips = 4;
+	tracker.Register(texture, D3D12_RESOURCE_STATE_RENDER_TARGET, mips);
+	backend.Register(texture, D3D12_RESOURCE_STATE_RENDER_TARGET, mips);
+
+	// A pending whole-resource barrier followed by a per-subresource one
+	tracker.Transition(texture, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE);
+	tracker.Transition(texture, D3D12_RESOURCE_STATE_COPY_SOURCE, 2);
+	Check(backend.Flush(tracker), test, "replay after whole then one");
+	Check(backend.Matches(tracker), test, "replayed states after whole then one");
+
+	// A per-subresource barrier, then whole-resource ones, then the same subresource again. The first barrier
+	// must not be extended past the whole-resource ones.
+	tracker.Transition(texture, D3D12_RESOURCE_STATE_RENDER_TARGET);
+	Check(backend.Flush(tracker), test, "replay of the reset");
+	tracker.Transition(texture, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, 1);
+	tracker.Transition(texture, D3D12_RESOURCE_STATE_COPY_SOURCE);
+	tracker.Transition(texture, D3D12_RESOURCE_STATE_RENDER_TARGET);
+	tracker.Transition(texture, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, 1);
+	Check(backend.Flush(tracker), test, "replay after one, whole, whole, one");
+	Check(backend.Matches(tracker), test, "replayed states after one, whole, whole, one");
+	Check(tracker.GetState(texture, 1) == D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE && tracker.GetState(texture, 0) == D3D12_RESOURCE_STATE_RENDER_TARGET,
+		test, "final states");
+
+	// A UAV barrier pins the transitions before it
+	ID3D12Resource* buffer = FakeResource(5);
+	tracker.Register(buffer, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+	backend.Register(buffer, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, 1);
+	tracker.Transition(buffer, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+	tracker.UavBarrier(buffer);
+	tracker.Transition(buffer, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+	Check(backend.Flush(tracker), test, "replay around a UAV barrier");
+	Check(backend.batch.size() == 3, test, "transitions around a UAV barrier stay apart");
+	Check(backend.Matches(tracker), test, "replayed states around a UAV barrier");
+}
+
+// Headless check of the resource state tracker, no device is created
+int main()
+{
+	TestRedundantTransitions();
+	TestReadStateMerging();
+	TestSubresources();
+	TestMixedBatch();
+
+	if (failures)
+	{
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+	printf("Resource state tracker: all checks passed\n");
+	return 0;
+}
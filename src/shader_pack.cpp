@@ -0,0 +1,19 @@
+#include "shader_pack.h"
+
+// Written by the prebuild step into generated/
+#include "shader_pack_generated.h"
+
+D3D12_SHADER_BYTECODE GetEmbeddedShader(const char* file, const char* entry_point)
+{
+	for (const EmbeddedShader& shader : embedded_shaders)
+	{
+		if (strcmp(shader.file, file) == 0 && strcmp(shader.entry_point, entry_point) == 0)
+		{
+			return { shader.bytecode, shader.size };
+		}
+	}
+
+	OutputDebugStringA((std::string("Shader is not in the manifest: ") + file + " " + entry_point + "\n").c_str());
+	ThrowIfFailed(E_INVALIDARG);
+	return {};
+}
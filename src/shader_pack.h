@@ -0,0 +1,16 @@
+#pragma once
+
+#include "dx12_labs.h"
+
+// Shader bytecode compiled at build time by tools/compile_shaders.py from shaders/shaders.manifest
+struct EmbeddedShader
+{
+	const char* file;
+	const char* entry_point;
+	const char* target;
+	const unsigned char* bytecode;
+	size_t size;
+};
+
+// Throws when the manifest has no such entry point, e.g. when it was not added after a shader change
+D3D12_SHADER_BYTECODE GetEmbeddedShader(const char* file, const char* entry_point);
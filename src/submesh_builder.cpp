@@ -0,0 +1,201 @@
+#include "submesh_builder.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <unordered_map>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define SUBMESH_BOUNDS_SSE 1
+#include <xmmintrin.h>
+#endif
+
+static const float* Stride(const float* data, size_t stride, size_t index)
+{
+	return reinterpret_cast<const float*>(reinterpret_cast<const char*>(data) + index * stride);
+}
+
+#ifdef SUBMESH_BOUNDS_SSE
+static float HorizontalMin(__m128 value)
+{
+	value = _mm_min_ps(value, _mm_shuffle_ps(value, value, _MM_SHUFFLE(1, 0, 3, 2)));
+	value = _mm_min_ps(value, _mm_shuffle_ps(value, value, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtss_f32(value);
+}
+
+static float HorizontalMax(__m128 value)
+{
+	value = _mm_max_ps(value, _mm_shuffle_ps(value, value, _MM_SHUFFLE(1, 0, 3, 2)));
+	value = _mm_max_ps(value, _mm_shuffle_ps(value, value, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtss_f32(value);
+}
+#endif
+
+void SubmeshBuilder::Build(const unsigned int* indices, const std::vector<IndexRange>& ranges, const uint16_t* triangle_materials,
+	const float* positions, size_t position_stride, const std::vector<Meshlet>& meshlets, std::vector<Submesh>& submeshes) const
+{
+	submeshes.clear();
+
+	size_t meshlet = 0;
+	for (size_t r = 0; r < ranges.size(); r++)
+	{
+		Submesh submesh = {};
+		submesh.index_offset = static_cast<uint32_t>(ranges[r].first);
+		submesh.index_count = static_cast<uint32_t>(ranges[r].count / 3 * 3);
+
+		submesh.meshlet_offset = static_cast<uint32_t>(meshlet);
+		while (meshlet < meshlets.size() && meshlets[meshlet].shape == r)
+		{
+			meshlet++;
+		}
+		submesh.meshlet_count = static_cast<uint32_t>(meshlet - submesh.meshlet_offset);
+
+		// Ties go to the lower material index so the result does not depend on hashing
+		std::unordered_map<uint16_t, size_t> materialCounts;
+		const size_t firstTriangle = submesh.index_offset / 3;
+		for (size_t t = firstTriangle; t < firstTriangle + submesh.index_count / 3; t++)
+		{
+			materialCounts[triangle_materials[t]]++;
+		}
+		size_t bestCount = 0;
+		for (const auto& entry : materialCounts)
+		{
+			if (entry.second > bestCount || (entry.second == bestCount && entry.first < submesh.material))
+			{
+				submesh.material = entry.first;
+				bestCount = entry.second;
+			}
+		}
+
+		ComputeBounds(indices + submesh.index_offset, submesh.index_count, positions, position_stride, submesh);
+		submeshes.push_back(submesh);
+	}
+}
+
+void SubmeshBuilder::ComputeBounds(const unsigned int* indices, size_t index_count, const float* positions, size_t position_stride, Submesh& submesh)
+{
+	float minimum[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float maximum[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	if (index_count == 0)
+	{
+		std::fill(submesh.aabb_min, submesh.aabb_min + 3, 0.f);
+		std::fill(submesh.aabb_max, submesh.aabb_max + 3, 0.f);
+		std::fill(submesh.center, submesh.center + 3, 0.f);
+		submesh.radius = 0.f;
+		return;
+	}
+
+	// Each lane gathers one vertex, the lanes are reduced at the end
+	size_t first = 0;
+#ifdef SUBMESH_BOUNDS_SSE
+	__m128 minX = _mm_set1_ps(FLT_MAX), minY = minX, minZ = minX;
+	__m128 maxX = _mm_set1_ps(-FLT_MAX), maxY = maxX, maxZ = maxX;
+	for (; first + 4 <= index_count; first += 4)
+	{
+		const float* p0 = Stride(positions, position_stride, indices[first + 0]);
+		const float* p1 = Stride(positions, position_stride, indices[first + 1]);
+		const float* p2 = Stride(positions, position_stride, indices[first + 2]);
+		const float* p3 = Stride(positions, position_stride, indices[first + 3]);
+		const __m128 x = _mm_setr_ps(p0[0], p1[0], p2[0], p3[0]);
+		const __m128 y = _mm_setr_ps(p0[1], p1[1], p2[1], p3[1]);
+		const __m128 z = _mm_setr_ps(p0[2], p1[2], p2[2], p3[2]);
+		minX = _mm_min_ps(minX, x);
+		minY = _mm_min_ps(minY, y);
+		minZ = _mm_min_ps(minZ, z);
+		maxX = _mm_max_ps(maxX, x);
+		maxY = _mm_max_ps(maxY, y);
+		maxZ = _mm_max_ps(maxZ, z);
+	}
+	minimum[0] = HorizontalMin(minX);
+	minimum[1] = HorizontalMin(minY);
+	minimum[2] = HorizontalMin(minZ);
+	maximum[0] = HorizontalMax(maxX);
+	maximum[1] = HorizontalMax(maxY);
+	maximum[2] = HorizontalMax(maxZ);
+#endif
+	for (size_t i = first; i < index_count; i++)
+	{
+		const float* position = Stride(positions, position_stride, indices[i]);
+		for (size_t k = 0; k < 3; k++)
+		{
+			minimum[k] = (std::min)(minimum[k], position[k]);
+			maximum[k] = (std::max)(maximum[k], position[k]);
+		}
+	}
+
+	for (size_t k = 0; k < 3; k++)
+	{
+		submesh.aabb_min[k] = minimum[k];
+		submesh.aabb_max[k] = maximum[k];
+		submesh.center[k] = (minimum[k] + maximum[k]) * 0.5f;
+	}
+
+	// Sphere around the box center, reaching the farthest vertex
+	float radiusSquared = 0.f;
+	first = 0;
+#ifdef SUBMESH_BOUNDS_SSE
+	const __m128 centerX = _mm_set1_ps(submesh.center[0]);
+	const __m128 centerY = _mm_set1_ps(submesh.center[1]);
+	const __m128 centerZ = _mm_set1_ps(submesh.center[2]);
+	__m128 maxDistance = _mm_setzero_ps();
+	for (; first + 4 <= index_count; first += 4)
+	{
+		const float* p0 = Stride(positions, position_stride, indices[first + 0]);
+		const float* p1 = Stride(positions, position_stride, indices[first + 1]);
+		const float* p2 = Stride(positions, position_stride, indices[first + 2]);
+		const float* p3 = Stride(positions, position_stride, indices[first + 3]);
+		const __m128 dx = _mm_sub_ps(_mm_setr_ps(p0[0], p1[0], p2[0], p3[0]), centerX);
+		const __m128 dy = _mm_sub_ps(_mm_setr_ps(p0[1], p1[1], p2[1], p3[1]), centerY);
+		const __m128 dz = _mm_sub_ps(_mm_setr_ps(p0[2], p1[2], p2[2], p3[2]), centerZ);
+		maxDistance = _mm_max_ps(maxDistance, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+	}
+	radiusSquared = HorizontalMax(maxDistance);
+#endif
+	for (size_t i = first; i < index_count; i++)
+	{
+		const float* position = Stride(positions, position_stride, indices[i]);
+		float dx = position[0] - submesh.center[0];
+		float dy = position[1] - submesh.center[1];
+		float dz = position[2] - submesh.center[2];
+		radiusSquared = (std::max)(radiusSquared, dx * dx + dy * dy + dz * dz);
+	}
+	submesh.radius = std::sqrt(radiusSquared);
+}
+
+bool SubmeshBuilder::IsVisible(const Submesh& submesh, const ClusterCullingView& view)
+{
+	// Test the box corner farthest along each plane normal
+	for (uint32_t p = 0; p < view.plane_count; p++)
+	{
+		const float* plane = view.planes[p];
+		float distance = plane[3];
+		for (size_t k = 0; k < 3; k++)
+		{
+			distance += plane[k] * (plane[k] >= 0.f ? submesh.aabb_max[k] : submesh.aabb_min[k]);
+		}
+		if (distance < 0.f)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+std::string SubmeshBuilder::FormatReport(const std::vector<Submesh>& submeshes) const
+{
+	size_t triangles = 0;
+	size_t meshlets = 0;
+	float largestRadius = 0.f;
+	for (const Submesh& submesh : submeshes)
+	{
+		triangles += submesh.index_count / 3;
+		meshlets += submesh.meshlet_count;
+		largestRadius = (std::max)(largestRadius, submesh.radius);
+	}
+
+	char report[256];
+	snprintf(report, sizeof(report), "Submesh builder: %zu submeshes with %zu triangles in %zu meshlets, largest bounding radius %g\n",
+		submeshes.size(), triangles, meshlets, largestRadius);
+	return report;
+}
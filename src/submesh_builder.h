@@ -0,0 +1,46 @@
+#pragma once
+
+#include "cluster_culling.h"
+#include "mesh_optimizer.h"
+#include "meshlet_builder.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// One shape of the source mesh kept as its own object: an index range of the mesh index buffer,
+// the meshlets it was split into, its dominant material and its bounds.
+struct Submesh
+{
+	uint32_t index_offset;
+	uint32_t index_count;
+	uint32_t meshlet_offset;
+	uint32_t meshlet_count;
+	uint32_t material;	// most used triangle material, triangles still carry their own
+	float aabb_min[3];
+	float aabb_max[3];
+	float center[3];
+	float radius;
+};
+static_assert(sizeof(Submesh) == 60, "Submesh is stored in the mesh cache, keep it packed");
+
+class SubmeshBuilder
+{
+public:
+	SubmeshBuilder() {};
+	virtual ~SubmeshBuilder() {};
+
+	// One submesh per range, meshlets must be sorted by shape as MeshletBuilder emits them.
+	// Triangle materials are indexed by triangle of the whole index buffer.
+	void Build(const unsigned int* indices, const std::vector<IndexRange>& ranges, const uint16_t* triangle_materials,
+		const float* positions, size_t position_stride, const std::vector<Meshlet>& meshlets, std::vector<Submesh>& submeshes) const;
+
+	std::string FormatReport(const std::vector<Submesh>& submeshes) const;
+
+	// Bounding box and the sphere around its center, four vertices at a time with SSE
+	static void ComputeBounds(const unsigned int* indices, size_t index_count, const float* positions, size_t position_stride, Submesh& submesh);
+
+	// False when the box lies entirely behind one of the view planes
+	static bool IsVisible(const Submesh& submesh, const ClusterCullingView& view);
+};
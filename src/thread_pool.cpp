@@ -0,0 +1,123 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+
+ThreadPool::ThreadPool(size_t thread_count) : stopping(false)
+{
+	if (thread_count == 0)
+	{
+		thread_count = 1;
+	}
+
+	workers.reserve(thread_count);
+	for (size_t i = 0; i < thread_count; i++)
+	{
+		workers.emplace_back(&ThreadPool::WorkerLoop, this);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(tasks_mutex);
+		stopping = true;
+	}
+	tasks_condition.notify_all();
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+std::future<void> ThreadPool::Submit(std::function<void()> task)
+{
+	std::packaged_task<void()> packagedTask(std::move(task));
+	std::future<void> result = packagedTask.get_future();
+	{
+		std::lock_guard<std::mutex> lock(tasks_mutex);
+		tasks.push(std::move(packagedTask));
+	}
+	tasks_condition.notify_one();
+	return result;
+}
+
+void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)>& task)
+{
+	if (count == 0)
+	{
+		return;
+	}
+	if (count == 1)
+	{
+		task(0);
+		return;
+	}
+
+	// Every participant pulls the next index, so uneven items balance themselves
+	std::atomic<size_t> next(0);
+	auto body = [&]()
+	{
+		for (size_t i = next++; i < count; i = next++)
+		{
+			task(i);
+		}
+	};
+
+	size_t helperCount = (std::min)(count - 1, workers.size());
+	std::vector<std::future<void>> helpers;
+	helpers.reserve(helperCount);
+	for (size_t i = 0; i < helperCount; i++)
+	{
+		helpers.push_back(Submit(body));
+	}
+	body();
+
+	// Help draining the queue while waiting, so nested calls from workers can't deadlock
+	for (std::future<void>& helper : helpers)
+	{
+		while (helper.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		{
+			if (!RunPendingTask())
+			{
+				helper.wait();
+			}
+		}
+		helper.get();
+	}
+}
+
+void ThreadPool::WorkerLoop()
+{
+	for (;;)
+	{
+		std::packaged_task<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(tasks_mutex);
+			tasks_condition.wait(lock, [this]() { return stopping || !tasks.empty(); });
+			if (stopping && tasks.empty())
+			{
+				return;
+			}
+			task = std::move(tasks.front());
+			tasks.pop();
+		}
+		task();
+	}
+}
+
+bool ThreadPool::RunPendingTask()
+{
+	std::packaged_task<void()> task;
+	{
+		std::lock_guard<std::mutex> lock(tasks_mutex);
+		if (tasks.empty())
+		{
+			return false;
+		}
+		task = std::move(tasks.front());
+		tasks.pop();
+	}
+	task();
+	return true;
+}
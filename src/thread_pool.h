@@ -0,0 +1,38 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed size pool of worker threads shared by the loaders and the renderer
+class ThreadPool
+{
+public:
+	ThreadPool(size_t thread_count = std::thread::hardware_concurrency());
+	virtual ~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	size_t GetThreadCount() const { return workers.size(); }
+
+	std::future<void> Submit(std::function<void()> task);
+
+	// Runs task(i) for every i in [0, count) and blocks until all of them are done.
+	// The calling thread takes part in the work, so it is safe to call from a worker.
+	void ParallelFor(size_t count, const std::function<void(size_t)>& task);
+
+protected:
+	std::vector<std::thread> workers;
+	std::queue<std::packaged_task<void()>> tasks;
+	std::mutex tasks_mutex;
+	std::condition_variable tasks_condition;
+	bool stopping;
+
+	void WorkerLoop();
+	bool RunPendingTask();
+};
@@ -0,0 +1,109 @@
+#include "upload_ring.h"
+
+static UINT64 AlignUp(UINT64 value, UINT64 alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+UploadRing::UploadRing(ID3D12Device* device, UINT64 capacity) :
+	device(device), data(nullptr), gpu_address(0), capacity(0), head(0), used(0), frame_size(0)
+{
+	CreateBuffer(capacity);
+}
+
+UploadRing::~UploadRing()
+{
+	if (buffer)
+	{
+		buffer->Unmap(0, nullptr);
+	}
+}
+
+UploadRing::Allocation UploadRing::Allocate(UINT64 size, UINT64 alignment)
+{
+	// Skip to the alignment, or to the start of the buffer when the tail is too short
+	UINT64 offset = AlignUp(head, alignment);
+	if (offset + size > capacity)
+	{
+		offset = 0;
+	}
+	UINT64 consumed = (offset >= head ? offset - head : capacity - head + offset) + size;
+	if (used + consumed > capacity)
+	{
+		Grow(size + alignment);
+		offset = 0;
+		consumed = size;
+	}
+
+	head = offset + size;
+	used += consumed;
+	frame_size += consumed;
+	return { data + offset, gpu_address + offset, size };
+}
+
+void UploadRing::FinishFrame(UINT64 fence_value)
+{
+	frames.push_back({ fence_value, frame_size });
+	frame_size = 0;
+
+	for (RetiredBuffer& retired : retired_buffers)
+	{
+		if (retired.fence_value == 0)
+		{
+			retired.fence_value = fence_value;
+		}
+	}
+}
+
+void UploadRing::Reclaim(UINT64 completed_fence_value)
+{
+	while (!frames.empty() && frames.front().fence_value <= completed_fence_value)
+	{
+		used -= frames.front().size;
+		frames.pop_front();
+	}
+	while (!retired_buffers.empty() && retired_buffers.front().fence_value != 0 && retired_buffers.front().fence_value <= completed_fence_value)
+	{
+		retired_buffers.pop_front();
+	}
+}
+
+void UploadRing::CreateBuffer(UINT64 size)
+{
+	ThrowIfFailed(device->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(size),
+		D3D12_RESOURCE_STATE_GENERIC_READ,
+		nullptr,
+		IID_PPV_ARGS(&buffer)
+	));
+
+	CD3DX12_RANGE readRange(0, 0);
+	ThrowIfFailed(buffer->Map(0, &readRange, reinterpret_cast<void**>(&data)));
+	gpu_address = buffer->GetGPUVirtualAddress();
+	capacity = size;
+}
+
+void UploadRing::Grow(UINT64 minimum_size)
+{
+	UINT64 newCapacity = capacity * 2;
+	while (newCapacity < minimum_size)
+	{
+		newCapacity *= 2;
+	}
+
+	WCHAR warning[128];
+	swprintf_s(warning, L"Upload ring overflow, growing from %llu to %llu bytes\n", capacity, newCapacity);
+	OutputDebugString(warning);
+
+	// Frames in flight still read the old buffer, it goes away with the fence of the current frame
+	buffer->Unmap(0, nullptr);
+	retired_buffers.push_back({ buffer, 0 });
+	CreateBuffer(newCapacity);
+
+	head = 0;
+	used = 0;
+	frame_size = 0;
+	frames.clear();
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "dx12_labs.h"
+
+#include <deque>
+
+// Linear allocator over one persistently mapped upload buffer, used as a ring across frames.
+// Everything allocated between two FinishFrame calls is released together once the GPU passed
+// the fence value of that frame. When the ring runs full it grows into a new buffer and keeps
+// the old one alive until the frames that used it are done.
+class UploadRing
+{
+public:
+	struct Allocation
+	{
+		UINT8* cpu_address;
+		D3D12_GPU_VIRTUAL_ADDRESS gpu_address;
+		UINT64 size;
+	};
+
+	UploadRing(ID3D12Device* device, UINT64 capacity);
+	virtual ~UploadRing();
+
+	UploadRing(const UploadRing&) = delete;
+	UploadRing& operator=(const UploadRing&) = delete;
+
+	// Offsets are aligned for constant buffer views and root CBVs by default
+	Allocation Allocate(UINT64 size, UINT64 alignment = D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT);
+
+	template <typename T>
+	Allocation Push(const T& data, UINT64 alignment = D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT)
+	{
+		Allocation allocation = Allocate(sizeof(T), alignment);
+		memcpy(allocation.cpu_address, &data, sizeof(T));
+		return allocation;
+	}
+
+	// Tags the allocations made since the last call with the fence value signaled after the GPU used them
+	void FinishFrame(UINT64 fence_value);
+
+	// Releases the frames whose fence value the GPU reached
+	void Reclaim(UINT64 completed_fence_value);
+
+	UINT64 GetCapacity() const { return capacity; }
+	UINT64 GetUsed() const { return used; }
+
+protected:
+	struct FrameUsage
+	{
+		UINT64 fence_value;
+		UINT64 size;
+	};
+
+	struct RetiredBuffer
+	{
+		ComPtr<ID3D12Resource> buffer;
+		UINT64 fence_value;	// 0 until the frame that still uses it is finished
+	};
+
+	ComPtr<ID3D12Device> device;
+	ComPtr<ID3D12Resource> buffer;
+	UINT8* data;
+	D3D12_GPU_VIRTUAL_ADDRESS gpu_address;
+	UINT64 capacity;
+
+	UINT64 head;
+	UINT64 used;
+	UINT64 frame_size;
+	std::deque<FrameUsage> frames;
+	std::deque<RetiredBuffer> retired_buffers;
+
+	void CreateBuffer(UINT64 size);
+	void Grow(UINT64 minimum_size);
+};
@@ -0,0 +1,164 @@
+#include "upload_scheduler.h"
+
+static const UINT64 staging_alignment = 16;
+
+UploadScheduler::UploadScheduler(ID3D12Device* device, UINT64 page_size) :
+	device(device), page_size(page_size), copy_fence_value(0), fence_event(nullptr)
+{
+	// Create a copy queue for uploads, it runs next to the direct queue
+	D3D12_COMMAND_QUEUE_DESC queueDescriptor = {};
+	queueDescriptor.Type = D3D12_COMMAND_LIST_TYPE_COPY;
+	queueDescriptor.Flags = D3D12_COMMAND_QUEUE_FLAG_NONE;
+	ThrowIfFailed(device->CreateCommandQueue(&queueDescriptor, IID_PPV_ARGS(&copy_queue)));
+	ThrowIfFailed(device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&copy_fence)));
+
+	fence_event = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+	if (fence_event == nullptr)
+	{
+		ThrowIfFailed(HRESULT_FROM_WIN32(GetLastError()));
+	}
+}
+
+UploadScheduler::~UploadScheduler()
+{
+	WaitIdle();
+	CloseHandle(fence_event);
+}
+
+void UploadScheduler::Enqueue(ID3D12Resource* destination, UINT64 destination_offset, const void* data, UINT64 size)
+{
+	std::lock_guard<std::mutex> lock(scheduler_mutex);
+	StagingPage& page = GetPage(size);
+	memcpy(page.data + page.used, data, size);
+	pending_copies.push_back({ destination, destination_offset, page.buffer.Get(), page.used, size });
+	page.used = (page.used + size + staging_alignment - 1) / staging_alignment * staging_alignment;
+}
+
+UINT64 UploadScheduler::Flush()
+{
+	std::lock_guard<std::mutex> lock(scheduler_mutex);
+	if (pending_copies.empty())
+	{
+		return copy_fence_value;
+	}
+
+	// Record every pending copy into one list
+	ID3D12CommandAllocator* allocator = GetAllocator();
+	if (command_list)
+	{
+		ThrowIfFailed(command_list->Reset(allocator, nullptr));
+	}
+	else
+	{
+		ThrowIfFailed(device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_COPY, allocator, nullptr, IID_PPV_ARGS(&command_list)));
+	}
+	for (const PendingCopy& copy : pending_copies)
+	{
+		command_list->CopyBufferRegion(copy.destination.Get(), copy.destination_offset, copy.source, copy.source_offset, copy.size);
+	}
+	ThrowIfFailed(command_list->Close());
+
+	ID3D12CommandList* commandLists[] = { command_list.Get() };
+	copy_queue->ExecuteCommandLists(_countof(commandLists), commandLists);
+	ThrowIfFailed(copy_queue->Signal(copy_fence.Get(), ++copy_fence_value));
+
+	// The pages and the allocator stay with the batch until the fence passes
+	allocators.back().fence_value = copy_fence_value;
+	for (StagingPage& page : pending_pages)
+	{
+		page.fence_value = copy_fence_value;
+		submitted_pages.push_back(page);
+	}
+	pending_pages.clear();
+	pending_copies.clear();
+	return copy_fence_value;
+}
+
+void UploadScheduler::WaitOnQueue(ID3D12CommandQueue* queue, UINT64 fence_value)
+{
+	ThrowIfFailed(queue->Wait(copy_fence.Get(), fence_value));
+}
+
+void UploadScheduler::WaitIdle()
+{
+	Flush();
+
+	std::lock_guard<std::mutex> lock(scheduler_mutex);
+	if (copy_fence->GetCompletedValue() < copy_fence_value)
+	{
+		ThrowIfFailed(copy_fence->SetEventOnCompletion(copy_fence_value, fence_event));
+		WaitForSingleObject(fence_event, INFINITE);
+	}
+	Reclaim();
+}
+
+UploadScheduler::StagingPage& UploadScheduler::GetPage(UINT64 size)
+{
+	// Keep filling the open page, the batch only ends at Flush
+	if (!pending_pages.empty() && pending_pages.back().used + size <= pending_pages.back().capacity)
+	{
+		return pending_pages.back();
+	}
+
+	Reclaim();
+	for (size_t i = 0; i < free_pages.size(); i++)
+	{
+		if (free_pages[i].capacity >= size)
+		{
+			pending_pages.push_back(free_pages[i]);
+			free_pages.erase(free_pages.begin() + i);
+			return pending_pages.back();
+		}
+	}
+
+	// Uploads larger than a page get a page of their own size
+	StagingPage page = {};
+	page.capacity = max(page_size, size);
+	ThrowIfFailed(device->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(page.capacity),
+		D3D12_RESOURCE_STATE_GENERIC_READ,
+		nullptr,
+		IID_PPV_ARGS(&page.buffer)
+	));
+	CD3DX12_RANGE readRange(0, 0);
+	ThrowIfFailed(page.buffer->Map(0, &readRange, reinterpret_cast<void**>(&page.data)));
+	pending_pages.push_back(page);
+	return pending_pages.back();
+}
+
+ID3D12CommandAllocator* UploadScheduler::GetAllocator()
+{
+	// Allocators are reused in submission order, the oldest one is free once its batch is done
+	if (!allocators.empty() && allocators.front().fence_value <= copy_fence->GetCompletedValue())
+	{
+		PooledAllocator pooled = allocators.front();
+		allocators.pop_front();
+		ThrowIfFailed(pooled.allocator->Reset());
+		allocators.push_back(pooled);
+	}
+	else
+	{
+		PooledAllocator pooled = {};
+		ThrowIfFailed(device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_COPY, IID_PPV_ARGS(&pooled.allocator)));
+		allocators.push_back(pooled);
+	}
+	return allocators.back().allocator.Get();
+}
+
+void UploadScheduler::Reclaim()
+{
+	// Oversized pages are dropped instead of pooled so one huge mesh does not pin its staging memory
+	const UINT64 completed = copy_fence->GetCompletedValue();
+	while (!submitted_pages.empty() && submitted_pages.front().fence_value <= completed)
+	{
+		StagingPage page = submitted_pages.front();
+		submitted_pages.pop_front();
+		if (page.capacity == page_size)
+		{
+			page.used = 0;
+			free_pages.push_back(page);
+		}
+	}
+}
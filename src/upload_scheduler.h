@@ -0,0 +1,79 @@
+#pragma once
+
+#include "dx12_labs.h"
+
+#include <deque>
+#include <mutex>
+#include <vector>
+
+// Batches buffer uploads onto a copy queue. Enqueue copies the source data into pooled staging
+// pages right away, so the caller may free it at once, and Flush submits every pending copy in
+// one command list. Pages and allocators go back to their pools when the copy fence passes them.
+// Consumers make their queue wait on the returned fence value before the first use of the data.
+class UploadScheduler
+{
+public:
+	UploadScheduler(ID3D12Device* device, UINT64 page_size = 4 * 1024 * 1024);
+	virtual ~UploadScheduler();
+
+	UploadScheduler(const UploadScheduler&) = delete;
+	UploadScheduler& operator=(const UploadScheduler&) = delete;
+
+	// Safe to call from any thread
+	void Enqueue(ID3D12Resource* destination, UINT64 destination_offset, const void* data, UINT64 size);
+
+	// Submits the pending copies and returns the fence value signaled once they are done
+	UINT64 Flush();
+
+	// GPU side wait, the queue stalls until the copies up to fence_value landed
+	void WaitOnQueue(ID3D12CommandQueue* queue, UINT64 fence_value);
+	bool IsComplete(UINT64 fence_value) const { return copy_fence->GetCompletedValue() >= fence_value; }
+
+	// Blocks until everything submitted so far is done
+	void WaitIdle();
+
+protected:
+	struct StagingPage
+	{
+		ComPtr<ID3D12Resource> buffer;
+		UINT8* data;
+		UINT64 capacity;
+		UINT64 used;
+		UINT64 fence_value;
+	};
+
+	struct PendingCopy
+	{
+		ComPtr<ID3D12Resource> destination;
+		UINT64 destination_offset;
+		ID3D12Resource* source;
+		UINT64 source_offset;
+		UINT64 size;
+	};
+
+	struct PooledAllocator
+	{
+		ComPtr<ID3D12CommandAllocator> allocator;
+		UINT64 fence_value;
+	};
+
+	ComPtr<ID3D12Device> device;
+	UINT64 page_size;
+
+	ComPtr<ID3D12CommandQueue> copy_queue;
+	ComPtr<ID3D12GraphicsCommandList> command_list;
+	ComPtr<ID3D12Fence> copy_fence;
+	UINT64 copy_fence_value;
+	HANDLE fence_event;
+
+	std::vector<StagingPage> free_pages;
+	std::vector<StagingPage> pending_pages;
+	std::deque<StagingPage> submitted_pages;
+	std::vector<PendingCopy> pending_copies;
+	std::deque<PooledAllocator> allocators;
+	std::mutex scheduler_mutex;
+
+	StagingPage& GetPage(UINT64 size);
+	ID3D12CommandAllocator* GetAllocator();
+	void Reclaim();
+};
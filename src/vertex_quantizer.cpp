@@ -0,0 +1,118 @@
+#include "vertex_quantizer.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+
+static const float* Stride(const float* data, size_t stride, size_t index)
+{
+	return reinterpret_cast<const float*>(reinterpret_cast<const char*>(data) + index * stride);
+}
+
+static int8_t ToSnorm8(float value)
+{
+	return static_cast<int8_t>(std::lround((std::max)(-1.f, (std::min)(1.f, value)) * 127.f));
+}
+
+void VertexQuantizer::EncodeOctahedral(const float normal[3], int8_t out[2])
+{
+	float length = std::fabs(normal[0]) + std::fabs(normal[1]) + std::fabs(normal[2]);
+	if (length == 0.f)
+	{
+		out[0] = out[1] = 0;
+		return;
+	}
+
+	// Project onto the octahedron and fold the lower hemisphere over the diagonals
+	float x = normal[0] / length;
+	float y = normal[1] / length;
+	if (normal[2] < 0.f)
+	{
+		float foldedX = (1.f - std::fabs(y)) * (x >= 0.f ? 1.f : -1.f);
+		float foldedY = (1.f - std::fabs(x)) * (y >= 0.f ? 1.f : -1.f);
+		x = foldedX;
+		y = foldedY;
+	}
+	out[0] = ToSnorm8(x);
+	out[1] = ToSnorm8(y);
+}
+
+void VertexQuantizer::DecodeOctahedral(const int8_t encoded[2], float normal[3])
+{
+	float x = (std::max)(encoded[0] / 127.f, -1.f);
+	float y = (std::max)(encoded[1] / 127.f, -1.f);
+	float z = 1.f - std::fabs(x) - std::fabs(y);
+	float t = (std::max)(-z, 0.f);
+	x += x >= 0.f ? -t : t;
+	y += y >= 0.f ? -t : t;
+
+	float length = std::sqrt(x * x + y * y + z * z);
+	normal[0] = x / length;
+	normal[1] = y / length;
+	normal[2] = z / length;
+}
+
+void VertexQuantizer::Quantize(const float* positions, size_t position_stride, const float* normals, size_t normal_stride,
+	size_t vertex_count, PackedVertex* out)
+{
+	parameters = {};
+	error = {};
+
+	float minimum[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float maximum[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (size_t v = 0; v < vertex_count; v++)
+	{
+		const float* position = Stride(positions, position_stride, v);
+		for (size_t k = 0; k < 3; k++)
+		{
+			minimum[k] = (std::min)(minimum[k], position[k]);
+			maximum[k] = (std::max)(maximum[k], position[k]);
+		}
+	}
+	for (size_t k = 0; k < 3 && vertex_count > 0; k++)
+	{
+		parameters.position_offset[k] = minimum[k];
+		parameters.position_scale[k] = maximum[k] - minimum[k];
+		error.position_error_bound = (std::max)(error.position_error_bound, parameters.position_scale[k] / 65535.f * 0.5f);
+	}
+
+	for (size_t v = 0; v < vertex_count; v++)
+	{
+		const float* position = Stride(positions, position_stride, v);
+		PackedVertex& packed = out[v];
+		for (size_t k = 0; k < 3; k++)
+		{
+			float scale = parameters.position_scale[k];
+			float unorm = scale > 0.f ? (position[k] - parameters.position_offset[k]) / scale : 0.f;
+			packed.position[k] = static_cast<uint16_t>(std::lround((std::max)(0.f, (std::min)(1.f, unorm)) * 65535.f));
+
+			float decoded = packed.position[k] / 65535.f * scale + parameters.position_offset[k];
+			error.max_position_error = (std::max)(error.max_position_error, std::fabs(decoded - position[k]));
+		}
+
+		packed.normal[0] = packed.normal[1] = 0;
+		if (normals)
+		{
+			const float* normal = Stride(normals, normal_stride, v);
+			float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+			EncodeOctahedral(normal, packed.normal);
+			if (length > 0.f)
+			{
+				float decoded[3];
+				DecodeOctahedral(packed.normal, decoded);
+				float cosine = (decoded[0] * normal[0] + decoded[1] * normal[1] + decoded[2] * normal[2]) / length;
+				float degrees = std::acos((std::max)(-1.f, (std::min)(1.f, cosine))) * 57.2957795f;
+				error.max_normal_error_degrees = (std::max)(error.max_normal_error_degrees, degrees);
+			}
+		}
+	}
+}
+
+std::string VertexQuantizer::FormatReport() const
+{
+	char report[256];
+	snprintf(report, sizeof(report), "Vertex quantizer: %zu bytes per vertex, max position error %g (bound %g), max normal error %.3f degrees\n",
+		sizeof(PackedVertex), error.max_position_error, error.position_error_bound, error.max_normal_error_degrees);
+	return report;
+}
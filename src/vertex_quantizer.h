@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// 8 byte GPU vertex: position quantized against the mesh bounds and an octahedral normal in the fourth lane.
+// Fetched as one R16G16B16A16_UINT element, matches the input layout in Renderer::LoadAssets and the decode in shaders.hlsl.
+// Materials are looked up per triangle, so the vertex carries none.
+struct PackedVertex
+{
+	uint16_t position[3];	// unorm
+	int8_t normal[2];		// snorm, octahedral, x in the low byte
+};
+static_assert(sizeof(PackedVertex) == 8, "PackedVertex must stay 8 bytes");
+
+// Dequantization constants, position = unorm * position_scale + position_offset
+struct QuantizationParameters
+{
+	float position_offset[4];
+	float position_scale[4];
+};
+
+struct QuantizationError
+{
+	float max_position_error;
+	float position_error_bound;
+	float max_normal_error_degrees;
+};
+
+class VertexQuantizer
+{
+public:
+	VertexQuantizer() : parameters(), error() {};
+	virtual ~VertexQuantizer() {};
+
+	// Normals may be null, zero length normals encode to zero
+	void Quantize(const float* positions, size_t position_stride, const float* normals, size_t normal_stride,
+		size_t vertex_count, PackedVertex* out);
+
+	const QuantizationParameters& GetParameters() const { return parameters; }
+	const QuantizationError& GetError() const { return error; }
+	std::string FormatReport() const;
+
+	static void EncodeOctahedral(const float normal[3], int8_t out[2]);
+	static void DecodeOctahedral(const int8_t encoded[2], float normal[3]);
+
+protected:
+	QuantizationParameters parameters;
+	QuantizationError error;
+};
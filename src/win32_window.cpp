@@ -91,7 +91,7 @@ LRESULT Win32Window::WindowProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM l
 		if (pRender)
 		{
 			CString ss((wchar_t)wParam);
-			pRender->OnKeyDown(ss);
+			pRender->OnKeyUp(ss);
 		}
 	}
 	return 0;
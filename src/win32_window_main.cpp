@@ -7,7 +7,46 @@ int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, INT nC
 {
 	try
 	{
-		Renderer render(1280, 720);
+		// "-frames N" sets the number of frames in flight, "-threads N" the number of recording threads
+		// and "-record-benchmark" measures command list recording on every thread count up to it.
+		// "-instances N" draws N copies of the mesh. "-vsync" and "-tearing" pick the present mode,
+		// "-latency N" the maximum number of frames queued for presentation. "-validate-culling" checks
+		// every GPU cull against the CPU reference, which debug builds always do.
+		UINT frameCount = 2;
+		if (const char* option = strstr(lpCmdLine, "-frames"))
+		{
+			frameCount = static_cast<UINT>(atoi(option + strlen("-frames")));
+		}
+
+		Renderer render(1280, 720, frameCount);
+		if (const char* option = strstr(lpCmdLine, "-threads"))
+		{
+			render.SetRecordingThreads(static_cast<UINT>(atoi(option + strlen("-threads"))));
+		}
+		if (const char* option = strstr(lpCmdLine, "-instances"))
+		{
+			render.SetInstanceCount(static_cast<UINT>(atoi(option + strlen("-instances"))));
+		}
+		if (strstr(lpCmdLine, "-vsync"))
+		{
+			render.SetPresentMode(PRESENT_MODE_VSYNC);
+		}
+		else if (strstr(lpCmdLine, "-tearing"))
+		{
+			render.SetPresentMode(PRESENT_MODE_TEARING);
+		}
+		if (const char* option = strstr(lpCmdLine, "-latency"))
+		{
+			render.SetMaximumFrameLatency(static_cast<UINT>(atoi(option + strlen("-latency"))));
+		}
+		if (strstr(lpCmdLine, "-record-benchmark"))
+		{
+			render.EnableRecordingBenchmark();
+		}
+		if (strstr(lpCmdLine, "-validate-culling"))
+		{
+			render.EnableCullingValidation();
+		}
 		return Win32Window::Run(&render, hInstance, nCmdShow);
 	}
 	catch (com_exception e)
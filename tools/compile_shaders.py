@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+"""Compiles every entry point of a shader manifest with DXC and writes one C++ header with the
+bytecode, so the renderer needs neither the shader sources nor a compiler at runtime.
+
+Manifest lines are "file entry_point target", paths relative to the manifest, # starts a comment.
+The header is only rewritten when its content changes, so unchanged shaders don't trigger a rebuild.
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+
+
+def read_manifest(path):
+    entries = []
+    with open(path) as manifest:
+        for number, line in enumerate(manifest, 1):
+            fields = line.split('#', 1)[0].split()
+            if not fields:
+                continue
+            if len(fields) != 3:
+                sys.exit(f'{path}:{number}: expected "file entry_point target"')
+            entries.append(tuple(fields))
+    return entries
+
+
+def compile_entry(dxc, source, entry_point, target, debug):
+    with tempfile.TemporaryDirectory() as directory:
+        output = os.path.join(directory, 'shader.bin')
+        arguments = [dxc, '-nologo', '-T', target, '-E', entry_point, '-Fo', output]
+        arguments += ['-Zi', '-Qembed_debug', '-Od'] if debug else ['-O3']
+        result = subprocess.run(arguments + [source], capture_output=True, text=True)
+        if result.returncode != 0:
+            sys.exit(f'{source}({entry_point}, {target}): {result.stderr or result.stdout}')
+        with open(output, 'rb') as bytecode:
+            return bytecode.read()
+
+
+def symbol_name(file_name, entry_point):
+    return ''.join(c if c.isalnum() else '_' for c in f'{file_name}_{entry_point}')
+
+
+def write_header(path, manifest_name, shaders):
+    lines = [f'// Generated by tools/compile_shaders.py from {manifest_name}, do not edit', '#pragma once', '']
+    for file_name, entry_point, target, bytecode in shaders:
+        lines.append(f'static const unsigned char {symbol_name(file_name, entry_point)}[] =')
+        lines.append('{')
+        for offset in range(0, len(bytecode), 16):
+            lines.append('\t' + ', '.join(f'0x{byte:02x}' for byte in bytecode[offset:offset + 16]) + ',')
+        lines.append('};')
+        lines.append('')
+
+    lines.append('static const EmbeddedShader embedded_shaders[] =')
+    lines.append('{')
+    for file_name, entry_point, target, _ in shaders:
+        symbol = symbol_name(file_name, entry_point)
+        lines.append(f'\t{{ "{file_name}", "{entry_point}", "{target}", {symbol}, sizeof({symbol}) }},')
+    lines.append('};')
+    content = '\n'.join(lines) + '\n'
+
+    if os.path.exists(path):
+        with open(path) as existing:
+            if existing.read() == content:
+                return
+    os.makedirs(os.path.dirname(path) or '.', exist_ok=True)
+    with open(path, 'w') as header:
+        header.write(content)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('manifest')
+    parser.add_argument('output')
+    parser.add_argument('--dxc', default='dxc', help='DXC executable, the Linux and Windows releases both work')
+    parser.add_argument('--debug', action='store_true', help='embed debug information and skip optimizations')
+    arguments = parser.parse_args()
+
+    directory = os.path.dirname(os.path.abspath(arguments.manifest))
+    shaders = []
+    for file_name, entry_point, target in read_manifest(arguments.manifest):
+        bytecode = compile_entry(arguments.dxc, os.path.join(directory, file_name), entry_point, target, arguments.debug)
+        shaders.append((file_name, entry_point, target, bytecode))
+        print(f'{file_name} {entry_point} {target}: {len(bytecode)} bytes')
+    write_header(arguments.output, os.path.basename(arguments.manifest), shaders)
+
+
+if __name__ == '__main__':
+    main()